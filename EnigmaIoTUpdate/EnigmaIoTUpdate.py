@@ -15,15 +15,121 @@ resultTopic = "/result/#"
 sleepSetTopic = "/set/sleeptime"
 sleepResultTopic = "/result/sleeptime"
 otaSetTopic = "/set/ota"
+otaImageSetTopic = "/set/otaimage"
 otaResultTopic = "/result/ota"
 otaOutOfSequenceError = "OTA out of sequence error"
 otaOK = "OTA finished OK"
 # otaLength = 0
 otaFinished = False
-idx = 0
-
+otaFailed = False
+lastStatus = 0
+idx = -1
+sackBase = 0
+sackReceived = 0
+sackNew = False
+
+OTA_START_ERROR = 1
+OTA_CHECK_FAIL = 3
 OTA_OUT_OF_SEQUENCE = 4
+OTA_TIMEOUT = 5
 OTA_FINISHED = 6
+OTA_SACK = 7
+OTA_CACHE_STORED = 8
+OTA_CACHE_ERROR = 9
+OTA_PROGRESS = 10
+OTA_MULTICAST_END = 11
+BROADCAST_NAME = "broadcast"  # Node name that gateway uses to send an update to every non sleepy node at once
+CACHE_STATUS_TIMEOUT = 30  # Seconds without news from gateway before a cached update is considered lost
+OTA_FORMAT_LZSS = 1
+LZSS_WINDOW_BITS = 11  # Must match OTA_LZSS_WINDOW_BITS on node
+LZSS_LOOKAHEAD_BITS = 4  # Must match OTA_LZSS_LOOKAHEAD_BITS on node
+LZSS_MAX_CANDIDATES = 32  # Previous positions checked for every match. Higher is slower but compresses better
+SACK_TIMEOUT = 2  # Seconds without acknowledgement before first missing chunk is sent again
+MAX_SACK_TIMEOUTS = 5  # Transfer is given up after this number of consecutive timeouts
+
+
+def compress(data):
+    # LZSS in heatshrink bit format. 1 + literal byte, or 0 + (distance - 1) + (length - 1), MSB first
+    window = 1 << LZSS_WINDOW_BITS
+    max_len = 1 << LZSS_LOOKAHEAD_BITS
+    out = bytearray()
+    bits = 0
+    bit_count = 0
+    chains = {}
+    pos = 0
+
+    def put(value, count):
+        nonlocal bits, bit_count
+        bits = (bits << count) | value
+        bit_count = bit_count + count
+        while bit_count >= 8:
+            bit_count = bit_count - 8
+            out.append((bits >> bit_count) & 0xFF)
+        bits = bits & ((1 << bit_count) - 1)
+
+    def insert(p):
+        key = data[p:p + 2]
+        chain = chains.setdefault(key, [])
+        chain.append(p)
+        if len(chain) > LZSS_MAX_CANDIDATES:
+            del chain[0]
+
+    while pos < len(data):
+        best_len = 1
+        best_dist = 0
+        limit = min(max_len, len(data) - pos)
+        for candidate in reversed(chains.get(data[pos:pos + 2], [])):
+            if pos - candidate > window:
+                break
+            length = 0
+            while length < limit and data[candidate + length] == data[pos + length]:
+                length = length + 1
+            if length > best_len:
+                best_len = length
+                best_dist = pos - candidate
+                if length == limit:
+                    break
+        if best_dist:
+            # A back reference takes 16 bits, so it is only used for 2 bytes or more
+            put(0, 1)
+            put(best_dist - 1, LZSS_WINDOW_BITS)
+            put(best_len - 1, LZSS_LOOKAHEAD_BITS)
+        else:
+            put(1, 1)
+            put(data[pos], 8)
+            best_len = 1
+        for p in range(pos, pos + best_len):
+            insert(p)
+        pos = pos + best_len
+
+    if bit_count:
+        put(0, 8 - bit_count)
+    return bytes(out)
+
+
+def send_to_cache(client, args, ota_header, encoded_string):
+    global lastStatus
+
+    # Image is uploaded as fast as broker allows. Gateway drives transfer to node from its own copy
+    cache_topic = args.baseTopic + "/" + args.address + otaImageSetTopic
+    print("Uploading file to gateway: " + args.filename)
+    client.publish(cache_topic, ota_header)
+    for i in range(0, len(encoded_string)):
+        client.publish(cache_topic, str(i + 1) + "," + encoded_string[i])
+        client.loop()
+        time.sleep(0.005)
+        if otaFailed:
+            break
+
+    lastStatus = time.time()
+    while not otaFinished and not otaFailed and time.time() - lastStatus < CACHE_STATUS_TIMEOUT:
+        client.loop()
+        time.sleep(0.1)
+
+    if otaFinished:
+        print("100%")
+    elif not otaFailed:
+        print(" No answer from gateway. OTA status is unknown")
 
 
 def on_connect(client, userdata, flags, rc):
@@ -38,12 +144,16 @@ def on_connect(client, userdata, flags, rc):
 
     sleep_topic = args.baseTopic + "/" + args.address + resultTopic
     client.subscribe(sleep_topic)
+    if args.broadcast:
+        # Every node reports its own result during a multicast update
+        client.subscribe(args.baseTopic + "/+" + otaResultTopic)
     print("Subscribed")
 
 
 def on_message(client, userdata, msg):
     global sleepyNode
-    global idx, otaFinished
+    global idx, otaFinished, otaFailed, lastStatus
+    global sackBase, sackReceived, sackNew
 
     payload = json.loads(msg.payload)
 
@@ -54,15 +164,41 @@ def on_message(client, userdata, msg):
     # payload = msg.payload.decode('utf-8')
 
     if msg.topic.find(otaResultTopic) >= 0:
+        lastStatus = time.time()
+
+        if args.broadcast and msg.topic.split("/")[-3] != BROADCAST_NAME:
+            if payload['status'] != OTA_SACK:
+                print(" " + msg.topic.split("/")[-3] + ": " + payload['result'])
+            return
 
         if payload['status'] == OTA_OUT_OF_SEQUENCE:
             print(payload['last_chunk'], end='')
             idx = int(payload['last_chunk'])
 
+        elif payload['status'] == OTA_SACK:
+            sackBase = int(payload['base'])
+            sackReceived = int(payload['received'])
+            sackNew = True
+
         elif payload['status'] == OTA_FINISHED:
             print(" OTA Finished ", end='')
             otaFinished = True
 
+        elif payload['status'] == OTA_CACHE_STORED:
+            print("Image stored on gateway. Sending it to node")
+
+        elif payload['status'] == OTA_PROGRESS:
+            print(" %.f%%" % (payload['chunks'] / payload['total'] * 100))
+
+        elif payload['status'] == OTA_MULTICAST_END:
+            print(" %d nodes updated, %d failed" % (payload['updated'], payload['failed']))
+            otaFinished = payload['failed'] == 0
+            otaFailed = not otaFinished
+
+        elif payload['status'] in (OTA_CACHE_ERROR, OTA_START_ERROR, OTA_CHECK_FAIL, OTA_TIMEOUT):
+            print(" " + payload['result'])
+            otaFailed = True
+
 
 def main():
     global args
@@ -114,6 +250,28 @@ def main():
                      dest="mqttSecure",
                      default=False,
                      help="Use secure plain TCP in MQTT connection. Normally you should use port 1883")
+    opt.add_argument("-w", "--window",
+                     type=int,
+                     dest="otaWindow",
+                     default=8,
+                     help="Number of chunks sent ahead of first one not acknowledged by node. It must not be higher than "
+                          "OTA_WINDOW on node. Use 0 for nodes without selective acknowledgement support. Default: 8")
+    opt.add_argument("-r", "--raw",
+                     action="store_true",
+                     dest="rawImage",
+                     default=False,
+                     help="Send image uncompressed. Use it for nodes without compressed OTA support")
+    opt.add_argument("-c", "--cache",
+                     action="store_true",
+                     dest="gwCache",
+                     default=False,
+                     help="Upload whole image to gateway at once. Gateway stores it and sends it to node by itself")
+    opt.add_argument("-b", "--broadcast",
+                     action="store_true",
+                     dest="broadcast",
+                     default=False,
+                     help="Update every registered non sleepy node with broadcast enabled at once. Image is stored "
+                          "on gateway and broadcast to all of them. Destination address is not needed")
     opt.add_argument("-D", "--speed",
                      type=str,
                      dest="otaSpeed",
@@ -124,6 +282,10 @@ def main():
     # (options, args) = opt.parse_args()
     args = opt.parse_args()
 
+    if args.broadcast:
+        args.address = BROADCAST_NAME
+        args.gwCache = True
+
     if not args.address:
         opt.error('Destination address not supplied')
 
@@ -138,23 +300,22 @@ def main():
     packet_delay = delay_options.get(args.otaSpeed, 0.07)
 
     with open(args.filename, "rb") as binary_file:
-        chunked_file = []
-        encoded_string = []
-        n = 212  # Max 215 - 2. Divisible by 4 => 212
-
-        for chunk in iter(lambda: binary_file.read(n), b""):
-            chunked_file.append(chunk)
-        for chunk in chunked_file:
-            encoded_string.append(base64.b64encode(bytes(chunk)).decode('ascii'))
-        # chunked_string = [encoded_string[i:i+n] for i in range(0, len(encoded_string), n)]
-        binary_file.seek(0);
-        hash_md5 = hashlib.md5()
-        for chunk in iter(lambda: binary_file.read(4096), b""):
-            hash_md5.update(chunk)
-
-        # print(hash_md5.hexdigest())
+        image = binary_file.read()
         binary_file.close()
 
+    # Size and MD5 refer to image as it is written to flash, even if it is sent compressed
+    hash_md5 = hashlib.md5(image)
+    if not args.rawImage:
+        payload = compress(image)
+        print("Image compressed from %d to %d bytes" % (ota_length, len(payload)))
+    else:
+        payload = image
+
+    encoded_string = []
+    n = 212  # Max 215 - 2. Divisible by 4 => 212
+    for i in range(0, len(payload), n):
+        encoded_string.append(base64.b64encode(payload[i:i + n]).decode('ascii'))
+
     mqtt.Client.connected_flag = False
     client = mqtt.Client(mqttclientname, True)
     client.username_pw_set(username=args.mqttUser, password=args.mqttPass)
@@ -171,7 +332,10 @@ def main():
 
     # client.loop_start()
     sleep_topic = args.baseTopic + "/" + args.address + sleepSetTopic
-    client.publish(sleep_topic, "0")
+    if not args.broadcast:  # Sleepy nodes are left out of a multicast update
+        client.publish(sleep_topic, "0")
+    else:
+        sleepyNode = False
 
     while sleepyNode:
         print("Waiting for non sleepy confirmation")
@@ -181,42 +345,95 @@ def main():
     print("Sending hash: " + hash_md5.hexdigest())
     md5_str = hash_md5.hexdigest()
 
-    # msg 0, file size, number of chunks, md5 checksum
+    # msg 0, file size, number of chunks, md5 checksum[, image format]
     print("Sending %d bytes in %d chunks" % (ota_length,len(encoded_string)))
-    client.publish(ota_topic, "0," + str(ota_length) + "," + str(len(encoded_string)) + "," + md5_str)
+    ota_header = "0," + str(ota_length) + "," + str(len(encoded_string)) + "," + md5_str
+    if not args.rawImage:
+        ota_header = ota_header + "," + str(OTA_FORMAT_LZSS)
 
-    # for i in range(0, len(chunked_string), 1):
-    print("Sending file: " + args.filename)
-    global idx
+    if args.gwCache:
+        send_to_cache(client, args, ota_header, encoded_string)
+        client.disconnect()
+        return
 
-    # remove to simulate lost message
-    # error = False
+    client.publish(ota_topic, ota_header)
 
-    while idx < len(encoded_string):
+    print("Sending file: " + args.filename)
+    global idx, sackNew
+
+    num_chunks = len(encoded_string)
+    window = args.otaWindow if args.otaWindow > 0 else num_chunks
+    base = 1  # First chunk not acknowledged
+    next_chunk = 1  # Next chunk never sent
+    resend = []
+    sent_order = [0] * (num_chunks + 2)  # Send sequence number of last transmission of every chunk
+    last_sack_base = 1
+    last_ack = time.time()
+    timeouts = 0
+    sent = 0
+
+    while base <= num_chunks and not otaFinished:
         client.loop()
-        time.sleep(packet_delay)
-        # time.sleep(0.2)
-        # if i not in range(10,13):
-        i = idx + 1
-        client.publish(ota_topic, str(i) + "," + encoded_string[idx])
-        idx = idx + 1
+        if sackNew:
+            # Node reports first chunk it misses and a bitmap of those received after it
+            sackNew = False
+            last_ack = time.time()
+            timeouts = 0
+            if sackBase > base:
+                base = sackBase
+            resend = []
+            if sackReceived:
+                # Only gaps below highest received chunk are lost. Later ones may still be on their way
+                highest = sackReceived.bit_length() - 1
+                resend = [base + i for i in range(0, highest)
+                          if not (sackReceived >> i) & 1 and sent_order[base + i] < sent_order[base + highest]]
+            elif sackBase == last_sack_base:
+                # Node got nothing new since last report, so every outstanding chunk was lost
+                resend = list(range(base, next_chunk))
+            last_sack_base = sackBase
+        if idx >= 0:
+            # Node could not keep chunks so far ahead. Go back to first missing one
+            base = idx + 1
+            next_chunk = base
+            resend = []
+            idx = -1
+            last_ack = time.time()
+
+        if resend:
+            i = resend.pop(0)
+        elif next_chunk < base + window and next_chunk <= num_chunks:
+            i = next_chunk
+            next_chunk = next_chunk + 1
+        elif time.time() - last_ack > SACK_TIMEOUT:
+            timeouts = timeouts + 1
+            if timeouts > MAX_SACK_TIMEOUTS:
+                print(" No answer from node. OTA aborted")
+                break
+            i = base
+            last_ack = time.time()
+        else:
+            time.sleep(packet_delay)
+            continue
 
-        # remove to simulate lost message
-        # if idx == 100 and not error:
-        #    error = True
-        #    idx = idx + 1
+        time.sleep(packet_delay)
+        client.publish(ota_topic, str(i) + "," + encoded_string[i - 1])
+        sent = sent + 1
+        sent_order[i] = sent
+        if args.otaWindow == 0 and i == next_chunk - 1:
+            base = next_chunk  # Legacy nodes only report errors
 
         if i % 2 == 0:
             print(".", end='')
         if i % 160 == 0:
-            print(" %.f%%" % (i / len(encoded_string) * 100))
-        if i == len(encoded_string):
-            for i in range(0, 40):
-                client.loop()
-                time.sleep(0.5)
-                if otaFinished:
-                    print(" OTA OK ", end='')
-                    break
+            print(" %.f%%" % (i / num_chunks * 100))
+
+    print(" %d chunks sent for %d chunks in image" % (sent, num_chunks))
+    for i in range(0, 40):
+        if otaFinished:
+            print(" OTA OK ", end='')
+            break
+        client.loop()
+        time.sleep(0.5)
 
     print("100%")
     # time.sleep(5)
@@ -0,0 +1,94 @@
+/**
+  * @file EnigmaIOTCipherBenchmark.ino
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Measures encryption and decryption time of every cipher suite supported by this board
+  *
+  * Payload sizes are 32, 100 and 214 bytes, that are a small reading, a typical JSON message and a full data message.
+  * Time to get a random IV from DRBG and from hardware RNG is measured too.
+  * Results are printed on serial port so that cipher suite selection can be checked on real hardware
+  */
+
+#include <Arduino.h>
+#include <cryptModule.h>
+
+constexpr int ROUNDS = 500; ///< @brief Number of times every measurement is repeated
+const size_t PAYLOAD_SIZES[] = { 32, 100, 214 }; ///< @brief Payload sizes to measure
+
+uint8_t key[KEY_LENGTH];
+uint8_t iv[IV_LENGTH];
+uint8_t aad[AAD_LENGTH + 1 + IV_LENGTH];
+uint8_t tag[TAG_LENGTH];
+uint8_t payload[MAX_MESSAGE_LENGTH];
+
+void benchmark (cipherSuite_t suite, size_t len) {
+	uint32_t encTime = 0;
+	uint32_t decTime = 0;
+	bool ok = true;
+
+	for (int i = 0; i < ROUNDS; i++) {
+		CryptModule::random (payload, len);
+		uint32_t start = micros ();
+		ok &= CryptModule::encryptBuffer (payload, len, iv, IV_LENGTH, key, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), tag, TAG_LENGTH, suite);
+		encTime += micros () - start;
+		start = micros ();
+		ok &= CryptModule::decryptBuffer (payload, len, iv, IV_LENGTH, key, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), tag, TAG_LENGTH, suite);
+		decTime += micros () - start;
+		yield ();
+	}
+
+	Serial.printf ("%-12s %4u bytes: encrypt %7.1f us, decrypt %7.1f us, %6.1f kB/s %s\n",
+				   CryptModule::getSuiteName (suite), (unsigned)len,
+				   (float)encTime / ROUNDS, (float)decTime / ROUNDS,
+				   (float)len * ROUNDS * 1000 / encTime,
+				   ok ? "" : "ERROR");
+}
+
+void benchmarkRandom () {
+	uint32_t drbgTime = 0;
+	uint32_t hwTime = 0;
+
+	for (int i = 0; i < ROUNDS; i++) {
+		uint32_t start = micros ();
+		CryptModule::random (iv, IV_LENGTH);
+		drbgTime += micros () - start;
+		start = micros ();
+		for (int j = 0; j < IV_LENGTH; j += sizeof (uint32_t)) {
+			uint32_t rnd = CryptModule::hardwareRandom ();
+			memcpy (iv + j, &rnd, IV_LENGTH - j < sizeof (uint32_t) ? IV_LENGTH - j : sizeof (uint32_t));
+		}
+		hwTime += micros () - start;
+	}
+
+	Serial.printf ("Random IV:   DRBG %5.2f us, hardware RNG %5.2f us, %u reseeds\n",
+				   (float)drbgTime / ROUNDS, (float)hwTime / ROUNDS, CryptModule::getRandomReseedCount ());
+}
+
+void setup () {
+	Serial.begin (115200);
+	delay (1000);
+	Serial.println ();
+#ifdef ESP32
+	Serial.printf ("ESP32 at %u MHz\n", getCpuFrequencyMhz ());
+#else
+	Serial.printf ("ESP8266 at %u MHz\n", ESP.getCpuFreqMHz ());
+#endif
+
+	CryptModule::random (key, KEY_LENGTH);
+	CryptModule::random (iv, IV_LENGTH);
+	CryptModule::random (aad, sizeof (aad));
+
+	for (uint8_t suite = 0; suite < 8; suite++) {
+		if (!CryptModule::isSuiteSupported ((cipherSuite_t)suite)) {
+			continue;
+		}
+		for (size_t len : PAYLOAD_SIZES) {
+			benchmark ((cipherSuite_t)suite, len);
+		}
+	}
+	benchmarkRandom ();
+}
+
+void loop () {
+}
@@ -167,11 +167,15 @@ void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lost
 		GwOutput.outputDataSend (mac_str, payload, pld_size, GwOutput_data_type::lostmessages);
 		//DEBUG_INFO ("Published MQTT from %s: %s", mac_str, payload);
 	}
-	pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"per\":%e,\"lostmessages\":%u,\"totalmessages\":%u,\"packetshour\":%.2f}",
+	comms_link_state_t link = {};
+	EnigmaIOTGateway.getLinkState ((uint8_t*)mac, &link);
+	pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"per\":%e,\"lostmessages\":%u,\"totalmessages\":%u,\"packetshour\":%.2f,\"txrate\":%.1f,\"txpower\":%.2f}",
 						 EnigmaIOTGateway.getPER ((uint8_t*)mac),
 						 EnigmaIOTGateway.getErrorPackets ((uint8_t*)mac),
 						 EnigmaIOTGateway.getTotalPackets ((uint8_t*)mac),
-						 EnigmaIOTGateway.getPacketsHour ((uint8_t*)mac));
+						 EnigmaIOTGateway.getPacketsHour ((uint8_t*)mac),
+						 link.rate / 10.0,
+						 link.txPower / 4.0);
 	GwOutput.outputDataSend (mac_str, payload, pld_size, GwOutput_data_type::status);
 	//DEBUG_INFO ("Published MQTT from %s: %s", mac_str, payload);
 	//free (payload);
@@ -210,7 +210,7 @@ void processHADiscovery (const char* topic, char* message, size_t len) {
 }
 #endif
 
-void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
+void publishData (uint8_t* mac, uint8_t* buffer, size_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName) {
 	uint8_t* addr = mac;
 	size_t pld_size = 0;
 	const int PAYLOAD_SIZE = 1024; // Max MQTT payload in PubSubClient library normal operation.
@@ -268,17 +268,29 @@ void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lost
 		DEBUG_INFO ("Published MQTT from %s: %s", nodeName ? nodeName : mac_str, payload);
 	}
 #if ENABLE_STATUS_MESSAGES
-    pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"rssi\":%d,\"per\":%e,\"lostmessages\":%u,\"totalmessages\":%u,\"packetshour\":%.2f}",
+	comms_link_state_t link = {};
+	EnigmaIOTGateway.getLinkState ((uint8_t*)mac, &link);
+    pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"rssi\":%d,\"per\":%e,\"lostmessages\":%u,\"totalmessages\":%u,\"packetshour\":%.2f,\"txrate\":%.1f,\"txpower\":%.2f}",
                          EnigmaIOTGateway.getNodes()->getNodeFromMAC((uint8_t*)mac)->getRSSI(),
                          EnigmaIOTGateway.getPER ((uint8_t*)mac),
 						 EnigmaIOTGateway.getErrorPackets ((uint8_t*)mac),
 						 EnigmaIOTGateway.getTotalPackets ((uint8_t*)mac),
-						 EnigmaIOTGateway.getPacketsHour ((uint8_t*)mac));
+						 EnigmaIOTGateway.getPacketsHour ((uint8_t*)mac),
+						 link.rate / 10.0,
+						 link.txPower / 4.0);
 	GwOutput.outputDataSend (nodeName ? nodeName : mac_str, payload, pld_size, GwOutput_data_type::status);
 	DEBUG_INFO ("Published MQTT from %s: %s", nodeName ? nodeName : mac_str, payload);
 #endif
 }
 
+void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
+	publishData (mac, buffer, length, lostMessages, control, payload_type, nodeName);
+}
+
+void processRxLongData (uint8_t* mac, uint8_t* buffer, size_t length, uint16_t lostMessages, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
+	publishData (mac, buffer, length, lostMessages, false, payload_type, nodeName);
+}
+
 void onDownlinkData (uint8_t* address, char* nodeName, control_message_type_t msgType, char* data, unsigned int len) {
 	uint8_t* buffer;
 	unsigned int bufferLen = len;
@@ -426,6 +438,7 @@ void setup () {
 	EnigmaIOTGateway.onWiFiManagerStarted (wifiManagerStarted);
 	EnigmaIOTGateway.onWiFiManagerExit (wifiManagerExit);
     EnigmaIOTGateway.onDataRx (processRxData);
+	EnigmaIOTGateway.onLongDataRx (processRxLongData);
 #if SUPPORT_HA_DISCOVERY
     EnigmaIOTGateway.onHADiscovery (processHADiscovery);
 #endif
@@ -323,6 +323,8 @@ control_message_type_t checkMsgType (String data) {
 		return control_message_type::SLEEP_SET;
 	} else if (data == SET_OTA) {
 		return control_message_type::OTA;
+	} else if (data == SET_OTA_IMAGE) {
+		return control_message_type::OTA_IMAGE;
 	} else if (data == SET_IDENTIFY) {
 		DEBUG_WARN ("IDENTIFY MESSAGE %s", data.c_str ());
 		return control_message_type::IDENTIFY;
@@ -662,6 +664,33 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 		case ota_status::OTA_FINISHED:
 			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA finished OK\",\"status\":%u}", data[1]);
 			break;
+		case ota_status::OTA_SACK:
+			uint16_t sackBase;
+			uint32_t sackReceived;
+			memcpy ((uint8_t*)&sackBase, data + 2, sizeof (uint16_t));
+			memcpy ((uint8_t*)&sackReceived, data + 2 + sizeof (uint16_t), sizeof (uint32_t));
+			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"base\":%u,\"received\":%u,\"result\":\"OTA selective ack\",\"status\":%u}", sackBase, sackReceived, data[1]);
+			break;
+		case ota_status::OTA_CACHE_STORED:
+			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA image stored on gateway\",\"status\":%u}", data[1]);
+			break;
+		case ota_status::OTA_CACHE_ERROR:
+			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA image error on gateway\",\"status\":%u}", data[1]);
+			break;
+		case ota_status::OTA_PROGRESS:
+			uint16_t chunksDone;
+			uint16_t chunksTotal;
+			memcpy ((uint8_t*)&chunksDone, data + 2, sizeof (uint16_t));
+			memcpy ((uint8_t*)&chunksTotal, data + 2 + sizeof (uint16_t), sizeof (uint16_t));
+			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"chunks\":%u,\"total\":%u,\"result\":\"OTA progress\",\"status\":%u}", chunksDone, chunksTotal, data[1]);
+			break;
+		case ota_status::OTA_MULTICAST_END:
+			uint16_t nodesUpdated;
+			uint16_t nodesFailed;
+			memcpy ((uint8_t*)&nodesUpdated, data + 2, sizeof (uint16_t));
+			memcpy ((uint8_t*)&nodesFailed, data + 2 + sizeof (uint16_t), sizeof (uint16_t));
+			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"updated\":%u,\"failed\":%u,\"result\":\"OTA multicast finished\",\"status\":%u}", nodesUpdated, nodesFailed, data[1]);
+			break;
 		}
 		if (addMQTTqueue (topic, payload, pld_size)) {
 			DEBUG_INFO ("Published MQTT %s %s", topic, payload);
@@ -39,6 +39,7 @@
 #define SET_SLEEP        "set/sleeptime"
 #define SET_OTA          "set/ota"
 #define SET_OTA_ANS      "result/ota"
+#define SET_OTA_IMAGE    "set/otaimage"
 #define SET_IDENTIFY     "set/identify"
 #define SET_RESET_CONFIG "set/reset"
 #define SET_RESET_ANS    "result/reset"
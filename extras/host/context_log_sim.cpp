@@ -0,0 +1,140 @@
+/**
+  * @file context_log_sim.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Simulates flash wear, boot time and power loss of `ContextLogClass`
+  *
+  * A context is saved many times. Every save increments a counter, as a data message does, and every
+  * `KEY_CHANGE_PERIOD` saves a 32 byte key changes too, as a new registration does. Then a write is cut at every
+  * possible byte of a save, at every position of a sector, and a boot is simulated. Context found after boot must be
+  * either previous or new one, and log must go on working. With a single sector context is lost if power fails while
+  * that sector is being started again, so only the second check applies then.
+  *
+  * Usage: context_log_sim [sectors] [context length] [saves]
+  */
+
+#include <Arduino.h>
+#include <ContextLog.h>
+#include <vector>
+
+static const uint16_t COUNTER_OFFSET = 40; ///< @brief Offset of message counter in simulated context
+static const uint16_t KEY_OFFSET = 64; ///< @brief Offset of key in simulated context
+static const uint16_t KEY_CHANGE_PERIOD = 500; ///< @brief Saves between key changes
+static const uint32_t FLASH_ENDURANCE = 100000; ///< @brief Erase cycles that a flash sector is guaranteed to stand
+
+static uint16_t contextLen;
+
+void nextContext (uint8_t* context, uint32_t step) {
+	uint32_t counter;
+	memcpy (&counter, context + COUNTER_OFFSET, sizeof (counter));
+	counter++;
+	memcpy (context + COUNTER_OFFSET, &counter, sizeof (counter));
+	if (step % KEY_CHANGE_PERIOD == 0) {
+		for (int i = 0; i < 32; i++) {
+			context[KEY_OFFSET + i] = rand ();
+		}
+	}
+}
+
+int main (int argc, char** argv) {
+	uint16_t sectors = argc > 1 ? atoi (argv[1]) : 2;
+	contextLen = argc > 2 ? atoi (argv[2]) : 200;
+	uint32_t saves = argc > 3 ? atoi (argv[3]) : 100000;
+	std::vector<uint8_t> context (contextLen);
+	std::vector<uint8_t> loaded (contextLen);
+
+	if (contextLen < KEY_OFFSET + 32 || contextLen > CONTEXT_LOG_MAX_SIZE) {
+		fprintf (stderr, "Context length must be between %u and %u\n", KEY_OFFSET + 32, CONTEXT_LOG_MAX_SIZE);
+		return 1;
+	}
+	srand (1);
+	for (uint16_t i = 0; i < contextLen; i++) {
+		context[i] = rand ();
+	}
+
+	// Wear and boot time
+	ContextFlashSimClass* flash = new ContextFlashSimClass (sectors);
+	ContextLogClass log;
+	log.begin (flash, contextLen);
+	for (uint32_t i = 1; i <= saves; i++) {
+		nextContext (context.data (), i);
+		log.save (context.data ());
+	}
+	const context_log_stats_t* stats = log.getStats ();
+	uint32_t maxErases = 0;
+	for (uint16_t s = 0; s < sectors; s++) {
+		maxErases = flash->getEraseCount (s) > maxErases ? flash->getEraseCount (s) : maxErases;
+	}
+	printf ("%u sectors, %u byte context, %u saves\n", sectors, contextLen, saves);
+	printf ("records full %u delta %u, %.1f bytes per save, %u erases, max %u per sector\n", stats->fullRecords,
+			stats->deltaRecords, (float)stats->bytesWritten / saves, stats->sectorErases, maxErases);
+	if (maxErases) {
+		printf ("estimated saves before %u erases on a sector: %.0f\n", FLASH_ENDURANCE, (double)saves * FLASH_ENDURANCE / maxErases);
+	}
+	uint64_t worstBoot = 0;
+	uint16_t worstReplayed = 0;
+	for (uint32_t i = 0; i < CONTEXT_SECTOR_SIZE / 16; i++) {
+		ContextLogClass boot;
+		flash->resetBusyTime ();
+		boot.begin (flash, contextLen);
+		boot.load (loaded.data ());
+		if (flash->getBusyTime () > worstBoot) {
+			worstBoot = flash->getBusyTime ();
+			worstReplayed = boot.getStats ()->replayed;
+		}
+		nextContext (context.data (), saves + i + 1);
+		log.save (context.data ());
+	}
+	printf ("worst boot: %u records replayed, %.2f ms of flash access\n", worstReplayed, worstBoot / 1000.0);
+	delete flash;
+
+	// Power loss at every byte of every save over one sector and a half
+	uint32_t trials = 0;
+	uint32_t lost = 0;
+	uint32_t stuck = 0;
+	flash = new ContextFlashSimClass (sectors);
+	ContextLogClass running;
+	running.begin (flash, contextLen);
+	ContextFlashSimClass* trial = new ContextFlashSimClass (sectors);
+	for (uint32_t i = 1; running.getStats ()->sectorErases < 3; i++) {
+		std::vector<uint8_t> previous = context;
+		nextContext (context.data (), i);
+		for (int32_t cut = 0; ; cut++) {
+			*trial = *flash;
+			ContextLogClass before;
+			before.begin (trial, contextLen);
+			trial->setWriteLimit (cut);
+			bool done = before.save (context.data ());
+			trial->setWriteLimit (-1);
+			trials++;
+
+			ContextLogClass after;
+			after.begin (trial, contextLen);
+			if (!after.load (loaded.data ())) {
+				lost += i > 1; // Nothing to lose on first save
+			} else if (loaded != previous && loaded != context) {
+				lost++;
+			} else {
+				// Log has to accept a new save after recovery
+				std::vector<uint8_t> next = loaded;
+				nextContext (next.data (), i + 1);
+				ContextLogClass recovered;
+				after.save (next.data ());
+				recovered.begin (trial, contextLen);
+				if (!recovered.load (loaded.data ()) || loaded != next) {
+					stuck++;
+				}
+			}
+			if (done) {
+				break;
+			}
+		}
+		running.save (context.data ());
+	}
+	printf ("power loss: %u cut points, %u lost context, %u could not save after recovery\n", trials, lost, stuck);
+	delete trial;
+	delete flash;
+	// A single sector is erased while it holds the only copy of context, so losing it there is expected
+	return (sectors > 1 && lost) || stuck ? 2 : 0;
+}
@@ -0,0 +1,137 @@
+/**
+  * @file crc32_bench.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Checks every `CRC32_IMPLEMENTATION` engine against the bitwise one and measures its speed
+  *
+  * Each engine is built from `crc32.cpp` into its own object with `calculateCRC32` renamed, so all of them
+  * run in the same program. Buffer sizes are the ones node context uses: a counter block write, a session
+  * block and the full context that a single CRC covered before context was split.
+  */
+
+#include <Arduino.h>
+#include <EnigmaIoTconfigAdvanced.h>
+#include <chrono>
+#include <random>
+
+uint32_t calculateCRC32_0 (const uint8_t* data, size_t length);
+uint32_t calculateCRC32_1 (const uint8_t* data, size_t length);
+uint32_t calculateCRC32_2 (const uint8_t* data, size_t length);
+uint32_t calculateCRC32_3 (const uint8_t* data, size_t length);
+
+typedef uint32_t (*crc32Engine_t)(const uint8_t* data, size_t length);
+
+/**
+  * @brief Engine under test
+  */
+struct engine_t {
+	const char* name; ///< @brief Engine name as in `EnigmaIoTconfigAdvanced.h`
+	crc32Engine_t calculate; ///< @brief Engine function
+};
+
+static const engine_t engines[] = {
+	{ "CRC32_BITWISE", calculateCRC32_0 },
+	{ "CRC32_NIBBLE", calculateCRC32_1 },
+	{ "CRC32_TABLE", calculateCRC32_2 },
+	{ "CRC32_SLICE_BY_8", calculateCRC32_3 },
+};
+
+static const int NUM_ENGINES = sizeof (engines) / sizeof (engines[0]);
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf ("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+static volatile uint32_t sink; ///< @brief Keeps results alive so that benchmark loops are not optimized away
+
+/**
+  * @brief Measures time per call of an engine
+  * @param engine Engine to measure
+  * @param data Input buffer
+  * @param length Input length
+  * @param calls Number of calls
+  * @return Nanoseconds per call
+  */
+double benchmark (crc32Engine_t engine, const uint8_t* data, size_t length, unsigned calls) {
+	uint32_t acc = 0;
+
+	auto start = std::chrono::steady_clock::now ();
+	for (unsigned i = 0; i < calls; i++) {
+		acc ^= engine (data, length);
+	}
+	double elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+	sink = acc;
+	return elapsed * 1e9 / calls;
+}
+
+int main () {
+	const uint8_t check[] = "123456789";
+	std::mt19937 rng (0x0C4C32);
+	uint8_t buffer[1024 + 8];
+
+	// CRC-32/MPEG-2 check value
+	for (int e = 0; e < NUM_ENGINES; e++) {
+		uint32_t crc = engines[e].calculate (check, 9);
+		if (crc != 0x0376E6E7) {
+			printf ("%s check value 0x%08X, expected 0x0376E6E7\n", engines[e].name, crc);
+		}
+		CHECK (crc == 0x0376E6E7);
+	}
+
+	// Random data, lengths and alignments against bitwise engine
+	int mismatches = 0;
+	for (int i = 0; i < 20000; i++) {
+		size_t offset = rng () % 8;
+		size_t length = i < 1024 ? i : rng () % 1024;
+		for (size_t j = 0; j < length; j++) {
+			buffer[offset + j] = rng ();
+		}
+		uint32_t reference = calculateCRC32_0 (buffer + offset, length);
+		for (int e = 1; e < NUM_ENGINES; e++) {
+			if (engines[e].calculate (buffer + offset, length) != reference) {
+				if (mismatches++ < 10) {
+					printf ("%s differs from CRC32_BITWISE: length %u, offset %u\n", engines[e].name, (unsigned)length, (unsigned)offset);
+				}
+			}
+		}
+	}
+	CHECK (mismatches == 0);
+
+	// Sizes taken from rtcmem_data_t
+	const struct {
+		size_t length;
+		const char* what;
+	} sizes[] = {
+		{ 20, "counter block CRC" },
+		{ 24, "counter block write" },
+		{ 200, "session block CRC" },
+		{ 224, "full context CRC, before split" },
+	};
+
+	for (size_t j = 0; j < sizeof (buffer); j++) {
+		buffer[j] = rng ();
+	}
+	printf ("%-18s", "ns per call");
+	for (const auto& size : sizes) {
+		printf (" %8u B", (unsigned)size.length);
+	}
+	printf ("\n");
+	for (int e = 0; e < NUM_ENGINES; e++) {
+		printf ("%-18s", engines[e].name);
+		for (const auto& size : sizes) {
+			printf (" %10.1f", benchmark (engines[e].calculate, buffer, size.length, 200000));
+		}
+		printf ("\n");
+	}
+	for (const auto& size : sizes) {
+		printf ("%3u B: %s\n", (unsigned)size.length, size.what);
+	}
+
+	if (failures) {
+		printf ("%d checks failed\n", failures);
+		return 1;
+	}
+	printf ("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,118 @@
+/**
+  * @file AES.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief AES block cipher with the subset of CryptoArduino `AES128` and `AES256` API used by `GCM`
+  */
+
+#include "AES.h"
+#include <string.h>
+
+static uint8_t sbox[256]; ///< @brief AES S-box, built on first use
+static bool sboxReady = false; ///< @brief `true` after S-box is built
+
+static uint8_t rotl8 (uint8_t x, int n) {
+	return (x << n) | (x >> (8 - n));
+}
+
+static uint8_t xtime (uint8_t x) {
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+/**
+  * @brief Builds S-box from multiplicative inverse on GF(2^8) and AES affine transform
+  */
+static void buildSbox () {
+	uint8_t p = 1, q = 1;
+
+	// p runs over every non zero element as powers of 3, q runs over their inverses
+	do {
+		p = p ^ xtime (p);
+		q ^= q << 1;
+		q ^= q << 2;
+		q ^= q << 4;
+		if (q & 0x80) {
+			q ^= 0x09;
+		}
+		sbox[p] = q ^ rotl8 (q, 1) ^ rotl8 (q, 2) ^ rotl8 (q, 3) ^ rotl8 (q, 4) ^ 0x63;
+	} while (p != 1);
+	sbox[0] = 0x63;
+	sboxReady = true;
+}
+
+AESCommon::AESCommon (uint8_t keyLength) : rounds (keyLength == 16 ? 10 : 14), keyLength (keyLength) {
+	if (!sboxReady) {
+		buildSbox ();
+	}
+}
+
+bool AESCommon::setKey (const uint8_t* key, size_t len) {
+	uint8_t rcon = 1;
+
+	if (len != keyLength) {
+		return false;
+	}
+	memcpy (schedule, key, keyLength);
+	for (size_t i = keyLength; i < (size_t)16 * (rounds + 1); i += 4) {
+		uint8_t t[4];
+		memcpy (t, schedule + i - 4, 4);
+		if (i % keyLength == 0) {
+			uint8_t first = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[first];
+			rcon = xtime (rcon);
+		} else if (keyLength == 32 && i % keyLength == 16) {
+			for (int j = 0; j < 4; j++) {
+				t[j] = sbox[t[j]];
+			}
+		}
+		for (int j = 0; j < 4; j++) {
+			schedule[i + j] = schedule[i + j - keyLength] ^ t[j];
+		}
+	}
+	return true;
+}
+
+void AESCommon::encryptBlock (uint8_t* output, const uint8_t* input) {
+	uint8_t s[16];
+	uint8_t t[16];
+
+	for (int i = 0; i < 16; i++) {
+		s[i] = input[i] ^ schedule[i];
+	}
+	for (int round = 1; round <= rounds; round++) {
+		// SubBytes and ShiftRows. Byte at row r and column c is s[r + 4 * c]
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				t[r + 4 * c] = sbox[s[r + 4 * ((c + r) % 4)]];
+			}
+		}
+		// MixColumns, except on last round
+		if (round < rounds) {
+			for (int c = 0; c < 4; c++) {
+				uint8_t* a = t + 4 * c;
+				uint8_t all = a[0] ^ a[1] ^ a[2] ^ a[3];
+				uint8_t first = a[0];
+				s[4 * c] = a[0] ^ all ^ xtime (a[0] ^ a[1]);
+				s[4 * c + 1] = a[1] ^ all ^ xtime (a[1] ^ a[2]);
+				s[4 * c + 2] = a[2] ^ all ^ xtime (a[2] ^ a[3]);
+				s[4 * c + 3] = a[3] ^ all ^ xtime (a[3] ^ first);
+			}
+		} else {
+			memcpy (s, t, sizeof (s));
+		}
+		for (int i = 0; i < 16; i++) {
+			s[i] ^= schedule[16 * round + i];
+		}
+	}
+	memcpy (output, s, sizeof (s));
+	memset (s, 0, sizeof (s));
+	memset (t, 0, sizeof (t));
+}
+
+void AESCommon::clear () {
+	memset (schedule, 0, sizeof (schedule));
+}
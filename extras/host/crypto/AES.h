@@ -0,0 +1,86 @@
+/**
+  * @file AES.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief AES block cipher with the subset of CryptoArduino `AES128` and `AES256` API used by `GCM`
+  *
+  * Only encryption is provided, as GCM does not need decryption.
+  */
+
+#ifndef _HOST_AES_h
+#define _HOST_AES_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+  * @brief AES encryption with 128 or 256 bit keys
+  */
+class AESCommon {
+protected:
+	uint8_t rounds; ///< @brief Number of rounds. 10 for AES-128, 14 for AES-256
+	uint8_t keyLength; ///< @brief Key length in number of bytes
+	uint8_t schedule[240]; ///< @brief Round keys
+
+	/**
+	  * @brief Initializes cipher size
+	  * @param keyLength Key length in number of bytes. 16 or 32
+	  */
+	AESCommon (uint8_t keyLength);
+
+public:
+	/**
+	  * @brief Gets cipher block size
+	  * @return Always 16
+	  */
+	size_t blockSize () const {
+		return 16;
+	}
+
+	/**
+	  * @brief Gets key size
+	  * @return Key size in number of bytes
+	  */
+	size_t keySize () const {
+		return keyLength;
+	}
+
+	/**
+	  * @brief Expands key into round keys
+	  * @param key Key buffer
+	  * @param len Key length. It must be equal to `keySize ()`
+	  * @return `true` if length is valid
+	  */
+	bool setKey (const uint8_t* key, size_t len);
+
+	/**
+	  * @brief Encrypts a block
+	  * @param output 16 byte output buffer. It may be the same as input
+	  * @param input 16 byte input buffer
+	  */
+	void encryptBlock (uint8_t* output, const uint8_t* input);
+
+	/**
+	  * @brief Erases round keys
+	  */
+	void clear ();
+};
+
+/**
+  * @brief AES with 128 bit key
+  */
+class AES128 : public AESCommon {
+public:
+	AES128 () : AESCommon (16) {}
+};
+
+/**
+  * @brief AES with 256 bit key
+  */
+class AES256 : public AESCommon {
+public:
+	AES256 () : AESCommon (32) {}
+};
+
+#endif // _HOST_AES_h
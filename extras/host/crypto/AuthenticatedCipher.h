@@ -0,0 +1,88 @@
+/**
+  * @file AuthenticatedCipher.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Subset of CryptoArduino `AuthenticatedCipher` interface used by `CryptModule`
+  */
+
+#ifndef _HOST_AUTHENTICATEDCIPHER_h
+#define _HOST_AUTHENTICATEDCIPHER_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+  * @brief Cipher that encrypts data and authenticates it together with additional data
+  */
+class AuthenticatedCipher {
+public:
+	virtual ~AuthenticatedCipher () {}
+
+	/**
+	  * @brief Gets preferred key size
+	  * @return Key size in number of bytes
+	  */
+	virtual size_t keySize () const = 0;
+
+	/**
+	  * @brief Sets key
+	  * @param key Key buffer
+	  * @param len Key length
+	  * @return `true` if key was accepted
+	  */
+	virtual bool setKey (const uint8_t* key, size_t len) = 0;
+
+	/**
+	  * @brief Sets IV and starts a new message
+	  * @param iv IV buffer
+	  * @param len IV length
+	  * @return `true` if IV was accepted
+	  */
+	virtual bool setIV (const uint8_t* iv, size_t len) = 0;
+
+	/**
+	  * @brief Encrypts data. Additional data may not be added after this
+	  * @param output Output buffer. It may be the same as input
+	  * @param input Input buffer
+	  * @param len Number of bytes
+	  */
+	virtual void encrypt (uint8_t* output, const uint8_t* input, size_t len) = 0;
+
+	/**
+	  * @brief Decrypts data. Additional data may not be added after this
+	  * @param output Output buffer. It may be the same as input
+	  * @param input Input buffer
+	  * @param len Number of bytes
+	  */
+	virtual void decrypt (uint8_t* output, const uint8_t* input, size_t len) = 0;
+
+	/**
+	  * @brief Adds data that is authenticated but not encrypted
+	  * @param data Data buffer
+	  * @param len Number of bytes
+	  */
+	virtual void addAuthData (const void* data, size_t len) = 0;
+
+	/**
+	  * @brief Calculates authentication tag of message
+	  * @param tag Buffer to store tag
+	  * @param len Number of tag bytes to store
+	  */
+	virtual void computeTag (void* tag, size_t len) = 0;
+
+	/**
+	  * @brief Checks authentication tag of message
+	  * @param tag Received tag
+	  * @param len Tag length
+	  * @return `true` if tag is correct
+	  */
+	virtual bool checkTag (const void* tag, size_t len) = 0;
+
+	/**
+	  * @brief Erases key and state
+	  */
+	virtual void clear () = 0;
+};
+
+#endif // _HOST_AUTHENTICATEDCIPHER_h
@@ -0,0 +1,114 @@
+/**
+  * @file ChaCha.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief ChaCha20 stream cipher with the subset of CryptoArduino `ChaCha` API used by `ChaChaDrbgClass` and `ChaChaPoly`
+  */
+
+#include "ChaCha.h"
+#include <string.h>
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define QUARTER(a, b, c, d) \
+	a += b; d ^= a; d = ROTL (d, 16); \
+	c += d; b ^= c; b = ROTL (b, 12); \
+	a += b; d ^= a; d = ROTL (d, 8); \
+	c += d; b ^= c; b = ROTL (b, 7)
+
+static uint32_t load32 (const uint8_t* p) {
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool ChaCha::setKey (const uint8_t* key, size_t len) {
+	static const char sigma[] = "expand 32-byte k";
+	static const char tau[] = "expand 16-byte k";
+
+	uint8_t padded[32] = {};
+
+	if (len > 32) {
+		len = 32;
+	}
+	memcpy (padded, key, len);
+	const char* constants = len > 16 ? sigma : tau;
+	for (int i = 0; i < 4; i++) {
+		state[i] = load32 ((const uint8_t*)constants + 4 * i);
+	}
+	for (int i = 0; i < 8; i++) {
+		state[4 + i] = load32 (padded + 4 * (len > 16 ? i : i % 4));
+	}
+	memset (padded, 0, sizeof (padded));
+	posn = 64;
+	return true;
+}
+
+bool ChaCha::setIV (const uint8_t* iv, size_t len) {
+	if (len == 8) {
+		state[12] = 0;
+		state[13] = 0;
+		state[14] = load32 (iv);
+		state[15] = load32 (iv + 4);
+	} else if (len == 12) {
+		state[12] = 0;
+		state[13] = load32 (iv);
+		state[14] = load32 (iv + 4);
+		state[15] = load32 (iv + 8);
+	} else if (len == 16) {
+		for (int i = 0; i < 4; i++) {
+			state[12 + i] = load32 (iv + 4 * i);
+		}
+	} else {
+		return false;
+	}
+	posn = 64;
+	return true;
+}
+
+void ChaCha::nextBlock () {
+	uint32_t x[16];
+
+	memcpy (x, state, sizeof (x));
+	for (int i = 0; i < 10; i++) {
+		QUARTER (x[0], x[4], x[8], x[12]);
+		QUARTER (x[1], x[5], x[9], x[13]);
+		QUARTER (x[2], x[6], x[10], x[14]);
+		QUARTER (x[3], x[7], x[11], x[15]);
+		QUARTER (x[0], x[5], x[10], x[15]);
+		QUARTER (x[1], x[6], x[11], x[12]);
+		QUARTER (x[2], x[7], x[8], x[13]);
+		QUARTER (x[3], x[4], x[9], x[14]);
+	}
+	for (int i = 0; i < 16; i++) {
+		uint32_t v = x[i] + state[i];
+		stream[4 * i] = v;
+		stream[4 * i + 1] = v >> 8;
+		stream[4 * i + 2] = v >> 16;
+		stream[4 * i + 3] = v >> 24;
+	}
+	if (!++state[12]) {
+		state[13]++;
+	}
+	posn = 0;
+}
+
+void ChaCha::encrypt (uint8_t* output, const uint8_t* input, size_t len) {
+	while (len > 0) {
+		if (posn >= 64) {
+			nextBlock ();
+		}
+		size_t chunk = (size_t)(64 - posn) < len ? (size_t)(64 - posn) : len;
+		for (size_t i = 0; i < chunk; i++) {
+			output[i] = input[i] ^ stream[posn + i];
+		}
+		posn += chunk;
+		output += chunk;
+		input += chunk;
+		len -= chunk;
+	}
+}
+
+void ChaCha::clear () {
+	memset (state, 0, sizeof (state));
+	memset (stream, 0, sizeof (stream));
+	posn = 64;
+}
@@ -0,0 +1,65 @@
+/**
+  * @file ChaCha.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief ChaCha20 stream cipher with the subset of CryptoArduino `ChaCha` API used by `ChaChaDrbgClass` and `ChaChaPoly`
+  *
+  * It lets DRBG and `CryptModule` be built on a host without CryptoArduino. Keystream follows original ChaCha
+  * definition with 64 bit counter and 64 bit nonce, as CryptoArduino does, so output is the same. A 96 bit nonce gives
+  * RFC 7539 layout. Build with `CRYPTO_DIR` set to use CryptoArduino sources for DRBG instead.
+  */
+
+#ifndef _HOST_CHACHA_h
+#define _HOST_CHACHA_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+  * @brief ChaCha20 stream cipher
+  */
+class ChaCha {
+protected:
+	uint32_t state[16]; ///< @brief Constants, key, counter and nonce
+	uint8_t stream[64]; ///< @brief Current keystream block
+	uint8_t posn = 64; ///< @brief Next unused byte in `stream`
+
+	/**
+	  * @brief Generates next keystream block and increments counter
+	  */
+	void nextBlock ();
+
+public:
+	/**
+	  * @brief Sets key. As CryptoArduino does, keys up to 16 bytes are padded with zeros to 16 bytes and used twice,
+	  * longer ones are padded with zeros to 32 bytes
+	  * @param key Key buffer
+	  * @param len Key length. Bytes after 32 are ignored
+	  * @return Always `true`
+	  */
+	bool setKey (const uint8_t* key, size_t len);
+
+	/**
+	  * @brief Sets nonce and resets counter
+	  * @param iv 8 byte nonce, 12 byte nonce with 32 bit counter as in RFC 7539, or 8 byte counter followed by 8 byte nonce
+	  * @param len 8, 12 or 16 bytes
+	  * @return `true` if length is valid
+	  */
+	bool setIV (const uint8_t* iv, size_t len);
+
+	/**
+	  * @brief XORs input with keystream
+	  * @param output Output buffer. It may be the same as input
+	  * @param input Input buffer
+	  * @param len Number of bytes
+	  */
+	void encrypt (uint8_t* output, const uint8_t* input, size_t len);
+
+	/**
+	  * @brief Erases key and state
+	  */
+	void clear ();
+};
+
+#endif // _HOST_CHACHA_h
@@ -0,0 +1,95 @@
+/**
+  * @file ChaChaPoly.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief ChaCha20-Poly1305 AEAD with the subset of CryptoArduino `ChaChaPoly` API used by `CryptModule`
+  */
+
+#include "ChaChaPoly.h"
+#include <string.h>
+
+bool ChaChaPoly::setKey (const uint8_t* key, size_t len) {
+	return chacha.setKey (key, len);
+}
+
+bool ChaChaPoly::setIV (const uint8_t* iv, size_t len) {
+	uint8_t block[64] = {};
+
+	if (!chacha.setIV (iv, len)) {
+		return false;
+	}
+	chacha.encrypt (block, block, sizeof (block)); // Block 0 keystream. Data starts on block 1
+	poly1305.reset (block);
+	memcpy (nonce, block + 16, sizeof (nonce));
+	memset (block, 0, sizeof (block));
+	authSize = 0;
+	dataSize = 0;
+	dataStarted = false;
+	return true;
+}
+
+void ChaChaPoly::startData () {
+	if (!dataStarted) {
+		poly1305.pad ();
+		dataStarted = true;
+	}
+}
+
+void ChaChaPoly::encrypt (uint8_t* output, const uint8_t* input, size_t len) {
+	startData ();
+	chacha.encrypt (output, input, len);
+	poly1305.update (output, len);
+	dataSize += len;
+}
+
+void ChaChaPoly::decrypt (uint8_t* output, const uint8_t* input, size_t len) {
+	startData ();
+	poly1305.update (input, len);
+	chacha.encrypt (output, input, len);
+	dataSize += len;
+}
+
+void ChaChaPoly::addAuthData (const void* data, size_t len) {
+	if (!dataStarted) {
+		poly1305.update (data, len);
+		authSize += len;
+	}
+}
+
+void ChaChaPoly::computeTag (void* tag, size_t len) {
+	uint8_t sizes[16];
+
+	startData ();
+	poly1305.pad ();
+	for (int i = 0; i < 8; i++) {
+		sizes[i] = authSize >> (8 * i);
+		sizes[8 + i] = dataSize >> (8 * i);
+	}
+	poly1305.update (sizes, sizeof (sizes));
+	poly1305.finalize (nonce, tag, len);
+}
+
+bool ChaChaPoly::checkTag (const void* tag, size_t len) {
+	uint8_t expected[16];
+	uint8_t diff = 0;
+
+	if (len > sizeof (expected)) {
+		return false;
+	}
+	computeTag (expected, len);
+	for (size_t i = 0; i < len; i++) {
+		diff |= expected[i] ^ ((const uint8_t*)tag)[i];
+	}
+	memset (expected, 0, sizeof (expected));
+	return diff == 0;
+}
+
+void ChaChaPoly::clear () {
+	chacha.clear ();
+	poly1305.clear ();
+	memset (nonce, 0, sizeof (nonce));
+	authSize = 0;
+	dataSize = 0;
+	dataStarted = false;
+}
@@ -0,0 +1,50 @@
+/**
+  * @file ChaChaPoly.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief ChaCha20-Poly1305 AEAD with the subset of CryptoArduino `ChaChaPoly` API used by `CryptModule`
+  *
+  * Construction follows RFC 7539 as CryptoArduino does. Poly1305 key comes from keystream block 0 and data is
+  * encrypted from block 1.
+  */
+
+#ifndef _HOST_CHACHAPOLY_h
+#define _HOST_CHACHAPOLY_h
+
+#include "AuthenticatedCipher.h"
+#include "ChaCha.h"
+#include "Poly1305.h"
+
+/**
+  * @brief ChaCha20-Poly1305 authenticated cipher
+  */
+class ChaChaPoly : public AuthenticatedCipher {
+protected:
+	ChaCha chacha; ///< @brief Keystream generator
+	Poly1305 poly1305; ///< @brief Authenticator
+	uint8_t nonce[16]; ///< @brief Poly1305 nonce taken from keystream block 0
+	uint64_t authSize = 0; ///< @brief Number of additional data bytes
+	uint64_t dataSize = 0; ///< @brief Number of encrypted bytes
+	bool dataStarted = false; ///< @brief `true` once encryption or decryption has started
+
+	/**
+	  * @brief Pads additional data before first encrypted byte
+	  */
+	void startData ();
+
+public:
+	size_t keySize () const override {
+		return 32;
+	}
+	bool setKey (const uint8_t* key, size_t len) override;
+	bool setIV (const uint8_t* iv, size_t len) override;
+	void encrypt (uint8_t* output, const uint8_t* input, size_t len) override;
+	void decrypt (uint8_t* output, const uint8_t* input, size_t len) override;
+	void addAuthData (const void* data, size_t len) override;
+	void computeTag (void* tag, size_t len) override;
+	bool checkTag (const void* tag, size_t len) override;
+	void clear () override;
+};
+
+#endif // _HOST_CHACHAPOLY_h
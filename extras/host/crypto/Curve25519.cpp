@@ -0,0 +1,191 @@
+/**
+  * @file Curve25519.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief X25519 key agreement with the subset of CryptoArduino `Curve25519` API used by `CryptModule`
+  *
+  * Field elements are 16 limbs of 16 bits, as in TweetNaCl. Speed is not a goal here.
+  */
+
+#include "Curve25519.h"
+#include <string.h>
+#include <sys/random.h>
+
+typedef int64_t gf[16]; ///< @brief Field element modulo 2^255 - 19
+
+static const gf A24 = { 0xdb41, 1 }; ///< @brief (A - 2) / 4 = 121665
+
+/**
+  * @brief Propagates carries so that every limb fits in 16 bits
+  */
+static void carry (gf o) {
+	for (int i = 0; i < 16; i++) {
+		o[i] += 1 << 16;
+		int64_t c = o[i] >> 16;
+		if (i < 15) {
+			o[i + 1] += c - 1;
+		} else {
+			o[0] += 38 * (c - 1); // 2^256 = 38 modulo p
+		}
+		o[i] -= c * 65536;
+	}
+}
+
+/**
+  * @brief Swaps p and q if b is 1, in constant time
+  */
+static void swap (gf p, gf q, int b) {
+	int64_t mask = ~((int64_t)b - 1);
+	for (int i = 0; i < 16; i++) {
+		int64_t t = mask & (p[i] ^ q[i]);
+		p[i] ^= t;
+		q[i] ^= t;
+	}
+}
+
+static void pack (uint8_t* o, const gf n) {
+	gf m, t;
+
+	memcpy (t, n, sizeof (gf));
+	carry (t);
+	carry (t);
+	carry (t);
+	for (int j = 0; j < 2; j++) {
+		m[0] = t[0] - 0xffed;
+		for (int i = 1; i < 15; i++) {
+			m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+			m[i - 1] &= 0xffff;
+		}
+		m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+		int b = (m[15] >> 16) & 1;
+		m[14] &= 0xffff;
+		swap (t, m, 1 - b);
+	}
+	for (int i = 0; i < 16; i++) {
+		o[2 * i] = t[i] & 0xff;
+		o[2 * i + 1] = t[i] >> 8;
+	}
+}
+
+static void unpack (gf o, const uint8_t* n) {
+	for (int i = 0; i < 16; i++) {
+		o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+	}
+	o[15] &= 0x7fff;
+}
+
+static void add (gf o, const gf a, const gf b) {
+	for (int i = 0; i < 16; i++) {
+		o[i] = a[i] + b[i];
+	}
+}
+
+static void sub (gf o, const gf a, const gf b) {
+	for (int i = 0; i < 16; i++) {
+		o[i] = a[i] - b[i];
+	}
+}
+
+static void mul (gf o, const gf a, const gf b) {
+	int64_t t[31] = {};
+
+	for (int i = 0; i < 16; i++) {
+		for (int j = 0; j < 16; j++) {
+			t[i + j] += a[i] * b[j];
+		}
+	}
+	for (int i = 0; i < 15; i++) {
+		t[i] += 38 * t[i + 16];
+	}
+	memcpy (o, t, sizeof (gf));
+	carry (o);
+	carry (o);
+}
+
+static void invert (gf o, const gf i) {
+	gf c;
+
+	memcpy (c, i, sizeof (gf));
+	// i^(p - 2)
+	for (int a = 253; a >= 0; a--) {
+		mul (c, c, c);
+		if (a != 2 && a != 4) {
+			mul (c, c, i);
+		}
+	}
+	memcpy (o, c, sizeof (gf));
+}
+
+void Curve25519::eval (uint8_t result[32], const uint8_t s[32], const uint8_t x[32]) {
+	static const uint8_t basePoint[32] = { 9 };
+	uint8_t z[32];
+	gf a, b, c, d, e, f, px;
+
+	memcpy (z, s, sizeof (z));
+	z[31] = (z[31] & 127) | 64;
+	z[0] &= 248;
+	unpack (px, x ? x : basePoint);
+
+	// Montgomery ladder
+	memcpy (b, px, sizeof (gf));
+	memset (a, 0, sizeof (gf));
+	memset (c, 0, sizeof (gf));
+	memset (d, 0, sizeof (gf));
+	a[0] = 1;
+	d[0] = 1;
+	for (int i = 254; i >= 0; i--) {
+		int r = (z[i >> 3] >> (i & 7)) & 1;
+		swap (a, b, r);
+		swap (c, d, r);
+		add (e, a, c);
+		sub (a, a, c);
+		add (c, b, d);
+		sub (b, b, d);
+		mul (d, e, e);
+		mul (f, a, a);
+		mul (a, c, a);
+		mul (c, b, e);
+		add (e, a, c);
+		sub (a, a, c);
+		mul (b, a, a);
+		sub (c, d, f);
+		mul (a, c, A24);
+		add (a, a, d);
+		mul (c, c, a);
+		mul (a, d, f);
+		mul (d, b, px);
+		mul (b, e, e);
+		swap (a, b, r);
+		swap (c, d, r);
+	}
+	invert (c, c);
+	mul (a, a, c);
+	pack (result, a);
+	memset (z, 0, sizeof (z));
+}
+
+void Curve25519::dh1 (uint8_t k[32], uint8_t f[32]) {
+	size_t done = 0;
+
+	while (done < 32) {
+		ssize_t got = getrandom (f + done, 32 - done, 0);
+		if (got > 0) {
+			done += got;
+		}
+	}
+	f[0] &= 248;
+	f[31] = (f[31] & 127) | 64;
+	eval (k, f, NULL);
+}
+
+bool Curve25519::dh2 (uint8_t k[32], uint8_t f[32]) {
+	uint8_t zero = 0;
+
+	eval (k, f, k);
+	memset (f, 0, 32);
+	for (int i = 0; i < 32; i++) {
+		zero |= k[i];
+	}
+	return zero != 0;
+}
@@ -0,0 +1,44 @@
+/**
+  * @file Curve25519.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief X25519 key agreement with the subset of CryptoArduino `Curve25519` API used by `CryptModule`
+  */
+
+#ifndef _HOST_CURVE25519_h
+#define _HOST_CURVE25519_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+  * @brief Diffie-Hellman key agreement on Curve25519, as defined in RFC 7748
+  */
+class Curve25519 {
+public:
+	/**
+	  * @brief Evaluates X25519 function
+	  * @param result 32 byte result
+	  * @param s 32 byte scalar. It is clamped as RFC 7748 requires
+	  * @param x 32 byte point. Base point is used if it is NULL
+	  */
+	static void eval (uint8_t result[32], const uint8_t s[32], const uint8_t x[32]);
+
+	/**
+	  * @brief Generates a random private key and its public key. Random data is read from operating system
+	  * @param k Buffer to store public key
+	  * @param f Buffer to store private key
+	  */
+	static void dh1 (uint8_t k[32], uint8_t f[32]);
+
+	/**
+	  * @brief Calculates shared secret. Private key is erased
+	  * @param k Public key from the other peer. It is replaced with shared secret
+	  * @param f Own private key
+	  * @return `false` if the other peer public key gives an all zero secret
+	  */
+	static bool dh2 (uint8_t k[32], uint8_t f[32]);
+};
+
+#endif // _HOST_CURVE25519_h
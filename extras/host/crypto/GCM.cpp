@@ -0,0 +1,210 @@
+/**
+  * @file GCM.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Galois/Counter Mode with the subset of CryptoArduino `GCM` API used by `CryptModule`
+  */
+
+#include "GCM.h"
+#include <string.h>
+
+/**
+  * @brief Multiplies two elements of GF(2^128) with GCM bit order, bit by bit
+  * @param z Result. It may be the same as x
+  * @param x First factor
+  * @param y Second factor
+  */
+static void gfMultiply (uint8_t* z, const uint8_t* x, const uint8_t* y) {
+	uint8_t v[16];
+	uint8_t result[16] = {};
+
+	memcpy (v, y, sizeof (v));
+	for (int i = 0; i < 128; i++) {
+		if (x[i / 8] & (0x80 >> (i % 8))) {
+			for (int j = 0; j < 16; j++) {
+				result[j] ^= v[j];
+			}
+		}
+		bool lsb = v[15] & 1;
+		for (int j = 15; j > 0; j--) {
+			v[j] = (v[j] >> 1) | (v[j - 1] << 7);
+		}
+		v[0] >>= 1;
+		if (lsb) {
+			v[0] ^= 0xe1;
+		}
+	}
+	memcpy (z, result, sizeof (result));
+}
+
+void GHASH::reset (const uint8_t* key) {
+	memcpy (H, key, sizeof (H));
+	memset (Y, 0, sizeof (Y));
+	posn = 0;
+}
+
+void GHASH::update (const void* data, size_t len) {
+	const uint8_t* d = (const uint8_t*)data;
+
+	while (len > 0) {
+		size_t chunk = (size_t)(16 - posn) < len ? (size_t)(16 - posn) : len;
+		for (size_t i = 0; i < chunk; i++) {
+			Y[posn + i] ^= d[i];
+		}
+		posn += chunk;
+		d += chunk;
+		len -= chunk;
+		if (posn == 16) {
+			gfMultiply (Y, Y, H);
+			posn = 0;
+		}
+	}
+}
+
+void GHASH::pad () {
+	if (posn) {
+		gfMultiply (Y, Y, H); // Remaining bytes of block are already zero padded
+		posn = 0;
+	}
+}
+
+void GHASH::finalize (void* token, size_t len) {
+	pad ();
+	memcpy (token, Y, len < 16 ? len : 16);
+}
+
+void GHASH::clear () {
+	memset (H, 0, sizeof (H));
+	memset (Y, 0, sizeof (Y));
+	posn = 0;
+}
+
+bool GCMCommon::setIV (const uint8_t* iv, size_t len) {
+	uint8_t hashKey[16] = {};
+
+	if (!len) {
+		return false;
+	}
+	encryptBlock (hashKey, hashKey);
+	if (len == 12) {
+		memcpy (counter, iv, 12);
+		counter[12] = 0;
+		counter[13] = 0;
+		counter[14] = 0;
+		counter[15] = 1;
+	} else {
+		// Other IV lengths are hashed together with their length in bits
+		uint8_t sizes[16] = {};
+		for (int i = 0; i < 8; i++) {
+			sizes[15 - i] = ((uint64_t)len * 8) >> (8 * i);
+		}
+		ghash.reset (hashKey);
+		ghash.update (iv, len);
+		ghash.pad ();
+		ghash.update (sizes, sizeof (sizes));
+		ghash.finalize (counter, sizeof (counter));
+	}
+	encryptBlock (tagMask, counter);
+	ghash.reset (hashKey);
+	memset (hashKey, 0, sizeof (hashKey));
+	posn = 16;
+	authSize = 0;
+	dataSize = 0;
+	dataStarted = false;
+	return true;
+}
+
+void GCMCommon::crypt (uint8_t* output, const uint8_t* input, size_t len) {
+	while (len > 0) {
+		if (posn >= 16) {
+			// Increment lower 32 bits of counter
+			for (int i = 15; i >= 12; i--) {
+				if (++counter[i]) {
+					break;
+				}
+			}
+			encryptBlock (stream, counter);
+			posn = 0;
+		}
+		size_t chunk = (size_t)(16 - posn) < len ? (size_t)(16 - posn) : len;
+		for (size_t i = 0; i < chunk; i++) {
+			output[i] = input[i] ^ stream[posn + i];
+		}
+		posn += chunk;
+		output += chunk;
+		input += chunk;
+		len -= chunk;
+	}
+}
+
+void GCMCommon::encrypt (uint8_t* output, const uint8_t* input, size_t len) {
+	if (!dataStarted) {
+		ghash.pad ();
+		dataStarted = true;
+	}
+	crypt (output, input, len);
+	ghash.update (output, len);
+	dataSize += len;
+}
+
+void GCMCommon::decrypt (uint8_t* output, const uint8_t* input, size_t len) {
+	if (!dataStarted) {
+		ghash.pad ();
+		dataStarted = true;
+	}
+	ghash.update (input, len);
+	crypt (output, input, len);
+	dataSize += len;
+}
+
+void GCMCommon::addAuthData (const void* data, size_t len) {
+	if (!dataStarted) {
+		ghash.update (data, len);
+		authSize += len;
+	}
+}
+
+void GCMCommon::computeTag (void* tag, size_t len) {
+	uint8_t sizes[16];
+	uint8_t hash[16];
+
+	ghash.pad ();
+	for (int i = 0; i < 8; i++) {
+		sizes[7 - i] = (authSize * 8) >> (8 * i);
+		sizes[15 - i] = (dataSize * 8) >> (8 * i);
+	}
+	ghash.update (sizes, sizeof (sizes));
+	ghash.finalize (hash, sizeof (hash));
+	for (int i = 0; i < 16; i++) {
+		hash[i] ^= tagMask[i];
+	}
+	memcpy (tag, hash, len < 16 ? len : 16);
+	memset (hash, 0, sizeof (hash));
+}
+
+bool GCMCommon::checkTag (const void* tag, size_t len) {
+	uint8_t expected[16];
+	uint8_t diff = 0;
+
+	if (len > sizeof (expected)) {
+		return false;
+	}
+	computeTag (expected, len);
+	for (size_t i = 0; i < len; i++) {
+		diff |= expected[i] ^ ((const uint8_t*)tag)[i];
+	}
+	memset (expected, 0, sizeof (expected));
+	return diff == 0;
+}
+
+void GCMCommon::clear () {
+	ghash.clear ();
+	memset (counter, 0, sizeof (counter));
+	memset (stream, 0, sizeof (stream));
+	memset (tagMask, 0, sizeof (tagMask));
+	posn = 16;
+	authSize = 0;
+	dataSize = 0;
+	dataStarted = false;
+}
@@ -0,0 +1,125 @@
+/**
+  * @file GCM.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Galois/Counter Mode with the subset of CryptoArduino `GCM` API used by `CryptModule`
+  */
+
+#ifndef _HOST_GCM_h
+#define _HOST_GCM_h
+
+#include "AuthenticatedCipher.h"
+#include "AES.h"
+
+/**
+  * @brief GHASH universal hash used by GCM
+  */
+class GHASH {
+protected:
+	uint8_t H[16]; ///< @brief Hash key
+	uint8_t Y[16]; ///< @brief Accumulator
+	uint8_t posn = 0; ///< @brief Number of bytes already added to current block
+
+public:
+	/**
+	  * @brief Sets hash key and clears accumulator
+	  * @param key 16 byte hash key
+	  */
+	void reset (const uint8_t* key);
+
+	/**
+	  * @brief Adds data
+	  * @param data Data buffer
+	  * @param len Number of bytes
+	  */
+	void update (const void* data, size_t len);
+
+	/**
+	  * @brief Pads data with zeros up to next 16 byte boundary
+	  */
+	void pad ();
+
+	/**
+	  * @brief Gets hash value
+	  * @param token Buffer to store hash
+	  * @param len Number of bytes to store, up to 16
+	  */
+	void finalize (void* token, size_t len);
+
+	/**
+	  * @brief Erases key and state
+	  */
+	void clear ();
+};
+
+/**
+  * @brief Common part of GCM, independent from block cipher
+  */
+class GCMCommon : public AuthenticatedCipher {
+protected:
+	GHASH ghash; ///< @brief Authenticator
+	uint8_t counter[16]; ///< @brief Current counter block
+	uint8_t stream[16]; ///< @brief Keystream of previous counter block
+	uint8_t tagMask[16]; ///< @brief Encrypted first counter block, added to tag
+	uint8_t posn = 16; ///< @brief Next unused byte in `stream`
+	uint64_t authSize = 0; ///< @brief Number of additional data bytes
+	uint64_t dataSize = 0; ///< @brief Number of encrypted bytes
+	bool dataStarted = false; ///< @brief `true` once encryption or decryption has started
+
+	/**
+	  * @brief Encrypts a block with underlying block cipher
+	  * @param output 16 byte output buffer
+	  * @param input 16 byte input buffer
+	  */
+	virtual void encryptBlock (uint8_t* output, const uint8_t* input) = 0;
+
+	/**
+	  * @brief XORs data with counter mode keystream
+	  * @param output Output buffer
+	  * @param input Input buffer
+	  * @param len Number of bytes
+	  */
+	void crypt (uint8_t* output, const uint8_t* input, size_t len);
+
+public:
+	/**
+	  * @brief Sets IV. Hash key is derived here from block cipher key, so key must be set before
+	  */
+	bool setIV (const uint8_t* iv, size_t len) override;
+	void encrypt (uint8_t* output, const uint8_t* input, size_t len) override;
+	void decrypt (uint8_t* output, const uint8_t* input, size_t len) override;
+	void addAuthData (const void* data, size_t len) override;
+	void computeTag (void* tag, size_t len) override;
+	bool checkTag (const void* tag, size_t len) override;
+	void clear () override;
+};
+
+/**
+  * @brief GCM on top of a 128 bit block cipher
+  */
+template <typename T>
+class GCM : public GCMCommon {
+protected:
+	T blockCipher; ///< @brief Block cipher instance
+
+	void encryptBlock (uint8_t* output, const uint8_t* input) override {
+		blockCipher.encryptBlock (output, input);
+	}
+
+public:
+	size_t keySize () const override {
+		return blockCipher.keySize ();
+	}
+
+	bool setKey (const uint8_t* key, size_t len) override {
+		return blockCipher.setKey (key, len);
+	}
+
+	void clear () override {
+		blockCipher.clear ();
+		GCMCommon::clear ();
+	}
+};
+
+#endif // _HOST_GCM_h
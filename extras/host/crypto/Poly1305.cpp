@@ -0,0 +1,165 @@
+/**
+  * @file Poly1305.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Poly1305 authenticator with the subset of CryptoArduino `Poly1305` API used by `ChaChaPoly`
+  */
+
+#include "Poly1305.h"
+#include <string.h>
+
+static const uint32_t LIMB_MASK = 0x3ffffff;
+
+static uint32_t load32 (const uint8_t* p) {
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32 (uint8_t* p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+void Poly1305::reset (const void* key) {
+	const uint8_t* k = (const uint8_t*)key;
+
+	r[0] = load32 (k) & 0x3ffffff;
+	r[1] = (load32 (k + 3) >> 2) & 0x3ffff03;
+	r[2] = (load32 (k + 6) >> 4) & 0x3ffc0ff;
+	r[3] = (load32 (k + 9) >> 6) & 0x3f03fff;
+	r[4] = (load32 (k + 12) >> 8) & 0x00fffff;
+	memset (h, 0, sizeof (h));
+	posn = 0;
+}
+
+void Poly1305::processBlock (const uint8_t* data, uint32_t hibit) {
+	uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+
+	h[0] += load32 (data) & LIMB_MASK;
+	h[1] += (load32 (data + 3) >> 2) & LIMB_MASK;
+	h[2] += (load32 (data + 6) >> 4) & LIMB_MASK;
+	h[3] += (load32 (data + 9) >> 6) & LIMB_MASK;
+	h[4] += (load32 (data + 12) >> 8) | hibit;
+
+	uint64_t d0 = (uint64_t)h[0] * r[0] + (uint64_t)h[1] * s4 + (uint64_t)h[2] * s3 + (uint64_t)h[3] * s2 + (uint64_t)h[4] * s1;
+	uint64_t d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] + (uint64_t)h[2] * s4 + (uint64_t)h[3] * s3 + (uint64_t)h[4] * s2;
+	uint64_t d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] + (uint64_t)h[2] * r[0] + (uint64_t)h[3] * s4 + (uint64_t)h[4] * s3;
+	uint64_t d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] + (uint64_t)h[2] * r[1] + (uint64_t)h[3] * r[0] + (uint64_t)h[4] * s4;
+	uint64_t d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] + (uint64_t)h[2] * r[2] + (uint64_t)h[3] * r[1] + (uint64_t)h[4] * r[0];
+
+	uint32_t c = d0 >> 26;
+	h[0] = d0 & LIMB_MASK;
+	d1 += c;
+	c = d1 >> 26;
+	h[1] = d1 & LIMB_MASK;
+	d2 += c;
+	c = d2 >> 26;
+	h[2] = d2 & LIMB_MASK;
+	d3 += c;
+	c = d3 >> 26;
+	h[3] = d3 & LIMB_MASK;
+	d4 += c;
+	c = d4 >> 26;
+	h[4] = d4 & LIMB_MASK;
+	h[0] += c * 5;
+	c = h[0] >> 26;
+	h[0] &= LIMB_MASK;
+	h[1] += c;
+}
+
+void Poly1305::update (const void* data, size_t len) {
+	const uint8_t* d = (const uint8_t*)data;
+
+	while (len > 0) {
+		if (!posn && len >= 16) {
+			processBlock (d, 1 << 24);
+			d += 16;
+			len -= 16;
+			continue;
+		}
+		size_t chunk = (size_t)(16 - posn) < len ? (size_t)(16 - posn) : len;
+		memcpy (block + posn, d, chunk);
+		posn += chunk;
+		d += chunk;
+		len -= chunk;
+		if (posn == 16) {
+			processBlock (block, 1 << 24);
+			posn = 0;
+		}
+	}
+}
+
+void Poly1305::pad () {
+	if (posn) {
+		memset (block + posn, 0, 16 - posn);
+		processBlock (block, 1 << 24);
+		posn = 0;
+	}
+}
+
+void Poly1305::finalize (const void* nonce, void* token, size_t len) {
+	const uint8_t* n = (const uint8_t*)nonce;
+	uint8_t mac[16];
+	uint32_t c, g[5];
+
+	if (posn) {
+		block[posn] = 1;
+		memset (block + posn + 1, 0, 15 - posn);
+		processBlock (block, 0);
+		posn = 0;
+	}
+
+	// Full carry
+	c = h[1] >> 26;
+	h[1] &= LIMB_MASK;
+	for (int i = 2; i < 5; i++) {
+		h[i] += c;
+		c = h[i] >> 26;
+		h[i] &= LIMB_MASK;
+	}
+	h[0] += c * 5;
+	c = h[0] >> 26;
+	h[0] &= LIMB_MASK;
+	h[1] += c;
+
+	// h - p, selected if h >= p
+	g[0] = h[0] + 5;
+	c = g[0] >> 26;
+	g[0] &= LIMB_MASK;
+	for (int i = 1; i < 4; i++) {
+		g[i] = h[i] + c;
+		c = g[i] >> 26;
+		g[i] &= LIMB_MASK;
+	}
+	g[4] = h[4] + c - (1 << 26);
+	uint32_t mask = (g[4] >> 31) - 1;
+	for (int i = 0; i < 5; i++) {
+		h[i] = (h[i] & ~mask) | (g[i] & mask);
+	}
+
+	// h mod 2^128 plus nonce
+	uint32_t w0 = h[0] | (h[1] << 26);
+	uint32_t w1 = (h[1] >> 6) | (h[2] << 20);
+	uint32_t w2 = (h[2] >> 12) | (h[3] << 14);
+	uint32_t w3 = (h[3] >> 18) | (h[4] << 8);
+	uint64_t f = (uint64_t)w0 + load32 (n);
+	store32 (mac, f);
+	f = (uint64_t)w1 + load32 (n + 4) + (f >> 32);
+	store32 (mac + 4, f);
+	f = (uint64_t)w2 + load32 (n + 8) + (f >> 32);
+	store32 (mac + 8, f);
+	f = (uint64_t)w3 + load32 (n + 12) + (f >> 32);
+	store32 (mac + 12, f);
+
+	memcpy (token, mac, len < 16 ? len : 16);
+	memset (mac, 0, sizeof (mac));
+}
+
+void Poly1305::clear () {
+	memset (r, 0, sizeof (r));
+	memset (h, 0, sizeof (h));
+	memset (block, 0, sizeof (block));
+	posn = 0;
+}
@@ -0,0 +1,65 @@
+/**
+  * @file Poly1305.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Poly1305 authenticator with the subset of CryptoArduino `Poly1305` API used by `ChaChaPoly`
+  */
+
+#ifndef _HOST_POLY1305_h
+#define _HOST_POLY1305_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+  * @brief Poly1305 one time authenticator
+  */
+class Poly1305 {
+protected:
+	uint32_t r[5]; ///< @brief Clamped key in 26 bit limbs
+	uint32_t h[5]; ///< @brief Accumulator in 26 bit limbs
+	uint8_t block[16]; ///< @brief Pending partial block
+	uint8_t posn = 0; ///< @brief Number of bytes in `block`
+
+	/**
+	  * @brief Adds a block to accumulator and multiplies it by key
+	  * @param data 16 byte block
+	  * @param hibit `1 << 24` for a full block, 0 for last padded block
+	  */
+	void processBlock (const uint8_t* data, uint32_t hibit);
+
+public:
+	/**
+	  * @brief Starts a new message
+	  * @param key 16 byte key. It is clamped as Poly1305 requires
+	  */
+	void reset (const void* key);
+
+	/**
+	  * @brief Adds message data
+	  * @param data Data buffer
+	  * @param len Number of bytes
+	  */
+	void update (const void* data, size_t len);
+
+	/**
+	  * @brief Pads message with zeros up to next 16 byte boundary
+	  */
+	void pad ();
+
+	/**
+	  * @brief Calculates authenticator
+	  * @param nonce 16 byte value added to result
+	  * @param token Buffer to store result
+	  * @param len Number of bytes to store, up to 16
+	  */
+	void finalize (const void* nonce, void* token, size_t len);
+
+	/**
+	  * @brief Erases key and state
+	  */
+	void clear ();
+};
+
+#endif // _HOST_POLY1305_h
@@ -0,0 +1,151 @@
+/**
+  * @file SHA256.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief SHA-256 with the subset of CryptoArduino `SHA256` API used by `CryptModule`
+  */
+
+#include "SHA256.h"
+#include <string.h>
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+void SHA256::reset () {
+	static const uint32_t initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy (state, initial, sizeof (state));
+	posn = 0;
+	length = 0;
+}
+
+void SHA256::processBlock () {
+	uint32_t w[64];
+
+	for (int i = 0; i < 16; i++) {
+		w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) | ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = ROTR (w[i - 15], 7) ^ ROTR (w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR (w[i - 2], 17) ^ ROTR (w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (ROTR (e, 6) ^ ROTR (e, 11) ^ ROTR (e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		uint32_t t2 = (ROTR (a, 2) ^ ROTR (a, 13) ^ ROTR (a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+	memset (w, 0, sizeof (w));
+}
+
+void SHA256::update (const void* data, size_t len) {
+	const uint8_t* d = (const uint8_t*)data;
+
+	length += len;
+	while (len > 0) {
+		size_t chunk = (size_t)(64 - posn) < len ? (size_t)(64 - posn) : len;
+		memcpy (block + posn, d, chunk);
+		posn += chunk;
+		d += chunk;
+		len -= chunk;
+		if (posn == 64) {
+			processBlock ();
+			posn = 0;
+		}
+	}
+}
+
+void SHA256::finalize (void* hash, size_t len) {
+	uint8_t result[32];
+	uint64_t bits = length * 8;
+
+	block[posn++] = 0x80;
+	if (posn > 56) {
+		memset (block + posn, 0, 64 - posn);
+		processBlock ();
+		posn = 0;
+	}
+	memset (block + posn, 0, 56 - posn);
+	for (int i = 0; i < 8; i++) {
+		block[63 - i] = bits >> (8 * i);
+	}
+	processBlock ();
+	posn = 0;
+	for (int i = 0; i < 8; i++) {
+		result[4 * i] = state[i] >> 24;
+		result[4 * i + 1] = state[i] >> 16;
+		result[4 * i + 2] = state[i] >> 8;
+		result[4 * i + 3] = state[i];
+	}
+	memcpy (hash, result, len < 32 ? len : 32);
+	memset (result, 0, sizeof (result));
+}
+
+void SHA256::formatHMACKey (const void* key, size_t len, uint8_t pad) {
+	uint8_t padded[64] = {};
+
+	if (len > sizeof (padded)) {
+		reset ();
+		update (key, len);
+		finalize (padded, 32);
+	} else {
+		memcpy (padded, key, len);
+	}
+	for (size_t i = 0; i < sizeof (padded); i++) {
+		padded[i] ^= pad;
+	}
+	reset ();
+	update (padded, sizeof (padded));
+	memset (padded, 0, sizeof (padded));
+}
+
+void SHA256::resetHMAC (const void* key, size_t keyLen) {
+	formatHMACKey (key, keyLen, 0x36);
+}
+
+void SHA256::finalizeHMAC (const void* key, size_t keyLen, void* hash, size_t hashLen) {
+	uint8_t inner[32];
+
+	finalize (inner, sizeof (inner));
+	formatHMACKey (key, keyLen, 0x5c);
+	update (inner, sizeof (inner));
+	finalize (hash, hashLen);
+	memset (inner, 0, sizeof (inner));
+}
+
+void SHA256::clear () {
+	memset (state, 0, sizeof (state));
+	memset (block, 0, sizeof (block));
+	posn = 0;
+	length = 0;
+}
@@ -0,0 +1,84 @@
+/**
+  * @file SHA256.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief SHA-256 with the subset of CryptoArduino `SHA256` API used by `CryptModule`
+  */
+
+#ifndef _HOST_SHA256_h
+#define _HOST_SHA256_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+  * @brief SHA-256 hash and HMAC-SHA256
+  */
+class SHA256 {
+protected:
+	uint32_t state[8]; ///< @brief Hash state
+	uint8_t block[64]; ///< @brief Pending partial block
+	uint8_t posn; ///< @brief Number of bytes in `block`
+	uint64_t length; ///< @brief Number of bytes hashed
+
+	/**
+	  * @brief Processes a full block
+	  */
+	void processBlock ();
+
+	/**
+	  * @brief Hashes HMAC key padded with a byte value
+	  * @param key HMAC key
+	  * @param len HMAC key length
+	  * @param pad 0x36 for inner hash, 0x5c for outer hash
+	  */
+	void formatHMACKey (const void* key, size_t len, uint8_t pad);
+
+public:
+	SHA256 () {
+		reset ();
+	}
+
+	/**
+	  * @brief Starts a new hash
+	  */
+	void reset ();
+
+	/**
+	  * @brief Adds data to hash
+	  * @param data Data buffer
+	  * @param len Number of bytes
+	  */
+	void update (const void* data, size_t len);
+
+	/**
+	  * @brief Gets hash value
+	  * @param hash Buffer to store hash
+	  * @param len Number of bytes to store, up to 32
+	  */
+	void finalize (void* hash, size_t len);
+
+	/**
+	  * @brief Starts a new HMAC calculation
+	  * @param key HMAC key
+	  * @param keyLen HMAC key length
+	  */
+	void resetHMAC (const void* key, size_t keyLen);
+
+	/**
+	  * @brief Gets HMAC value
+	  * @param key HMAC key. It must be the same given to `resetHMAC`
+	  * @param keyLen HMAC key length
+	  * @param hash Buffer to store HMAC
+	  * @param hashLen Number of bytes to store, up to 32
+	  */
+	void finalizeHMAC (const void* key, size_t keyLen, void* hash, size_t hashLen);
+
+	/**
+	  * @brief Erases state
+	  */
+	void clear ();
+};
+
+#endif // _HOST_SHA256_h
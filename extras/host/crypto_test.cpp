@@ -0,0 +1,307 @@
+/**
+  * @file crypto_test.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Checks `CryptModule` cipher suite negotiation, AEAD, hash and key agreement functions
+  *
+  * Built with all cipher suites enabled, against the software backends in `crypto` folder.
+  */
+
+#include <Arduino.h>
+#include <cryptModule.h>
+#include <helperFunctions.h>
+#include <Curve25519.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf ("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+/**
+  * @brief Converts a hex string to binary
+  * @param out Output buffer
+  * @param hex Hex string with even number of digits
+  * @return Number of bytes written
+  */
+size_t fromHex (uint8_t* out, const char* hex) {
+	size_t len = strlen (hex) / 2;
+
+	for (size_t i = 0; i < len; i++) {
+		unsigned value;
+		sscanf (hex + 2 * i, "%2x", &value);
+		out[i] = value;
+	}
+	return len;
+}
+
+/**
+  * @brief Compares a buffer with a hex string
+  * @param data Buffer to check
+  * @param hex Expected value
+  * @return `true` if both are equal
+  */
+bool equalsHex (const uint8_t* data, const char* hex) {
+	uint8_t expected[256];
+	size_t len = fromHex (expected, hex);
+
+	return !memcmp (data, expected, len);
+}
+
+/**
+  * @brief Builds ClientHello Random field the way `EnigmaIOTNodeClass::clientHello` does
+  * @param offered Offered cipher suites mask
+  * @return Random field
+  */
+uint32_t nodeHelloRandom (uint8_t offered) {
+	return ((uint32_t)HELLO_CAPABILITY_MARKER << 16) | ((uint32_t)offered << 8) | 0x0000000DU;
+}
+
+/**
+  * @brief Checks suite selection for every mask a node may offer, and for nodes that do not signal capabilities
+  */
+void testSuiteSelection () {
+	for (int offered = 0; offered < 256; offered++) {
+		cipherSuite_t expected = (offered & (1 << PREFERRED_CIPHER_SUITE)) ? PREFERRED_CIPHER_SUITE : CIPHER_CHACHAPOLY;
+		cipherSuite_t suite = CryptModule::selectSuite (offered);
+		CHECK (suite == expected);
+		CHECK (CryptModule::isSuiteSupported (suite));
+		CHECK (CryptModule::helloSignalsCapabilities (nodeHelloRandom (offered)));
+		CHECK (CryptModule::selectHelloSuite (nodeHelloRandom (offered)) == expected);
+		// Reserved bits 5-7 set mean that Random is not a capabilities field
+		CHECK (!CryptModule::helloSignalsCapabilities (nodeHelloRandom (offered) | 0x00000020U));
+		CHECK (CryptModule::selectHelloSuite (nodeHelloRandom (offered) | 0x000000E0U) == CIPHER_CHACHAPOLY);
+	}
+
+	// 0.9.8 nodes send random data, that may offer any suite by chance
+	for (int i = 0; i < 100000; i++) {
+		uint32_t random = CryptModule::hardwareRandom ();
+		if ((random >> 16) == HELLO_CAPABILITY_MARKER) {
+			continue;
+		}
+		CHECK (!CryptModule::helloSignalsCapabilities (random));
+		CHECK (CryptModule::selectHelloSuite (random) == CIPHER_CHACHAPOLY);
+	}
+	CHECK (CryptModule::selectHelloSuite (0x0000FF00U) == CIPHER_CHACHAPOLY);
+	CHECK (CryptModule::selectHelloSuite (0xE10B0200U) == CIPHER_CHACHAPOLY);
+
+	for (int suite = 0; suite < 3; suite++) {
+		CHECK (CryptModule::isSuiteSupported ((cipherSuite_t)suite));
+	}
+	CHECK (!CryptModule::isSuiteSupported ((cipherSuite_t)3));
+	CHECK (!CryptModule::isSuiteSupported ((cipherSuite_t)200));
+	printf ("suite selection: preferred %s, legacy hello ChaChaPoly\n", CryptModule::getSuiteName (PREFERRED_CIPHER_SUITE));
+}
+
+/**
+  * @brief Checks AEAD output against published test vectors
+  */
+void testVectors () {
+	uint8_t key[KEY_LENGTH];
+	uint8_t iv[IV_LENGTH];
+	uint8_t aad[32];
+	uint8_t data[128];
+	uint8_t tag[TAG_LENGTH];
+	size_t aadLen, dataLen;
+
+	// RFC 7539 section 2.8.2
+	fromHex (key, "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f");
+	fromHex (iv, "070000004041424344454647");
+	aadLen = fromHex (aad, "50515253c0c1c2c3c4c5c6c7");
+	const char* text = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+	dataLen = strlen (text);
+	memcpy (data, text, dataLen);
+	CHECK (CryptModule::encryptBuffer (data, dataLen, iv, IV_LENGTH, key, KEY_LENGTH, aad, aadLen, tag, TAG_LENGTH, CIPHER_CHACHAPOLY));
+	CHECK (equalsHex (data, "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d63dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b3692ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc3ff4def08e4b7a9de576d26586cec64b6116"));
+	CHECK (equalsHex (tag, "1ae10b594f09e26a7e902ecbd0600691"));
+	CHECK (CryptModule::decryptBuffer (data, dataLen, iv, IV_LENGTH, key, KEY_LENGTH, aad, aadLen, tag, TAG_LENGTH, CIPHER_CHACHAPOLY));
+	CHECK (!memcmp (data, text, dataLen));
+
+	// GCM specification test cases 4 and 16
+	const char* gcmKeys[] = { "feffe9928665731c6d6a8f9467308308",
+							  "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308" };
+	const char* gcmCipher[] = { "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+								"522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662" };
+	const char* gcmTags[] = { "5bc94fbc3221a5db94fae95ae7121a47", "76fc6ece0f4e1768cddf8853bb2d551b" };
+	const char* gcmPlain = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39";
+	for (int i = 0; i < 2; i++) {
+		cipherSuite_t suite = i ? CIPHER_AES256_GCM : CIPHER_AES128_GCM;
+		uint8_t keyLen = fromHex (key, gcmKeys[i]);
+		fromHex (iv, "cafebabefacedbaddecaf888");
+		aadLen = fromHex (aad, "feedfacedeadbeeffeedfacedeadbeefabaddad2");
+		dataLen = fromHex (data, gcmPlain);
+		CHECK (CryptModule::encryptBuffer (data, dataLen, iv, IV_LENGTH, key, keyLen, aad, aadLen, tag, TAG_LENGTH, suite));
+		CHECK (equalsHex (data, gcmCipher[i]));
+		CHECK (equalsHex (tag, gcmTags[i]));
+		CHECK (CryptModule::decryptBuffer (data, dataLen, iv, IV_LENGTH, key, keyLen, aad, aadLen, tag, TAG_LENGTH, suite));
+		CHECK (equalsHex (data, gcmPlain));
+	}
+	printf ("AEAD test vectors checked\n");
+}
+
+/**
+  * @brief Encrypts and decrypts a message the way data messages are protected, and checks that any change is detected
+  * @param suite Cipher suite
+  * @param length Message length
+  */
+void roundTrip (cipherSuite_t suite, size_t length) {
+	const uint8_t KEY_LEN = KEY_LENGTH - AAD_LENGTH; // Protocol messages use the first part of the key only
+	uint8_t key[KEY_LENGTH] = {};
+	uint8_t iv[IV_LENGTH] = {};
+	uint8_t aad[1 + IV_LENGTH + AAD_LENGTH]; // Message type, IV and last part of key
+	uint8_t plain[256] = {};
+	uint8_t data[256];
+	uint8_t tag[TAG_LENGTH];
+
+	CryptModule::random (key, KEY_LENGTH);
+	CryptModule::random (iv, IV_LENGTH);
+	CryptModule::random (plain, length);
+	aad[0] = 0x01;
+	memcpy (aad + 1, iv, IV_LENGTH);
+	memcpy (aad + 1 + IV_LENGTH, key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	memcpy (data, plain, length);
+	CHECK (CryptModule::encryptBuffer (data, length, iv, IV_LENGTH, key, KEY_LEN, aad, sizeof (aad), tag, TAG_LENGTH, suite));
+	CHECK (memcmp (data, plain, length));
+	uint8_t cipherText[256];
+	memcpy (cipherText, data, length);
+
+	CHECK (CryptModule::decryptBuffer (data, length, iv, IV_LENGTH, key, KEY_LEN, aad, sizeof (aad), tag, TAG_LENGTH, suite));
+	CHECK (!memcmp (data, plain, length));
+
+	// Changed ciphertext
+	memcpy (data, cipherText, length);
+	data[length / 2] ^= 0x01;
+	CHECK (!CryptModule::decryptBuffer (data, length, iv, IV_LENGTH, key, KEY_LEN, aad, sizeof (aad), tag, TAG_LENGTH, suite));
+
+	// Changed tag
+	memcpy (data, cipherText, length);
+	tag[TAG_LENGTH - 1] ^= 0x80;
+	CHECK (!CryptModule::decryptBuffer (data, length, iv, IV_LENGTH, key, KEY_LEN, aad, sizeof (aad), tag, TAG_LENGTH, suite));
+	tag[TAG_LENGTH - 1] ^= 0x80;
+
+	// Changed AAD
+	memcpy (data, cipherText, length);
+	aad[0] ^= 0x01;
+	CHECK (!CryptModule::decryptBuffer (data, length, iv, IV_LENGTH, key, KEY_LEN, aad, sizeof (aad), tag, TAG_LENGTH, suite));
+	aad[0] ^= 0x01;
+
+	// Other suites do not decrypt it
+	for (int other = 0; other < 3; other++) {
+		if (other != suite) {
+			memcpy (data, cipherText, length);
+			CHECK (!CryptModule::decryptBuffer (data, length, iv, IV_LENGTH, key, KEY_LEN, aad, sizeof (aad), tag, TAG_LENGTH, (cipherSuite_t)other));
+		}
+	}
+
+	// Message is still valid after failed attempts
+	memcpy (data, cipherText, length);
+	CHECK (CryptModule::decryptBuffer (data, length, iv, IV_LENGTH, key, KEY_LEN, aad, sizeof (aad), tag, TAG_LENGTH, suite));
+	CHECK (!memcmp (data, plain, length));
+}
+
+/**
+  * @brief Checks SHA256, HMAC and HKDF against published test vectors
+  */
+void testHash () {
+	uint8_t buffer[64];
+	uint8_t out[64];
+	size_t len;
+
+	const char* text = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	len = strlen (text);
+	memcpy (buffer, text, len);
+	CHECK (CryptModule::getSHA256 (buffer, len) == buffer);
+	CHECK (equalsHex (buffer, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+	CHECK (CryptModule::getSHA256 (buffer, 31) == NULL);
+
+	// RFC 4231 test case 2
+	text = "what do ya want for nothing?";
+	CryptModule::getHMAC ((const uint8_t*)"Jefe", 4, (const uint8_t*)text, strlen (text), out, 32);
+	CHECK (equalsHex (out, "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"));
+
+	// RFC 5869 test case 1
+	uint8_t salt[13];
+	uint8_t info[10];
+	len = fromHex (buffer, "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b");
+	fromHex (salt, "000102030405060708090a0b0c");
+	fromHex (info, "f0f1f2f3f4f5f6f7f8f9");
+	CHECK (CryptModule::deriveKey (buffer, len, salt, sizeof (salt), info, sizeof (info), out, 42));
+	CHECK (equalsHex (out, "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865"));
+	CHECK (!CryptModule::deriveKey (buffer, len, salt, sizeof (salt), info, sizeof (info), out, 255 * 32 + 1));
+	printf ("hash test vectors checked\n");
+}
+
+/**
+  * @brief Checks key agreement with RFC 7748 test vector, and between two instances as node and gateway do
+  */
+void testKeyAgreement () {
+	CryptModule alice;
+	CryptModule bob;
+	uint8_t remote[KEY_LENGTH];
+	uint8_t pub[KEY_LENGTH];
+
+	// RFC 7748 section 6.1
+	fromHex (alice.getPrivDHKey (), "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+	Curve25519::eval (pub, alice.getPrivDHKey (), NULL);
+	CHECK (equalsHex (pub, "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a"));
+	fromHex (remote, "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f");
+	CHECK (alice.getDH2 (remote));
+	CHECK (equalsHex (remote, "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742"));
+
+	// All zero public key is rejected
+	alice.getDH1 ();
+	memset (remote, 0, sizeof (remote));
+	CHECK (!alice.getDH2 (remote));
+
+	// Node and gateway agree a key and protect a message with the suite that gateway selected
+	for (int offered = 0; offered < 8; offered++) {
+		uint8_t nodeKey[KEY_LENGTH];
+		uint8_t gwKey[KEY_LENGTH];
+		alice.getDH1 ();
+		bob.getDH1 ();
+		memcpy (nodeKey, bob.getPubDHKey (), KEY_LENGTH);
+		memcpy (gwKey, alice.getPubDHKey (), KEY_LENGTH);
+		CHECK (alice.getDH2 (nodeKey));
+		CHECK (bob.getDH2 (gwKey));
+		CHECK (!memcmp (nodeKey, gwKey, KEY_LENGTH));
+		CryptModule::getSHA256 (nodeKey, KEY_LENGTH);
+		CryptModule::getSHA256 (gwKey, KEY_LENGTH);
+
+		cipherSuite_t suite = CryptModule::selectHelloSuite (nodeHelloRandom (offered | 0x01));
+		uint8_t iv[IV_LENGTH] = {};
+		uint8_t data[32];
+		uint8_t tag[TAG_LENGTH];
+		CryptModule::random (iv, IV_LENGTH);
+		memset (data, offered, sizeof (data));
+		CHECK (CryptModule::encryptBuffer (data, sizeof (data), iv, IV_LENGTH, nodeKey, KEY_LENGTH - AAD_LENGTH, NULL, 0, tag, TAG_LENGTH, suite));
+		CHECK (CryptModule::decryptBuffer (data, sizeof (data), iv, IV_LENGTH, gwKey, KEY_LENGTH - AAD_LENGTH, NULL, 0, tag, TAG_LENGTH, suite));
+		CHECK (data[0] == offered && data[31] == offered);
+	}
+	printf ("key agreement checked\n");
+}
+
+int main () {
+	const size_t sizes[] = { 32, 100, 214 };
+
+	testSuiteSelection ();
+	testVectors ();
+	testHash ();
+	testKeyAgreement ();
+
+	for (int suite = 0; suite < 3; suite++) {
+		for (size_t size : sizes) {
+			for (int i = 0; i < 100; i++) {
+				roundTrip ((cipherSuite_t)suite, size);
+			}
+		}
+		printf ("%s round trip: %u, %u and %u bytes\n", CryptModule::getSuiteName ((cipherSuite_t)suite),
+				(unsigned)sizes[0], (unsigned)sizes[1], (unsigned)sizes[2]);
+	}
+
+	if (failures) {
+		printf ("%d checks failed\n", failures);
+		return 1;
+	}
+	printf ("All checks passed\n");
+	return 0;
+}
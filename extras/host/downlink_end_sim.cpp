@@ -0,0 +1,198 @@
+/**
+  * @file downlink_end_sim.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Measures how long a sleepy node stays awake after each send, with and without `DOWNLINK_END`
+  *
+  * Node sleep decision follows `EnigmaIOTNodeClass::handle ()`: node sleeps once `DOWNLINK_WAIT_TIME` has passed since
+  * its last send or, if gateway signalled end of downlink for that send, once `DOWNLINK_END_GUARD` has passed since
+  * the signal. Gateway follows `manageMessage ()`: a message queued for the node is sent right after its data is
+  * processed, then `DOWNLINK_END` is sent unless a new message was queued while processing. Every frame takes a fixed
+  * air time, gateway takes a fixed time to process a message, and frames are lost independently, as in ota_*_sim.
+  *
+  * Usage: downlink_end_sim [wakes] [gateway processing ms]
+  */
+
+#include <Arduino.h>
+#include <EnigmaIoTconfig.h>
+#include <map>
+
+static const uint32_t AIR_TIME = 2; ///< @brief Time for a frame and its ESP-NOW acknowledgement (ms)
+static const uint32_t NODE_REPLY_TIME = 1; ///< @brief Time for node application to answer a downlink message (ms)
+static const int KEY_UPDATE_INTERVAL = 4; ///< @brief Gateway queues a message while processing every this number of wakes
+
+/**
+  * @brief Traffic seen by node
+  */
+enum scenario_t {
+	NO_DOWNLINK, ///< @brief Gateway has nothing for node
+	QUEUED, ///< @brief Controller queues a message for node while it sleeps, before every wake
+	QUEUED_ANSWERED, ///< @brief As `QUEUED`, and node sends an answer for every message it gets
+	QUEUED_WHILE_PROCESSING ///< @brief Gateway queues a message while processing node data, as a key update does
+};
+
+static const char* scenarioNames[] = {
+	"no downlink",
+	"queued while asleep",
+	"queued, node answers",
+	"queued while processing"
+};
+
+enum frame_t {
+	DATA, ///< @brief Node data message
+	DOWNLINK, ///< @brief Queued downlink message
+	END ///< @brief `DOWNLINK_END` with counter of the data message it answers
+};
+
+struct frame_msg_t {
+	frame_t type;
+	uint32_t counter;
+};
+
+/**
+  * @brief Results summed over every wake
+  */
+struct result_t {
+	uint64_t afterSend[2] = {}; ///< @brief Time awake after first and second send, until next send or sleep
+	uint32_t sends[2] = {}; ///< @brief Number of wakes with a first and a second send
+	uint64_t toSleep = 0; ///< @brief Time from first send to sleep
+	uint32_t queued = 0; ///< @brief Messages queued on gateway
+	uint32_t delivered = 0; ///< @brief Queued messages that node got
+	uint32_t endAccepted = 0; ///< @brief Wakes that ended after a `DOWNLINK_END`
+};
+
+static double lossRate;
+
+bool lost () {
+	return rand () < lossRate * ((double)RAND_MAX + 1);
+}
+
+/**
+  * @brief Runs a series of wakes of one node
+  * @param scenario Traffic seen by node
+  * @param downlinkEnd `true` if node and gateway use `DOWNLINK_END`
+  * @param wakes Number of wakes
+  * @param gatewayTime Time that gateway takes to process a message (ms)
+  * @param result Results are added here
+  */
+void runNode (scenario_t scenario, bool downlinkEnd, int wakes, uint32_t gatewayTime, result_t* result) {
+	bool qMessagePending = false; // Gateway queue survives node sleep
+	uint32_t counter = 0;
+
+	for (int wake = 0; wake < wakes; wake++) {
+		std::multimap<uint32_t, frame_msg_t> toNode;
+		std::multimap<uint32_t, frame_msg_t> toGateway;
+		uint32_t lastMessageTime = 0;
+		uint32_t downlinkEndTime = 0;
+		uint32_t sendTime[2] = {};
+		int sends = 0;
+		int64_t replyAt = -1;
+
+		if (scenario == QUEUED || scenario == QUEUED_ANSWERED) {
+			result->queued++;
+			qMessagePending = true;
+		}
+
+		auto send = [&] (uint32_t now) {
+			counter++;
+			lastMessageTime = now;
+			downlinkEndTime = 0; // Any gateway answer refers to an older message from now on
+			if (sends < 2) {
+				sendTime[sends] = now;
+			}
+			sends++;
+			if (!lost ()) {
+				toGateway.insert ({ now + AIR_TIME, { DATA, counter } });
+			}
+		};
+
+		// Node sends its reading and asks to sleep, as sketches do
+		send (1);
+		for (uint32_t now = 1; ; now++) {
+			// Gateway processes data and answers at once
+			while (!toGateway.empty () && toGateway.begin ()->first <= now) {
+				uint32_t msgCounter = toGateway.begin ()->second.counter;
+				toGateway.erase (toGateway.begin ());
+				uint32_t answerTime = now + gatewayTime;
+				if (qMessagePending) {
+					qMessagePending = false;
+					if (!lost ()) {
+						toNode.insert ({ answerTime + AIR_TIME, { DOWNLINK, 0 } });
+					}
+					answerTime += AIR_TIME;
+				}
+				if (scenario == QUEUED_WHILE_PROCESSING && wake % KEY_UPDATE_INTERVAL == 0 && sends == 1) {
+					qMessagePending = true;
+					result->queued++;
+				}
+				if (downlinkEnd && !qMessagePending && !lost ()) {
+					toNode.insert ({ answerTime + AIR_TIME, { END, msgCounter } });
+				}
+			}
+
+			// Node receives downlink
+			while (!toNode.empty () && toNode.begin ()->first <= now) {
+				frame_msg_t msg = toNode.begin ()->second;
+				toNode.erase (toNode.begin ());
+				if (msg.type == DOWNLINK) {
+					result->delivered++;
+					if (scenario == QUEUED_ANSWERED) {
+						replyAt = now + NODE_REPLY_TIME;
+					}
+				} else if (msg.type == END && msg.counter == counter) {
+					downlinkEndTime = now;
+				}
+			}
+			if (replyAt >= 0 && now >= (uint32_t)replyAt) {
+				replyAt = -1;
+				send (now);
+			}
+
+			// Sleep check in handle ()
+			bool downlinkWaitDone = now - lastMessageTime > DOWNLINK_WAIT_TIME;
+			if (downlinkEndTime && now - downlinkEndTime > DOWNLINK_END_GUARD) {
+				downlinkWaitDone = true;
+			}
+			if (downlinkWaitDone && replyAt < 0) {
+				result->endAccepted += downlinkEndTime != 0;
+				result->toSleep += now - sendTime[0];
+				for (int i = 0; i < 2 && i < sends; i++) {
+					result->afterSend[i] += (i + 1 < sends ? sendTime[i + 1] : now) - sendTime[i];
+					result->sends[i]++;
+				}
+				break;
+			}
+		}
+	}
+}
+
+int main (int argc, char** argv) {
+	int wakes = argc > 1 ? atoi (argv[1]) : 1000;
+	uint32_t gatewayTime = argc > 2 ? atoi (argv[2]) : 5;
+	const int losses[] = { 0, 5, 10 };
+
+	printf ("%d wakes, %u ms air time, %u ms gateway processing, DOWNLINK_WAIT_TIME %u ms, DOWNLINK_END_GUARD %u ms\n",
+			wakes, AIR_TIME, gatewayTime, DOWNLINK_WAIT_TIME, DOWNLINK_END_GUARD);
+	printf ("Awake times are averages in ms. Queued messages are delivered on a later wake if not on this one\n");
+	printf ("%-24s loss  %-12s  after send 1  after send 2  to sleep  ends  delivered\n", "scenario", "mode");
+	for (int scenario = NO_DOWNLINK; scenario <= QUEUED_WHILE_PROCESSING; scenario++) {
+		for (int loss : losses) {
+			lossRate = loss / 100.0;
+			for (bool downlinkEnd : { false, true }) {
+				result_t result;
+				srand (scenario * 1000 + loss);
+				runNode ((scenario_t)scenario, downlinkEnd, wakes, gatewayTime, &result);
+				char second[16] = "-";
+				if (result.sends[1]) {
+					snprintf (second, sizeof (second), "%.1f", (double)result.afterSend[1] / result.sends[1]);
+				}
+				printf ("%-24s %3d%%  %-12s  %12.1f  %12s  %8.1f  %3u%%  %4u/%u\n",
+						scenarioNames[scenario], loss, downlinkEnd ? "DOWNLINK_END" : "wait",
+						(double)result.afterSend[0] / result.sends[0], second, (double)result.toSleep / wakes,
+						result.endAccepted * 100 / wakes, result.delivered, result.queued);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+/**
+  * @file drbg_test.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Checks `ChaChaDrbgClass` in deterministic mode and measures its throughput
+  *
+  * Entropy source is a counter, so the number of hardware RNG reads that DRBG saves can be reported too.
+  */
+
+#include <Arduino.h>
+#include <ChaChaDrbg.h>
+#include <helperFunctions.h>
+#include <chrono>
+
+static uint32_t entropyReads = 0;
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf ("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+uint32_t fakeEntropy () {
+	entropyReads++;
+	return entropyReads * 0x9E3779B9;
+}
+
+/**
+  * @brief Measures DRBG output rate for a given request size
+  * @param size Bytes per request
+  * @param total Bytes to generate
+  */
+void benchmark (size_t size, size_t total) {
+	ChaChaDrbgClass drbg (fakeEntropy);
+	uint8_t buffer[256];
+	uint32_t reads = entropyReads;
+
+	auto start = std::chrono::steady_clock::now ();
+	for (size_t done = 0; done < total; done += size) {
+		drbg.read (buffer, size);
+	}
+	double elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+	printf ("%3u byte requests: %7.1f MB/s, %5.1f ns per request, %u reseeds, %u entropy reads (%u without DRBG)\n",
+			(unsigned)size, total / elapsed / 1e6, elapsed * 1e9 / (total / size), drbg.getReseedCount (),
+			entropyReads - reads, (unsigned)((total / size) * ((size + 3) / 4)));
+}
+
+int main () {
+	uint8_t key[KEY_LENGTH];
+	uint8_t a[1000];
+	uint8_t b[1000];
+
+	for (int i = 0; i < KEY_LENGTH; i++) {
+		key[i] = i;
+	}
+
+	// Same seed gives same sequence and entropy is never read
+	ChaChaDrbgClass first (fakeEntropy);
+	ChaChaDrbgClass second (fakeEntropy);
+	first.seed (key, true);
+	second.seed (key, true);
+	first.read (a, sizeof (a));
+	for (size_t i = 0; i < sizeof (b); i += 7) {
+		second.read (b + i, i + 7 <= sizeof (b) ? 7 : sizeof (b) - i); // Request size does not change sequence
+	}
+	CHECK (!memcmp (a, b, sizeof (a)));
+	CHECK (first.getReseedCount () == 0 && entropyReads == 0);
+	printf ("deterministic output: %s\n", printHexBuffer (a, 16));
+
+	// Different seed gives different sequence
+	key[0] ^= 1;
+	second.seed (key, true);
+	second.read (b, sizeof (b));
+	CHECK (memcmp (a, b, sizeof (a)));
+
+	// Output is never repeated across blocks
+	first.read (b, sizeof (b));
+	CHECK (memcmp (a, b, sizeof (a)));
+
+	// Deterministic mode is never reseeded
+	for (int i = 0; i < DRBG_RESEED_INTERVAL * 2 / (int)sizeof (a); i++) {
+		first.read (a, sizeof (a));
+	}
+	CHECK (first.getReseedCount () == 0 && entropyReads == 0);
+
+	// Normal mode is seeded on first use and reseeded every DRBG_RESEED_INTERVAL bytes
+	ChaChaDrbgClass normal (fakeEntropy);
+	normal.read (a, 4);
+	CHECK (normal.getReseedCount () == 1 && entropyReads == KEY_LENGTH / 4);
+	for (uint32_t served = 4; served < DRBG_RESEED_INTERVAL + ChaChaDrbgClass::DRBG_BLOCK_SIZE; served += 4) {
+		normal.read (a, 4);
+	}
+	CHECK (normal.getReseedCount () == 2);
+	CHECK (normal.getBytesServed () == DRBG_RESEED_INTERVAL + ChaChaDrbgClass::DRBG_BLOCK_SIZE);
+
+	// Seeding normal mode adds to entropy instead of replacing it
+	ChaChaDrbgClass mixed (fakeEntropy);
+	uint32_t reads = entropyReads;
+	mixed.seed (key, false);
+	CHECK (entropyReads > reads);
+	mixed.read (a, 16);
+	second.seed (key, true);
+	second.read (b, 16);
+	CHECK (memcmp (a, b, 16));
+
+	printf ("drbg: %s\n", failures ? "FAILED" : "OK");
+
+	benchmark (4, 64 << 20); // CryptModule::random ()
+	benchmark (12, 64 << 20); // IV
+	benchmark (32, 64 << 20); // Key
+	benchmark (256, 64 << 20);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Runs one gateway and NODES node processes over UDP communication layer and sums their results. Nodes register
+# first, so only registered ones send data. It fails if any node rejects a gateway message
+# Usage: launch_udp_peers.sh [nodes] [seconds] [loss %] [latency ms] [jitter ms] [period ms]
+
+NODES=${1:-100}
+SECONDS_RUN=${2:-10}
+LOSS=${3:-0}
+LATENCY=${4:-5}
+JITTER=${5:-5}
+PERIOD=${6:-1000}
+DIR=$(dirname "$0")
+PEER="$DIR/build/udp_peer"
+OUT=$(mktemp -d)
+
+if [ ! -x "$PEER" ]; then
+	echo "Build first with: make -C $DIR" >&2
+	exit 1
+fi
+
+"$PEER" gateway 0 $((SECONDS_RUN + 1)) "$LOSS" "$LATENCY" "$JITTER" > "$OUT/gateway" 2>/dev/null &
+sleep 0.5
+i=1
+while [ $i -le "$NODES" ]; do
+	"$PEER" node $i "$SECONDS_RUN" "$LOSS" "$LATENCY" "$JITTER" "$PERIOD" > "$OUT/node$i" 2>/dev/null &
+	i=$((i + 1))
+done
+wait
+
+cat "$OUT/gateway"
+cat "$OUT"/node* | awk '{ sent += $4; delivered += $6; failed += $8; dropped += $10; echoes += $12; rtt += $14 * $12
+		hellos += $16; registered += $18; if ($18) suites[$20]++; auth += $24; replay += $26 }
+	END { printf "%d nodes sent %d delivered %d failed %d dropped %d echoes %d (%.1f%%) avg_rtt_ms %.1f\n",
+		NR, sent, delivered, failed, dropped, echoes, sent ? 100 * echoes / sent : 0, echoes ? rtt / echoes : 0
+		printf "%d registered after %d hellos, auth_errors %d counter_errors %d, suites:", registered, hellos, auth, replay
+		for (suite in suites) printf " %s %d", suite, suites[suite]
+		printf "\n"
+		exit auth + replay > 0 }'
+RESULT=$?
+rm -rf "$OUT"
+exit $RESULT
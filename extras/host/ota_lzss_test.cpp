@@ -0,0 +1,105 @@
+/**
+  * @file ota_lzss_test.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Decodes images compressed by update tool with `OtaDecompressorClass` and compares them with the originals
+  *
+  * Vectors are written by `ota_lzss_vectors.py`, that calls `compress ()` from `EnigmaIoTUpdate.py`. Every vector is
+  * decoded with input pieces of every length from 1 to 1000 bytes, as OTA chunks may split the stream anywhere, and
+  * output must match original image bit by bit. A change of `OTA_LZSS_*_BITS` on either side makes it fail.
+  *
+  * Usage: ota_lzss_test <image> <compressed image> [<image> <compressed image> ...]
+  */
+
+#include <Arduino.h>
+#include <OtaDecompressor.h>
+#include <vector>
+
+static const size_t MAX_PIECE = 1000; ///< @brief Longest input piece (bytes)
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf ("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+bool readFile (const char* path, std::vector<uint8_t>* data) {
+	FILE* f = fopen (path, "rb");
+	if (!f) {
+		printf ("Cannot open %s\n", path);
+		return false;
+	}
+	uint8_t buffer[4096];
+	size_t len;
+	while ((len = fread (buffer, 1, sizeof (buffer), f)) > 0) {
+		data->insert (data->end (), buffer, buffer + len);
+	}
+	fclose (f);
+	return true;
+}
+
+/**
+  * @brief Decodes a compressed image fed in pieces of the same length
+  * @param compressed Compressed image
+  * @param piece Input piece length
+  * @param outLen Output buffer length given to every `read` call
+  * @param output Gets decoded image
+  */
+void decode (const std::vector<uint8_t>& compressed, size_t piece, size_t outLen, std::vector<uint8_t>* output) {
+	OtaDecompressorClass decompressor;
+	uint8_t buffer[MAX_PIECE];
+
+	output->clear ();
+	if (!decompressor.begin ()) {
+		return;
+	}
+	for (size_t pos = 0; pos < compressed.size (); pos += piece) {
+		size_t len = compressed.size () - pos < piece ? compressed.size () - pos : piece;
+		decompressor.setInput (compressed.data () + pos, len);
+		size_t got;
+		while ((got = decompressor.read (buffer, outLen)) > 0) {
+			output->insert (output->end (), buffer, buffer + got);
+		}
+	}
+	decompressor.end ();
+}
+
+int main (int argc, char** argv) {
+	if (argc < 3 || argc % 2 == 0) {
+		printf ("Usage: %s <image> <compressed image> [<image> <compressed image> ...]\n", argv[0]);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i += 2) {
+		std::vector<uint8_t> image;
+		std::vector<uint8_t> compressed;
+		std::vector<uint8_t> output;
+		if (!readFile (argv[i], &image) || !readFile (argv[i + 1], &compressed)) {
+			return 1;
+		}
+		int mismatches = 0;
+		for (size_t piece = 1; piece <= MAX_PIECE; piece++) {
+			// Output buffer length changes too, so that output stops at every decoder state
+			decode (compressed, piece, (piece * 7) % MAX_PIECE + 1, &output);
+			if (output != image) {
+				if (mismatches++ < 5) {
+					size_t diff = 0;
+					while (diff < output.size () && diff < image.size () && output[diff] == image[diff]) {
+						diff++;
+					}
+					printf ("%s: %u byte pieces give %u bytes, expected %u. First difference at %u\n", argv[i],
+							(unsigned)piece, (unsigned)output.size (), (unsigned)image.size (), (unsigned)diff);
+				}
+			}
+		}
+		CHECK (mismatches == 0);
+		printf ("%-32s %6u bytes from %6u, %4d of %u piece lengths wrong\n", argv[i], (unsigned)image.size (),
+				(unsigned)compressed.size (), mismatches, (unsigned)MAX_PIECE);
+	}
+
+	if (failures) {
+		printf ("%d checks failed\n", failures);
+		return 1;
+	}
+	printf ("All checks passed\n");
+	return 0;
+}
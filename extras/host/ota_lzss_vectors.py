@@ -0,0 +1,60 @@
+# Writes OTA LZSS test vectors with the update tool compressor, so that ota_lzss_test can decode them with
+# OtaDecompressor. Every vector is written as <name>.bin and its compressed form as <name>.lzss
+# Usage: ota_lzss_vectors.py <output folder> [file ...]
+
+import os
+import random
+import sys
+import types
+
+# Update tool imports paho at load time. Only compress() is needed here, so a stub is enough
+paho = types.ModuleType("paho")
+paho.mqtt = types.ModuleType("paho.mqtt")
+paho.mqtt.client = types.ModuleType("paho.mqtt.client")
+sys.modules["paho"] = paho
+sys.modules["paho.mqtt"] = paho.mqtt
+sys.modules["paho.mqtt.client"] = paho.mqtt.client
+
+sys.dont_write_bytecode = True  # Do not leave a cache folder next to the update tool
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "EnigmaIoTUpdate"))
+import EnigmaIoTUpdate
+
+
+def vectors():
+    rng = random.Random(48)
+    yield "empty", b""
+    yield "one_byte", b"\x5a"
+    yield "zeros", bytes(5000)
+    yield "random", bytes(rng.getrandbits(8) for _ in range(5000))
+    text = b"EnigmaIOT node OTA update. " * 40
+    yield "text", text
+    # Repeats at every distance up to window size and beyond, with every match length
+    mixed = bytearray()
+    while len(mixed) < 20000:
+        if mixed and rng.random() < 0.6:
+            distance = rng.randint(1, min(len(mixed), (1 << EnigmaIoTUpdate.LZSS_WINDOW_BITS) + 100))
+            length = rng.randint(1, (1 << EnigmaIoTUpdate.LZSS_LOOKAHEAD_BITS) + 4)
+            for _ in range(length):
+                mixed.append(mixed[-distance])
+        else:
+            mixed.append(rng.getrandbits(8))
+    yield "mixed", bytes(mixed)
+    for path in sys.argv[2:]:
+        with open(path, "rb") as f:
+            yield os.path.splitext(os.path.basename(path))[0], f.read(65536)
+
+
+def main():
+    folder = sys.argv[1]
+    os.makedirs(folder, exist_ok=True)
+    for name, data in vectors():
+        compressed = EnigmaIoTUpdate.compress(data)
+        with open(os.path.join(folder, name + ".bin"), "wb") as f:
+            f.write(data)
+        with open(os.path.join(folder, name + ".lzss"), "wb") as f:
+            f.write(compressed)
+        print("%-16s %6d bytes, compressed to %6d" % (name, len(data), len(compressed)))
+
+
+if __name__ == '__main__':
+    main()
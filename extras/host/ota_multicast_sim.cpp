@@ -0,0 +1,242 @@
+/**
+  * @file ota_multicast_sim.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Runs a multicast OTA update from gateway cache to several nodes over a lossy simulated link
+  *
+  * Gateway side is `OtaMulticastClass` driven with the same steps and timers as gateway multicast loop. Node side is
+  * `OtaWindowClass` with node multicast reporting rules. Every node loses every frame independently, and every answer
+  * is lost with the same probability. Time is simulated in 1 ms steps.
+  *
+  * Usage: ota_multicast_sim [nodes] [chunks] [runs]
+  */
+
+#include <Arduino.h>
+#include <OtaWindow.h>
+#include <OtaMulticast.h>
+#include <map>
+#include <vector>
+
+static const uint32_t FRAME_LATENCY = 2; ///< @brief Time from sender to receiver for any frame (ms)
+static const uint32_t SIM_LIMIT = 600000; ///< @brief Simulation is stopped after this time (ms)
+
+enum sim_msg_t {
+	MSG_HEADER,
+	MSG_CHUNK,
+	ANS_STARTED,
+	ANS_SACK,
+	ANS_CHECK_OK,
+	ANS_FINISHED
+};
+
+struct sim_frame_t {
+	sim_msg_t type;
+	uint16_t nodeId;
+	uint16_t idx;
+	uint32_t received;
+};
+
+struct sim_node_t {
+	OtaWindowClass otaWindow;
+	bool running;
+	bool done;
+	bool sackPending;
+	uint32_t lastOtaMsg;
+	uint32_t reportDelay;
+};
+
+static double lossRate;
+
+bool lost () {
+	return rand () < lossRate * ((double)RAND_MAX + 1);
+}
+
+uint32_t randomReportDelay () {
+	return OTA_MULTICAST_REPORT_DELAY + rand () % OTA_MULTICAST_REPORT_JITTER;
+}
+
+/**
+  * @brief Runs a multicast session
+  * @param numNodes Number of nodes. Node ids go from 0 to `numNodes - 1`
+  * @param numChunks Number of chunks in image
+  * @param session Gets final session state
+  * @param complete Gets number of nodes that got whole image, even if gateway did not get their result
+  * @return Time from start to end of session, in milliseconds
+  */
+uint32_t runSession (uint16_t numNodes, uint16_t numChunks, OtaMulticastClass* session, uint16_t* complete) {
+	std::multimap<uint32_t, sim_frame_t> air;
+	std::vector<sim_node_t> nodes (numNodes);
+	uint8_t chunk[OTA_CHUNK_MAX_LENGTH] = {};
+	uint32_t now = 0;
+	uint32_t start = now;
+	uint32_t lastTx = now;
+	bool sending = false;
+
+	session->begin (numChunks, now);
+	for (uint16_t nodeId = 0; nodeId < numNodes; nodeId++) {
+		session->addMember (nodeId);
+	}
+
+	auto toNode = [&] (sim_msg_t type, uint16_t nodeId, uint16_t idx) {
+		if (!lost ()) {
+			air.insert ({ now + FRAME_LATENCY, { type, nodeId, idx, 0 } });
+		}
+		lastTx = now;
+	};
+
+	auto answer = [&] (sim_msg_t type, uint16_t nodeId, uint16_t base = 0, uint32_t received = 0) {
+		if (!lost ()) {
+			air.insert ({ now + FRAME_LATENCY, { type, nodeId, base, received } });
+		}
+	};
+
+	for (; now < SIM_LIMIT; now++) {
+		// Frames that arrive now
+		while (!air.empty () && air.begin ()->first <= now) {
+			sim_frame_t frame = air.begin ()->second;
+			air.erase (air.begin ());
+			sim_node_t* node = &nodes[frame.nodeId];
+			switch (frame.type) {
+			case MSG_HEADER:
+				if (!node->done && node->otaWindow.begin (numChunks)) {
+					node->running = true;
+					node->sackPending = false;
+					node->lastOtaMsg = now;
+					node->reportDelay = randomReportDelay ();
+					answer (ANS_STARTED, frame.nodeId);
+				}
+				break;
+			case MSG_CHUNK:
+				if (!node->running) {
+					break;
+				}
+				node->lastOtaMsg = now;
+				if (node->otaWindow.add (frame.idx, chunk, sizeof (chunk)) == OTA_CHUNK_OUT_OF_WINDOW) {
+					break;
+				}
+				node->sackPending = true;
+				{
+					const uint8_t* data;
+					size_t len;
+					while (node->otaWindow.pop (&data, &len));
+				}
+				if (node->otaWindow.isComplete ()) {
+					node->running = false;
+					node->done = true;
+					answer (ANS_CHECK_OK, frame.nodeId);
+					answer (ANS_FINISHED, frame.nodeId);
+				}
+				break;
+			case ANS_STARTED:
+				session->processStarted (frame.nodeId, now);
+				break;
+			case ANS_SACK:
+				session->processSack (frame.nodeId, frame.idx, frame.received, now);
+				break;
+			case ANS_CHECK_OK:
+				session->processCheck (frame.nodeId, now);
+				break;
+			case ANS_FINISHED:
+				session->processResult (frame.nodeId, true);
+				break;
+			}
+		}
+
+		// Node loop
+		for (uint16_t nodeId = 0; nodeId < numNodes; nodeId++) {
+			sim_node_t* node = &nodes[nodeId];
+			if (!node->running) {
+				continue;
+			}
+			if (now - node->lastOtaMsg > OTA_TIMEOUT_TIME) {
+				node->running = false;
+			} else if (node->sackPending && now - node->lastOtaMsg > node->reportDelay) {
+				node->sackPending = false;
+				node->reportDelay = randomReportDelay ();
+				answer (ANS_SACK, nodeId, node->otaWindow.getBase (), node->otaWindow.getReceived ());
+			}
+		}
+
+		// Gateway loop
+		if (!sending) {
+			if (session->isStarted () || now - start > OTA_MULTICAST_START_TIMEOUT) {
+				for (uint16_t nodeId = 0; nodeId < numNodes; nodeId++) {
+					session->dropIfStarting (nodeId);
+				}
+				sending = true;
+				session->planRound ();
+			} else if (now - lastTx >= OTA_STREAM_CHUNK_INTERVAL) {
+				int nodeId = session->getNextHeader (now);
+				if (nodeId >= 0) {
+					toNode (MSG_HEADER, nodeId, 0);
+				}
+			}
+			continue;
+		}
+		if (now - lastTx < OTA_STREAM_CHUNK_INTERVAL) {
+			continue;
+		}
+		uint16_t msgIdx = session->getNextChunk ();
+		if (msgIdx) {
+			// Broadcast. Every node may lose it
+			for (uint16_t nodeId = 0; nodeId < numNodes; nodeId++) {
+				if (!lost ()) {
+					air.insert ({ now + FRAME_LATENCY, { MSG_CHUNK, nodeId, msgIdx, 0 } });
+				}
+			}
+			lastTx = now;
+			continue;
+		}
+		if (!session->isRoundReported () && now - lastTx < OTA_MULTICAST_REPORT_TIMEOUT) {
+			continue;
+		}
+		for (uint16_t nodeId = 0; nodeId < numNodes; nodeId++) {
+			session->closeRound (nodeId, now);
+		}
+		if (session->isFinished ()) {
+			break;
+		}
+		session->planRound ();
+		lastTx = now;
+	}
+	*complete = 0;
+	for (uint16_t nodeId = 0; nodeId < numNodes; nodeId++) {
+		*complete += nodes[nodeId].done;
+	}
+	return now - start;
+}
+
+int main (int argc, char** argv) {
+	uint16_t numNodes = argc > 1 ? atoi (argv[1]) : 30;
+	uint16_t numChunks = argc > 2 ? atoi (argv[2]) : 600;
+	int runs = argc > 3 ? atoi (argv[3]) : 10;
+	const int losses[] = { 0, 1, 5, 10 };
+
+	if (numNodes > NUM_NODES) {
+		fprintf (stderr, "Up to %d nodes\n", NUM_NODES);
+		return 1;
+	}
+
+	printf ("%u nodes, %u chunks, average of %d runs\n", numNodes, numChunks, runs);
+	printf ("loss  time (s)  broadcast chunks  rounds  updated  failed  whole image\n");
+	for (int loss : losses) {
+		uint64_t time = 0, sent = 0, rounds = 0, updated = 0, failed = 0, complete = 0;
+		lossRate = loss / 100.0;
+		srand (loss + 1);
+		for (int run = 0; run < runs; run++) {
+			static OtaMulticastClass session;
+			uint16_t runComplete;
+			time += runSession (numNodes, numChunks, &session, &runComplete);
+			complete += runComplete;
+			sent += session.getSentCount ();
+			rounds += session.getRounds ();
+			updated += session.getCount (OTA_MEMBER_DONE);
+			failed += session.getCount (OTA_MEMBER_FAILED);
+		}
+		printf ("%3d%%  %8.1f  %16llu  %6llu  %7.1f  %6.1f  %11.1f\n", loss, time / 1000.0 / runs,
+				(unsigned long long)(sent / runs), (unsigned long long)(rounds / runs),
+				(double)updated / runs, (double)failed / runs, (double)complete / runs);
+	}
+	return 0;
+}
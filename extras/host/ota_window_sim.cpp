@@ -0,0 +1,350 @@
+/**
+  * @file ota_window_sim.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Compares stop-and-go and windowed OTA transfers over a lossy simulated link
+  *
+  * Sender follows EnigmaIoTUpdate.py chunk scheduling, with `-w 0` for stop-and-go and `OTA_WINDOW` otherwise. Node
+  * side of windowed transfer is `OtaWindowClass` with node reporting rules. Node side of stop-and-go is the previous
+  * node code, that only accepts next chunk in sequence and reports a gap once. Chunks and answers are lost
+  * independently with the same probability and every one of them takes a fixed time through gateway and MQTT broker.
+  *
+  * In gateway cache mode, sender is `OtaSenderClass` driven as gateway does when it sends an image from its cache:
+  * a chunk every `OTA_STREAM_CHUNK_INTERVAL` at most, and answers processed as soon as they arrive. Chunks and answers
+  * go straight between gateway and node.
+  *
+  * Usage: ota_window_sim [runs] [chunks]
+  */
+
+#include <Arduino.h>
+#include <OtaWindow.h>
+#include <OtaSender.h>
+#include <map>
+#include <vector>
+
+static const uint32_t PACKET_DELAY = 70; ///< @brief Time between chunks. Default update tool speed (ms)
+static const uint32_t DOWN_LATENCY = 2 * PACKET_DELAY; ///< @brief Time from update tool to node (ms)
+static const uint32_t UP_LATENCY = 3 * PACKET_DELAY; ///< @brief Time from node to update tool (ms)
+static const uint32_t SACK_TIMEOUT = 2000; ///< @brief Update tool time without answer before it sends first missing chunk (ms)
+static const int MAX_SACK_TIMEOUTS = 5; ///< @brief Update tool gives up after this number of timeouts
+static const uint32_t FINISH_WAIT = 20000; ///< @brief Update tool waits this time for result after last chunk (ms)
+static const uint32_t CACHE_LATENCY = 2; ///< @brief Time from gateway to node and back on gateway cache mode (ms)
+
+/**
+  * @brief Sender of OTA chunks
+  */
+enum sender_mode_t {
+	STOP_AND_GO, ///< @brief Update tool with `-w 0`
+	TOOL_WINDOW, ///< @brief Update tool with `OTA_WINDOW` window
+	GATEWAY_CACHE ///< @brief Gateway sends from its cache with `OtaSenderClass`
+};
+
+enum answer_t {
+	ANS_SACK,
+	ANS_OUT_OF_SEQUENCE,
+	ANS_FINISHED
+};
+
+struct answer_msg_t {
+	answer_t type;
+	uint16_t base;
+	uint32_t received;
+};
+
+static double lossRate;
+
+bool lost () {
+	return rand () < lossRate * ((double)RAND_MAX + 1);
+}
+
+/**
+  * @brief Runs a transfer
+  * @param numChunks Number of chunks in image
+  * @param mode Chunk sender
+  * @param frames Gets number of chunks sent
+  * @param elapsed Gets time until sender got result or gave up (ms)
+  * @param updated Gets `true` if node got whole image, even if sender did not get its result
+  * @return `true` if sender got OTA finished status
+  */
+bool runTransfer (uint16_t numChunks, sender_mode_t mode, uint32_t* frames, uint32_t* elapsed, bool* updated) {
+	std::multimap<uint32_t, uint16_t> toNode;
+	std::multimap<uint32_t, answer_msg_t> toTool;
+	uint8_t chunk[OTA_CHUNK_MAX_LENGTH] = {};
+	int window = mode == STOP_AND_GO ? 0 : OTA_WINDOW;
+	bool cache = mode == GATEWAY_CACHE;
+	uint32_t downLatency = cache ? CACHE_LATENCY : DOWN_LATENCY;
+	uint32_t upLatency = cache ? CACHE_LATENCY : UP_LATENCY;
+
+	// Node
+	OtaWindowClass otaWindow;
+	otaWindow.begin (numChunks);
+	uint16_t oldIdx = 0; // Stop-and-go node state
+	bool recoverRequested = false;
+	bool sackPending = false;
+	uint8_t chunksSinceSack = 0;
+	uint16_t gapReported = 0;
+	uint32_t lastOtaMsg = 0;
+	bool nodeRunning = true;
+
+	// Update tool
+	int toolWindow = window ? window : numChunks;
+	uint16_t base = 1;
+	uint16_t nextChunk = 1;
+	std::vector<uint16_t> resend;
+	std::vector<uint32_t> sentOrder (numChunks + 2, 0);
+	uint16_t lastSackBase = 1;
+	uint32_t lastAck = 0;
+	int timeouts = 0;
+	uint32_t sent = 0;
+	bool finished = false;
+	bool sending = true;
+	uint32_t sendingEnd = 0;
+	bool sackNew = false;
+	uint16_t sackBase = 0;
+	uint32_t sackReceived = 0;
+	int idx = -1;
+
+	// Gateway
+	OtaSenderClass otaSender;
+	otaSender.begin (numChunks, 0);
+	uint32_t lastTx = 0;
+	uint32_t now;
+
+	auto answer = [&] (uint32_t now, answer_t type, uint16_t base, uint32_t received) {
+		if (!lost ()) {
+			toTool.insert ({ now + upLatency, { type, base, received } });
+		}
+	};
+
+	auto sendSack = [&] (uint32_t now) {
+		chunksSinceSack = 0;
+		sackPending = false;
+		answer (now, ANS_SACK, otaWindow.getBase (), otaWindow.getReceived ());
+	};
+
+	for (now = 0; ; now++) {
+		// Node receives chunks
+		while (!toNode.empty () && toNode.begin ()->first <= now) {
+			uint16_t idx = toNode.begin ()->second;
+			toNode.erase (toNode.begin ());
+			if (!nodeRunning) {
+				continue;
+			}
+			lastOtaMsg = now;
+			if (!window) {
+				if (idx != oldIdx + 1) {
+					if (!recoverRequested) {
+						recoverRequested = true;
+						answer (now, ANS_OUT_OF_SEQUENCE, oldIdx, 0);
+					}
+					continue;
+				}
+				oldIdx = idx;
+				recoverRequested = false;
+				if (idx == numChunks) {
+					nodeRunning = false;
+					answer (now, ANS_FINISHED, 0, 0);
+				}
+				continue;
+			}
+			ota_chunk_result_t result = otaWindow.add (idx, chunk, sizeof (chunk));
+			if (result == OTA_CHUNK_OUT_OF_WINDOW) {
+				sackPending = true;
+				if (!recoverRequested) {
+					recoverRequested = true;
+					answer (now, ANS_OUT_OF_SEQUENCE, otaWindow.getBase () - 1, 0);
+				}
+				continue;
+			}
+			sackPending = true;
+			if (result == OTA_CHUNK_DUPLICATE) {
+				continue;
+			}
+			chunksSinceSack++;
+			const uint8_t* data;
+			size_t len;
+			while (otaWindow.pop (&data, &len)) {
+				recoverRequested = false;
+			}
+			if (otaWindow.isComplete ()) {
+				nodeRunning = false;
+				answer (now, ANS_FINISHED, 0, 0);
+				continue;
+			}
+			bool newGap = otaWindow.hasGap () && gapReported != otaWindow.getBase ();
+			if (newGap || chunksSinceSack >= OTA_SACK_INTERVAL) {
+				if (newGap) {
+					gapReported = otaWindow.getBase ();
+				}
+				sendSack (now);
+			}
+		}
+		if (nodeRunning) {
+			if (now - lastOtaMsg > OTA_TIMEOUT_TIME) {
+				nodeRunning = false;
+			} else if (window && sackPending && now - lastOtaMsg > OTA_SACK_IDLE_TIME) {
+				sendSack (now);
+			}
+		}
+
+		// Update tool receives answers. They are kept until sending loop runs, as MQTT callback does
+		while (!toTool.empty () && toTool.begin ()->first <= now) {
+			answer_msg_t msg = toTool.begin ()->second;
+			toTool.erase (toTool.begin ());
+			if (msg.type == ANS_FINISHED) {
+				finished = true;
+			} else if (cache) {
+				if (msg.type == ANS_OUT_OF_SEQUENCE) {
+					otaSender.rewind (msg.base, now);
+				} else {
+					otaSender.processSack (msg.base, msg.received, now);
+				}
+			} else if (msg.type == ANS_OUT_OF_SEQUENCE) {
+				idx = msg.base;
+			} else {
+				sackNew = true;
+				sackBase = msg.base;
+				sackReceived = msg.received;
+			}
+		}
+		if (finished) {
+			break;
+		}
+
+		// Gateway loop, as in handleOtaStream ()
+		if (cache) {
+			if (now - lastTx < OTA_STREAM_CHUNK_INTERVAL) {
+				continue;
+			}
+			uint16_t i = otaSender.getNextChunk (now);
+			if (otaSender.isFailed ()) {
+				break;
+			}
+			if (i) {
+				lastTx = now;
+				if (!lost ()) {
+					toNode.insert ({ now + downLatency, i });
+				}
+			}
+			continue;
+		}
+		if (!sending) {
+			if (now - sendingEnd > FINISH_WAIT) {
+				break;
+			}
+			continue;
+		}
+		if (now % PACKET_DELAY) {
+			continue;
+		}
+
+		// Update tool sending loop, one iteration every packet delay
+		if (sackNew) {
+			sackNew = false;
+			lastAck = now;
+			timeouts = 0;
+			if (sackBase > base) {
+				base = sackBase;
+			}
+			resend.clear ();
+			if (sackReceived) {
+				int highest = 31 - __builtin_clz (sackReceived);
+				for (int i = 0; i < highest; i++) {
+					if (!((sackReceived >> i) & 1) && sentOrder[base + i] < sentOrder[base + highest]) {
+						resend.push_back (base + i);
+					}
+				}
+			} else if (sackBase == lastSackBase) {
+				for (uint16_t i = base; i < nextChunk; i++) {
+					resend.push_back (i);
+				}
+			}
+			lastSackBase = sackBase;
+		}
+		if (idx >= 0) {
+			base = idx + 1;
+			nextChunk = base;
+			resend.clear ();
+			idx = -1;
+			lastAck = now;
+		}
+
+		uint16_t i;
+		if (!resend.empty ()) {
+			i = resend.front ();
+			resend.erase (resend.begin ());
+		} else if (nextChunk < base + toolWindow && nextChunk <= numChunks) {
+			i = nextChunk++;
+		} else if (now - lastAck > SACK_TIMEOUT) {
+			if (++timeouts > MAX_SACK_TIMEOUTS) {
+				break;
+			}
+			i = base;
+			lastAck = now;
+		} else {
+			continue;
+		}
+
+		if (!lost ()) {
+			toNode.insert ({ now + downLatency, i });
+		}
+		sentOrder[i] = ++sent;
+		if (!window && i == nextChunk - 1) {
+			base = nextChunk; // Stop-and-go nodes only report errors
+		}
+		if (base > numChunks) {
+			sending = false;
+			sendingEnd = now;
+		}
+	}
+	*frames = cache ? otaSender.getSentCount () : sent;
+	*elapsed = now;
+	*updated = window ? otaWindow.isComplete () : oldIdx == numChunks;
+	return finished;
+}
+
+int main (int argc, char** argv) {
+	int runs = argc > 1 ? atoi (argv[1]) : 20;
+	uint16_t numChunks = argc > 2 ? atoi (argv[2]) : 2000;
+	const int losses[] = { 0, 1, 5, 10 };
+
+	printf ("%u chunks, %d runs, %u ms between chunks, %u ms round trip\n", numChunks, runs, PACKET_DELAY, DOWN_LATENCY + UP_LATENCY);
+	printf ("Gateway cache sends a chunk every %u ms at most, %u ms round trip\n", OTA_STREAM_CHUNK_INTERVAL, 2 * CACHE_LATENCY);
+	printf ("Nodes that got whole image, even if their result was lost, are shown in parentheses\n");
+	char toolWindow[16];
+	snprintf (toolWindow, sizeof (toolWindow), "window %u", OTA_WINDOW);
+	printf ("loss  %-38s  %-38s  %s\n", "stop-and-go", toolWindow, "gateway cache");
+	for (int loss : losses) {
+		lossRate = loss / 100.0;
+		printf ("%3d%%", loss);
+		for (int mode = STOP_AND_GO; mode <= GATEWAY_CACHE; mode++) {
+			int ok = 0;
+			int updated = 0;
+			uint64_t frames = 0;
+			uint64_t elapsed = 0;
+			srand (loss * 1000 + mode);
+			for (int run = 0; run < runs; run++) {
+				uint32_t runFrames;
+				uint32_t runElapsed;
+				bool runUpdated;
+				if (runTransfer (numChunks, (sender_mode_t)mode, &runFrames, &runElapsed, &runUpdated)) {
+					ok++;
+					frames += runFrames;
+					elapsed += runElapsed;
+				}
+				updated += runUpdated;
+			}
+			char result[80];
+			if (ok) {
+				snprintf (result, sizeof (result), "%2d/%d ok (%d), %llu frames, %llu s", ok, runs, updated,
+						  (unsigned long long)(frames / ok), (unsigned long long)(elapsed / ok / 1000));
+			} else {
+				snprintf (result, sizeof (result), "%2d/%d ok (%d)", ok, runs, updated);
+			}
+			printf ("  %-38s", result);
+		}
+		printf ("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+/**
+  * @file pcap_replay.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Replays an ESP-NOW capture through `Pcap_halClass` and measures replay and delivery throughput
+  *
+  * Every delivered message is classified by its EnigmaIOT message type, and its CRC32 is calculated as gateway does on
+  * every decrypted message. Optionally every message is sent back to its source, so capture path is measured too and
+  * can be checked in Wireshark. Gateway message processing is not run here, so reported rate is not gateway
+  * throughput. `EnigmaIOTGatewayClass` cannot be built on host, and node keys in a capture cannot be recovered anyway.
+  *
+  * Usage: pcap_replay <capture> [speed] [seconds] [output capture]
+  * Speed 0 replays as fast as possible, looping file until time is over.
+  */
+
+#include <Arduino.h>
+#include <pcap_hal.h>
+#include <atomic>
+
+static std::atomic<uint32_t> messages (0);
+static std::atomic<uint32_t> bytes (0);
+static std::atomic<uint32_t> typeCount[256];
+static std::atomic<uint32_t> crcSum (0);
+static bool echo = false;
+
+void rxData (uint8_t* address, uint8_t* data, uint8_t len, signed int rssi) {
+	(void)rssi;
+	typeCount[data[0]]++;
+	crcSum += calculateCRC32 (data, len);
+	messages++;
+	bytes += len;
+	if (echo) {
+		Pcap_hal.send (address, data, len);
+	}
+}
+
+int main (int argc, char** argv) {
+	if (argc < 2) {
+		fprintf (stderr, "Usage: %s <capture> [speed] [seconds] [output capture]\n", argv[0]);
+		return 1;
+	}
+	float speed = argc > 2 ? atof (argv[2]) : 0;
+	uint32_t duration = (argc > 3 ? atoi (argv[3]) : 5) * 1000;
+
+	if (!Pcap_hal.openReplay (argv[1], speed, speed == 0)) {
+		fprintf (stderr, "Cannot open %s\n", argv[1]);
+		return 1;
+	}
+	if (argc > 4) {
+		if (!Pcap_hal.openCapture (argv[4])) {
+			fprintf (stderr, "Cannot create %s\n", argv[4]);
+			return 1;
+		}
+		echo = true;
+	}
+	Pcap_hal.onDataRcvd (rxData);
+
+	uint32_t start = micros ();
+	Pcap_hal.begin (NULL, 0, COMM_GATEWAY);
+	while (!Pcap_hal.replayFinished () && micros () - start < duration * 1000) {
+		Pcap_hal.handle ();
+		delay (1);
+	}
+	uint32_t elapsed = micros () - start;
+	Pcap_hal.stop ();
+
+	const pcap_stats_t* stats = Pcap_hal.getReplayStats ();
+	printf ("frames %u delivered %u skipped %u late %u captured %u\n",
+			stats->frames, stats->delivered, stats->skipped, stats->late, stats->captured);
+	printf ("%u messages %u bytes in %.3f s: %.0f msg/s\n", messages.load (), bytes.load (), elapsed / 1e6,
+			messages * 1e6 / elapsed);
+	for (int i = 0; i < 256; i++) {
+		if (typeCount[i]) {
+			printf ("type 0x%02X: %u\n", i, typeCount[i].load ());
+		}
+	}
+	return 0;
+}
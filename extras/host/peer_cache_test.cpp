@@ -0,0 +1,158 @@
+/**
+  * @file peer_cache_test.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Checks `PeerCacheClass` against a fake driver with a limited peer table
+  *
+  * Fake driver behaves as ESP-NOW peer list: it rejects registrations with a full error when its table is full and
+  * keeps every peer on the channel it was registered on.
+  */
+
+#include <Arduino.h>
+#include <PeerCache.h>
+#include <helperFunctions.h>
+
+static const uint8_t FAKE_MAX_PEERS = 20; ///< @brief Driver table size
+
+static struct {
+	uint8_t address[6];
+	uint8_t channel;
+	bool used;
+} fakePeers[FAKE_MAX_PEERS];
+static uint8_t fakeCapacity = FAKE_MAX_PEERS;
+static uint32_t fakeAdds = 0;
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf ("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+int fakeFind (const uint8_t* address) {
+	for (int i = 0; i < FAKE_MAX_PEERS; i++) {
+		if (fakePeers[i].used && !memcmp (fakePeers[i].address, address, 6)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int fakeCount () {
+	int count = 0;
+	for (int i = 0; i < FAKE_MAX_PEERS; i++) {
+		count += fakePeers[i].used;
+	}
+	return count;
+}
+
+peer_add_result_t fakeAdd (const uint8_t* address, uint8_t channel) {
+	fakeAdds++;
+	if (fakeFind (address) >= 0) {
+		return PEER_ADD_OK;
+	}
+	if (fakeCount () >= fakeCapacity) {
+		return PEER_ADD_FULL;
+	}
+	for (int i = 0; i < FAKE_MAX_PEERS; i++) {
+		if (!fakePeers[i].used) {
+			memcpy (fakePeers[i].address, address, 6);
+			fakePeers[i].channel = channel;
+			fakePeers[i].used = true;
+			break;
+		}
+	}
+	return PEER_ADD_OK;
+}
+
+void fakeDel (const uint8_t* address) {
+	int i = fakeFind (address);
+	if (i >= 0) {
+		fakePeers[i].used = false;
+	}
+}
+
+void fakeReset (uint8_t capacity) {
+	memset (fakePeers, 0, sizeof (fakePeers));
+	fakeCapacity = capacity;
+	fakeAdds = 0;
+}
+
+void peer (uint8_t n, uint8_t* address) {
+	uint8_t mac[6] = { 0x02, 0, 0, 0, 0, n };
+	memcpy (address, mac, 6);
+}
+
+int main () {
+	PeerCacheClass cache;
+	uint8_t address[6];
+
+	// Broadcast is pinned and survives LRU eviction
+	fakeReset (FAKE_MAX_PEERS);
+	cache.begin (4, fakeAdd, fakeDel);
+	CHECK (cache.pin (BROADCAST_ADDRESS));
+	CHECK (!cache.isChannelKnown ());
+	cache.setChannel (3);
+	CHECK (cache.isChannelKnown ());
+	CHECK (cache.get (BROADCAST_ADDRESS));
+	for (uint8_t n = 1; n <= 10; n++) {
+		peer (n, address);
+		CHECK (cache.get (address));
+		CHECK (cache.get (BROADCAST_ADDRESS));
+		CHECK (fakeFind (BROADCAST_ADDRESS) >= 0);
+		CHECK (fakeCount () <= 4);
+	}
+	CHECK (cache.getStats ()->evictions == 7);
+	peer (10, address);
+	uint32_t adds = fakeAdds;
+	CHECK (cache.get (address));
+	CHECK (fakeAdds == adds); // Cached peer is not registered again
+
+	// Channel change registers every peer again on new channel. Broadcast stays pinned
+	cache.invalidateChannel ();
+	CHECK (!cache.isChannelKnown ());
+	cache.setChannel (3);
+	CHECK (fakeCount () == 4); // Same channel. Nothing flushed
+	cache.setChannel (6);
+	CHECK (fakeCount () == 0);
+	CHECK (cache.get (BROADCAST_ADDRESS));
+	CHECK (fakePeers[fakeFind (BROADCAST_ADDRESS)].channel == 6);
+	CHECK (cache.getStats ()->flushes == 2);
+
+	// Driver table full because of peers registered outside cache
+	fakeReset (4);
+	cache.begin (4, fakeAdd, fakeDel);
+	cache.pin (BROADCAST_ADDRESS);
+	cache.setChannel (1);
+	uint8_t foreign[6] = { 0x02, 0xFF, 0, 0, 0, 1 };
+	fakeAdd (foreign, 1);
+	foreign[5] = 2;
+	fakeAdd (foreign, 1);
+	CHECK (cache.get (BROADCAST_ADDRESS));
+	peer (1, address);
+	CHECK (cache.get (address));
+	peer (2, address);
+	CHECK (cache.get (address));
+	CHECK (cache.getStats ()->fullRetries == 1);
+	CHECK (cache.get (BROADCAST_ADDRESS));
+	CHECK (fakeFind (BROADCAST_ADDRESS) >= 0);
+	peer (1, address);
+	CHECK (fakeFind (address) < 0); // Least recently used one made room
+
+	// Nothing can be evicted if every entry is pinned
+	fakeReset (FAKE_MAX_PEERS);
+	cache.begin (1, fakeAdd, fakeDel);
+	cache.pin (BROADCAST_ADDRESS);
+	cache.setChannel (1);
+	peer (1, address);
+	CHECK (!cache.get (address));
+	CHECK (cache.get (BROADCAST_ADDRESS));
+
+	// Driver reset forgets registrations
+	cache.reset ();
+	CHECK (!cache.isChannelKnown ());
+	fakeReset (FAKE_MAX_PEERS);
+	cache.setChannel (1);
+	CHECK (cache.get (BROADCAST_ADDRESS));
+	CHECK (fakeFind (BROADCAST_ADDRESS) >= 0);
+
+	printf ("peer cache: %s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+/**
+  * @file Arduino.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Minimal Arduino API used by EnigmaIOT classes that may be built on a Linux host
+  */
+
+#include "Arduino.h"
+#include <chrono>
+#include <thread>
+
+Stream Serial (stdout);
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now ();
+
+unsigned long millis () {
+	return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime).count ();
+}
+
+unsigned long micros () {
+	return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::steady_clock::now () - startTime).count ();
+}
+
+void delay (unsigned long ms) {
+	std::this_thread::sleep_for (std::chrono::milliseconds (ms));
+}
+
+void yield () {
+	std::this_thread::yield ();
+}
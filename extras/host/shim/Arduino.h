@@ -0,0 +1,112 @@
+/**
+  * @file Arduino.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Minimal Arduino API used by EnigmaIOT classes that may be built on a Linux host
+  *
+  * Only functions that platform free classes and host communication layers need are provided. It is not meant to
+  * run the full node or gateway, that depend on ESP-NOW, WiFi and flash APIs.
+  */
+
+#ifndef _HOST_ARDUINO_h
+#define _HOST_ARDUINO_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <stdarg.h>
+#include <string>
+
+#define IRAM_ATTR
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5] ///< @brief Expands a MAC address to `printf` arguments, as ESP SDK does
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x" ///< @brief Format string for `MAC2STR`, as ESP SDK does
+
+/**
+  * @brief Gets time since program started
+  * @return Time in milliseconds
+  */
+unsigned long millis ();
+
+/**
+  * @brief Gets time since program started
+  * @return Time in microseconds
+  */
+unsigned long micros ();
+
+/**
+  * @brief Blocks calling thread
+  * @param ms Time to wait in milliseconds
+  */
+void delay (unsigned long ms);
+
+/**
+  * @brief Lets other threads run
+  */
+void yield ();
+
+/**
+  * @brief Checks if a character is a decimal digit
+  * @param c Character to check
+  * @return `true` if it is a digit
+  */
+inline bool isDigit (int c) {
+	return isdigit (c) != 0;
+}
+
+/**
+  * @brief Minimal Arduino String replacement
+  */
+class String : public std::string {
+public:
+	String () {}
+	String (const char* str) : std::string (str ? str : "") {}
+	String (const std::string& str) : std::string (str) {}
+};
+
+/**
+  * @brief Minimal Arduino Stream replacement. Output goes to a stdio stream
+  */
+class Stream {
+protected:
+	FILE* out; ///< @brief Output stream
+
+public:
+	Stream (FILE* out) : out (out) {}
+
+	size_t printf (const char* format, ...) __attribute__ ((format (printf, 2, 3))) {
+		va_list args;
+		va_start (args, format);
+		int len = vfprintf (out, format, args);
+		va_end (args);
+		return len > 0 ? len : 0;
+	}
+
+	size_t print (const char* str) {
+		return fputs (str, out) >= 0 ? strlen (str) : 0;
+	}
+
+	size_t println (const char* str = "") {
+		return printf ("%s\n", str);
+	}
+
+	size_t println (int value) {
+		return printf ("%d\n", value);
+	}
+};
+
+extern Stream Serial; ///< @brief Serial port. It writes to stdout
+
+#endif // _HOST_ARDUINO_h
@@ -0,0 +1,331 @@
+/**
+  * @file tx_pump_sim.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Compares ESP-NOW transmission driven by a periodic poll with transmission driven by events
+  *
+  * The TX queue follows `Espnow_halClass`: one frame in flight, per destination order, retries with backoff and a send
+  * status timeout, with `EnigmaIoTconfigAdvanced.h` limits. `handle ()` and `nextEventDelay ()` logic is repeated
+  * here because the ESP-NOW layer cannot be built on a host. It is run as the previous code did, from a 20 ms
+  * periodic os_timer on ESP8266 or a task that waits 1 tick on ESP32, and as it does now, when `send ()` or the send
+  * callback notifies it or the next retry or timeout is due. Each frame takes a fixed air time until its send status
+  * and is lost with a fixed probability. Time is simulated in microseconds.
+  *
+  * Usage: tx_pump_sim [seconds] [air time us]
+  */
+
+#include <Arduino.h>
+#include <EnigmaIoTconfig.h>
+#include <math.h>
+#include <vector>
+
+static const uint32_t NO_TX_EVENT = 0xFFFFFFFF; ///< @brief Transmission has nothing pending
+static const uint64_t NEVER = UINT64_MAX;
+static const uint32_t DISPATCH_TIME = 100; ///< @brief Time from a notification to handle () run (us)
+static const int NUM_DESTINATIONS = 4; ///< @brief Nodes that messages are sent to
+static const uint32_t LIGHT_INTERVAL = 100; ///< @brief Average time between messages on light load (ms)
+
+/**
+  * @brief How handle () is run
+  */
+enum pump_t {
+	POLL_20MS, ///< @brief Previous ESP8266 code. Periodic 20 ms os_timer
+	POLL_1MS, ///< @brief Previous ESP32 code. Task waits one 1 ms tick between runs
+	EVENTS ///< @brief Current code. Run on notification or at next retry or timeout
+};
+
+static const char* pumpNames[] = {
+	"20 ms poll (ESP8266)",
+	"1 ms poll (ESP32)",
+	"event driven"
+};
+
+struct tx_item_t {
+	int destination;
+	uint32_t order;
+	uint32_t notBefore; // ms
+	uint64_t queuedAt; // us
+	uint8_t attempts;
+};
+
+/**
+  * @brief Results of one run
+  */
+struct result_t {
+	uint32_t queued = 0;
+	uint32_t delivered = 0;
+	uint32_t failed = 0;
+	uint32_t dropped = 0;
+	uint64_t totalLatency = 0; ///< @brief Sum of time from queuing to delivery (us)
+	uint64_t maxLatency = 0; ///< @brief Highest time from queuing to delivery (us)
+	uint32_t runs = 0; ///< @brief Number of handle () runs
+};
+
+static double lossRate;
+
+bool lost () {
+	return rand () < lossRate * ((double)RAND_MAX + 1);
+}
+
+/**
+  * @brief Transmission queue and its pump
+  */
+class TxPump {
+public:
+	TxPump (pump_t pump, uint32_t airTime, result_t* result) : pump (pump), airTime (airTime), result (result) {}
+
+	uint64_t now = 0; ///< @brief Simulated time (us)
+	uint64_t nextRun = 0; ///< @brief Next handle () run (us)
+	uint64_t statusAt = NEVER; ///< @brief Time when send callback of frame in flight is called (us)
+
+	uint32_t millis () {
+		return now / 1000;
+	}
+
+	size_t depth () {
+		return queue.size ();
+	}
+
+	int getQueueDepth (int destination) {
+		return countMessages (destination);
+	}
+
+	/**
+	  * @brief Queues a message as `Espnow_halClass::send ()` does
+	  */
+	void send (int destination) {
+		result->queued++;
+		if (countMessages (destination) >= COMMS_QUEUE_PER_DESTINATION || queue.size () >= COMMS_QUEUE_SIZE) {
+			result->dropped++; // Dropped message choice does not change timing
+			return;
+		}
+		queue.push_back ({ destination, order++, millis (), now, 0 });
+		notify ();
+	}
+
+	/**
+	  * @brief Send callback
+	  */
+	void txCallback () {
+		statusAt = NEVER;
+		txDone = true;
+		notify ();
+	}
+
+	/**
+	  * @brief Runs handle () and sets time of next run
+	  */
+	void run () {
+		result->runs++;
+		handle ();
+		if (pump == POLL_20MS) {
+			nextRun = now + 20000;
+		} else if (pump == POLL_1MS) {
+			nextRun = (now / 1000 + 1) * 1000;
+		} else {
+			uint32_t delay = nextEventDelay ();
+			nextRun = delay == NO_TX_EVENT ? NEVER : now + (delay ? delay * 1000 : DISPATCH_TIME);
+		}
+	}
+
+protected:
+	pump_t pump;
+	uint32_t airTime;
+	result_t* result;
+	std::vector<tx_item_t> queue;
+	uint32_t order = 0;
+	int inFlight = -1; // Queue index
+	uint32_t inFlightSince = 0;
+	bool txDone = false;
+	uint8_t txStatus = 0;
+
+	void notify () {
+		if (pump == EVENTS && now + DISPATCH_TIME < nextRun) {
+			nextRun = now + DISPATCH_TIME;
+		}
+	}
+
+	int countMessages (int destination) {
+		int count = 0;
+		for (const auto& item : queue) {
+			count += item.destination == destination;
+		}
+		return count;
+	}
+
+	int getNextMessage () {
+		int next = -1;
+		for (size_t i = 0; i < queue.size (); i++) {
+			if ((int32_t)(millis () - queue[i].notBefore) < 0 || (next >= 0 && queue[next].order < queue[i].order)) {
+				continue;
+			}
+			bool first = true;
+			for (const auto& other : queue) {
+				if (other.order < queue[i].order && other.destination == queue[i].destination) {
+					first = false;
+					break;
+				}
+			}
+			if (first) {
+				next = i;
+			}
+		}
+		return next;
+	}
+
+	void processTxStatus () {
+		uint8_t status;
+
+		if (inFlight < 0) {
+			return;
+		}
+		if (txDone) {
+			status = txStatus;
+		} else if (millis () - inFlightSince > COMMS_TX_TIMEOUT) {
+			status = 1;
+		} else {
+			return;
+		}
+		tx_item_t& item = queue[inFlight];
+		int idx = inFlight;
+		inFlight = -1;
+		if (status == 0) {
+			uint64_t latency = now - item.queuedAt;
+			result->delivered++;
+			result->totalLatency += latency;
+			if (latency > result->maxLatency) {
+				result->maxLatency = latency;
+			}
+			queue.erase (queue.begin () + idx);
+		} else if (item.attempts > COMMS_MAX_RETRIES) {
+			result->failed++;
+			queue.erase (queue.begin () + idx);
+		} else {
+			uint32_t backoff = (uint32_t)COMMS_RETRY_BACKOFF << (item.attempts - 1);
+			if (backoff > COMMS_RETRY_BACKOFF_MAX) {
+				backoff = COMMS_RETRY_BACKOFF_MAX;
+			}
+			item.notBefore = millis () + backoff;
+		}
+	}
+
+	void handle () {
+		processTxStatus ();
+		if (inFlight >= 0) {
+			return;
+		}
+		int next = getNextMessage ();
+		if (next < 0) {
+			return;
+		}
+		queue[next].attempts++;
+		txDone = false;
+		txStatus = lost () ? 1 : 0;
+		inFlightSince = millis ();
+		inFlight = next;
+		statusAt = now + airTime;
+	}
+
+	uint32_t nextEventDelay () {
+		uint32_t delay = NO_TX_EVENT;
+
+		if (inFlight >= 0) {
+			if (txDone) {
+				return 0;
+			}
+			uint32_t elapsed = millis () - inFlightSince;
+			return elapsed > COMMS_TX_TIMEOUT ? 0 : COMMS_TX_TIMEOUT - elapsed + 1;
+		}
+		for (const auto& item : queue) {
+			int32_t wait = item.notBefore - millis ();
+			if (wait <= 0) {
+				return 0;
+			}
+			if ((uint32_t)wait < delay) {
+				delay = wait;
+			}
+		}
+		return delay;
+	}
+};
+
+/**
+  * @brief Runs a pump under a load
+  * @param pump How handle () is run
+  * @param saturated `true` to keep queue full. Otherwise messages come at random times, `LIGHT_INTERVAL` apart on average
+  * @param seconds Simulated time
+  * @param airTime Time from sending a frame to its send status (us)
+  * @param result Results
+  */
+void runPump (pump_t pump, bool saturated, uint32_t seconds, uint32_t airTime, result_t* result) {
+	TxPump tx (pump, airTime, result);
+	uint64_t end = (uint64_t)seconds * 1000000;
+	uint64_t nextMessage = 0;
+	int destination = 0;
+
+	tx.nextRun = pump == EVENTS ? NEVER : 0;
+	while (true) {
+		uint64_t t = nextMessage;
+		if (tx.statusAt < t) {
+			t = tx.statusAt;
+		}
+		if (tx.nextRun < t) {
+			t = tx.nextRun;
+		}
+		if (t >= end) {
+			break;
+		}
+		tx.now = t;
+		if (t == nextMessage) {
+			if (saturated) {
+				// Main loop queues a new message as soon as there is room, skipping destinations that have their share
+				for (int i = 0; i < NUM_DESTINATIONS && tx.depth () < COMMS_QUEUE_SIZE; i++) {
+					if (tx.getQueueDepth (destination) < COMMS_QUEUE_PER_DESTINATION) {
+						tx.send (destination);
+						i = -1;
+					}
+					destination = (destination + 1) % NUM_DESTINATIONS;
+				}
+				nextMessage = NEVER;
+			} else {
+				tx.send (rand () % NUM_DESTINATIONS);
+				nextMessage = t + (uint64_t)(-log ((rand () + 1.0) / ((double)RAND_MAX + 2)) * LIGHT_INTERVAL * 1000);
+			}
+		} else if (t == tx.statusAt) {
+			tx.txCallback ();
+		} else {
+			size_t depth = tx.depth ();
+			tx.run ();
+			if (saturated && tx.depth () < depth) {
+				nextMessage = t + DISPATCH_TIME;
+			}
+		}
+	}
+}
+
+int main (int argc, char** argv) {
+	uint32_t seconds = argc > 1 ? atoi (argv[1]) : 60;
+	uint32_t airTime = argc > 2 ? atoi (argv[2]) : 1500;
+	const int losses[] = { 0, 10 };
+
+	printf ("%u s per run, %u us from send to status, %d destinations, queue of %u, %u per destination\n",
+			seconds, airTime, NUM_DESTINATIONS, COMMS_QUEUE_SIZE, COMMS_QUEUE_PER_DESTINATION);
+	printf ("%-10s loss  %-22s  msg/s  avg latency ms  max latency ms  handle runs/s  failed  dropped\n", "load", "pump");
+	for (bool saturated : { false, true }) {
+		for (int loss : losses) {
+			lossRate = loss / 100.0;
+			for (int pump = POLL_20MS; pump <= EVENTS; pump++) {
+				result_t result;
+				srand (loss * 10 + saturated);
+				runPump ((pump_t)pump, saturated, seconds, airTime, &result);
+				printf ("%-10s %3d%%  %-22s  %5.1f  %14.2f  %14.2f  %13.1f  %6u  %7u\n",
+						saturated ? "saturated" : "light", loss, pumpNames[pump],
+						(double)result.delivered / seconds,
+						result.delivered ? result.totalLatency / 1000.0 / result.delivered : 0.0,
+						result.maxLatency / 1000.0, (double)result.runs / seconds, result.failed, result.dropped);
+			}
+		}
+	}
+	return 0;
+}
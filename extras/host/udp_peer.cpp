@@ -0,0 +1,489 @@
+/**
+  * @file udp_peer.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Gateway or node process that registers and exchanges EnigmaIoT messages over UDP communication layer
+  *
+  * Nodes register with ClientHello and ServerHello messages, then send a numbered sensor data message to gateway
+  * periodically. Gateway answers every one with a downlink data message that carries the same payload, so that loss,
+  * latency and queue behaviour of `Udp_halClass` can be checked with many processes at once. Messages use the same
+  * layout, key agreement, cipher suite negotiation and counter checks as `EnigmaIOTNodeClass` and
+  * `EnigmaIOTGatewayClass`, through `CryptModule` and `Node` classes. Summary is printed on exit as a single line.
+  * Delivered, failed and dropped counts come from `Udp_halClass` and include ClientHello and ServerHello messages.
+  * Use `launch_udp_peers.sh` to run one gateway and several nodes.
+  *
+  * Usage: udp_peer gateway|node <index> [seconds] [loss %] [latency ms] [jitter ms] [period ms]
+  */
+
+#include <Arduino.h>
+#include <udp_hal.h>
+#include <cryptModule.h>
+#include <NodeList.h>
+#include <helperFunctions.h>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Same values as in EnigmaIOTNode.h and EnigmaIOTGateway.h, that cannot be included on host
+static const uint8_t SENSOR_DATA = 0x01; ///< @brief Data message from node
+static const uint8_t DOWNSTREAM_DATA_SET = 0x02; ///< @brief Data message from gateway
+static const uint8_t SERVER_HELLO = 0xFE; ///< @brief ServerHello message from gateway
+static const uint8_t CLIENT_HELLO = 0xFF; ///< @brief ClientHello message from node
+static const uint8_t RAW_ENCODING = 0x00; ///< @brief Payload encoding for raw data
+
+static const char NETWORK_KEY[] = "EnigmaIoTUdpPeer"; ///< @brief Network key shared by every peer
+
+/**
+  * @brief Data message payload
+  */
+typedef struct __attribute__ ((packed, aligned (1))) {
+	uint32_t seq; ///< @brief Message number
+	uint32_t sentAt; ///< @brief Node time when message was sent
+	uint8_t fill[12]; ///< @brief Makes payload as long as a small sensor reading
+} payload_t;
+
+/**
+  * @brief Received message waiting to be processed by main loop
+  */
+typedef struct {
+	uint8_t address[ENIGMAIOT_ADDR_LEN]; ///< @brief Source address
+	uint8_t data[MAX_MESSAGE_LENGTH]; ///< @brief Message
+	uint8_t len; ///< @brief Message length
+	int rssi; ///< @brief Received signal strength
+} rx_message_t;
+
+static uint8_t gatewayAddress[ENIGMAIOT_ADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static uint8_t networkKey[KEY_LENGTH];
+static bool isGateway = false;
+
+// Messages are received on communication layer thread. Crypto objects are shared, so they are processed on main thread
+static std::deque<rx_message_t> rxQueue;
+static std::mutex rxMutex;
+static std::condition_variable rxEvent;
+
+static Node self; ///< @brief Node side registration state
+static NodeList* nodelist; ///< @brief Gateway side node list
+
+static uint32_t dataReceived = 0;
+static uint32_t echoesSent = 0;
+static uint32_t echoReceived = 0;
+static uint32_t echoLatency = 0;
+static uint32_t hellosSent = 0;
+static uint32_t registrations = 0;
+static uint32_t authErrors = 0;
+static uint32_t counterErrors = 0;
+
+void rxData (uint8_t* address, uint8_t* data, uint8_t len, signed int rssi) {
+	rx_message_t message;
+
+	if (!len || len > MAX_MESSAGE_LENGTH) {
+		return;
+	}
+	memcpy (message.address, address, ENIGMAIOT_ADDR_LEN);
+	memcpy (message.data, data, len);
+	message.len = len;
+	message.rssi = rssi;
+	std::lock_guard<std::mutex> lock (rxMutex);
+	rxQueue.push_back (message);
+	rxEvent.notify_one ();
+}
+
+/**
+  * @brief Builds AAD from message type, IV and last bytes of a key, as every EnigmaIoT message does
+  * @param aad Buffer of `1 + IV_LENGTH + AAD_LENGTH` bytes
+  * @param msg Message
+  * @param key Key used to encrypt message
+  */
+void buildAad (uint8_t* aad, const uint8_t* msg, const uint8_t* key) {
+	memcpy (aad, msg, 1 + IV_LENGTH);
+	memcpy (aad + 1 + IV_LENGTH, key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+}
+
+/**
+  * @brief Builds and sends ClientHello, as `EnigmaIOTNodeClass::clientHello` does without cookie
+  * @return `true` if message was queued
+  */
+bool clientHello () {
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t publicKey[KEY_LENGTH];
+		uint32_t random;
+		uint8_t tag[TAG_LENGTH];
+	} msg;
+	uint8_t aad[1 + IV_LENGTH + AAD_LENGTH];
+
+	Crypto.getDH1 ();
+	self.setStatus (WAIT_FOR_SERVER_HELLO);
+	msg.msgType = CLIENT_HELLO;
+	CryptModule::random (msg.iv, IV_LENGTH);
+	memcpy (msg.publicKey, Crypto.getPubDHKey (), KEY_LENGTH);
+	msg.random = ((uint32_t)HELLO_CAPABILITY_MARKER << 16) | ((uint32_t)SUPPORTED_CIPHER_SUITES << 8); // Always awake, no broadcast
+#if USE_32BIT_COUNTERS
+	msg.random |= 0x00000004U;
+#endif
+	buildAad (aad, (uint8_t*)&msg, networkKey);
+	if (!CryptModule::encryptBuffer (msg.publicKey, KEY_LENGTH + sizeof (uint32_t), msg.iv, IV_LENGTH,
+									 networkKey, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), msg.tag, TAG_LENGTH)) {
+		return false;
+	}
+	hellosSent++;
+	return Udp_hal.send (gatewayAddress, (uint8_t*)&msg, sizeof (msg)) == 0;
+}
+
+/**
+  * @brief Processes ServerHello on node, as `EnigmaIOTNodeClass::processServerHello` does
+  * @param message Received message
+  * @return `true` if node got registered
+  */
+bool processServerHello (rx_message_t* message) {
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t publicKey[KEY_LENGTH];
+		uint16_t nodeId;
+		uint32_t random;
+		uint8_t tag[TAG_LENGTH];
+	} msg;
+	uint8_t aad[1 + IV_LENGTH + AAD_LENGTH];
+
+	if (self.getStatus () != WAIT_FOR_SERVER_HELLO || message->len != sizeof (msg)) {
+		return false;
+	}
+	memcpy (&msg, message->data, sizeof (msg));
+	buildAad (aad, (uint8_t*)&msg, networkKey);
+	if (!CryptModule::decryptBuffer (msg.publicKey, KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t), msg.iv, IV_LENGTH,
+									 networkKey, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), msg.tag, TAG_LENGTH)) {
+		authErrors++;
+		return false;
+	}
+	if (!Crypto.getDH2 (msg.publicKey)) {
+		return false;
+	}
+	bool capable = (msg.random >> 16) == HELLO_CAPABILITY_MARKER && (msg.random & 0x0000FE00U) == 0;
+	cipherSuite_t suite = capable ? (cipherSuite_t)(msg.random & 0x000000FFU) : CIPHER_CHACHAPOLY;
+	if (!CryptModule::isSuiteSupported (suite)) {
+		return false;
+	}
+	self.reset ();
+	self.setNodeId (msg.nodeId);
+	self.setEncryptionKey (CryptModule::getSHA256 (msg.publicKey, KEY_LENGTH));
+	self.setCipherSuite (suite);
+	self.setCounter32 (capable && (msg.random & 0x00000100U));
+	self.setKeyValid (true);
+	self.setStatus (REGISTERED);
+	Udp_hal.linkRssiUpdate (message->address, message->rssi);
+	registrations++;
+	return true;
+}
+
+/**
+  * @brief Processes ClientHello on gateway and answers with ServerHello, as `EnigmaIOTGatewayClass` does
+  * @param message Received message
+  * @return `true` if node got registered
+  */
+bool processClientHello (rx_message_t* message) {
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t publicKey[KEY_LENGTH];
+		uint32_t random;
+		uint8_t tag[TAG_LENGTH];
+	} hello;
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t publicKey[KEY_LENGTH];
+		uint16_t nodeId;
+		uint32_t random;
+		uint8_t tag[TAG_LENGTH];
+	} answer;
+	uint8_t aad[1 + IV_LENGTH + AAD_LENGTH];
+
+	if (message->len != sizeof (hello)) {
+		return false;
+	}
+	Node* node = nodelist->getNewNode (message->address);
+	if (!node) {
+		return false;
+	}
+	memcpy (&hello, message->data, sizeof (hello));
+	buildAad (aad, (uint8_t*)&hello, networkKey);
+	if (!CryptModule::decryptBuffer (hello.publicKey, KEY_LENGTH + sizeof (uint32_t), hello.iv, IV_LENGTH,
+									 networkKey, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), hello.tag, TAG_LENGTH)) {
+		authErrors++;
+		return false;
+	}
+
+	node->reset ();
+	node->setEncryptionKey (hello.publicKey);
+	Crypto.getDH1 ();
+	memcpy (answer.publicKey, Crypto.getPubDHKey (), KEY_LENGTH);
+	if (!Crypto.getDH2 (node->getEncriptionKey ())) {
+		nodelist->unregisterNode (node);
+		return false;
+	}
+	CryptModule::getSHA256 (node->getEncriptionKey (), KEY_LENGTH);
+	node->setKeyValid (true);
+	bool capable = CryptModule::helloSignalsCapabilities (hello.random);
+	node->setCipherSuite (CryptModule::selectHelloSuite (hello.random));
+	node->setCounter32 (USE_32BIT_COUNTERS && capable && (hello.random & 0x00000004U));
+
+	answer.msgType = SERVER_HELLO;
+	CryptModule::random (answer.iv, IV_LENGTH);
+	answer.nodeId = node->getNodeId ();
+	answer.random = ((uint32_t)HELLO_CAPABILITY_MARKER << 16) | (uint8_t)node->getCipherSuite ();
+	if (node->useCounter32 ()) {
+		answer.random |= 0x00000100U;
+	}
+	buildAad (aad, (uint8_t*)&answer, networkKey);
+	if (!CryptModule::encryptBuffer (answer.publicKey, KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t), answer.iv, IV_LENGTH,
+									 networkKey, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), answer.tag, TAG_LENGTH)) {
+		nodelist->unregisterNode (node);
+		return false;
+	}
+	if (Udp_hal.send (node->getMacAddress (), (uint8_t*)&answer, sizeof (answer))) {
+		nodelist->unregisterNode (node);
+		return false;
+	}
+	node->setStatus (REGISTERED);
+	node->setKeyValidFrom (millis ());
+	node->setLastMessageCounter (0);
+	node->setLastDownlinkMsgCounter (0);
+	node->setLastMessageTime ();
+	Udp_hal.linkRssiUpdate (message->address, message->rssi);
+	registrations++;
+	return true;
+}
+
+/**
+  * @brief Builds and sends an encrypted data message, with the layout that node data and gateway downlink messages use
+  * @param node Peer state with key, suite and counters
+  * @param address Destination
+  * @param msgType `SENSOR_DATA` or `DOWNSTREAM_DATA_SET`
+  * @param counter Message counter
+  * @param data Payload
+  * @param len Payload length
+  * @return `true` if message was queued
+  */
+bool sendDataMessage (Node* node, uint8_t* address, uint8_t msgType, uint32_t counter, const uint8_t* data, size_t len) {
+	uint8_t buf[MAX_MESSAGE_LENGTH] = {};
+	uint8_t aad[1 + IV_LENGTH + AAD_LENGTH];
+	uint8_t counterLen = node->getCounterLength ();
+	uint16_t nodeId = node->getNodeId ();
+	uint8_t length_idx = 1 + IV_LENGTH;
+	uint8_t nodeId_idx = length_idx + sizeof (int16_t);
+	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
+	uint8_t encoding_idx = counter_idx + counterLen;
+	uint8_t data_idx = encoding_idx + sizeof (int8_t);
+	uint16_t tag_idx = data_idx + len;
+
+	if (tag_idx + TAG_LENGTH > MAX_MESSAGE_LENGTH) {
+		return false;
+	}
+	buf[0] = msgType;
+	CryptModule::random (buf + 1, IV_LENGTH);
+	memcpy (buf + length_idx, &tag_idx, sizeof (uint16_t));
+	memcpy (buf + nodeId_idx, &nodeId, sizeof (uint16_t));
+	memcpy (buf + counter_idx, &counter, counterLen);
+	buf[encoding_idx] = RAW_ENCODING;
+	memcpy (buf + data_idx, data, len);
+	buildAad (aad, buf, node->getEncriptionKey ());
+	if (!CryptModule::encryptBuffer (buf + length_idx, tag_idx - length_idx, buf + 1, IV_LENGTH,
+									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad),
+									 buf + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
+		return false;
+	}
+	return Udp_hal.send (address, buf, tag_idx + TAG_LENGTH) == 0;
+}
+
+/**
+  * @brief Decrypts a data message in place
+  * @param node Peer state with key and suite
+  * @param message Received message
+  * @param counter Message counter
+  * @param data Pointer to payload
+  * @return Payload length, or -1 if message is not authentic
+  */
+int decryptDataMessage (Node* node, rx_message_t* message, uint32_t* counter, uint8_t** data) {
+	uint8_t aad[1 + IV_LENGTH + AAD_LENGTH];
+	uint8_t counterLen = node->getCounterLength ();
+	uint8_t length_idx = 1 + IV_LENGTH;
+	uint8_t counter_idx = length_idx + 2 * sizeof (int16_t);
+	uint8_t data_idx = counter_idx + counterLen + sizeof (int8_t);
+
+	if (message->len < data_idx + TAG_LENGTH) {
+		return -1;
+	}
+	uint8_t tag_idx = message->len - TAG_LENGTH;
+	buildAad (aad, message->data, node->getEncriptionKey ());
+	if (!CryptModule::decryptBuffer (message->data + length_idx, tag_idx - length_idx, message->data + 1, IV_LENGTH,
+									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad),
+									 message->data + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
+		authErrors++;
+		return -1;
+	}
+	*counter = 0;
+	memcpy (counter, message->data + counter_idx, counterLen);
+	*data = message->data + data_idx;
+	return tag_idx - data_idx;
+}
+
+/**
+  * @brief Processes a message on gateway
+  * @param message Received message
+  */
+void gatewayProcess (rx_message_t* message) {
+	if (message->data[0] == CLIENT_HELLO) {
+		processClientHello (message);
+		return;
+	}
+	if (message->data[0] != SENSOR_DATA) {
+		return;
+	}
+	Node* node = nodelist->getNodeFromMAC (message->address);
+	if (!node || node->getStatus () != REGISTERED) {
+		return;
+	}
+	uint32_t counter;
+	uint8_t* data;
+	int len = decryptDataMessage (node, message, &counter, &data);
+	if (len < 0) {
+		return;
+	}
+	if (!node->acceptMessageCounter (counter)) {
+		counterErrors++;
+		return;
+	}
+	Udp_hal.linkRssiUpdate (message->address, message->rssi); // As gateway does once a message is authenticated
+	node->setLastMessageTime ();
+	dataReceived++;
+	uint32_t downlinkCounter = node->getLastDownlinkMsgCounter () + 1;
+	node->setLastDownlinkMsgCounter (downlinkCounter);
+	if (sendDataMessage (node, node->getMacAddress (), DOWNSTREAM_DATA_SET, downlinkCounter, data, len)) {
+		echoesSent++;
+	}
+}
+
+/**
+  * @brief Processes a message on node
+  * @param message Received message
+  */
+void nodeProcess (rx_message_t* message) {
+	if (message->data[0] == SERVER_HELLO) {
+		processServerHello (message);
+		return;
+	}
+	if (message->data[0] != DOWNSTREAM_DATA_SET || self.getStatus () != REGISTERED) {
+		return;
+	}
+	uint32_t counter;
+	uint8_t* data;
+	payload_t payload;
+	int len = decryptDataMessage (&self, message, &counter, &data);
+	if (len != sizeof (payload_t)) {
+		return;
+	}
+	if (!self.acceptDownlinkCounter (counter)) {
+		counterErrors++;
+		return;
+	}
+	Udp_hal.linkRssiUpdate (message->address, message->rssi); // As node does once a message is authenticated
+	memcpy (&payload, data, sizeof (payload));
+	echoReceived++;
+	echoLatency += (uint32_t)millis () - payload.sentAt;
+}
+
+/**
+  * @brief Processes received messages until timeout expires or queue is empty after first message
+  * @param timeout Maximum time to wait in milliseconds
+  */
+void processMessages (uint32_t timeout) {
+	std::unique_lock<std::mutex> lock (rxMutex);
+	if (rxQueue.empty ()) {
+		rxEvent.wait_for (lock, std::chrono::milliseconds (timeout));
+	}
+	while (!rxQueue.empty ()) {
+		rx_message_t message = rxQueue.front ();
+		rxQueue.pop_front ();
+		lock.unlock ();
+		if (isGateway) {
+			gatewayProcess (&message);
+		} else {
+			nodeProcess (&message);
+		}
+		lock.lock ();
+	}
+}
+
+int main (int argc, char** argv) {
+	if (argc < 3) {
+		fprintf (stderr, "Usage: %s gateway|node <index> [seconds] [loss %%] [latency ms] [jitter ms] [period ms]\n", argv[0]);
+		return 1;
+	}
+	isGateway = !strcmp (argv[1], "gateway");
+	uint16_t index = atoi (argv[2]);
+	uint32_t duration = (argc > 3 ? atoi (argv[3]) : 10) * 1000;
+	udp_link_model_t link = { 0, 0, 0, -50, 5, 10 };
+	link.lossPercent = argc > 4 ? atoi (argv[4]) : 0;
+	link.latency = argc > 5 ? atoi (argv[5]) : 0;
+	link.jitter = argc > 6 ? atoi (argv[6]) : 0;
+	uint32_t period = argc > 7 ? atoi (argv[7]) : 1000;
+
+	uint8_t address[ENIGMAIOT_ADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, (uint8_t)(index >> 8), (uint8_t)index };
+	srand (time (NULL) ^ (index << 16));
+	memset (networkKey, 0, KEY_LENGTH);
+	memcpy (networkKey, NETWORK_KEY, strlen (NETWORK_KEY));
+	CryptModule::getSHA256 (networkKey, KEY_LENGTH);
+	if (isGateway) {
+		nodelist = new NodeList ();
+	}
+	Udp_hal.setAddress (address);
+	Udp_hal.setLinkModel (link);
+	Udp_hal.onDataRcvd (rxData);
+	Udp_hal.begin (gatewayAddress, 0, isGateway ? COMM_GATEWAY : COMM_NODE);
+
+	uint32_t start = millis ();
+	uint32_t lastSent = start - (rand () % period); // Spread nodes over period
+	uint32_t helloDeadline = start + (rand () % period);
+	uint32_t seq = 0;
+	while (millis () - start < duration) {
+		// Same timing as a non sleepy node in EnigmaIOTNodeClass::handleRegistration
+		if (!isGateway && self.getStatus () == UNREGISTERED && (int32_t)(millis () - helloDeadline) >= 0) {
+			clientHello ();
+			helloDeadline = millis () + RECONNECTION_PERIOD * 5;
+		} else if (!isGateway && self.getStatus () == WAIT_FOR_SERVER_HELLO && (int32_t)(millis () - helloDeadline) >= 0) {
+			self.setStatus (UNREGISTERED);
+			helloDeadline = millis () + RECONNECTION_PERIOD + rand () % PRE_REG_DELAY;
+		}
+		if (!isGateway && self.getStatus () == REGISTERED && millis () - lastSent >= period) {
+			payload_t payload = {};
+			lastSent = millis ();
+			payload.seq = ++seq;
+			payload.sentAt = lastSent;
+			uint32_t counter = self.getLastMessageCounter () + 1;
+			self.setLastMessageCounter (counter);
+			sendDataMessage (&self, gatewayAddress, SENSOR_DATA, counter, (uint8_t*)&payload, sizeof (payload));
+		}
+		processMessages (10);
+	}
+	uint32_t drainStart = millis ();
+	while (millis () - drainStart < (unsigned long)(link.latency + link.jitter + 100)) { // Let last answers arrive
+		processMessages (10);
+	}
+	Udp_hal.stop ();
+
+	const comms_tx_stats_t* stats = Udp_hal.getTxStats ();
+	if (isGateway) {
+		printf ("gateway received %u from %u nodes echoed %u failed %u dropped %u registrations %u auth_errors %u counter_errors %u\n",
+				dataReceived, nodelist->countActiveNodes (), echoesSent, stats->failed, stats->dropped,
+				registrations, authErrors, counterErrors);
+	} else {
+		printf ("node %u sent %u delivered %u failed %u dropped %u echoes %u avg_rtt_ms %.1f hellos %u registered %u suite %s counter %u auth_errors %u counter_errors %u\n",
+				index, seq, stats->delivered, stats->failed, stats->dropped, echoReceived,
+				echoReceived ? (float)echoLatency / echoReceived : 0.0f, hellosSent, self.getStatus () == REGISTERED,
+				CryptModule::getSuiteName (self.getCipherSuite ()), self.getCounterLength () * 8, authErrors, counterErrors);
+	}
+	return 0;
+}
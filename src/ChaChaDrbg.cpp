@@ -0,0 +1,88 @@
+/**
+  * @file ChaChaDrbg.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Random number generator based on ChaCha20 keystream
+  */
+
+#include "ChaChaDrbg.h"
+
+static const uint8_t DRBG_NONCE[8] = { 0 }; ///< @brief Fixed nonce. Key changes after every refill
+
+void ChaChaDrbgClass::rekey (uint8_t* seed) {
+	uint8_t stream[KEY_LENGTH];
+
+	if (seeded) {
+		memset (stream, 0, KEY_LENGTH);
+		cipher.encrypt (stream, stream, KEY_LENGTH);
+		for (int i = 0; i < KEY_LENGTH; i++) {
+			seed[i] ^= stream[i];
+		}
+	}
+	cipher.setKey (seed, KEY_LENGTH);
+	cipher.setIV (DRBG_NONCE, sizeof (DRBG_NONCE));
+	memset (stream, 0, KEY_LENGTH);
+	available = 0; // Discard buffered output generated with previous key
+	seeded = true;
+}
+
+void ChaChaDrbgClass::reseed () {
+	uint8_t seed[KEY_LENGTH];
+
+	for (int i = 0; i < KEY_LENGTH; i += sizeof (uint32_t)) {
+		uint32_t rnd = entropy ();
+		memcpy (seed + i, &rnd, sizeof (uint32_t));
+	}
+	rekey (seed);
+	memset (seed, 0, KEY_LENGTH);
+	bytesSinceReseed = 0;
+	reseeds++;
+}
+
+void ChaChaDrbgClass::refill () {
+	uint8_t stream[KEY_LENGTH + DRBG_BLOCK_SIZE];
+
+	if (!seeded || (!deterministic && bytesSinceReseed >= DRBG_RESEED_INTERVAL)) {
+		reseed ();
+	}
+	memset (stream, 0, sizeof (stream));
+	cipher.encrypt (stream, stream, sizeof (stream));
+	cipher.setKey (stream, KEY_LENGTH);
+	cipher.setIV (DRBG_NONCE, sizeof (DRBG_NONCE));
+	memcpy (block, stream + KEY_LENGTH, DRBG_BLOCK_SIZE);
+	memset (stream, 0, sizeof (stream));
+	available = DRBG_BLOCK_SIZE;
+}
+
+void ChaChaDrbgClass::read (uint8_t* buf, size_t len) {
+	while (len > 0) {
+		if (!available) {
+			refill ();
+		}
+		size_t chunk = len < available ? len : available;
+		uint8_t* src = block + DRBG_BLOCK_SIZE - available;
+		memcpy (buf, src, chunk);
+		memset (src, 0, chunk); // Never serve same bytes twice
+		available -= chunk;
+		bytesSinceReseed += chunk;
+		bytesServed += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+void ChaChaDrbgClass::seed (const uint8_t* key, bool deterministic) {
+	uint8_t seedKey[KEY_LENGTH];
+
+	memcpy (seedKey, key, KEY_LENGTH);
+	this->deterministic = deterministic;
+	if (deterministic) {
+		seeded = false; // Forget previous state so output depends on seed only
+	} else if (!seeded) {
+		reseed (); // Seed is added to entropy, never replaces it
+	}
+	rekey (seedKey);
+	bytesSinceReseed = 0;
+	memset (seedKey, 0, KEY_LENGTH);
+}
@@ -0,0 +1,108 @@
+/**
+  * @file ChaChaDrbg.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Random number generator based on ChaCha20 keystream
+  *
+  * Random bytes are served from a buffered ChaCha20 keystream. Generator is seeded from an entropy source on first
+  * use and reseeded every `DRBG_RESEED_INTERVAL` bytes. Its key is replaced with fresh keystream after every block, so
+  * a later state compromise does not reveal already served values. Deterministic mode never reads entropy source, so
+  * sequence depends only on given seed. It is intended for testing only.
+  *
+  * Entropy source is passed as a function and there is no locking here, so it does not use any platform function and
+  * may be run on a host. Caller has to serialize access if it is used from several tasks.
+  */
+
+#ifndef _CHACHA_DRBG_h
+#define _CHACHA_DRBG_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+#include <ChaCha.h>
+
+/**
+  * @brief Gets 32 bits from an entropy source
+  * @return Random value
+  */
+typedef uint32_t (*drbg_entropy_t)();
+
+/**
+  * @brief ChaCha20 based random number generator
+  */
+class ChaChaDrbgClass {
+public:
+	static const size_t DRBG_BLOCK_SIZE = 64; ///< @brief Random bytes buffered on every refill
+
+protected:
+	ChaCha cipher; ///< @brief ChaCha20 instance used as keystream generator
+	uint8_t block[DRBG_BLOCK_SIZE]; ///< @brief Buffered random bytes
+	size_t available = 0; ///< @brief Number of unused bytes in `block`
+	uint32_t bytesSinceReseed = 0; ///< @brief Bytes served since last reseed
+	bool seeded = false; ///< @brief Generator has a valid key
+	bool deterministic = false; ///< @brief Entropy source disabled. For testing only
+	uint32_t bytesServed = 0; ///< @brief Total bytes served
+	uint32_t reseeds = 0; ///< @brief Number of reseeds from entropy source
+	drbg_entropy_t entropy; ///< @brief Entropy source
+
+	/**
+	  * @brief Sets a new key mixing given seed with current keystream, so previous entropy is never lost
+	  * @param seed Seed to mix. `KEY_LENGTH` bytes. It is modified
+	  */
+	void rekey (uint8_t* seed);
+
+	/**
+	  * @brief Mixes `KEY_LENGTH` bytes from entropy source into key
+	  */
+	void reseed ();
+
+	/**
+	  * @brief Generates next block of random bytes and replaces key with fresh keystream
+	  */
+	void refill ();
+
+public:
+	/**
+	  * @brief Class constructor
+	  * @param entropy Entropy source
+	  */
+	ChaChaDrbgClass (drbg_entropy_t entropy) : entropy (entropy) {}
+
+	/**
+	  * @brief Copies random bytes, refilling buffer as needed
+	  * @param buf Destination buffer
+	  * @param len Number of bytes
+	  */
+	void read (uint8_t* buf, size_t len);
+
+	/**
+	  * @brief Mixes a key into generator state. In deterministic mode state depends only on given key and entropy source
+	  * is never read again
+	  * @param key Seed key. `KEY_LENGTH` bytes
+	  * @param deterministic `true` to disable entropy source
+	  */
+	void seed (const uint8_t* key, bool deterministic);
+
+	/**
+	  * @brief Gets number of random bytes served
+	  * @return Number of bytes
+	  */
+	uint32_t getBytesServed () {
+		return bytesServed;
+	}
+
+	/**
+	  * @brief Gets number of reseeds from entropy source
+	  * @return Number of reseeds
+	  */
+	uint32_t getReseedCount () {
+		return reseeds;
+	}
+};
+
+#endif // _CHACHA_DRBG_h
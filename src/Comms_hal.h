@@ -31,6 +31,41 @@ typedef struct {
     size_t payload_len; /**< Payload length*/
 } comms_queue_item_t;
 
+/**
+  * @brief Final result of a queued message
+  */
+enum comms_tx_status_t {
+	COMMS_TX_DELIVERED = 0, /**< Message was acknowledged by destination */
+	COMMS_TX_FAILED = 1, /**< Message was not acknowledged after all retries */
+	COMMS_TX_DROPPED = 2 /**< Message was discarded from queue before being sent */
+};
+
+/**
+  * @brief Transmission counters
+  */
+typedef struct {
+	uint32_t queued; /**< Messages accepted by send() */
+	uint32_t attempts; /**< Transmissions started, including retries */
+	uint32_t delivered; /**< Messages acknowledged by destination */
+	uint32_t retries; /**< Retransmissions after a failed attempt */
+	uint32_t failed; /**< Messages given up after last retry */
+	uint32_t dropped; /**< Messages discarded because queue was full */
+	uint8_t depth; /**< Messages currently queued */
+	uint8_t maxDepth; /**< Highest number of queued messages seen */
+	uint32_t totalLatency; /**< Sum of time from queuing to delivery of delivered messages (us) */
+	uint32_t maxLatency; /**< Highest time from queuing to delivery (us) */
+} comms_tx_stats_t;
+
+/**
+  * @brief Link state and rate and power selected for a peer
+  */
+typedef struct {
+	uint16_t rate; /**< PHY rate in 100 kbps units */
+	int8_t txPower; /**< Transmission power in 0.25 dBm units */
+	int8_t rssi; /**< Smoothed signal strength of frames received from peer (dBm). 0 if none has been received */
+	uint8_t failures; /**< Failed transmissions among last 8 */
+} comms_link_state_t;
+
 /**
       * @brief Received data callback definition
       * @param address Address of the sender
@@ -47,6 +82,15 @@ typedef void (*comms_hal_rcvd_data)(uint8_t* address, uint8_t* data, uint8_t len
 */
 typedef void (*comms_hal_sent_data)(uint8_t* address, uint8_t status);
 
+/**
+      * @brief Delivery receipt callback definition
+      * @param handle Message handle given when message was queued
+      * @param address Destination address
+      * @param status Final message status
+      * @param attempts Number of transmissions done for this message
+*/
+typedef void (*comms_hal_tx_receipt)(uint32_t handle, uint8_t* address, comms_tx_status_t status, uint8_t attempts);
+
 /**
   * @brief Interface for communication subsystem abstraction layer definition
   */
@@ -56,11 +100,14 @@ public:
 	static const uint8_t COMMS_HAL_ADDR_LEN = 1; ///< @brief Address length
 
 protected:
-	uint8_t gateway[COMMS_HAL_ADDR_LEN]; ///< @brief Gateway address
+	uint8_t gateway[ENIGMAIOT_ADDR_LEN]; ///< @brief Gateway address
 	uint8_t channel; ///< @brief Comms channel to be used
 
 	comms_hal_rcvd_data dataRcvd = 0; ///< @brief Pointer to a function to be called on every received message
 	comms_hal_sent_data sentResult = 0; ///< @brief Pointer to a function to be called to notify last sending status
+	comms_hal_tx_receipt txReceipt = 0; ///< @brief Pointer to a function to be called with final status of every queued message
+	uint32_t lastTxHandle = 0; ///< @brief Handle assigned to last message accepted by send()
+	comms_tx_stats_t txStats = {}; ///< @brief Transmission counters
 	peerType_t _ownPeerType; ///< @brief Stores peer type, node or gateway
 
 	/**
@@ -113,6 +160,49 @@ public:
 	  */
 	virtual uint8_t getAddressLength () = 0;
 
+	/**
+	  * @brief Attach a callback function to get final delivery status of every message, identified by its handle
+	  * @param txReceipt Pointer to the callback function
+	  */
+	virtual void onTxReceipt (comms_hal_tx_receipt txReceipt) {
+		this->txReceipt = txReceipt;
+	}
+
+	/**
+	  * @brief Gets handle of last message accepted by send(). It identifies that message on delivery receipt
+	  * @return Message handle. 0 if no message has been queued yet
+	  */
+	uint32_t getLastTxHandle () {
+		return lastTxHandle;
+	}
+
+	/**
+	  * @brief Gets transmission counters
+	  * @return Pointer to counters
+	  */
+	const comms_tx_stats_t* getTxStats () {
+		return &txStats;
+	}
+
+	/**
+	  * @brief Gets number of messages queued for a destination
+	  * @param da Destination address
+	  * @return Number of queued messages
+	  */
+	virtual uint8_t getQueueDepth (const uint8_t* da) {
+		return 0;
+	}
+
+	/**
+	  * @brief Gets link state of a peer
+	  * @param da Peer address
+	  * @param state Gets rate, power and link quality
+	  * @return `true` if link to that peer is being tracked
+	  */
+	virtual bool getLinkState (const uint8_t* da, comms_link_state_t* state) {
+		return false;
+	}
+
     /**
       * @brief Sends next message in the queue
       */
@@ -123,6 +213,19 @@ public:
       * @param enable `true` to enable transmission, `false` to disable it
       */
     virtual void enableTransmit (bool enable) = 0;
+
+    /**
+      * @brief Tells communication layer that WiFi channel may have changed. It has to be called after channel is set
+      */
+    virtual void channelChanged () {}
+
+    /**
+      * @brief Reports signal strength of a message from a peer. It has to be called only after upper layer has
+      * authenticated that message, so that forged frames cannot change rate or power used for that peer
+      * @param address Peer address
+      * @param rssi RSSI in dBm
+      */
+    virtual void linkRssiUpdate (const uint8_t* address, int rssi) {}
 };
 
 #endif
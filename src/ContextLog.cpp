@@ -0,0 +1,370 @@
+/**
+  * @file ContextLog.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Log structured context store on raw flash sectors
+  */
+
+#include "ContextLog.h"
+#include "helperFunctions.h"
+#include "EnigmaIOTdebug.h"
+#ifdef ESP32
+#include <esp_partition.h>
+#endif
+
+#define ALIGN4(x) (((x) + 3) & ~3)
+
+static const uint16_t RECORD_BUFFER_WORDS = ALIGN4 (sizeof (context_record_header_t) + CONTEXT_LOG_MAX_SIZE) / 4; ///< @brief Biggest record size in 4 byte words
+
+ContextLogClass ContextLog;
+
+#ifdef ESP8266
+extern "C" uint32_t _EEPROM_start;
+
+ContextFlash_halClass ContextFlash_hal;
+
+bool ContextFlash_halClass::begin () {
+	// EEPROM sector is used. Sketch must not use EEPROM library
+	firstSector = ((uint32_t)&_EEPROM_start - 0x40200000) / SPI_FLASH_SEC_SIZE;
+	sectors = 1;
+	return true;
+}
+
+bool ContextFlash_halClass::eraseSector (uint16_t sector) {
+	return ESP.flashEraseSector (firstSector + sector);
+}
+
+bool ContextFlash_halClass::write (uint16_t sector, uint16_t offset, const uint8_t* data, size_t len) {
+	return ESP.flashWrite ((firstSector + sector) * SPI_FLASH_SEC_SIZE + offset, (uint32_t*)data, len);
+}
+
+bool ContextFlash_halClass::read (uint16_t sector, uint16_t offset, uint8_t* data, size_t len) {
+	return ESP.flashRead ((firstSector + sector) * SPI_FLASH_SEC_SIZE + offset, (uint32_t*)data, len);
+}
+#elif defined ESP32
+ContextFlash_halClass ContextFlash_hal;
+
+bool ContextFlash_halClass::begin () {
+	const esp_partition_t* part = esp_partition_find_first (ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CONTEXT_LOG_PARTITION);
+	if (!part) {
+		DEBUG_WARN ("Partition %s not found", CONTEXT_LOG_PARTITION);
+		return false;
+	}
+	partition = part;
+	sectors = part->size / CONTEXT_SECTOR_SIZE;
+	if (sectors > CONTEXT_LOG_SECTORS) {
+		sectors = CONTEXT_LOG_SECTORS;
+	}
+	return sectors > 0;
+}
+
+bool ContextFlash_halClass::eraseSector (uint16_t sector) {
+	return esp_partition_erase_range ((const esp_partition_t*)partition, sector * CONTEXT_SECTOR_SIZE, CONTEXT_SECTOR_SIZE) == ESP_OK;
+}
+
+bool ContextFlash_halClass::write (uint16_t sector, uint16_t offset, const uint8_t* data, size_t len) {
+	return esp_partition_write ((const esp_partition_t*)partition, sector * CONTEXT_SECTOR_SIZE + offset, data, len) == ESP_OK;
+}
+
+bool ContextFlash_halClass::read (uint16_t sector, uint16_t offset, uint8_t* data, size_t len) {
+	return esp_partition_read ((const esp_partition_t*)partition, sector * CONTEXT_SECTOR_SIZE + offset, data, len) == ESP_OK;
+}
+#endif
+
+#ifdef __linux__
+ContextFlashSimClass::ContextFlashSimClass (uint16_t sectors) {
+	this->sectors = sectors > MAX_SECTORS ? MAX_SECTORS : sectors;
+	memset (memory, 0xFF, sizeof (memory));
+	memset (eraseCount, 0, sizeof (eraseCount));
+}
+
+bool ContextFlashSimClass::eraseSector (uint16_t sector) {
+	if (sector >= sectors) {
+		return false;
+	}
+	memset (memory[sector], 0xFF, CONTEXT_SECTOR_SIZE);
+	eraseCount[sector]++;
+	busyTime += ACCESS_TIME + ERASE_TIME;
+	return true;
+}
+
+bool ContextFlashSimClass::write (uint16_t sector, uint16_t offset, const uint8_t* data, size_t len) {
+	if (sector >= sectors || offset + len > CONTEXT_SECTOR_SIZE) {
+		return false;
+	}
+	size_t written = len;
+	if (writeLimit >= 0) {
+		written = (size_t)writeLimit < len ? writeLimit : len;
+		writeLimit -= written;
+	}
+	// Programming can only clear bits
+	for (size_t i = 0; i < written; i++) {
+		memory[sector][offset + i] &= data[i];
+	}
+	busyTime += ACCESS_TIME + (written + 3) / 4 * WRITE_TIME_PER_WORD;
+	return written == len;
+}
+
+bool ContextFlashSimClass::read (uint16_t sector, uint16_t offset, uint8_t* data, size_t len) {
+	if (sector >= sectors || offset + len > CONTEXT_SECTOR_SIZE) {
+		return false;
+	}
+	memcpy (data, memory[sector] + offset, len);
+	busyTime += ACCESS_TIME + (len + 3) / 4 * READ_TIME_PER_WORD;
+	return true;
+}
+#endif // __linux__
+
+bool ContextLogClass::readRecord (uint16_t sector, uint16_t offset, context_record_header_t* header, uint8_t* payload) {
+	uint32_t buffer[RECORD_BUFFER_WORDS];
+	const size_t headerLen = sizeof (context_record_header_t);
+
+	if (offset + headerLen > CONTEXT_SECTOR_SIZE) {
+		return false;
+	}
+	if (!flash->read (sector, offset, (uint8_t*)buffer, headerLen)) {
+		return false;
+	}
+	memcpy (header, buffer, headerLen);
+	if (header->magic != CONTEXT_RECORD_MAGIC || header->length > contextLen
+		|| offset + ALIGN4 (headerLen + header->length) > CONTEXT_SECTOR_SIZE) {
+		return false;
+	}
+	if (header->length && !flash->read (sector, offset + headerLen, (uint8_t*)buffer + headerLen, ALIGN4 (header->length))) {
+		return false;
+	}
+	if (calculateCRC32 ((uint8_t*)buffer + sizeof (uint32_t), headerLen - sizeof (uint32_t) + header->length) != header->crc) {
+		DEBUG_DBG ("Wrong CRC on context record %u at sector %u offset %u", header->sequence, sector, offset);
+		return false;
+	}
+	memcpy (payload, (uint8_t*)buffer + headerLen, header->length);
+	return true;
+}
+
+bool ContextLogClass::applyDelta (const uint8_t* payload, uint16_t len) {
+	uint16_t pos = 0;
+
+	/*
+	* Every changed range is encoded as
+	* ------------------------------------------
+	*| Offset (2) | Length (1) | Data (Length) |
+	* ------------------------------------------
+	*/
+	while (pos + 3 <= len) {
+		uint16_t offset = payload[pos] | (payload[pos + 1] << 8);
+		uint8_t rangeLen = payload[pos + 2];
+		pos += 3;
+		if (offset + rangeLen > contextLen || pos + rangeLen > len) {
+			return false;
+		}
+		memcpy (shadow + offset, payload + pos, rangeLen);
+		pos += rangeLen;
+	}
+	return pos == len;
+}
+
+uint16_t ContextLogClass::buildDelta (const uint8_t* context, uint8_t* payload, uint16_t maxLen) {
+	uint16_t pos = 0;
+	uint16_t i = 0;
+
+	while (i < contextLen) {
+		if (context[i] == shadow[i]) {
+			i++;
+			continue;
+		}
+		uint16_t start = i;
+		uint16_t end = i + 1;
+		// Short runs of equal bytes are included as they cost less than a new range header
+		for (uint16_t j = i + 1; j < contextLen && j - start < 255; j++) {
+			if (context[j] != shadow[j]) {
+				end = j + 1;
+			} else if (j - end >= 3) {
+				break;
+			}
+		}
+		uint16_t rangeLen = end - start;
+		if (pos + 3 + rangeLen > maxLen) {
+			return 0;
+		}
+		payload[pos++] = start & 0xFF;
+		payload[pos++] = start >> 8;
+		payload[pos++] = rangeLen;
+		memcpy (payload + pos, context + start, rangeLen);
+		pos += rangeLen;
+		i = end;
+	}
+	return pos;
+}
+
+bool ContextLogClass::appendRecord (context_record_type_t type, const uint8_t* payload, uint16_t len) {
+	uint32_t buffer[RECORD_BUFFER_WORDS];
+	context_record_header_t* header = (context_record_header_t*)buffer;
+	const size_t headerLen = sizeof (context_record_header_t);
+	size_t recordLen = ALIGN4 (headerLen + len);
+
+	memset (buffer, 0xFF, recordLen);
+	header->magic = CONTEXT_RECORD_MAGIC;
+	header->type = type;
+	header->length = len;
+	header->sequence = sequence + 1;
+	memcpy ((uint8_t*)buffer + headerLen, payload, len);
+	header->crc = calculateCRC32 ((uint8_t*)buffer + sizeof (uint32_t), headerLen - sizeof (uint32_t) + len);
+
+	if (!flash->write (sector, writePos, (uint8_t*)buffer, recordLen)) {
+		DEBUG_WARN ("Error writing context record at sector %u offset %u", sector, writePos);
+		writePos = CONTEXT_SECTOR_SIZE; // Area may be partially written. Continue on next sector
+		return false;
+	}
+	sequence++;
+	writePos += recordLen;
+	stats.bytesWritten += recordLen;
+	if (type == CONTEXT_RECORD_FULL) {
+		stats.fullRecords++;
+	} else {
+		stats.deltaRecords++;
+	}
+	return true;
+}
+
+bool ContextLogClass::begin (ContextFlashClass* flash, size_t contextLen) {
+	context_record_header_t header;
+	uint8_t payload[CONTEXT_LOG_MAX_SIZE];
+	int32_t latest = -1;
+	uint32_t latestSequence = 0;
+
+	this->flash = flash;
+	this->contextLen = 0;
+	valid = false;
+	sector = 0;
+	writePos = CONTEXT_SECTOR_SIZE;
+	stats.replayed = 0;
+
+	if (!flash || contextLen > CONTEXT_LOG_MAX_SIZE || !flash->begin () || !flash->getSectors ()) {
+		DEBUG_WARN ("Context log not available");
+		return false;
+	}
+	this->contextLen = contextLen;
+	if (flash->getSectors () == 1) {
+		DEBUG_INFO ("Single context sector. Context is lost if power fails while it is erased");
+	}
+
+	// Every sector starts with a full record. Latest sector is the one with highest sequence on it
+	for (uint16_t s = 0; s < flash->getSectors (); s++) {
+		if (readRecord (s, 0, &header, payload) && header.type == CONTEXT_RECORD_FULL && header.length == contextLen
+			&& (latest < 0 || (int32_t)(header.sequence - latestSequence) > 0)) {
+			latest = s;
+			latestSequence = header.sequence;
+		}
+	}
+	if (latest < 0) {
+		DEBUG_DBG ("No context found on flash");
+		return true;
+	}
+
+	sector = latest;
+	uint16_t offset = 0;
+	while (readRecord (sector, offset, &header, payload)) {
+		if (offset && header.sequence != sequence + 1) {
+			break; // Stale record from before last erase
+		}
+		if (header.type == CONTEXT_RECORD_FULL && header.length == contextLen) {
+			memcpy (shadow, payload, contextLen);
+		} else if (!offset || header.type != CONTEXT_RECORD_DELTA || !applyDelta (payload, header.length)) {
+			break;
+		}
+		sequence = header.sequence;
+		offset += ALIGN4 (sizeof (context_record_header_t) + header.length);
+		stats.replayed++;
+	}
+	valid = true;
+	writePos = offset;
+
+	// An interrupted write leaves garbage after last valid record. Log continues on next sector in that case
+	if (writePos + sizeof (context_record_header_t) <= CONTEXT_SECTOR_SIZE) {
+		uint32_t next[sizeof (context_record_header_t) / 4];
+		if (!flash->read (sector, writePos, (uint8_t*)next, sizeof (next))) {
+			writePos = CONTEXT_SECTOR_SIZE;
+		}
+		for (uint8_t i = 0; i < sizeof (next) / 4; i++) {
+			if (next[i] != 0xFFFFFFFF) {
+				writePos = CONTEXT_SECTOR_SIZE;
+				break;
+			}
+		}
+	}
+	DEBUG_DBG ("Context %u loaded from sector %u after %u records", sequence, sector, stats.replayed);
+	return true;
+}
+
+bool ContextLogClass::load (uint8_t* context) {
+	if (!isReady () || !valid) {
+		return false;
+	}
+	memcpy (context, shadow, contextLen);
+	return true;
+}
+
+bool ContextLogClass::save (const uint8_t* context) {
+	uint8_t delta[CONTEXT_LOG_MAX_SIZE];
+	const uint8_t* payload = context;
+	uint16_t len = contextLen;
+	context_record_type_t type = CONTEXT_RECORD_FULL;
+
+	if (!isReady ()) {
+		return false;
+	}
+	if (valid) {
+		if (!memcmp (shadow, context, contextLen)) {
+			stats.unchanged++;
+			return true;
+		}
+		// Delta is used only while it is clearly smaller than full context
+		uint16_t deltaLen = buildDelta (context, delta, contextLen / 2);
+		if (deltaLen) {
+			payload = delta;
+			len = deltaLen;
+			type = CONTEXT_RECORD_DELTA;
+		}
+	}
+
+	if (!valid || writePos + ALIGN4 (sizeof (context_record_header_t) + len) > CONTEXT_SECTOR_SIZE) {
+		// Next sector is started with a full record. Previous one keeps last context until it is erased again
+		uint16_t next = valid ? (sector + 1) % flash->getSectors () : sector;
+		if (!flash->eraseSector (next)) {
+			DEBUG_WARN ("Error erasing sector %u", next);
+			return false;
+		}
+		stats.sectorErases++;
+		sector = next;
+		writePos = 0;
+		payload = context;
+		len = contextLen;
+		type = CONTEXT_RECORD_FULL;
+	}
+
+	if (!appendRecord (type, payload, len)) {
+		return false;
+	}
+	memcpy (shadow, context, contextLen);
+	valid = true;
+	return true;
+}
+
+bool ContextLogClass::clear () {
+	bool result = true;
+
+	if (!isReady ()) {
+		return false;
+	}
+	for (uint16_t s = 0; s < flash->getSectors (); s++) {
+		if (!flash->eraseSector (s)) {
+			result = false;
+		} else {
+			stats.sectorErases++;
+		}
+	}
+	valid = false;
+	writePos = CONTEXT_SECTOR_SIZE;
+	return result;
+}
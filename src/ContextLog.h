@@ -0,0 +1,316 @@
+/**
+  * @file ContextLog.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Log structured context store on raw flash sectors
+  *
+  * Every save appends a record to current sector. A record holds either the whole context or only the byte ranges that
+  * changed since previous one, so counter updates take a few bytes. Records carry a sequence number and a CRC. When a
+  * sector is full next one is erased and started with a full record, so only the sector that has the highest sequence
+  * on its first record has to be replayed on boot. Sectors are used in turn to spread wear.
+  *
+  * A power loss while a record is written leaves previous context in place. With a single sector, as on ESP8266, that
+  * sector holds the only copy when it is erased to start again, so a power loss at that moment loses context and node
+  * has to register again. `extras/host/context_log_sim` checks every cut point.
+  *
+  * Flash access is done through `ContextFlashClass` so that it may be simulated on a host to measure wear and boot time.
+  */
+
+#ifndef _CONTEXT_LOG_h
+#define _CONTEXT_LOG_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+static const uint16_t CONTEXT_SECTOR_SIZE = 4096; ///< @brief Flash sector size
+static const uint16_t CONTEXT_LOG_MAX_SIZE = 512; ///< @brief Maximum context length
+
+/**
+  * @brief Record types
+  */
+enum context_record_type_t {
+	CONTEXT_RECORD_FULL = 0x01, /**< Record holds whole context */
+	CONTEXT_RECORD_DELTA = 0x02 /**< Record holds changed ranges as offset (2), length (1) and data */
+};
+
+/**
+  * @brief Record header. It is followed by payload and padding up to a multiple of 4 bytes
+  */
+typedef struct {
+	uint32_t crc; ///< @brief CRC32 of the rest of header and payload
+	uint8_t magic; ///< @brief Always `CONTEXT_RECORD_MAGIC`. Erased flash reads as 0xFF
+	uint8_t type; ///< @brief Record type from `context_record_type_t`
+	uint16_t length; ///< @brief Payload length
+	uint32_t sequence; ///< @brief Record sequence number. It is consecutive across sectors
+} context_record_header_t;
+
+static const uint8_t CONTEXT_RECORD_MAGIC = 0xC7; ///< @brief Marks a written record
+
+/**
+  * @brief Context store counters
+  */
+typedef struct {
+	uint32_t fullRecords; ///< @brief Full records written
+	uint32_t deltaRecords; ///< @brief Delta records written
+	uint32_t unchanged; ///< @brief Saves skipped because context did not change
+	uint32_t sectorErases; ///< @brief Sectors erased to continue the log
+	uint32_t bytesWritten; ///< @brief Bytes written to flash, including headers and padding
+	uint16_t replayed; ///< @brief Records applied on boot
+} context_log_stats_t;
+
+/**
+  * @brief Raw flash access used by context log. Offsets and lengths are always multiple of 4
+  */
+class ContextFlashClass {
+public:
+	virtual ~ContextFlashClass () {}
+
+	/**
+	  * @brief Locates flash area
+	  * @return `true` if there is at least one sector available
+	  */
+	virtual bool begin () = 0;
+
+	/**
+	  * @brief Gets number of sectors available for context log
+	  * @return Number of sectors
+	  */
+	virtual uint16_t getSectors () = 0;
+
+	/**
+	  * @brief Erases a sector. Every byte reads as 0xFF after it
+	  * @param sector Sector index
+	  * @return `true` on success
+	  */
+	virtual bool eraseSector (uint16_t sector) = 0;
+
+	/**
+	  * @brief Writes data to an erased area
+	  * @param sector Sector index
+	  * @param offset Offset inside sector
+	  * @param data Data to write. It must be 4 byte aligned
+	  * @param len Data length
+	  * @return `true` on success
+	  */
+	virtual bool write (uint16_t sector, uint16_t offset, const uint8_t* data, size_t len) = 0;
+
+	/**
+	  * @brief Reads data
+	  * @param sector Sector index
+	  * @param offset Offset inside sector
+	  * @param data Buffer to store data. It must be 4 byte aligned
+	  * @param len Data length
+	  * @return `true` on success
+	  */
+	virtual bool read (uint16_t sector, uint16_t offset, uint8_t* data, size_t len) = 0;
+};
+
+#if defined ESP8266 || defined ESP32
+/**
+  * @brief Context log sectors on ESP8266 EEPROM sector or on an ESP32 data partition labeled `CONTEXT_LOG_PARTITION`
+  */
+class ContextFlash_halClass : public ContextFlashClass {
+protected:
+#ifdef ESP8266
+	uint32_t firstSector = 0; ///< @brief Absolute number of first flash sector
+#elif defined ESP32
+	const void* partition = NULL; ///< @brief Partition that holds context log
+#endif
+	uint16_t sectors = 0; ///< @brief Number of sectors available
+
+public:
+	bool begin () override;
+
+	uint16_t getSectors () override {
+		return sectors;
+	}
+
+	bool eraseSector (uint16_t sector) override;
+
+	bool write (uint16_t sector, uint16_t offset, const uint8_t* data, size_t len) override;
+
+	bool read (uint16_t sector, uint16_t offset, uint8_t* data, size_t len) override;
+};
+
+extern ContextFlash_halClass ContextFlash_hal; ///< @brief Singleton instance of platform flash access
+#endif // ESP8266 || ESP32
+
+#ifdef __linux__
+/**
+  * @brief Flash simulation in memory. Keeps erase count of every sector and estimated busy time
+  */
+class ContextFlashSimClass : public ContextFlashClass {
+public:
+	static const uint8_t MAX_SECTORS = 16; ///< @brief Maximum number of simulated sectors
+	static const uint32_t ERASE_TIME = 45000; ///< @brief Sector erase time (us)
+	static const uint32_t WRITE_TIME_PER_WORD = 10; ///< @brief Program time of every 4 bytes (us)
+	static const uint32_t READ_TIME_PER_WORD = 1; ///< @brief Read time of every 4 bytes (us)
+	static const uint32_t ACCESS_TIME = 20; ///< @brief Fixed time spent on every operation (us)
+
+protected:
+	uint8_t memory[MAX_SECTORS][CONTEXT_SECTOR_SIZE]; ///< @brief Flash content
+	uint32_t eraseCount[MAX_SECTORS]; ///< @brief Erases done on every sector
+	uint16_t sectors; ///< @brief Number of simulated sectors
+	uint64_t busyTime = 0; ///< @brief Accumulated operation time (us)
+	int32_t writeLimit = -1; ///< @brief Bytes that may still be written before a simulated power loss. -1 for no limit
+
+public:
+	/**
+	  * @brief Class constructor. Every sector starts erased
+	  * @param sectors Number of sectors to simulate
+	  */
+	ContextFlashSimClass (uint16_t sectors = 2);
+
+	bool begin () override {
+		return sectors > 0;
+	}
+
+	uint16_t getSectors () override {
+		return sectors;
+	}
+
+	bool eraseSector (uint16_t sector) override;
+
+	bool write (uint16_t sector, uint16_t offset, const uint8_t* data, size_t len) override;
+
+	bool read (uint16_t sector, uint16_t offset, uint8_t* data, size_t len) override;
+
+	/**
+	  * @brief Simulates a power loss after some more bytes are written. Following writes are ignored
+	  * @param bytes Number of bytes to write before failure. -1 to disable
+	  */
+	void setWriteLimit (int32_t bytes) {
+		writeLimit = bytes;
+	}
+
+	/**
+	  * @brief Gets number of erases done on a sector
+	  * @param sector Sector index
+	  * @return Erase count
+	  */
+	uint32_t getEraseCount (uint16_t sector) {
+		return sector < sectors ? eraseCount[sector] : 0;
+	}
+
+	/**
+	  * @brief Gets accumulated flash operation time
+	  * @return Time in microseconds
+	  */
+	uint64_t getBusyTime () {
+		return busyTime;
+	}
+
+	/**
+	  * @brief Resets accumulated flash operation time. Used to measure a boot
+	  */
+	void resetBusyTime () {
+		busyTime = 0;
+	}
+};
+#endif // __linux__
+
+/**
+  * @brief Log structured context store
+  */
+class ContextLogClass {
+protected:
+	ContextFlashClass* flash = NULL; ///< @brief Flash access
+	uint8_t shadow[CONTEXT_LOG_MAX_SIZE]; ///< @brief Last saved context. Deltas are calculated against it
+	uint16_t contextLen = 0; ///< @brief Context length
+	bool valid = false; ///< @brief `true` if `shadow` holds a stored context
+	uint16_t sector = 0; ///< @brief Sector being written
+	uint16_t writePos = CONTEXT_SECTOR_SIZE; ///< @brief Offset for next record. Sector size means next one has to be started
+	uint32_t sequence = 0; ///< @brief Sequence number of last record
+	context_log_stats_t stats = {}; ///< @brief Context store counters
+
+	/**
+	  * @brief Reads and checks a record
+	  * @param sector Sector index
+	  * @param offset Record offset
+	  * @param header Gets record header
+	  * @param payload Gets record payload. It must have room for `CONTEXT_LOG_MAX_SIZE` bytes plus delta overhead
+	  * @return `true` if record is valid
+	  */
+	bool readRecord (uint16_t sector, uint16_t offset, context_record_header_t* header, uint8_t* payload);
+
+	/**
+	  * @brief Applies a delta record payload to `shadow`
+	  * @param payload Delta payload
+	  * @param len Payload length
+	  * @return `true` if every range is inside context
+	  */
+	bool applyDelta (const uint8_t* payload, uint16_t len);
+
+	/**
+	  * @brief Builds a delta payload with ranges that differ from `shadow`
+	  * @param context New context
+	  * @param payload Buffer to store payload
+	  * @param maxLen Maximum payload length
+	  * @return Payload length. 0 if it does not fit in `maxLen`
+	  */
+	uint16_t buildDelta (const uint8_t* context, uint8_t* payload, uint16_t maxLen);
+
+	/**
+	  * @brief Writes a record at current position
+	  * @param type Record type
+	  * @param payload Record payload
+	  * @param len Payload length
+	  * @return `true` on success
+	  */
+	bool appendRecord (context_record_type_t type, const uint8_t* payload, uint16_t len);
+
+public:
+	/**
+	  * @brief Locates latest context and prepares log for appending
+	  * @param flash Flash access
+	  * @param contextLen Context length
+	  * @return `true` if flash area is available. It does not mean that a context was found
+	  */
+	bool begin (ContextFlashClass* flash, size_t contextLen);
+
+	/**
+	  * @brief Gets latest stored context
+	  * @param context Buffer to store context
+	  * @return `true` if a valid context was found on flash
+	  */
+	bool load (uint8_t* context);
+
+	/**
+	  * @brief Stores context. Nothing is written if it did not change. Only changed bytes are written if they are few
+	  * @param context Context to store
+	  * @return `true` on success
+	  */
+	bool save (const uint8_t* context);
+
+	/**
+	  * @brief Erases every sector so that no context is found on next boot
+	  * @return `true` on success
+	  */
+	bool clear ();
+
+	/**
+	  * @brief Checks if log was started successfully
+	  * @return `true` if flash area is available
+	  */
+	bool isReady () {
+		return flash && contextLen;
+	}
+
+	/**
+	  * @brief Gets context store counters
+	  * @return Pointer to counters
+	  */
+	const context_log_stats_t* getStats () {
+		return &stats;
+	}
+};
+
+extern ContextLogClass ContextLog; ///< @brief Singleton instance of context log
+
+#endif // _CONTEXT_LOG_h
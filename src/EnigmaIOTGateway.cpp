@@ -181,6 +181,97 @@ bool buildSendBrcastKey (uint8_t* data, size_t& dataLen, const uint8_t* key, siz
 
 }
 
+bool buildKeyUpdate (uint8_t* data, size_t& dataLen, Node* node) {
+	if (!node || !node->isKeyUpdatePending ()) {
+		return false;
+	}
+	if (dataLen < 1 + sizeof (uint16_t) + KEY_UPDATE_SALT_LENGTH) {
+		DEBUG_ERROR ("Not enough space to build message");
+		return false;
+	}
+	uint16_t epoch = node->getKeyEpoch () + 1;
+	data[0] = (uint8_t)control_message_type::KEY_UPDATE;
+	memcpy (data + 1, &epoch, sizeof (uint16_t));
+	memcpy (data + 1 + sizeof (uint16_t), node->getKeyUpdateSalt (), KEY_UPDATE_SALT_LENGTH);
+	dataLen = 1 + sizeof (uint16_t) + KEY_UPDATE_SALT_LENGTH;
+	return true;
+}
+
+bool buildFragmentStatus (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
+	/*
+	* ---------------------------------------------------------------
+	*| FRAGMENT_STATUS (1) | Sequence (1) | Missing fragments (1) |
+	* ---------------------------------------------------------------
+	*/
+	if (!inputData || inputLen != 2) {
+		return false;
+	}
+	if (dataLen < 1 + inputLen) {
+		DEBUG_ERROR ("Not enough space to build message");
+		return false;
+	}
+	data[0] = (uint8_t)control_message_type::FRAGMENT_STATUS;
+	memcpy (data + 1, inputData, inputLen);
+	dataLen = 1 + inputLen;
+	return true;
+}
+
+#if USE_TX_SLOTS
+bool buildTxSlot (uint8_t* data, size_t& dataLen, Node* node) {
+	/*
+	* ----------------------------------------------
+	*| TX_SLOT (1) | Period (4) | Delay to slot (4) |
+	* ----------------------------------------------
+	* Delay is time in ms from this message to next slot start
+	*/
+	if (!node || !node->getSleepPeriod ()) {
+		return false;
+	}
+	if (dataLen < 1 + 2 * sizeof (uint32_t)) {
+		DEBUG_ERROR ("Not enough space to build message");
+		return false;
+	}
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	int64_t now = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	uint32_t sleepPeriod = node->getSleepPeriod ();
+	uint32_t period = sleepPeriod * 1000;
+	uint32_t delay = (node->getTxSlotOffset () + period - (uint32_t)(now % period)) % period;
+
+	data[0] = (uint8_t)control_message_type::TX_SLOT;
+	memcpy (data + 1, &sleepPeriod, sizeof (uint32_t));
+	memcpy (data + 1 + sizeof (uint32_t), &delay, sizeof (uint32_t));
+	dataLen = 1 + 2 * sizeof (uint32_t);
+	return true;
+}
+#endif // USE_TX_SLOTS
+
+#if USE_DOWNLINK_END
+bool buildDownlinkEnd (uint8_t* data, size_t& dataLen, Node* node) {
+	/*
+	* -------------------------------------------------------------
+	*| DOWNLINK_END (1) | Data counter (4) | Control counter (4) |
+	* -------------------------------------------------------------
+	* Counters are the last ones received from node, so that it knows which of its messages this answers
+	*/
+	if (!node) {
+		return false;
+	}
+	if (dataLen < 1 + 2 * sizeof (uint32_t)) {
+		DEBUG_ERROR ("Not enough space to build message");
+		return false;
+	}
+	uint32_t dataCounter = node->getLastMessageCounter ();
+	uint32_t controlCounter = node->getLastControlCounter ();
+
+	data[0] = (uint8_t)control_message_type::DOWNLINK_END;
+	memcpy (data + 1, &dataCounter, sizeof (uint32_t));
+	memcpy (data + 1 + sizeof (uint32_t), &controlCounter, sizeof (uint32_t));
+	dataLen = 1 + 2 * sizeof (uint32_t);
+	return true;
+}
+#endif // USE_DOWNLINK_END
+
 int getNextNumber (char*& data, size_t& len/*, char* &position*/) {
 	char strNum[10];
 	int number;
@@ -318,6 +409,18 @@ bool buildOtaMsg (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size
 			decodedLen++;
 		}
 
+		// Image format is optional. It is not sent if update tool does not set it so that older nodes get the same message
+		if (payloadLen > 33 && payload[32] == ',') {
+			if (payload[33] < '0' || payload[33] > '9') {
+				DEBUG_ERROR ("OTA message format error. Image format is not a number");
+				return false;
+			}
+			*tempData = (uint8_t)(payload[33] - '0');
+			tempData++;
+			decodedLen++;
+			DEBUG_WARN ("OTA image format %u", payload[33] - '0');
+		}
+
 		DEBUG_VERBOSE ("Payload data: %s", printHexBuffer (data, decodedLen));
 	}
 
@@ -420,6 +523,10 @@ bool EnigmaIOTGatewayClass::sendDownstream (uint8_t* mac, const uint8_t* data, s
 		}
 		DEBUG_VERBOSE ("Set Sleep. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
 		break;
+#if USE_OTA_CACHE
+	case control_message_type::OTA_IMAGE:
+		return storeOtaImage (node, data, len);
+#endif // USE_OTA_CACHE
 	case control_message_type::OTA:
 		if (!buildOtaMsg (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building OTA message");
@@ -491,6 +598,38 @@ bool EnigmaIOTGatewayClass::sendDownstream (uint8_t* mac, const uint8_t* data, s
 		}
 		DEBUG_VERBOSE ("Broadcast key message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
 		break;
+	case control_message_type::KEY_UPDATE:
+		if (!buildKeyUpdate (downstreamData, dataLen, node)) {
+			DEBUG_ERROR ("Error building key update message");
+			return false;
+		}
+		DEBUG_VERBOSE ("Key update message. Len: %d", dataLen);
+		break;
+#if USE_TX_SLOTS
+	case control_message_type::TX_SLOT:
+		if (!buildTxSlot (downstreamData, dataLen, node)) {
+			DEBUG_ERROR ("Error building transmission slot message");
+			return false;
+		}
+		DEBUG_VERBOSE ("Transmission slot message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		break;
+#endif // USE_TX_SLOTS
+#if USE_DOWNLINK_END
+	case control_message_type::DOWNLINK_END:
+		if (!buildDownlinkEnd (downstreamData, dataLen, node)) {
+			DEBUG_ERROR ("Error building downlink end message");
+			return false;
+		}
+		DEBUG_VERBOSE ("Downlink end message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		break;
+#endif // USE_DOWNLINK_END
+	case control_message_type::FRAGMENT_STATUS:
+		if (!buildFragmentStatus (downstreamData, dataLen, data, len)) {
+			DEBUG_ERROR ("Error building fragment status message");
+			return false;
+		}
+		DEBUG_VERBOSE ("Fragment status message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		break;
 	case control_message_type::USERDATA_GET:
 		DEBUG_INFO ("Data message GET");
 		break;
@@ -774,6 +913,9 @@ void EnigmaIOTGatewayClass::begin (Comms_halClass* comm, uint8_t* networkKey, bo
 	CryptModule::random (broadcastKey, KEY_LENGTH); // Generate random broadcast key
 	DEBUG_DBG ("Broadcast key: %s", printHexBuffer (broadcastKey, KEY_LENGTH));
 	nodelist.getBroadcastNode ()->setEncryptionKey (broadcastKey);
+#if USE_HELLO_COOKIE
+	CryptModule::random (helloCookieSecret, KEY_LENGTH); // Cookie secret changes on every boot
+#endif
 
 	if (networkKey) {
 		memcpy (this->gwConfig.networkKey, networkKey, KEY_LENGTH);
@@ -951,6 +1093,16 @@ void EnigmaIOTGatewayClass::handle () {
 		}
 	}
 
+#if USE_OTA_CACHE
+	if (otaImageEndPending) {
+		otaImageEndPending = false;
+		endOtaImage ();
+	}
+	if (otaStreamPhase != OTA_STREAM_IDLE) {
+		handleOtaStream ();
+	}
+#endif // USE_OTA_CACHE
+
 	// Check input EnigmaIOT message queue
 
 	if (!input_queue->empty ()) {
@@ -977,6 +1129,14 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 		return;
 	}
 
+#if USE_HELLO_COOKIE
+	if (buf[0] == CLIENT_HELLO) {
+		if (!checkHelloCookie (mac, buf, count)) {
+			return; // Neither node slot nor current session are touched until a valid cookie is echoed
+		}
+	}
+#endif // USE_HELLO_COOKIE
+
 	node = nodelist.getNewNode (mac);
 
     if (!node) {
@@ -989,7 +1149,14 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 
     flashRx = true;
 
+#if USE_KEY_UPDATE
+	if (node->isKeyUpdatePending () && node->getStatus () == REGISTERED) {
+		checkPendingKey (node, buf, count);
+	}
+#endif // USE_KEY_UPDATE
+
 	int espNowError = 0; // TODO: May I remove this??
+	bool authenticated = false; // RSSI is given to link controller only if message is authenticated
 
 	switch (buf[0]) {
 	case CLIENT_HELLO:
@@ -1047,11 +1214,11 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 		if (node->getStatus () == REGISTERED) {
 			if (processControlMessage (mac, buf, count, node)) {
 				DEBUG_INFO ("Control message OK");
-				if (MAX_KEY_VALIDITY > 0) {
-					if (millis () - node->getKeyValidFrom () > MAX_KEY_VALIDITY) {
-						invalidateKey (node, KEY_EXPIRED);
-					}
-				}
+				authenticated = true;
+				checkKeyExpiration (node);
+#if USE_DOWNLINK_END
+				sendDownlinkEnd (node);
+#endif // USE_DOWNLINK_END
 			} else {
 				if (DISCONNECT_ON_DATA_ERROR) {
 					invalidateKey (node, WRONG_DATA);
@@ -1063,6 +1230,9 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 		}
 		break;
 	case SENSOR_DATA:
+	case SENSOR_AGGREGATED_DATA:
+	case SENSOR_BUFFERED_DATA:
+	case DATA_FRAGMENT:
     case UNENCRYPTED_NODE_DATA:
 #if SUPPORT_HA_DISCOVERY
     case HA_DISCOVERY_MESSAGE:
@@ -1072,6 +1242,15 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
         if (buf[0] == SENSOR_DATA) {
             DEBUG_INFO (" <------- ENCRYPTED DATA");
             encrypted = true;
+        } else if (buf[0] == SENSOR_AGGREGATED_DATA) {
+            DEBUG_INFO (" <------- AGGREGATED DATA");
+            encrypted = true;
+        } else if (buf[0] == SENSOR_BUFFERED_DATA) {
+            DEBUG_INFO (" <------- BUFFERED DATA");
+            encrypted = true;
+        } else if (buf[0] == DATA_FRAGMENT) {
+            DEBUG_INFO (" <------- DATA FRAGMENT");
+            encrypted = true;
         }
 #if SUPPORT_HA_DISCOVERY
         else if (buf[0] == HA_DISCOVERY_MESSAGE) {
@@ -1090,12 +1269,12 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
             if (processDataMessage (mac, buf, count, node, encrypted)) {
                 node->setLastMessageTime ();
                 DEBUG_INFO ("Data OK");
+                authenticated = true;
                 DEBUG_VERBOSE ("Key valid from %lu ms", millis () - node->getKeyValidFrom ());
-                if (MAX_KEY_VALIDITY > 0) {
-                    if (millis () - node->getKeyValidFrom () > MAX_KEY_VALIDITY) {
-                        invalidateKey (node, KEY_EXPIRED);
-                    }
-                }
+                checkKeyExpiration (node);
+#if USE_DOWNLINK_END
+                sendDownlinkEnd (node);
+#endif // USE_DOWNLINK_END
             } else {
                 if (DISCONNECT_ON_DATA_ERROR) {
                     invalidateKey (node, WRONG_DATA);
@@ -1116,11 +1295,8 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 		if (node->getStatus () == REGISTERED) {
 			if (processClockRequest (mac, buf, count, node)) {
 				DEBUG_INFO ("Clock request OK");
-				if (MAX_KEY_VALIDITY > 0) {
-					if (millis () - node->getKeyValidFrom () > MAX_KEY_VALIDITY) {
-						invalidateKey (node, KEY_EXPIRED);
-					}
-				}
+				authenticated = true;
+				checkKeyExpiration (node);
 			} else {
 				invalidateKey (node, WRONG_DATA);
 				DEBUG_WARN ("Clock request not OK");
@@ -1135,6 +1311,7 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 		if (node->getStatus () == REGISTERED) {
 			if (processNodeNameSet (mac, buf, count, node)) {
 				DEBUG_INFO ("Node name for node %d set to %s", node->getNodeId (), node->getNodeName ());
+				authenticated = true;
 				if (notifyNewNode) {
 					notifyNewNode (node->getMacAddress (), node->getNodeId (), node->getNodeName ());
                 }
@@ -1147,68 +1324,71 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 	default:
 		DEBUG_INFO ("Received unknown EnigmaIOT message 0x%02X");
 	}
+
+	if (authenticated) {
+		comm->linkRssiUpdate (mac, rssi);
+	}
 }
 
 bool EnigmaIOTGatewayClass::nodeNameSetRespose (Node* node, int8_t error) {
 	/*
-	 * ------------------------------------------------------------------
-	 *| msgType (1) | IV (12) | Counter (2) | Result code (1) | tag (16) |
-	 * ------------------------------------------------------------------
+	 * ------------------------------------------------------------------------
+	 *| msgType (1) | IV (12) | Counter (2 or 4) | Result code (1) | tag (16) |
+	 * ------------------------------------------------------------------------
 	 */
-	struct __attribute__ ((packed, aligned (1))) {
-		uint8_t msgType;
-		uint8_t iv[IV_LENGTH];
-		uint16_t counter;
-		int8_t errorCode;
-		uint8_t tag[TAG_LENGTH];
-	} nodeNameSetResponse_msg;
+	uint8_t counterLen = node->getCounterLength ();
+	uint8_t iv_idx = 1;
+	uint8_t counter_idx = iv_idx + IV_LENGTH;
+	uint8_t errorCode_idx = counter_idx + counterLen;
+	uint8_t tag_idx = errorCode_idx + sizeof (int8_t);
+	const unsigned int NNSRMSG_LEN = tag_idx + TAG_LENGTH;
 
-	uint16_t counter;
+	uint8_t nodeNameSetResponse_msg[1 + IV_LENGTH + sizeof (uint32_t) + sizeof (int8_t) + TAG_LENGTH];
 
-	const unsigned int NNSRMSG_LEN = sizeof (nodeNameSetResponse_msg);
+	uint32_t counter;
 
-	nodeNameSetResponse_msg.msgType = NODE_NAME_RESULT;
+	nodeNameSetResponse_msg[0] = NODE_NAME_RESULT;
 
 	if (useCounter) {
 		counter = node->getLastDownlinkMsgCounter () + 1;
 		node->setLastDownlinkMsgCounter (counter);
 	} else {
-		counter = (uint16_t)(Crypto.random ());
+		counter = node->useCounter32 () ? Crypto.random () : (uint16_t)(Crypto.random ());
 	}
-	DEBUG_INFO ("Downlink message #%d", counter);
+	DEBUG_INFO ("Downlink message #%u", counter);
 
-	memcpy (&(nodeNameSetResponse_msg.counter), &counter, sizeof (uint16_t));
+	memcpy (nodeNameSetResponse_msg + counter_idx, &counter, counterLen);
 
 	DEBUG_DBG ("Set node name Response. Error code: %d", error);
 
-	CryptModule::random (nodeNameSetResponse_msg.iv, IV_LENGTH);
+	CryptModule::random (nodeNameSetResponse_msg + iv_idx, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (nodeNameSetResponse_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", printHexBuffer (nodeNameSetResponse_msg + iv_idx, IV_LENGTH));
 
-	nodeNameSetResponse_msg.errorCode = error;
+	nodeNameSetResponse_msg[errorCode_idx] = (uint8_t)error;
 
 	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
-	memcpy (aad, (uint8_t*)&nodeNameSetResponse_msg, addDataLen); // Copy message upto iv
+	memcpy (aad, nodeNameSetResponse_msg, addDataLen); // Copy message upto iv
 
 	// Copy 8 last bytes from node key
 	memcpy (aad + addDataLen, node->getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::encryptBuffer ((uint8_t*)&(nodeNameSetResponse_msg.errorCode), sizeof (int8_t), // Encrypt error code only, 1 byte
-									 nodeNameSetResponse_msg.iv, IV_LENGTH,
+	if (!CryptModule::encryptBuffer (nodeNameSetResponse_msg + errorCode_idx, sizeof (int8_t), // Encrypt error code only, 1 byte
+									 nodeNameSetResponse_msg + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), nodeNameSetResponse_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), nodeNameSetResponse_msg + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted set node name response message: %s", printHexBuffer ((uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted set node name response message: %s", printHexBuffer (nodeNameSetResponse_msg, NNSRMSG_LEN));
 
 	DEBUG_INFO (" -------> SEND SET NODE NAME RESPONSE");
 	uint8_t* addr = node->getMacAddress ();
 	//char addrStr[ENIGMAIOT_ADDR_LEN * 3];
-	if (comm->send (addr, (uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN) == 0) {
+	if (comm->send (addr, nodeNameSetResponse_msg, NNSRMSG_LEN) == 0) {
 		DEBUG_INFO ("Set Node Name Response message sent to %s", mac2str (addr));
 		return true;
 	} else {
@@ -1220,22 +1400,23 @@ bool EnigmaIOTGatewayClass::nodeNameSetRespose (Node* node, int8_t error) {
 
 bool EnigmaIOTGatewayClass::processNodeNameSet (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node) {
 	/*
-	* ------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | NodeID (2) | Counter (2) | Node name (up to 32) | tag (16) |
-	* ------------------------------------------------------------------------------------
+	* -------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | NodeID (2) | Counter (2 or 4) | Node name (up to 32) | tag (16) |
+	* -------------------------------------------------------------------------------------------
 	*/
 	int8_t error = 0;
 
 	char nodeName[NODE_NAME_LENGTH];
 	memset ((void*)nodeName, 0, NODE_NAME_LENGTH);
 
+	uint8_t counterLen = node->getCounterLength ();
 	uint8_t iv_idx = 1;
 	uint8_t nodeId_idx = iv_idx + IV_LENGTH;
 	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
-	uint8_t nodeName_idx = counter_idx + sizeof (int16_t);
+	uint8_t nodeName_idx = counter_idx + counterLen;
 	uint8_t tag_idx = count - TAG_LENGTH;
 
-	uint16_t counter;
+	uint32_t counter = 0;
 
 	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
@@ -1249,17 +1430,16 @@ bool EnigmaIOTGatewayClass::processNodeNameSet (const uint8_t mac[ENIGMAIOT_ADDR
 	if (!CryptModule::decryptBuffer (buf + nodeId_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
 									 buf + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
 		DEBUG_ERROR ("Error during decryption");
 		error = -4; // Message error
 	}
 
-	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
-	DEBUG_INFO ("Node Id %d. Control message #%d", node->getNodeId (), counter);
-	if (useCounter) {
-		if (counter > node->getLastControlCounter ()) {
+	memcpy (&counter, &(buf[counter_idx]), counterLen);
+	DEBUG_INFO ("Node Id %d. Control message #%u", node->getNodeId (), counter);
+	if (useCounter && !error) { // Counter is not trusted if message could not be decrypted
+		if (node->acceptControlCounter (counter)) {
 			DEBUG_INFO ("Accepted");
-			node->setLastControlCounter (counter);
 		} else {
 			DEBUG_WARN ("Control message rejected");
 			return false;
@@ -1295,19 +1475,20 @@ bool EnigmaIOTGatewayClass::processNodeNameSet (const uint8_t mac[ENIGMAIOT_ADDR
 
 bool EnigmaIOTGatewayClass::processControlMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node) {
 	/*
-	* ----------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2) | Data (....) | Tag (16) |
-	* ----------------------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2 or 4) | Data (....) | Tag (16) |
+	* -----------------------------------------------------------------------------------------------
 	*/
 
+	uint8_t counterLen = node->getCounterLength ();
 	uint8_t iv_idx = 1;
 	uint8_t length_idx = iv_idx + IV_LENGTH;
 	uint8_t nodeId_idx = length_idx + sizeof (int16_t);
 	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
-	uint8_t data_idx = counter_idx + sizeof (int16_t);
+	uint8_t data_idx = counter_idx + counterLen;
 	uint8_t tag_idx = count - TAG_LENGTH;
 
-	uint16_t counter;
+	uint32_t counter = 0;
 
 	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
@@ -1322,27 +1503,54 @@ bool EnigmaIOTGatewayClass::processControlMessage (const uint8_t mac[ENIGMAIOT_A
 	if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
 									 buf + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
 	DEBUG_VERBOSE ("Decripted control message: %s", printHexBuffer (buf, count - TAG_LENGTH));
 
-	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
-	DEBUG_INFO ("Node Id %d. Control message #%d", node->getNodeId (), counter);
+	memcpy (&counter, &(buf[counter_idx]), counterLen);
+	DEBUG_INFO ("Node Id %d. Control message #%u", node->getNodeId (), counter);
 	if (useCounter) {
-		if (counter > node->getLastControlCounter ()) {
+		if (node->acceptControlCounter (counter)) {
 			DEBUG_INFO ("Accepted");
-			node->setLastControlCounter (counter);
 		} else {
-            DEBUG_WARN ("Control message rejected. Last counter: %u. Current counter", node->getLastControlCounter (), counter);
+            DEBUG_WARN ("Control message rejected. Last counter: %u. Current counter: %u", node->getLastControlCounter (), counter);
 			return false;
 		}
 	}
 
 	// Check if command informs about a sleepy mode change
 	const uint8_t* payload = buf + data_idx;
+
+#if USE_KEY_UPDATE
+	// Key update confirmation is internal. Pending key was already committed when this message was authenticated with it
+	if (payload[0] == control_message_type::KEY_UPDATE_ANS && (tag_idx - data_idx) >= 1 + sizeof (uint16_t)) {
+		uint16_t epoch;
+		memcpy (&epoch, payload + 1, sizeof (uint16_t));
+		DEBUG_INFO ("Node %d confirmed key epoch %u", node->getNodeId (), epoch);
+		if (epoch != node->getKeyEpoch ()) {
+			DEBUG_WARN ("Key epoch mismatch. Gateway is on epoch %u", node->getKeyEpoch ());
+		}
+		return true;
+	}
+#endif // USE_KEY_UPDATE
+#if USE_TX_SLOTS
+	// Slot request is internal. Node reports its sleep period and gets its slot at once
+	if (payload[0] == control_message_type::TX_SLOT_REQUEST && (tag_idx - data_idx) >= 1 + sizeof (uint32_t)) {
+		uint32_t period;
+		memcpy (&period, payload + 1, sizeof (uint32_t));
+		node->setSleepPeriod (period);
+		if (period) {
+			DEBUG_INFO ("Node %d sleep period is %u s. Slot starts at %u ms", node->getNodeId (), period, node->getTxSlotOffset ());
+			if (!sendDownstream (node->getMacAddress (), NULL, 0, control_message_type::TX_SLOT)) {
+				DEBUG_WARN ("Error sending transmission slot");
+			}
+		}
+		return true;
+	}
+#endif // USE_TX_SLOTS
 	if (payload[0] == control_message_type::SLEEP_ANS && (tag_idx - data_idx) >= 5) {
 		uint32_t sleepTime;
 		DEBUG_DBG ("Check if sleepy mode has changed for node");
@@ -1358,6 +1566,13 @@ bool EnigmaIOTGatewayClass::processControlMessage (const uint8_t mac[ENIGMAIOT_A
 
 	DEBUG_DBG ("Payload length: %d bytes", tag_idx - data_idx);
 
+#if USE_OTA_CACHE
+	// Acknowledgements of an update sent from cache are consumed here. Broker gets progress events instead
+	if (processOtaAnswer (node, payload, tag_idx - data_idx)) {
+		return true;
+	}
+#endif // USE_OTA_CACHE
+
 	char* nodeName = node->getNodeName ();
 
 	if (notifyData) {
@@ -1369,17 +1584,18 @@ bool EnigmaIOTGatewayClass::processControlMessage (const uint8_t mac[ENIGMAIOT_A
 
 bool EnigmaIOTGatewayClass::processUnencryptedDataMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node) {
 	/*
-	* ------------------------------------------------------------------------
-	*| msgType (1) | NodeId (2) | Counter (2) | PayloadType (1) | Data (....) |
-	* ------------------------------------------------------------------------
+	* -------------------------------------------------------------------------------
+	*| msgType (1) | NodeId (2) | Counter (2 or 4) | PayloadType (1) | Data (....) |
+	* -------------------------------------------------------------------------------
 	*/
 
+	uint8_t counterLen = node->getCounterLength ();
 	uint8_t nodeId_idx = 1;
 	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
-	uint8_t payloadType_idx = counter_idx + sizeof (int16_t);
+	uint8_t payloadType_idx = counter_idx + counterLen;
 	uint8_t data_idx = payloadType_idx + sizeof (int8_t);
 
-	uint16_t counter;
+	uint32_t counter = 0;
 	size_t lostMessages = 0;
 
 	//uint8_t packetLen = count; // Not used
@@ -1388,14 +1604,18 @@ bool EnigmaIOTGatewayClass::processUnencryptedDataMessage (const uint8_t mac[ENI
 
 	node->packetNumber++;
 
-	memcpy (&counter, &buf[counter_idx], sizeof (uint16_t));
+	memcpy (&counter, &buf[counter_idx], counterLen);
 	if (useCounter) {
-		if (counter > node->getLastMessageCounter ()) {
-			lostMessages = counter - node->getLastMessageCounter () - 1;
-			node->packetErrors += lostMessages;
-			node->setLastMessageCounter (counter);
+		uint32_t lastCounter = node->getLastMessageCounter ();
+		if (node->acceptMessageCounter (counter)) {
+			if (counter > lastCounter) {
+				lostMessages = counter - lastCounter - 1;
+				node->packetErrors += lostMessages;
+			} else if (node->packetErrors > 0) {
+				node->packetErrors--; // Late message inside replay window was counted as lost before
+			}
 		} else {
-			DEBUG_WARN ("Data counter error %d : %d", counter, node->getLastMessageCounter ());
+			DEBUG_WARN ("Data counter error %u : %u", counter, node->getLastMessageCounter ());
 			return false;
 		}
 	}
@@ -1403,6 +1623,9 @@ bool EnigmaIOTGatewayClass::processUnencryptedDataMessage (const uint8_t mac[ENI
 	char* nodeName = node->getNodeName ();
 
 	if (notifyData) {
+		struct timeval tv;
+		gettimeofday (&tv, NULL);
+		dataTimestamp = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
 		notifyData (const_cast<uint8_t*>(mac), &(buf[data_idx]), count - data_idx, lostMessages, false, RAW, nodeName ? nodeName : NULL);
 	}
 
@@ -1420,26 +1643,219 @@ bool EnigmaIOTGatewayClass::processUnencryptedDataMessage (const uint8_t mac[ENI
 }
 
 
+bool EnigmaIOTGatewayClass::notifyAggregatedData (const uint8_t* mac, uint8_t* data, uint8_t len, uint16_t lostMessages, gatewayPayloadEncoding_t encoding, char* nodeName, uint8_t ageLength) {
+	/*
+	* ----------------------------------------------------------------------
+	*| Age (2) | Length (1) | Reading (....) | Age (2) | Length (1) | ... |
+	* ----------------------------------------------------------------------
+	* Age is in milliseconds. It takes 4 bytes on buffered data messages
+	*/
+	const uint8_t header_len = ageLength + sizeof (uint8_t);
+	struct timeval tv;
+	uint8_t idx = 0;
+	uint8_t readings = 0;
+
+	// Check format before notifying anything
+	while (idx < len) {
+		if (idx + header_len > len || idx + header_len + data[idx + ageLength] > len) {
+			DEBUG_WARN ("Wrong aggregated data format");
+			return false;
+		}
+		idx += header_len + data[idx + ageLength];
+		readings++;
+	}
+	DEBUG_INFO ("%u aggregated readings", readings);
+
+	if (!notifyData) {
+		return true;
+	}
+
+	gettimeofday (&tv, NULL);
+	int64_t now = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	idx = 0;
+	while (idx < len) {
+		uint32_t age = 0;
+		memcpy (&age, data + idx, ageLength); // Little endian
+		uint8_t readingLen = data[idx + ageLength];
+		dataTimestamp = now - age;
+		notifyData (const_cast<uint8_t*>(mac), data + idx + header_len, readingLen, lostMessages, false, encoding, nodeName ? nodeName : NULL);
+		lostMessages = 0; // Lost messages are notified only once
+		idx += header_len + readingLen;
+	}
+	return true;
+}
+
+fragment_buffer_t* EnigmaIOTGatewayClass::getReassemblyBuffer (Node* node, uint8_t seq, uint8_t total) {
+	fragment_buffer_t* buffer = NULL;
+	uint16_t nodeId = node->getNodeId ();
+
+	for (int i = 0; i < FRAGMENT_POOL_SIZE; i++) {
+		fragment_buffer_t* entry = &reassemblyPool[i];
+		if (entry->used && millis () - entry->lastFragment > FRAGMENT_REASSEMBLY_TIMEOUT) {
+			if (!entry->complete) {
+				DEBUG_WARN ("Fragmented message %u from node %u timed out", entry->seq, entry->nodeId);
+			}
+			free (entry->data);
+			entry->data = NULL;
+			entry->used = false;
+		}
+		if (entry->used && entry->nodeId == nodeId) {
+			if (entry->seq == seq && entry->total == total) {
+				return entry;
+			}
+			buffer = entry; // A node sends only one fragmented message at a time. Older one is discarded
+		}
+	}
+
+	if (!buffer) {
+		for (int i = 0; i < FRAGMENT_POOL_SIZE; i++) {
+			if (!reassemblyPool[i].used) {
+				buffer = &reassemblyPool[i];
+				break;
+			}
+		}
+	}
+	if (!buffer) {
+		return NULL;
+	}
+	if (!buffer->data) {
+		buffer->data = (uint8_t*)malloc (MAX_FRAGMENTED_LENGTH);
+		if (!buffer->data) {
+			DEBUG_WARN ("Not enough memory for fragmented message");
+			buffer->used = false;
+			return NULL;
+		}
+	}
+
+	buffer->used = true;
+	buffer->complete = false;
+	buffer->nodeId = nodeId;
+	buffer->seq = seq;
+	buffer->total = total;
+	buffer->received = 0;
+	buffer->lostMessages = 0;
+	buffer->len = 0;
+	buffer->lastFragment = millis ();
+	return buffer;
+}
+
+bool EnigmaIOTGatewayClass::sendFragmentStatus (Node* node, fragment_buffer_t* buffer) {
+	uint8_t status[2];
+
+	status[0] = buffer->seq;
+	status[1] = ~buffer->received & ((1 << buffer->total) - 1); // Missing fragments
+	DEBUG_INFO ("Fragmented message %u status. Missing 0x%02X", buffer->seq, status[1]);
+	return sendDownstream (node->getMacAddress (), status, sizeof (status), control_message_type::FRAGMENT_STATUS);
+}
+
+bool EnigmaIOTGatewayClass::processFragment (const uint8_t* mac, Node* node, const uint8_t* data, size_t len, uint16_t lostMessages, gatewayPayloadEncoding_t encoding) {
+	/*
+	* ----------------------------------------------------------------------------
+	*| Sequence (1) | Index (1) | Total (1) | MsgType (1) | Fragment data (....) |
+	* ----------------------------------------------------------------------------
+	*/
+	if (len <= FRAGMENT_HEADER_LENGTH) {
+		DEBUG_WARN ("Fragment too short");
+		return false;
+	}
+
+	uint8_t seq = data[0];
+	uint8_t index = data[1];
+	uint8_t total = data[2];
+	uint8_t msgType = data[3];
+	size_t fragmentLen = len - FRAGMENT_HEADER_LENGTH;
+
+	if (!total || total > MAX_FRAGMENTS || index >= total
+		|| fragmentLen > FRAGMENT_DATA_LENGTH || (index < total - 1 && fragmentLen != FRAGMENT_DATA_LENGTH)) {
+		DEBUG_WARN ("Wrong fragment format");
+		return false;
+	}
+	if (msgType != SENSOR_DATA && msgType != HA_DISCOVERY_MESSAGE) {
+		DEBUG_WARN ("Wrong fragmented message type 0x%02X", msgType);
+		return false;
+	}
+
+	fragment_buffer_t* buffer = getReassemblyBuffer (node, seq, total);
+	if (!buffer) {
+		DEBUG_WARN ("No reassembly buffer available. Fragment ignored");
+		return true; // Node will send it again
+	}
+	buffer->lastFragment = millis ();
+
+	if (buffer->complete) {
+		DEBUG_DBG ("Fragment %u of complete message %u. Status is sent again", index, seq);
+		return sendFragmentStatus (node, buffer);
+	}
+
+	DEBUG_DBG ("Fragment %u/%u of message %u. %d bytes", index + 1, total, seq, fragmentLen);
+	if (!(buffer->received & (1 << index))) {
+		memcpy (buffer->data + index * FRAGMENT_DATA_LENGTH, data + FRAGMENT_HEADER_LENGTH, fragmentLen);
+		buffer->received |= 1 << index;
+		buffer->lostMessages += lostMessages;
+		buffer->msgType = msgType;
+		buffer->encoding = encoding;
+		if (index == total - 1) {
+			buffer->len = index * FRAGMENT_DATA_LENGTH + fragmentLen;
+		}
+	}
+
+	if (buffer->received != (uint8_t)((1 << total) - 1)) {
+		if (index == total - 1) {
+			sendFragmentStatus (node, buffer);
+		}
+		return true;
+	}
+
+	// Node is acknowledged before notifying message, as it may take some time
+	buffer->complete = true;
+	sendFragmentStatus (node, buffer);
+	DEBUG_INFO ("Fragmented message %u reassembled. %d bytes", seq, buffer->len);
+
+	char* nodeName = node->getNodeName ();
+#if SUPPORT_HA_DISCOVERY
+	if (buffer->msgType == HA_DISCOVERY_MESSAGE) {
+		sendHADiscoveryJSON (const_cast<uint8_t*>(mac), buffer->data, buffer->len, gwConfig.networkName, nodeName ? nodeName : NULL);
+	} else
+#endif // SUPPORT_HA_DISCOVERY
+		if (buffer->msgType == SENSOR_DATA) {
+			struct timeval tv;
+			gettimeofday (&tv, NULL);
+			dataTimestamp = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+			if (notifyLongData) {
+				notifyLongData (const_cast<uint8_t*>(mac), buffer->data, buffer->len, buffer->lostMessages, buffer->encoding, nodeName ? nodeName : NULL);
+			} else if (notifyData && buffer->len <= UINT8_MAX) {
+				notifyData (const_cast<uint8_t*>(mac), buffer->data, buffer->len, buffer->lostMessages, false, buffer->encoding, nodeName ? nodeName : NULL);
+			} else {
+				DEBUG_WARN ("No long data handler. Message discarded");
+			}
+		}
+	// Entry is kept without data to answer retransmissions of last fragment until it times out
+	free (buffer->data);
+	buffer->data = NULL;
+	return true;
+}
+
 bool EnigmaIOTGatewayClass::processDataMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node, bool encrypted) {
 	/*
-	* ----------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2) | Data (....) | Tag (16) |
-	* ----------------------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2 or 4) | Data (....) | Tag (16) |
+	* -----------------------------------------------------------------------------------------------
 	*/
 
 	if (!encrypted) {
 		return processUnencryptedDataMessage (mac, buf, count, node);
 	}
 
+	uint8_t counterLen = node->getCounterLength ();
 	uint8_t iv_idx = 1;
 	uint8_t length_idx = iv_idx + IV_LENGTH;
 	uint8_t nodeId_idx = length_idx + sizeof (int16_t);
 	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
-	uint8_t encoding_idx = counter_idx + sizeof (int16_t);
+	uint8_t encoding_idx = counter_idx + counterLen;
 	uint8_t data_idx = encoding_idx + sizeof (int8_t);
 	uint8_t tag_idx = count - TAG_LENGTH;
 
-	uint16_t counter;
+	uint32_t counter = 0;
 	size_t lostMessages = 0;
 
 	const uint8_t addDataLen = 1 + IV_LENGTH;
@@ -1455,7 +1871,7 @@ bool EnigmaIOTGatewayClass::processDataMessage (const uint8_t mac[ENIGMAIOT_ADDR
 	if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
 									 buf + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
@@ -1463,14 +1879,18 @@ bool EnigmaIOTGatewayClass::processDataMessage (const uint8_t mac[ENIGMAIOT_ADDR
 	DEBUG_DBG ("Data payload encoding: 0x%02X", buf[encoding_idx]);
 	node->packetNumber++;
 
-	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
-	DEBUG_INFO ("Node Id %d. Data message #%d", node->getNodeId (), counter);
+	memcpy (&counter, &(buf[counter_idx]), counterLen);
+	DEBUG_INFO ("Node Id %d. Data message #%u", node->getNodeId (), counter);
 	if (useCounter) {
-		if (counter > node->getLastMessageCounter ()) {
+		uint32_t lastCounter = node->getLastMessageCounter ();
+		if (node->acceptMessageCounter (counter)) {
 			DEBUG_INFO ("Accepted");
-			lostMessages = counter - node->getLastMessageCounter () - 1;
-			node->packetErrors += lostMessages;
-			node->setLastMessageCounter (counter);
+			if (counter > lastCounter) {
+				lostMessages = counter - lastCounter - 1;
+				node->packetErrors += lostMessages;
+			} else if (node->packetErrors > 0) {
+				node->packetErrors--; // Late message inside replay window was counted as lost before
+			}
 		} else {
 			DEBUG_WARN ("Data message rejected");
 			return false;
@@ -1485,12 +1905,32 @@ bool EnigmaIOTGatewayClass::processDataMessage (const uint8_t mac[ENIGMAIOT_ADDR
 #endif // SUPPORT_HA_DISCOVERY
         if (buf[0] == SENSOR_DATA && notifyData) {
 		//DEBUG_WARN ("Notify data %d", input_queue->size());
+		struct timeval tv;
+		gettimeofday (&tv, NULL);
+		dataTimestamp = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
 		notifyData (const_cast<uint8_t*>(mac), &(buf[data_idx]), tag_idx - data_idx, lostMessages, false, (gatewayPayloadEncoding_t)(buf[encoding_idx]), nodeName ? nodeName : NULL);
+        } else if (buf[0] == SENSOR_AGGREGATED_DATA) {
+            if (!notifyAggregatedData (mac, &(buf[data_idx]), tag_idx - data_idx, lostMessages, (gatewayPayloadEncoding_t)(buf[encoding_idx]), nodeName)) {
+                return false;
+            }
+        } else if (buf[0] == SENSOR_BUFFERED_DATA) {
+            if (!notifyAggregatedData (mac, &(buf[data_idx]), tag_idx - data_idx, lostMessages, (gatewayPayloadEncoding_t)(buf[encoding_idx]), nodeName, sizeof (uint32_t))) {
+                return false;
+            }
+        } else if (buf[0] == DATA_FRAGMENT) {
+            if (!processFragment (mac, node, &(buf[data_idx]), tag_idx - data_idx, lostMessages, (gatewayPayloadEncoding_t)(buf[encoding_idx]))) {
+                return false;
+            }
         } else {
             DEBUG_WARN ("Wrong message type. Possible memory corruption");
     }
 
 	if (node->getSleepy ()) {
+#if USE_TX_SLOTS
+		if (buf[0] != DATA_FRAGMENT) { // Only first message in a wake period is on time
+			checkTxSlot (node);
+		}
+#endif // USE_TX_SLOTS
 		if (node->qMessagePending) {
 			DEBUG_INFO (" -------> DOWNLINK QUEUED DATA");
 			flashTx = true;
@@ -1503,6 +1943,521 @@ bool EnigmaIOTGatewayClass::processDataMessage (const uint8_t mac[ENIGMAIOT_ADDR
 
 }
 
+#if USE_TX_SLOTS
+bool EnigmaIOTGatewayClass::checkTxSlot (Node* node) {
+	if (!node->getSleepPeriod ()) {
+		return false;
+	}
+
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	int64_t now = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	uint32_t period = node->getSleepPeriod () * 1000;
+	int32_t error = (int32_t)(((uint32_t)(now % period) + period - node->getTxSlotOffset ()) % period);
+	if (error > (int32_t)(period / 2)) {
+		error -= period;
+	}
+	if (error <= TX_SLOT_TOLERANCE && error >= -TX_SLOT_TOLERANCE) {
+		return false;
+	}
+
+	DEBUG_INFO ("Node %d transmitted %d ms away from its slot", node->getNodeId (), error);
+	return sendDownstream (node->getMacAddress (), NULL, 0, control_message_type::TX_SLOT);
+}
+#endif // USE_TX_SLOTS
+
+#if USE_DOWNLINK_END
+bool EnigmaIOTGatewayClass::sendDownlinkEnd (Node* node) {
+	// Any message queued while processing is sent on next node wake up, so node must keep waiting for it.
+	// Nodes that did not signal support would take it as an unknown control message
+	if (!node->getSleepy () || !node->supportsDownlinkEnd () || node->qMessagePending) {
+		return false;
+	}
+	DEBUG_INFO (" -------> DOWNLINK END");
+	return sendDownstream (node->getMacAddress (), NULL, 0, control_message_type::DOWNLINK_END);
+}
+#endif // USE_DOWNLINK_END
+
+#if USE_OTA_CACHE
+bool EnigmaIOTGatewayClass::storeOtaImage (Node* node, const uint8_t* data, size_t len) {
+	uint8_t msg[MAX_MESSAGE_LENGTH];
+	size_t msgLen = MAX_MESSAGE_LENGTH;
+	uint16_t msgIdx;
+
+	// Same parser as OTA messages that are forwarded to node, so both formats cannot diverge
+	if (!buildOtaMsg (msg, msgLen, data, len)) {
+		notifyOtaStatus (node, ota_status::OTA_CACHE_ERROR);
+		if (otaStreamPhase == OTA_STREAM_STORING && node == otaStreamNode) {
+			stopOtaStream ();
+		}
+		return false;
+	}
+	memcpy (&msgIdx, msg + 1, sizeof (uint16_t));
+
+	if (msgIdx == 0) {
+		/*
+		* ------------------------------------------------------------------------------------------
+		*| OTA (1) | Msg index = 0 (2) | Image size (4) | Number of chunks (2) | MD5 (32) | Format (1) |
+		* ------------------------------------------------------------------------------------------
+		*/
+		uint32_t size;
+		uint16_t numChunks;
+		uint8_t format = OTA_FORMAT_RAW;
+
+		memcpy (&size, msg + 3, sizeof (uint32_t));
+		memcpy (&numChunks, msg + 7, sizeof (uint16_t));
+		if (msgLen > 9 + 32) {
+			format = msg[9 + 32];
+		}
+		return beginOtaImage (node, size, numChunks, (char*)(msg + 9), format);
+	}
+
+	if (otaStreamPhase != OTA_STREAM_STORING || node != otaStreamNode) {
+		DEBUG_WARN ("OTA image chunk #%u without image header", msgIdx);
+		return false;
+	}
+	uint16_t expectedIdx = otaCache.getLength () / OTA_CHUNK_MAX_LENGTH + 1;
+	if (msgIdx < expectedIdx) {
+		DEBUG_DBG ("OTA image chunk #%u was already stored", msgIdx);
+		return true;
+	}
+	if (msgIdx > expectedIdx || otaCache.getLength () % OTA_CHUNK_MAX_LENGTH) {
+		DEBUG_ERROR ("OTA image chunk #%u out of sequence. Expected #%u", msgIdx, expectedIdx);
+		notifyOtaStatus (node, ota_status::OTA_CACHE_ERROR);
+		stopOtaStream ();
+		return false;
+	}
+	if (!addOtaImageData (msg + 3, msgLen - 3)) {
+		return false;
+	}
+	if (msgIdx == otaCache.getNumChunks ()) {
+		return endOtaImage ();
+	}
+	return true;
+}
+
+bool EnigmaIOTGatewayClass::beginOtaImage (Node* node, uint32_t size, uint16_t numChunks, const char* md5, uint8_t format) {
+	if (!node || !node->isRegistered ()) {
+		DEBUG_ERROR ("OTA image destination is not registered");
+		return false;
+	}
+	if (node->getSleepy ()) {
+		DEBUG_ERROR ("OTA is only possible with non sleepy nodes. Configure it accordingly first");
+		notifyOtaStatus (node, ota_status::OTA_CACHE_ERROR);
+		return false;
+	}
+	if (otaStreamPhase != OTA_STREAM_IDLE && otaStreamNode != node) {
+		DEBUG_ERROR ("OTA update for node %d is running", otaStreamNode->getNodeId ());
+		notifyOtaStatus (node, ota_status::OTA_CACHE_ERROR);
+		return false;
+	}
+	stopOtaStream ();
+	if (!numChunks || !otaCache.begin (size, numChunks, md5, format)) {
+		notifyOtaStatus (node, ota_status::OTA_CACHE_ERROR);
+		return false;
+	}
+	otaStreamNode = node;
+	otaStreamPhase = OTA_STREAM_STORING;
+	lastOTAmsg = millis ();
+	DEBUG_WARN ("Storing OTA image for node %d", node->getNodeId ());
+	return true;
+}
+
+bool EnigmaIOTGatewayClass::addOtaImageData (const uint8_t* data, size_t len) {
+	if (otaStreamPhase != OTA_STREAM_STORING) {
+		return false;
+	}
+	if (!otaCache.write (data, len)) {
+		notifyOtaStatus (otaStreamNode, ota_status::OTA_CACHE_ERROR);
+		stopOtaStream ();
+		return false;
+	}
+	lastOTAmsg = millis (); // Web API uploads do not go through buildOtaMsg ()
+	return true;
+}
+
+bool EnigmaIOTGatewayClass::endOtaImage () {
+	if (otaStreamPhase != OTA_STREAM_STORING) {
+		return false;
+	}
+	if (!otaCache.finish ()) {
+		notifyOtaStatus (otaStreamNode, ota_status::OTA_CACHE_ERROR);
+		stopOtaStream ();
+		return false;
+	}
+	notifyOtaStatus (otaStreamNode, ota_status::OTA_CACHE_STORED);
+	otaStreamRetries = 0;
+	otaStreamProgress = 0;
+	// Image stored for broadcast node is sent to every node that may receive it
+	if (otaStreamNode == nodelist.getBroadcastNode ()) {
+		return beginOtaMulticast ();
+	}
+	return sendOtaHeader (otaStreamNode);
+}
+
+bool EnigmaIOTGatewayClass::requestOtaImageEnd () {
+	if (otaStreamPhase != OTA_STREAM_STORING) {
+		return false;
+	}
+	// Image check reads whole file and first message is encrypted and sent, so web server task does not wait for them
+	otaImageEndPending = true;
+	return true;
+}
+
+bool EnigmaIOTGatewayClass::sendOtaHeader (Node* node, bool multicast) {
+	/*
+	* -----------------------------------------------------------------------------------------------------
+	*| OTA (1) | Msg index = 0 (2) | Image size (4) | Number of chunks (2) | MD5 (32) | Format (1) | Mode (1) |
+	* -----------------------------------------------------------------------------------------------------
+	* Mode is only sent to nodes joining a multicast update
+	*/
+	uint8_t msg[1 + sizeof (uint16_t) + sizeof (uint32_t) + sizeof (uint16_t) + 32 + 1 + 1];
+	uint16_t msgIdx = 0;
+	uint32_t size = otaCache.getImageSize ();
+	uint16_t numChunks = otaCache.getNumChunks ();
+	size_t len = sizeof (msg);
+
+	msg[0] = (uint8_t)control_message_type::OTA;
+	memcpy (msg + 1, &msgIdx, sizeof (uint16_t));
+	memcpy (msg + 3, &size, sizeof (uint32_t));
+	memcpy (msg + 7, &numChunks, sizeof (uint16_t));
+	memcpy (msg + 9, otaCache.getMD5 (), 32);
+	msg[9 + 32] = otaCache.getFormat ();
+	msg[9 + 32 + 1] = OTA_MODE_MULTICAST;
+	if (!multicast) {
+		len--;
+		// Raw images are announced without format, so that nodes without compression support accept them
+		if (otaCache.getFormat () == OTA_FORMAT_RAW) {
+			len--;
+		}
+	}
+
+	otaStreamPhase = OTA_STREAM_STARTING;
+	otaStreamLastTx = millis ();
+	OTAongoing = true;
+	lastOTAmsg = millis ();
+	DEBUG_INFO (" -------> OTA HEADER FROM CACHE");
+	return downstreamDataMessage (node, msg, len, control_message_type::OTA);
+}
+
+bool EnigmaIOTGatewayClass::sendOtaChunk (Node* node, uint16_t msgIdx) {
+	/*
+	* ----------------------------------------
+	*| OTA (1) | Msg index (2) | Chunk (...) |
+	* ----------------------------------------
+	*/
+	uint8_t msg[1 + sizeof (uint16_t) + OTA_CHUNK_MAX_LENGTH];
+	msg[0] = (uint8_t)control_message_type::OTA;
+	memcpy (msg + 1, &msgIdx, sizeof (uint16_t));
+	size_t len = otaCache.readChunk (msgIdx, msg + 1 + sizeof (uint16_t));
+	if (!len) {
+		DEBUG_ERROR ("Error reading OTA chunk #%u from cache", msgIdx);
+		return false;
+	}
+
+	otaStreamLastTx = millis ();
+	lastOTAmsg = otaStreamLastTx;
+	DEBUG_DBG ("OTA chunk #%u from cache", msgIdx);
+	if (!downstreamDataMessage (node, msg, 1 + sizeof (uint16_t) + len, control_message_type::OTA)) {
+		DEBUG_WARN ("Error sending OTA chunk #%u", msgIdx);
+	}
+	return true;
+}
+
+void EnigmaIOTGatewayClass::notifyOtaProgress (uint16_t acknowledged) {
+	/*
+	* ----------------------------------------------------------------------------
+	*| OTA_ANS (1) | OTA_PROGRESS (1) | Acknowledged chunks (2) | Total chunks (2) |
+	* ----------------------------------------------------------------------------
+	*/
+	uint16_t numChunks = otaCache.getNumChunks ();
+	uint8_t progress = (uint32_t)acknowledged * 10 / numChunks;
+	if (progress > otaStreamProgress) {
+		uint8_t progressData[2 * sizeof (uint16_t)];
+		otaStreamProgress = progress;
+		memcpy (progressData, &acknowledged, sizeof (uint16_t));
+		memcpy (progressData + sizeof (uint16_t), &numChunks, sizeof (uint16_t));
+		notifyOtaStatus (otaStreamNode, ota_status::OTA_PROGRESS, progressData, sizeof (progressData));
+	}
+}
+
+void EnigmaIOTGatewayClass::handleOtaStream () {
+	uint32_t now = millis ();
+
+	// An upload that stops halfway would keep cache busy and block any other update
+	if (otaStreamPhase == OTA_STREAM_STORING) {
+		if (now - lastOTAmsg > OTA_GW_TIMEOUT) {
+			DEBUG_ERROR ("OTA image for node %d not completed in time", otaStreamNode->getNodeId ());
+			notifyOtaStatus (otaStreamNode, ota_status::OTA_CACHE_ERROR);
+			stopOtaStream ();
+		}
+		return;
+	}
+
+	if (otaStreamNode == nodelist.getBroadcastNode ()) {
+		handleOtaMulticast ();
+		return;
+	}
+
+	if (otaStreamPhase == OTA_STREAM_STARTING) {
+		if (now - otaStreamLastTx > OTA_STREAM_ACK_TIMEOUT) {
+			if (++otaStreamRetries > OTA_STREAM_MAX_TIMEOUTS) {
+				DEBUG_ERROR ("Node %d did not start OTA update", otaStreamNode->getNodeId ());
+				notifyOtaStatus (otaStreamNode, ota_status::OTA_TIMEOUT);
+				stopOtaStream ();
+			} else {
+				sendOtaHeader (otaStreamNode);
+			}
+		}
+		return;
+	}
+
+	if (otaStreamPhase != OTA_STREAM_SENDING || now - otaStreamLastTx < OTA_STREAM_CHUNK_INTERVAL) {
+		return;
+	}
+
+	uint16_t msgIdx = otaSender.getNextChunk (now);
+	if (otaSender.isFailed ()) {
+		DEBUG_ERROR ("Node %d stopped answering OTA chunks", otaStreamNode->getNodeId ());
+		notifyOtaStatus (otaStreamNode, ota_status::OTA_TIMEOUT);
+		stopOtaStream ();
+		return;
+	}
+	if (!msgIdx) {
+		return;
+	}
+
+	if (!sendOtaChunk (otaStreamNode, msgIdx)) {
+		notifyOtaStatus (otaStreamNode, ota_status::OTA_CACHE_ERROR);
+		stopOtaStream ();
+		return;
+	}
+	notifyOtaProgress (otaSender.getBase () - 1);
+}
+
+bool EnigmaIOTGatewayClass::beginOtaMulticast () {
+	uint32_t now = millis ();
+	uint16_t members = 0;
+
+	otaMulticast.begin (otaCache.getNumChunks (), now);
+	otaMulticastStart = now;
+	otaStreamPhase = OTA_STREAM_STARTING;
+	otaStreamLastTx = now;
+	OTAongoing = true;
+	lastOTAmsg = now;
+	// Sleepy nodes do not listen to broadcast and nodes without broadcast enabled do not have broadcast key
+	for (uint16_t nodeId = 0; nodeId < NUM_NODES; nodeId++) {
+		Node* node = nodelist.getNodeFromID (nodeId);
+		if (node && node->isRegistered () && !node->getSleepy () && node->broadcastIsEnabled ()) {
+			otaMulticast.addMember (nodeId);
+			members++;
+		}
+	}
+	if (!members) {
+		DEBUG_ERROR ("No node may join multicast OTA update");
+		endOtaMulticast ();
+		return false;
+	}
+
+	DEBUG_WARN ("Multicast OTA update for %u nodes", members);
+	return true;
+}
+
+void EnigmaIOTGatewayClass::handleOtaMulticast () {
+	uint32_t now = millis ();
+
+	if (otaStreamPhase == OTA_STREAM_STARTING) {
+		if (otaMulticast.isStarted () || now - otaMulticastStart > OTA_MULTICAST_START_TIMEOUT) {
+			for (uint16_t nodeId = 0; nodeId < NUM_NODES; nodeId++) {
+				if (otaMulticast.dropIfStarting (nodeId)) {
+					DEBUG_ERROR ("Node %d did not start multicast OTA update", nodeId);
+					notifyOtaStatus (nodelist.getNodeFromID (nodeId), ota_status::OTA_TIMEOUT);
+				}
+			}
+			DEBUG_WARN ("Broadcasting OTA image from cache to %u nodes", otaMulticast.getCount (OTA_MEMBER_RECEIVING));
+			otaStreamPhase = OTA_STREAM_SENDING;
+			otaMulticast.planRound ();
+		} else if (now - otaStreamLastTx >= OTA_STREAM_CHUNK_INTERVAL) {
+			// Every node joins with a unicast message, so that image MD5 cannot be forged with broadcast key
+			int nodeId = otaMulticast.getNextHeader (now);
+			if (nodeId >= 0) {
+				sendOtaHeader (nodelist.getNodeFromID (nodeId), true);
+			}
+		}
+		return;
+	}
+
+	if (otaStreamPhase != OTA_STREAM_SENDING || now - otaStreamLastTx < OTA_STREAM_CHUNK_INTERVAL) {
+		return;
+	}
+
+	uint16_t msgIdx = otaMulticast.getNextChunk ();
+	if (msgIdx) {
+		if (!sendOtaChunk (otaStreamNode, msgIdx)) {
+			notifyOtaStatus (otaStreamNode, ota_status::OTA_CACHE_ERROR);
+			stopOtaStream ();
+		}
+		return;
+	}
+
+	// Whole round has been sent. Nodes report received chunks after a random delay
+	if (!otaMulticast.isRoundReported () && now - otaStreamLastTx < OTA_MULTICAST_REPORT_TIMEOUT) {
+		return;
+	}
+	for (uint16_t nodeId = 0; nodeId < NUM_NODES; nodeId++) {
+		if (otaMulticast.closeRound (nodeId, now)) {
+			DEBUG_ERROR ("Node %d stopped answering multicast OTA update", nodeId);
+			notifyOtaStatus (nodelist.getNodeFromID (nodeId), ota_status::OTA_TIMEOUT);
+		}
+	}
+	notifyOtaProgress (otaMulticast.getAcknowledged ());
+	if (otaMulticast.isFinished ()) {
+		endOtaMulticast ();
+		return;
+	}
+	otaMulticast.planRound ();
+	otaStreamLastTx = now;
+	lastOTAmsg = now;
+}
+
+bool EnigmaIOTGatewayClass::processOtaMulticastAnswer (Node* node, const uint8_t* data, size_t len) {
+	uint16_t nodeId = node->getNodeId ();
+	uint32_t now = millis ();
+
+	if (otaMulticast.getStatus (nodeId) == OTA_MEMBER_NONE) {
+		return false;
+	}
+
+	switch (data[1]) {
+	case ota_status::OTA_STARTED:
+		if (otaMulticast.processStarted (nodeId, now)) {
+			DEBUG_INFO ("Node %d joined multicast OTA update", nodeId);
+		}
+		return false;
+	case ota_status::OTA_SACK:
+		// | OTA_ANS | OTA_SACK | Base (2) | Received chunks (4) |
+		if (len >= 2 + sizeof (uint16_t) + sizeof (uint32_t)) {
+			uint16_t sackBase;
+			uint32_t received;
+			memcpy (&sackBase, data + 2, sizeof (uint16_t));
+			memcpy (&received, data + 2 + sizeof (uint16_t), sizeof (uint32_t));
+			otaMulticast.processSack (nodeId, sackBase, received, now);
+		}
+		return true;
+	case ota_status::OTA_OUT_OF_SEQUENCE:
+		return true;
+	case ota_status::OTA_CHECK_OK:
+		otaMulticast.processCheck (nodeId, now);
+		return false;
+	case ota_status::OTA_FINISHED:
+		otaMulticast.processResult (nodeId, true);
+		return false;
+	case ota_status::OTA_START_ERROR:
+	case ota_status::OTA_CHECK_FAIL:
+	case ota_status::OTA_TIMEOUT:
+		otaMulticast.processResult (nodeId, false);
+		return false;
+	default:
+		return false;
+	}
+}
+
+void EnigmaIOTGatewayClass::endOtaMulticast () {
+	/*
+	* ---------------------------------------------------------------------------
+	*| OTA_ANS (1) | OTA_MULTICAST_END (1) | Nodes updated (2) | Nodes failed (2) |
+	* ---------------------------------------------------------------------------
+	*/
+	uint8_t result[2 * sizeof (uint16_t)];
+	uint16_t updated = otaMulticast.getCount (OTA_MEMBER_DONE);
+	uint16_t failed = otaMulticast.getCount (OTA_MEMBER_FAILED);
+
+	DEBUG_WARN ("Multicast OTA update finished. %u nodes updated, %u failed. %u chunks sent in %u rounds for %u in image",
+				updated, failed, otaMulticast.getSentCount (), otaMulticast.getRounds (), otaCache.getNumChunks ());
+	memcpy (result, &updated, sizeof (uint16_t));
+	memcpy (result + sizeof (uint16_t), &failed, sizeof (uint16_t));
+	notifyOtaStatus (otaStreamNode, ota_status::OTA_MULTICAST_END, result, sizeof (result));
+	stopOtaStream ();
+}
+
+bool EnigmaIOTGatewayClass::processOtaAnswer (Node* node, const uint8_t* data, size_t len) {
+	if (len < 2 || data[0] != control_message_type::OTA_ANS ||
+		(otaStreamPhase != OTA_STREAM_STARTING && otaStreamPhase != OTA_STREAM_SENDING)) {
+		return false;
+	}
+	if (otaStreamNode == nodelist.getBroadcastNode ()) {
+		return processOtaMulticastAnswer (node, data, len);
+	}
+	if (node != otaStreamNode) {
+		return false;
+	}
+
+	uint32_t now = millis ();
+
+	switch (data[1]) {
+	case ota_status::OTA_STARTED:
+		if (otaStreamPhase == OTA_STREAM_STARTING) {
+			DEBUG_WARN ("Sending OTA image from cache to node %d", node->getNodeId ());
+			otaStreamPhase = OTA_STREAM_SENDING;
+			otaSender.begin (otaCache.getNumChunks (), now);
+		}
+		return false;
+	case ota_status::OTA_SACK:
+		// | OTA_ANS | OTA_SACK | Base (2) | Received chunks (4) |
+		if (len >= 2 + sizeof (uint16_t) + sizeof (uint32_t)) {
+			uint16_t sackBase;
+			uint32_t received;
+			memcpy (&sackBase, data + 2, sizeof (uint16_t));
+			memcpy (&received, data + 2 + sizeof (uint16_t), sizeof (uint32_t));
+			otaSender.processSack (sackBase, received, now);
+		}
+		return true;
+	case ota_status::OTA_OUT_OF_SEQUENCE:
+		// | OTA_ANS | OTA_OUT_OF_SEQUENCE | Last good chunk (2) |
+		if (len >= 2 + sizeof (uint16_t)) {
+			uint16_t lastGood;
+			memcpy (&lastGood, data + 2, sizeof (uint16_t));
+			otaSender.rewind (lastGood, now);
+		}
+		return true;
+	case ota_status::OTA_START_ERROR:
+	case ota_status::OTA_CHECK_FAIL:
+	case ota_status::OTA_TIMEOUT:
+	case ota_status::OTA_FINISHED:
+		DEBUG_WARN ("OTA update from cache finished. %u chunks sent for %u in image", otaSender.getSentCount (), otaCache.getNumChunks ());
+		stopOtaStream ();
+		return false;
+	default:
+		return false;
+	}
+}
+
+void EnigmaIOTGatewayClass::notifyOtaStatus (Node* node, uint8_t status, const uint8_t* data, size_t len) {
+	uint8_t payload[2 + 2 * sizeof (uint16_t)];
+
+	if (!node || !notifyData || len > sizeof (payload) - 2) {
+		return;
+	}
+	payload[0] = control_message_type::OTA_ANS;
+	payload[1] = status;
+	if (len) {
+		memcpy (payload + 2, data, len);
+	}
+	char* nodeName = node->getNodeName ();
+	notifyData (node->getMacAddress (), payload, 2 + len, 0, true, ENIGMAIOT, nodeName ? nodeName : NULL);
+}
+
+void EnigmaIOTGatewayClass::stopOtaStream () {
+	// A complete image is kept until a new one is stored
+	if (otaStreamPhase == OTA_STREAM_STORING) {
+		otaCache.end ();
+	}
+	otaStreamPhase = OTA_STREAM_IDLE;
+	otaStreamNode = NULL;
+	otaImageEndPending = false;
+}
+#endif // USE_OTA_CACHE
+
 double EnigmaIOTGatewayClass::getPER (uint8_t* address) {
 	Node* node = nodelist.getNewNode (address);
 
@@ -1534,9 +2489,10 @@ double EnigmaIOTGatewayClass::getPacketsHour (uint8_t* address) {
 
 bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding) {
 	/*
-	* ----------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2) | Data (....) | Tag (16) |
-	* ----------------------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2 or 4) | Data (....) | Tag (16) |
+	* -----------------------------------------------------------------------------------------------
+	* Broadcast messages always use a 2 byte counter
 	*/
 
 	uint8_t buffer[MAX_MESSAGE_LENGTH];
@@ -1549,8 +2505,14 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 	}
 
 	uint16_t nodeId = node->getNodeId ();
-	uint16_t counter;
+	uint32_t counter;
 
+	if (!memcmp (node->getMacAddress (), BROADCAST_ADDRESS, ENIGMAIOT_ADDR_LEN)) {
+		DEBUG_DBG ("Encoding broadcast message");
+		broadcast = true;
+	}
+
+	uint8_t counterLen = broadcast ? sizeof (uint16_t) : node->getCounterLength ();
 	uint8_t iv_idx = 1;
 	uint8_t length_idx = iv_idx + IV_LENGTH;
 	uint8_t nodeId_idx = length_idx + sizeof (int16_t);
@@ -1558,30 +2520,24 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 	uint8_t data_idx;
 	uint8_t encoding_idx; // Only for user data
 	if (controlData == USERDATA_GET || controlData == USERDATA_SET) {
-		encoding_idx = counter_idx + sizeof (int16_t);
+		encoding_idx = counter_idx + counterLen;
 		data_idx = encoding_idx + sizeof (int8_t);
 		buffer[encoding_idx] = encoding;
-		packet_length = 1 + IV_LENGTH + sizeof (int16_t) + sizeof (int16_t) + sizeof (int16_t) + 1 + len;
 	} else {
-		data_idx = counter_idx + sizeof (int16_t);
-		packet_length = 1 + IV_LENGTH + sizeof (int16_t) + sizeof (int16_t) + sizeof (int16_t) + len;
+		data_idx = counter_idx + counterLen;
 	}
+	packet_length = data_idx + len;
 	uint8_t tag_idx = data_idx + len;
 
 	if (!data) {
 		DEBUG_ERROR ("Downlink message buffer empty");
 		return false;
 	}
-	if (len > MAX_MESSAGE_LENGTH - 25) {
+	if (len > MAX_MESSAGE_LENGTH - data_idx - TAG_LENGTH) {
 		DEBUG_ERROR ("Downlink message too long: %d bytes", len);
 		return false;
 	}
 
-	if (!memcmp (node->getMacAddress (), BROADCAST_ADDRESS, ENIGMAIOT_ADDR_LEN)) {
-		DEBUG_DBG ("Encoding broadcast message");
-		broadcast = true;
-	}
-
 	if (controlData == control_message_type::USERDATA_GET) {
 		buffer[0] = (uint8_t)DOWNSTREAM_DATA_GET;
 	} else if (controlData == control_message_type::USERDATA_SET) {
@@ -1610,11 +2566,11 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 			nodelist.incLastBroadcastMsgCounter ();
 		}
 	} else {
-		counter = (uint16_t)(Crypto.random ());
+		counter = counterLen == sizeof (uint32_t) ? Crypto.random () : (uint16_t)(Crypto.random ());
 	}
-	DEBUG_INFO ("Downlink message #%d", counter);
+	DEBUG_INFO ("Downlink message #%u", counter);
 
-	memcpy (buffer + counter_idx, &counter, sizeof (uint16_t));
+	memcpy (buffer + counter_idx, &counter, counterLen);
 
 	memcpy (buffer + data_idx, data, len);
 
@@ -1640,7 +2596,7 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 	if (!CryptModule::encryptBuffer (buffer + length_idx, packet_length - addDataLen, // Encrypt from length
 									 buffer + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
-									 aad, sizeof (aad), buffer + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buffer + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
@@ -1648,7 +2604,8 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 	//DEBUG_WARN ("Encryption key: %s", printHexBuffer (node->getEncriptionKey (), KEY_LENGTH));
 	DEBUG_VERBOSE ("Encrypted downlink message: %s", printHexBuffer (buffer, packet_length + TAG_LENGTH));
 
-	if (node->getSleepy ()) { // Queue message if node may be sleeping
+	// Fragment status, slot and downlink end are sent at once, as answer to a message that node has just sent
+	if (node->getSleepy () && controlData != control_message_type::FRAGMENT_STATUS && controlData != control_message_type::TX_SLOT && controlData != control_message_type::DOWNLINK_END) { // Queue message if node may be sleeping
 		if (controlData != control_message_type::OTA) {
 			DEBUG_VERBOSE ("Node is sleepy. Queing message");
 			memcpy (node->queuedMessage, buffer, packet_length + TAG_LENGTH);
@@ -1703,11 +2660,142 @@ bool  EnigmaIOTGatewayClass::invalidateKey (Node* node, gwInvalidateReason_t rea
 	return error;
 }
 
+void EnigmaIOTGatewayClass::checkKeyExpiration (Node* node) {
+	if (MAX_KEY_VALIDITY == 0) {
+		return;
+	}
+
+	unsigned long keyAge = millis () - node->getKeyValidFrom ();
+	if (keyAge <= MAX_KEY_VALIDITY) {
+		return;
+	}
+
+#if USE_KEY_UPDATE
+	if (node->supportsKeyUpdate () && keyAge <= MAX_KEY_VALIDITY + KEY_UPDATE_TIMEOUT) {
+		if (!node->isKeyUpdatePending () || millis () - node->getLastKeyUpdateSent () > KEY_UPDATE_RETRY_PERIOD) {
+			if (!sendKeyUpdate (node)) {
+				DEBUG_WARN ("Error sending key update to node %d", node->getNodeId ());
+			}
+		}
+		return;
+	}
+#endif // USE_KEY_UPDATE
+
+	invalidateKey (node, KEY_EXPIRED);
+}
+
+#if USE_KEY_UPDATE
+bool EnigmaIOTGatewayClass::sendKeyUpdate (Node* node) {
+	if (!node->prepareKeyUpdate ()) {
+		DEBUG_ERROR ("Error deriving next key");
+		return false;
+	}
+	node->setLastKeyUpdateSent ();
+
+	DEBUG_INFO (" -------> KEY UPDATE. Epoch %u", node->getKeyEpoch () + 1);
+	return sendDownstream (node->getMacAddress (), NULL, 0, control_message_type_t::KEY_UPDATE);
+}
+
+bool EnigmaIOTGatewayClass::checkNodeKey (Node* node, const uint8_t* key, const uint8_t* buf, size_t count) {
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t msg[MAX_MESSAGE_LENGTH];
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	if (count <= addDataLen + TAG_LENGTH || count > MAX_MESSAGE_LENGTH) {
+		return false;
+	}
+
+	// Decryption is done on a copy so that message is processed later as usual
+	memcpy (msg, buf, count);
+	memcpy (aad, buf, addDataLen);
+	memcpy (aad + addDataLen, key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	return CryptModule::decryptBuffer (msg + addDataLen, count - addDataLen - TAG_LENGTH,
+									   msg + 1, IV_LENGTH,
+									   key, KEY_LENGTH - AAD_LENGTH,
+									   aad, sizeof (aad), msg + count - TAG_LENGTH, TAG_LENGTH, node->getCipherSuite ());
+}
+
+void EnigmaIOTGatewayClass::checkPendingKey (Node* node, const uint8_t* buf, size_t count) {
+	// All these messages are encrypted from IV end up to tag
+	switch (buf[0]) {
+	case SENSOR_DATA:
+	case SENSOR_AGGREGATED_DATA:
+	case SENSOR_BUFFERED_DATA:
+	case DATA_FRAGMENT:
+	case CONTROL_DATA:
+	case CLOCK_REQUEST:
+	case NODE_NAME_SET:
+#if SUPPORT_HA_DISCOVERY
+	case HA_DISCOVERY_MESSAGE:
+#endif // SUPPORT_HA_DISCOVERY
+		break;
+	default:
+		return;
+	}
+
+	if (checkNodeKey (node, node->getEncriptionKey (), buf, count)) {
+		return;
+	}
+	if (checkNodeKey (node, node->getPendingKey (), buf, count)) {
+		uint8_t oldKey[KEY_LENGTH];
+		memcpy (oldKey, node->getEncriptionKey (), KEY_LENGTH);
+		node->commitKeyUpdate ();
+		DEBUG_INFO ("Node %d switched to key epoch %u", node->getNodeId (), node->getKeyEpoch ());
+		if (node->qMessagePending && !reencryptQueuedMessage (node, oldKey)) {
+			node->qMessagePending = false;
+		}
+		memset (oldKey, 0, KEY_LENGTH);
+	}
+}
+
+bool EnigmaIOTGatewayClass::reencryptQueuedMessage (Node* node, const uint8_t* oldKey) {
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	const uint8_t data_idx = addDataLen + sizeof (uint16_t) + sizeof (uint16_t) + node->getCounterLength ();
+	uint8_t* buffer = node->queuedMessage;
+	size_t cryptLen = node->qMessageLength - addDataLen - TAG_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	if (node->qMessageLength <= data_idx + TAG_LENGTH) {
+		return false;
+	}
+
+	memcpy (aad, buffer, addDataLen);
+	memcpy (aad + addDataLen, oldKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	if (!CryptModule::decryptBuffer (buffer + addDataLen, cryptLen, buffer + 1, IV_LENGTH,
+									 oldKey, KEY_LENGTH - AAD_LENGTH,
+									 aad, sizeof (aad), buffer + addDataLen + cryptLen, TAG_LENGTH, node->getCipherSuite ())) {
+		DEBUG_WARN ("Queued downlink message could not be decrypted. Discarded");
+		return false;
+	}
+
+	// A key update retry is useless after node has switched
+	if (buffer[0] == DOWNSTREAM_CTRL_DATA && buffer[data_idx] == control_message_type::KEY_UPDATE) {
+		DEBUG_DBG ("Queued key update discarded");
+		return false;
+	}
+
+	CryptModule::random (buffer + 1, IV_LENGTH); // IV is never reused with new key
+	memcpy (aad, buffer, addDataLen);
+	memcpy (aad + addDataLen, node->getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	if (!CryptModule::encryptBuffer (buffer + addDataLen, cryptLen, buffer + 1, IV_LENGTH,
+									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH,
+									 aad, sizeof (aad), buffer + addDataLen + cryptLen, TAG_LENGTH, node->getCipherSuite ())) {
+		DEBUG_ERROR ("Error during encryption");
+		return false;
+	}
+	DEBUG_DBG ("Queued downlink message encrypted with key epoch %u", node->getKeyEpoch ());
+	return true;
+}
+#endif // USE_KEY_UPDATE
+
 bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* buf, size_t count, Node* node) {
 	/*
 	* ------------------------------------------------------------------------------------------------------------
 	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | Tag (16) |
 	* ------------------------------------------------------------------------------------------------------------
+	* Random bits 8-15 carry the mask of cipher suites supported by node. Bits 16-31 carry HELLO_CAPABILITY_MARKER
+	* If gateway answered with a handshake cookie it is added after Random field, before Tag
 	*/
 
 	bool sleepyNode;
@@ -1718,19 +2806,25 @@ bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR
 		uint8_t iv[IV_LENGTH];
 		uint8_t publicKey[KEY_LENGTH];
 		uint32_t random;
+		uint8_t cookie[HELLO_COOKIE_LENGTH];
 		uint8_t tag[TAG_LENGTH];
 	} clientHello_msg;
 
 #define CHMSG_LEN sizeof(clientHello_msg)
 
-	if (count < CHMSG_LEN) {
+	bool hasCookie = count >= CHMSG_LEN;
+	size_t cryptLen = KEY_LENGTH + sizeof (uint32_t) + (hasCookie ? HELLO_COOKIE_LENGTH : 0);
+	size_t msgLen = 1 + IV_LENGTH + cryptLen + TAG_LENGTH;
+	uint8_t* tag = hasCookie ? clientHello_msg.tag : clientHello_msg.cookie; // Tag goes just after last field
+
+	if (count < msgLen) {
 		DEBUG_WARN ("Message too short");
 		return false;
 	}
 
-	memcpy (&clientHello_msg, buf, count);
+	memcpy (&clientHello_msg, buf, msgLen);
 
-	const uint8_t addDataLen = CHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - KEY_LENGTH;
+	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
 	memcpy (aad, (uint8_t*)&clientHello_msg, addDataLen); // Copy message upto iv
@@ -1738,15 +2832,15 @@ bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, gwConfig.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::decryptBuffer (clientHello_msg.publicKey, KEY_LENGTH + sizeof (uint32_t),
+	if (!CryptModule::decryptBuffer (clientHello_msg.publicKey, cryptLen,
 									 clientHello_msg.iv, IV_LENGTH,
 									 gwConfig.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clientHello_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), tag, TAG_LENGTH)) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Decrypted Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, CHMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Decrypted Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, msgLen - TAG_LENGTH));
 
 	node->reset ();
 
@@ -1779,28 +2873,115 @@ bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR
 	node->setBroadcastKeyRequested (broadcast);
 	DEBUG_INFO ("This node has broadcast mode %s", broadcast ? "enabled" : "disabled");
 
+	// A node that does not set capability marker fills Random with random data, so it cannot be read as capabilities
+	bool capable = CryptModule::helloSignalsCapabilities (clientHello_msg.random);
+	DEBUG_INFO ("This node %s capabilities", capable ? "signals" : "does not signal");
+
+	node->setCipherSuite (CryptModule::selectHelloSuite (clientHello_msg.random));
+	DEBUG_INFO ("Cipher suite: %s", CryptModule::getSuiteName (node->getCipherSuite ()));
+
+	node->setCounter32 (USE_32BIT_COUNTERS && capable && (clientHello_msg.random & 0x00000004U) == 4);
+	DEBUG_INFO ("This node uses %d bit counters", node->useCounter32 () ? 32 : 16);
+
+	node->setKeyUpdateSupport (USE_KEY_UPDATE && capable && (clientHello_msg.random & 0x00000008U) == 8);
+	DEBUG_INFO ("Key update %ssupported", node->supportsKeyUpdate () ? "" : "not ");
+
+	node->setDownlinkEndSupport (USE_DOWNLINK_END && capable && (clientHello_msg.random & 0x00000010U) == 0x10);
+	DEBUG_INFO ("Downlink end %ssupported", node->supportsDownlinkEnd () ? "" : "not ");
+
 	return true;
 }
 
+#if USE_HELLO_COOKIE
+void EnigmaIOTGatewayClass::calculateHelloCookie (const uint8_t* mac, uint32_t window, uint8_t* cookie) {
+	uint8_t input[ENIGMAIOT_ADDR_LEN + sizeof (uint32_t)];
+
+	memcpy (input, mac, ENIGMAIOT_ADDR_LEN);
+	memcpy (input + ENIGMAIOT_ADDR_LEN, &window, sizeof (uint32_t));
+	CryptModule::getHMAC (helloCookieSecret, KEY_LENGTH, input, sizeof (input), cookie, HELLO_COOKIE_LENGTH);
+}
+
+bool EnigmaIOTGatewayClass::checkHelloCookie (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	const size_t cryptLen = KEY_LENGTH + sizeof (uint32_t) + HELLO_COOKIE_LENGTH;
+	const size_t msgLen = 1 + IV_LENGTH + cryptLen + TAG_LENGTH;
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t msg[msgLen];
+	uint8_t aad[AAD_LENGTH + addDataLen];
+	uint8_t cookie[HELLO_COOKIE_LENGTH];
+
+	if (count < msgLen) {
+		// No cookie. Answer with one without spending any other resource
+		DEBUG_DBG ("Client Hello without cookie");
+		sendHelloCookie (mac);
+		return false;
+	}
+
+	// Cookie is authenticated with network key. Decrypt a copy so that message is processed normally afterwards
+	memcpy (msg, buf, msgLen);
+	memcpy (aad, msg, addDataLen); // Copy message upto iv
+	memcpy (aad + addDataLen, gwConfig.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::decryptBuffer (msg + addDataLen, cryptLen,
+									 msg + 1, IV_LENGTH,
+									 gwConfig.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
+									 aad, sizeof (aad), msg + msgLen - TAG_LENGTH, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error during decryption");
+		return false;
+	}
+
+	const uint8_t* echoedCookie = msg + addDataLen + KEY_LENGTH + sizeof (uint32_t);
+	uint32_t window = millis () / HELLO_COOKIE_PERIOD;
+
+	calculateHelloCookie (mac, window, cookie);
+	if (!memcmp (cookie, echoedCookie, HELLO_COOKIE_LENGTH)) {
+		return true;
+	}
+	calculateHelloCookie (mac, window - 1, cookie);
+	if (!memcmp (cookie, echoedCookie, HELLO_COOKIE_LENGTH)) {
+		return true;
+	}
+
+	DEBUG_WARN ("Expired handshake cookie");
+	sendHelloCookie (mac);
+	return false;
+}
+
+bool EnigmaIOTGatewayClass::sendHelloCookie (const uint8_t* mac) {
+	/*
+	* ---------------------------
+	*| msgType (1) | Cookie (16) |
+	* ---------------------------
+	*/
+
+	uint8_t helloCookie_msg[1 + HELLO_COOKIE_LENGTH];
+
+	helloCookie_msg[0] = HELLO_COOKIE;
+	calculateHelloCookie (mac, millis () / HELLO_COOKIE_PERIOD, helloCookie_msg + 1);
+
+	DEBUG_INFO (" -------> HELLO COOKIE");
+	return comm->send (const_cast<uint8_t*>(mac), helloCookie_msg, sizeof (helloCookie_msg)) == 0;
+}
+#endif // USE_HELLO_COOKIE
+
 bool EnigmaIOTGatewayClass::processClockRequest (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* buf, size_t count, Node* node) {
 	/*
-	* ---------------------------------------------------------
-	*| msgType (1) | IV (12) | Counter (2) | T1 (8) | Tag (16) |
-	* ---------------------------------------------------------
+	* ---------------------------------------------------------------
+	*| msgType (1) | IV (12) | Counter (2 or 4) | T1 (8) | Tag (16) |
+	* ---------------------------------------------------------------
 	*/
 	struct timeval tv;
 	//struct timezone tz;
 
-	struct __attribute__ ((packed, aligned (1))) {
-		uint8_t msgType;
-		uint8_t iv[IV_LENGTH];
-		uint16_t counter;
-		int64_t t1;
-		uint8_t tag[TAG_LENGTH];
-	} clockRequest_msg;
-	uint16_t counter;
+	uint8_t counterLen = node->getCounterLength ();
+	uint8_t iv_idx = 1;
+	uint8_t counter_idx = iv_idx + IV_LENGTH;
+	uint8_t t1_idx = counter_idx + counterLen;
+	uint8_t tag_idx = t1_idx + sizeof (int64_t);
+	const unsigned int CRMSG_LEN = tag_idx + TAG_LENGTH;
 
-	const unsigned int CRMSG_LEN = sizeof (clockRequest_msg);
+	uint8_t clockRequest_msg[1 + IV_LENGTH + sizeof (uint32_t) + sizeof (int64_t) + TAG_LENGTH];
+	uint32_t counter = 0;
+	int64_t t1;
 
 	if (count < CRMSG_LEN) {
 		DEBUG_WARN ("Message too short");
@@ -1815,12 +2996,9 @@ bool EnigmaIOTGatewayClass::processClockRequest (const uint8_t mac[ENIGMAIOT_ADD
     t2 *= 1000000L;
     t2 += tv.tv_usec;
 
+	memcpy (clockRequest_msg, buf, CRMSG_LEN);
 
-	//CryptModule::random (clockRequest_msg.iv, IV_LENGTH);
-
-	memcpy (&clockRequest_msg, buf, count);
-
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (clockRequest_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", printHexBuffer (clockRequest_msg + iv_idx, IV_LENGTH));
 
 	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
@@ -1830,74 +3008,74 @@ bool EnigmaIOTGatewayClass::processClockRequest (const uint8_t mac[ENIGMAIOT_ADD
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, node->getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	//uint8_t packetLen = count - TAG_LENGTH;
-
-	if (!CryptModule::decryptBuffer ((uint8_t*)&(clockRequest_msg.counter), CRMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Decrypt from counter, 10 bytes
-									 clockRequest_msg.iv, IV_LENGTH,
+	if (!CryptModule::decryptBuffer (clockRequest_msg + counter_idx, tag_idx - counter_idx, // Decrypt from counter
+									 clockRequest_msg + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockRequest_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), clockRequest_msg + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-    DEBUG_VERBOSE ("Decripted Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, count - TAG_LENGTH));
+    DEBUG_VERBOSE ("Decripted Clock Request message: %s", printHexBuffer (clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
 
-	memcpy (&counter, &(clockRequest_msg.counter), sizeof (uint16_t));
-	DEBUG_INFO ("Node Id %d. Control message #%d", node->getNodeId (), counter);
+	memcpy (&counter, clockRequest_msg + counter_idx, counterLen);
+	DEBUG_INFO ("Node Id %d. Control message #%u", node->getNodeId (), counter);
 	if (useCounter) {
-		if (counter > node->getLastControlCounter ()) {
+		if (node->acceptControlCounter (counter)) {
 			DEBUG_INFO ("Accepted");
-			node->setLastControlCounter (counter);
 		} else {
 			DEBUG_WARN ("Control message rejected");
 			return false;
 		}
 	}
 
-	//node->t1 = clockRequest_msg.t1;
+	memcpy (&t1, clockRequest_msg + t1_idx, sizeof (int64_t));
 
-	//node->t2 = time_us;
-
-    DEBUG_DBG ("T1: %llu", clockRequest_msg.t1);
+    DEBUG_DBG ("T1: %llu", t1);
 	DEBUG_DBG ("T2: %llu", t2);
-	DEBUG_VERBOSE ("Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
 
-    return clockResponse (node, clockRequest_msg.t1, t2);
+    return clockResponse (node, t1, t2);
 }
 
 bool EnigmaIOTGatewayClass::clockResponse (Node* node, uint64_t t1, uint64_t t2) {
+	/*
+	* ---------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | Counter (2 or 4) | T1 (8) | T2 (8) | T3 (8) | Tag (16) |
+	* ---------------------------------------------------------------------------------
+	*/
 	struct timeval tv;
 	//struct timezone tz;
 
-	struct __attribute__ ((packed, aligned (1))) {
-		uint8_t msgType;
-		uint8_t iv[IV_LENGTH];
-		uint16_t counter;
-        int64_t t1;
-		int64_t t2;
-		int64_t t3;
-		uint8_t tag[TAG_LENGTH];
-	} clockResponse_msg;
+	uint8_t counterLen = node->getCounterLength ();
+	uint8_t iv_idx = 1;
+	uint8_t counter_idx = iv_idx + IV_LENGTH;
+	uint8_t t1_idx = counter_idx + counterLen;
+	uint8_t t2_idx = t1_idx + sizeof (int64_t);
+	uint8_t t3_idx = t2_idx + sizeof (int64_t);
+	uint8_t tag_idx = t3_idx + sizeof (int64_t);
+	const unsigned int CRSMSG_LEN = tag_idx + TAG_LENGTH;
 
-	uint16_t counter;
+	uint8_t clockResponse_msg[1 + IV_LENGTH + sizeof (uint32_t) + 3 * sizeof (int64_t) + TAG_LENGTH];
 
-	const unsigned int CRSMSG_LEN = sizeof (clockResponse_msg);
+	uint32_t counter;
 
-	clockResponse_msg.msgType = CLOCK_RESPONSE;
+	clockResponse_msg[0] = CLOCK_RESPONSE;
+
+	CryptModule::random (clockResponse_msg + iv_idx, IV_LENGTH);
 
 	if (useCounter) {
 		counter = node->getLastDownlinkMsgCounter () + 1;
 		node->setLastDownlinkMsgCounter (counter);
 	} else {
-		counter = (uint16_t)(Crypto.random ());
+		counter = node->useCounter32 () ? Crypto.random () : (uint16_t)(Crypto.random ());
 	}
-	DEBUG_INFO ("Downlink message #%d", counter);
+	DEBUG_INFO ("Downlink message #%u", counter);
 
-	memcpy (&(clockResponse_msg.counter), &counter, sizeof (uint16_t));
+	memcpy (clockResponse_msg + counter_idx, &counter, counterLen);
     
-    memcpy (&(clockResponse_msg.t1), &t1, sizeof (int64_t));
+    memcpy (clockResponse_msg + t1_idx, &t1, sizeof (int64_t));
 
-	memcpy (&(clockResponse_msg.t2), &t2, sizeof (int64_t));
+	memcpy (clockResponse_msg + t2_idx, &t2, sizeof (int64_t));
 
 	// Get current time. If Gateway is synchronized to NTP server it sends real world time.
 	gettimeofday (&tv, NULL);
@@ -1905,9 +3083,9 @@ bool EnigmaIOTGatewayClass::clockResponse (Node* node, uint64_t t1, uint64_t t2)
 	t3 *= 1000000L;
 	t3 += tv.tv_usec;
 
-	memcpy (&(clockResponse_msg.t3), &t3, sizeof (int64_t));
+	memcpy (clockResponse_msg + t3_idx, &t3, sizeof (int64_t));
 
-	DEBUG_VERBOSE ("Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Clock Response message: %s", printHexBuffer (clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
 
 #ifdef DEBUG_ESP_PORT
 	char mac[ENIGMAIOT_ADDR_LEN * 3];
@@ -1920,23 +3098,23 @@ bool EnigmaIOTGatewayClass::clockResponse (Node* node, uint64_t t1, uint64_t t2)
 	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
-	memcpy (aad, (uint8_t*)&clockResponse_msg, addDataLen); // Copy message upto iv
+	memcpy (aad, clockResponse_msg, addDataLen); // Copy message upto iv
 
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, node->getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::encryptBuffer ((uint8_t*)&(clockResponse_msg.counter), CRSMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Encrypt only from counter, 18 bytes
-									 clockResponse_msg.iv, IV_LENGTH,
+	if (!CryptModule::encryptBuffer (clockResponse_msg + counter_idx, tag_idx - counter_idx, // Encrypt only from counter
+									 clockResponse_msg + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockResponse_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), clockResponse_msg + tag_idx, TAG_LENGTH, node->getCipherSuite ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, CRSMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted Clock Response message: %s", printHexBuffer (clockResponse_msg, CRSMSG_LEN));
 
 	DEBUG_INFO (" -------> CLOCK RESPONSE");
-	if (comm->send (node->getMacAddress (), (uint8_t*)&clockResponse_msg, CRSMSG_LEN) == 0) {
+	if (comm->send (node->getMacAddress (), clockResponse_msg, CRSMSG_LEN) == 0) {
 		DEBUG_INFO ("Clock Response message sent to %s", mac);
 		return true;
 	} else {
@@ -1958,6 +3136,7 @@ bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 	* -----------------------------------------------------------------------------
 	*| msgType (1) | IV (12) | DH Kslave (32) | NodeID (2) | Random (4) | Tag (16) |
 	* -----------------------------------------------------------------------------
+	* Random lower byte carries cipher suite selected by gateway. Bits 16-31 carry HELLO_CAPABILITY_MARKER
 	*/
 
 	struct __attribute__ ((packed, aligned (1))) {
@@ -1991,7 +3170,12 @@ bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 	uint16_t nodeId = node->getNodeId ();
 	memcpy (&(serverHello_msg.nodeId), &nodeId, sizeof (uint16_t));
 
-	random = Crypto.random ();
+	random = ((uint32_t)HELLO_CAPABILITY_MARKER << 16) | (uint8_t)node->getCipherSuite (); // Signal capabilities and selected cipher suite. Bits 9-15 are reserved
+	if (node->useCounter32 ()) {
+		random = random | 0x00000100U; // Signal 32 bit counters agreed
+	} else {
+		random = random & 0xFFFFFEFFU; // Signal 16 bit counters
+	}
 	memcpy (&(serverHello_msg.random), &random, RANDOM_LENGTH);
 
 	DEBUG_VERBOSE ("Server Hello message: %s", printHexBuffer ((uint8_t*)&serverHello_msg, SHMSG_LEN - TAG_LENGTH));
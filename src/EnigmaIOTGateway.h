@@ -23,6 +23,11 @@
 #include <DNSServer.h>
 #include <queue>
 #include "EnigmaIOTRingBuffer.h"
+#if USE_OTA_CACHE
+#include "OtaCache.h"
+#include "OtaSender.h"
+#include "OtaMulticast.h"
+#endif // USE_OTA_CACHE
 #if ENABLE_REST_API
 #include "GatewayAPI.h"
 #endif // ENABLE_REST_API
@@ -38,6 +43,9 @@
 enum gatewayMessageType_t {
 	SENSOR_DATA = 0x01, /**< Data message from sensor node */
 	SENSOR_BRCAST_DATA = 0x81, /**< Data broadcast message from sensor node */
+	SENSOR_AGGREGATED_DATA = 0x09, /**< Data message from sensor node with several readings, each one with its relative timestamp */
+	DATA_FRAGMENT = 0x0A, /**< Part of a data or discovery message that is too long to be sent in a single message */
+	SENSOR_BUFFERED_DATA = 0x0B, /**< Data message from sensor node with readings stored along several sleep cycles, each one with its age */
 	UNENCRYPTED_NODE_DATA = 0x11, /**< Data message from sensor node. Unencrypted */
 	DOWNSTREAM_DATA_SET = 0x02, /**< Data message from gateway. Downstream data for user commands */
 	DOWNSTREAM_BRCAST_DATA_SET = 0x82, /**< Data broadcast message from gateway. Downstream data for user commands */
@@ -55,6 +63,7 @@ enum gatewayMessageType_t {
 	BROADCAST_KEY_RESPONSE = 0x18, /**< Message from gateway with broadcast key */
 	CLIENT_HELLO = 0xFF, /**< ClientHello message from sensor node */
 	SERVER_HELLO = 0xFE, /**< ServerHello message from gateway */
+	HELLO_COOKIE = 0xFD, /**< Handshake cookie from gateway that has to be echoed on ClientHello */
 	INVALIDATE_KEY = 0xFB /**< InvalidateKey message from gateway */
 };
 
@@ -85,6 +94,7 @@ enum gwInvalidateReason_t {
 #if defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32
 #include <functional>
 typedef std::function<void (uint8_t* mac, uint8_t* buf, uint8_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName)> onGwDataRx_t;
+typedef std::function<void (uint8_t* mac, uint8_t* buf, size_t len, uint16_t lostMessages, gatewayPayloadEncoding_t payload_type, char* nodeName)> onGwLongDataRx_t;
 #if SUPPORT_HA_DISCOVERY
 typedef std::function<void (const char* topic, char *message, size_t len)> onHADiscovery_t;
 #endif
@@ -95,12 +105,25 @@ typedef std::function<void (void)> simpleEventHandler_t;
 
 #else
 typedef void (*onGwDataRx_t)(uint8_t* mac, uint8_t* data, uint8_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName);
+typedef void (*onGwLongDataRx_t)(uint8_t* mac, uint8_t* data, size_t len, uint16_t lostMessages, gatewayPayloadEncoding_t payload_type, char* nodeName);
 typedef void (*onNewNode_t)(uint8_t* mac, uint16_t node_id, char* nodeName);
 typedef void (*onNodeDisconnected_t)(uint8_t* mac, gwInvalidateReason_t reason);
 typedef void (*onWiFiManagerExit_t)(boolean status);
 typedef void (*simpleEventHandler_t)(void);
 #endif
 
+#if USE_OTA_CACHE
+/**
+  * @brief Phase of OTA update sent from gateway cache
+  */
+enum otaStreamPhase_t {
+	OTA_STREAM_IDLE, /**< No OTA image is being received or sent */
+	OTA_STREAM_STORING, /**< OTA image is being stored in cache */
+	OTA_STREAM_STARTING, /**< First OTA message has been sent. Waiting for node to start update */
+	OTA_STREAM_SENDING /**< OTA chunks are being sent to node */
+};
+#endif // USE_OTA_CACHE
+
 typedef struct {
 	uint8_t channel = DEFAULT_CHANNEL; /**< Channel used for communications*/
 	uint8_t networkKey[KEY_LENGTH];   /**< Network key to protect key agreement*/
@@ -114,6 +137,21 @@ typedef struct {
     signed int rssi; /**< Message RSSI*/
 } msg_queue_item_t;
 
+typedef struct {
+	bool used; /**< `true` if this buffer holds a message*/
+	bool complete; /**< All fragments were received. Buffer is kept to answer retransmissions until it times out*/
+	uint16_t nodeId; /**< Node that sends the message*/
+	uint8_t seq; /**< Message sequence number*/
+	uint8_t total; /**< Number of fragments*/
+	uint8_t received; /**< Bitmap of received fragments*/
+	uint8_t msgType; /**< Message type to deliver reassembled message as*/
+	gatewayPayloadEncoding_t encoding; /**< Payload encoding*/
+	uint16_t lostMessages; /**< Lost messages detected while fragments were received*/
+	size_t len; /**< Message length. Known when last fragment is received*/
+	uint32_t lastFragment; /**< Time when last fragment was received*/
+	uint8_t* data; /**< Message buffer. It is allocated when first fragment arrives and freed when message is notified or times out*/
+} fragment_buffer_t;
+
 /**
   * @brief Main gateway class. Manages communication with nodes and sends data to upper layer
   *
@@ -131,6 +169,9 @@ protected:
 	unsigned long txLedOnTime; ///< @brief Flash duration for Tx LED
 	unsigned long rxLedOnTime; ///< @brief Flash duration for Rx LED
     onGwDataRx_t notifyData; ///< @brief Callback function that will be invoked when data is received from a node
+	onGwLongDataRx_t notifyLongData = NULL; ///< @brief Callback function that will be invoked when a reassembled fragmented message is received from a node
+	int64_t dataTimestamp = 0; ///< @brief Time when data being notified was measured, in milliseconds since epoch
+	fragment_buffer_t reassemblyPool[FRAGMENT_POOL_SIZE]; ///< @brief Fragmented messages being reassembled
 #if SUPPORT_HA_DISCOVERY
     onHADiscovery_t notifyHADiscovery; ///< @brief Callback function that will be invoked when HomeAssistant discovery message is received from a node
 #endif
@@ -144,8 +185,23 @@ protected:
 	portMUX_TYPE myMutex = portMUX_INITIALIZER_UNLOCKED; ///< @brief Handle to control critical sections
 #endif
 	msg_queue_item_t tempBuffer; ///< @brief Temporary storage for input message got from buffer
+#if USE_HELLO_COOKIE
+	uint8_t helloCookieSecret[KEY_LENGTH]; ///< @brief Random secret used to calculate handshake cookies. It never leaves gateway
+#endif
 
 	EnigmaIOTRingBuffer<msg_queue_item_t>* input_queue; ///< @brief Input messages buffer. It acts as a FIFO queue
+#if USE_OTA_CACHE
+	OtaCacheClass otaCache; ///< @brief OTA image stored on gateway file system
+	OtaSenderClass otaSender; ///< @brief Decides which cached OTA chunk is sent next
+	Node* otaStreamNode = NULL; ///< @brief Node that cached OTA image is being sent to
+	otaStreamPhase_t otaStreamPhase = OTA_STREAM_IDLE; ///< @brief Phase of OTA update sent from cache
+	uint32_t otaStreamLastTx = 0; ///< @brief `millis ()` value when last OTA message was sent from cache
+	uint8_t otaStreamRetries = 0; ///< @brief Times that first OTA message has been sent again
+	uint8_t otaStreamProgress = 0; ///< @brief Last progress reported, in tens of percent
+	OtaMulticastClass otaMulticast; ///< @brief Nodes that cached OTA image is being broadcast to. It keeps their result after update
+	uint32_t otaMulticastStart = 0; ///< @brief `millis ()` value when multicast OTA update started
+	volatile bool otaImageEndPending = false; ///< @brief Whole image has been uploaded to web API. It is checked and sent from `handle ()`
+#endif // USE_OTA_CACHE
 
 	AsyncWebServer* server; ///< @brief WebServer that holds configuration portal
 	DNSServer* dns; ///< @brief DNS server used by configuration portal
@@ -191,6 +247,33 @@ protected:
 	 */
 	bool processClientHello (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* buf, size_t count, Node* node);
 
+#if USE_HELLO_COOKIE
+	/**
+	 * @brief Calculates stateless handshake cookie for a node address and time window
+	 * @param mac Node address
+	 * @param window Time window index
+	 * @param cookie Buffer to store cookie. It must be `HELLO_COOKIE_LENGTH` bytes long
+	 */
+	void calculateHelloCookie (const uint8_t* mac, uint32_t window, uint8_t* cookie);
+
+	/**
+	 * @brief Checks that a **ClientHello** message echoes a valid handshake cookie. Otherwise a new cookie is sent to node.
+	 * This is done before any node slot is used and before key agreement starts
+	 * @param mac Address where this message was received from
+	 * @param buf Pointer to the buffer that contains the message
+	 * @param count Message length in number of bytes of ClientHello message
+	 * @return Returns `true` if cookie is valid and registration may go on
+	 */
+	bool checkHelloCookie (const uint8_t* mac, const uint8_t* buf, size_t count);
+
+	/**
+	 * @brief Sends a **HelloCookie** message to node
+	 * @param mac Node address
+	 * @return Returns `true` if message was successfully sent. `false` otherwise
+	 */
+	bool sendHelloCookie (const uint8_t* mac);
+#endif // USE_HELLO_COOKIE
+
 	/**
 	 * @brief Starts clock sync procedure from node to gateway
 	 * @param mac Address where this message was received from
@@ -218,6 +301,50 @@ protected:
 	 */
 	bool invalidateKey (Node* node, gwInvalidateReason_t reason);
 
+	/**
+	 * @brief Checks node key age after a correct message. If it has expired, key is rotated through a key update message
+	 * if node supports it or invalidated otherwise
+	 * @param node Node that sent last message
+	 */
+	void checkKeyExpiration (Node* node);
+
+#if USE_KEY_UPDATE
+	/**
+	 * @brief Sends a **KeyUpdate** control message with the salt that node needs to derive next key
+	 * @param node Node to send Key Update message to
+	 * @return Returns `true` if message could be correcly sent
+	 */
+	bool sendKeyUpdate (Node* node);
+
+	/**
+	 * @brief Checks if an encrypted message from a node with a pending key update was encrypted with the new key.
+	 * In that case node has already applied the update, so pending key replaces current one
+	 * @param node Node that sent the message
+	 * @param buf Received message. It is not modified
+	 * @param count Message length
+	 */
+	void checkPendingKey (Node* node, const uint8_t* buf, size_t count);
+
+	/**
+	 * @brief Checks if a node message can be authenticated with a given key
+	 * @param node Node that sent the message
+	 * @param key Key to check
+	 * @param buf Received message. It is not modified
+	 * @param count Message length
+	 * @return Returns `true` if message tag is correct for that key
+	 */
+	bool checkNodeKey (Node* node, const uint8_t* key, const uint8_t* buf, size_t count);
+
+	/**
+	 * @brief Encrypts again downlink message queued for a sleepy node after it has switched to a new key, so that
+	 * it is not lost. Queued key update messages are not kept
+	 * @param node Node whose message is queued. It must use new key already
+	 * @param oldKey Key that message was encrypted with
+	 * @return Returns `true` if queued message is still valid
+	 */
+	bool reencryptQueuedMessage (Node* node, const uint8_t* oldKey);
+#endif // USE_KEY_UPDATE
+
 	/**
 	 * @brief Processes data message from node
 	 * @param mac Node address
@@ -239,6 +366,190 @@ protected:
 	 */
 	bool processUnencryptedDataMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node);
 
+	/**
+	 * @brief Splits an aggregated or buffered data message payload and notifies every reading separately
+	 * @param mac Node address
+	 * @param data Decrypted payload. A sequence of readings with its age and length
+	 * @param len Payload length
+	 * @param lostMessages Lost messages before this one. It is only notified with first reading
+	 * @param encoding Encoding of all readings
+	 * @param nodeName Node name, if set
+	 * @param ageLength Length of age field in bytes. 2 on aggregated data, 4 on buffered data
+	 * @return Returns `true` if payload format is correct
+	 */
+	bool notifyAggregatedData (const uint8_t* mac, uint8_t* data, uint8_t len, uint16_t lostMessages, gatewayPayloadEncoding_t encoding, char* nodeName, uint8_t ageLength = sizeof (uint16_t));
+
+	/**
+	 * @brief Stores a fragment of a long message. Reassembled message is notified as a data or discovery message when all
+	 * fragments are received. Status is reported to node after last fragment so that it sends missing ones again
+	 * @param mac Node address
+	 * @param node Node where fragment comes from
+	 * @param data Decrypted fragment, including its header
+	 * @param len Fragment length
+	 * @param lostMessages Lost messages before this one
+	 * @param encoding Message payload encoding
+	 * @return Returns `true` if fragment format is correct
+	 */
+	bool processFragment (const uint8_t* mac, Node* node, const uint8_t* data, size_t len, uint16_t lostMessages, gatewayPayloadEncoding_t encoding);
+
+	/**
+	 * @brief Gets reassembly buffer for a fragmented message. A new one is assigned if it is not found. Timed out buffers are released
+	 * @param node Node where message comes from
+	 * @param seq Message sequence number
+	 * @param total Number of fragments
+	 * @return Pointer to buffer. `NULL` if there are no free buffers
+	 */
+	fragment_buffer_t* getReassemblyBuffer (Node* node, uint8_t seq, uint8_t total);
+
+	/**
+	 * @brief Sends a fragment status message to node with the fragments that are still missing
+	 * @param node Destination node
+	 * @param buffer Reassembly buffer
+	 * @return Returns `true` if message could be sent
+	 */
+	bool sendFragmentStatus (Node* node, fragment_buffer_t* buffer);
+
+#if USE_TX_SLOTS
+	/**
+	 * @brief Checks if a sleepy node has sent its message inside its transmission slot. Otherwise it sends the time to
+	 * next slot so that node adjusts its sleep time
+	 * @param node Node that has just sent a message
+	 * @return Returns `true` if a slot correction was sent
+	 */
+	bool checkTxSlot (Node* node);
+#endif // USE_TX_SLOTS
+
+#if USE_DOWNLINK_END
+	/**
+	 * @brief Tells a sleepy node that there is nothing else to send to it, so that it may go to sleep at once.
+	 * It is not sent if a message has been queued for next wake up
+	 * @param node Node that has just sent a message
+	 * @return Returns `true` if message could be sent
+	 */
+	bool sendDownlinkEnd (Node* node);
+#endif // USE_DOWNLINK_END
+
+#if USE_OTA_CACHE
+	/**
+	 * @brief Stores an OTA message in cache. It has same format as OTA messages sent to gateway for a node, so that
+	 * a whole image may be sent in advance, without waiting for node. When last chunk is stored gateway starts
+	 * sending image to node by itself
+	 * @param node Node that image is for
+	 * @param data OTA message as text. `0,<size>,<chunks>,<md5>[,<format>]` or `<index>,<base64 chunk>`
+	 * @param len Message length
+	 * @return Returns `true` if message could be stored
+	 */
+	bool storeOtaImage (Node* node, const uint8_t* data, size_t len);
+
+	/**
+	 * @brief Starts storing an OTA image in cache. Previous image is discarded
+	 * @param node Node that image is for. It has to be non sleepy
+	 * @param size Size of image written to node flash, after decompression
+	 * @param numChunks Number of chunks image is sent in
+	 * @param md5 MD5 of image written to node flash, as a 32 character hex string
+	 * @param format Image format. One of `ota_format_t`
+	 * @return Returns `true` if image may be stored
+	 */
+	bool beginOtaImage (Node* node, uint32_t size, uint16_t numChunks, const char* md5, uint8_t format);
+
+	/**
+	 * @brief Appends data to OTA image being stored in cache
+	 * @param data Image data
+	 * @param len Data length
+	 * @return Returns `true` if data could be stored
+	 */
+	bool addOtaImageData (const uint8_t* data, size_t len);
+
+	/**
+	 * @brief Checks OTA image stored in cache and starts sending it to node
+	 * @return Returns `true` if image is correct and update could be started
+	 */
+	bool endOtaImage ();
+
+	/**
+	 * @brief Marks OTA image being stored as complete, so that it is checked and sent to node from `handle ()`.
+	 * Web server task only has to store image data this way
+	 * @return Returns `true` if an image was being stored
+	 */
+	bool requestOtaImageEnd ();
+
+	/**
+	 * @brief Sends first OTA message, with image size, number of chunks, MD5 and format, from cached image
+	 * @param node Node to send message to
+	 * @param multicast `true` if node joins a multicast update, so it has to accept chunks sent as broadcast
+	 * @return Returns `true` if message could be sent
+	 */
+	bool sendOtaHeader (Node* node, bool multicast = false);
+
+	/**
+	 * @brief Sends an OTA chunk from cache
+	 * @param node Node to send chunk to. It may be broadcast node
+	 * @param msgIdx Chunk index
+	 * @return Returns `false` if chunk could not be read from cache
+	 */
+	bool sendOtaChunk (Node* node, uint16_t msgIdx);
+
+	/**
+	 * @brief Notifies update progress every 10% of image
+	 * @param acknowledged Number of chunks acknowledged
+	 */
+	void notifyOtaProgress (uint16_t acknowledged);
+
+	/**
+	 * @brief Sends next OTA chunk from cache when node window allows it. It is called from `handle ()`
+	 */
+	void handleOtaStream ();
+
+	/**
+	 * @brief Starts sending cached OTA image to every registered non sleepy node with broadcast enabled
+	 * @return Returns `true` if some node may join update
+	 */
+	bool beginOtaMulticast ();
+
+	/**
+	 * @brief Sends first OTA message to joining nodes, broadcasts chunks and plans repair rounds. It is called
+	 * from `handle ()`
+	 */
+	void handleOtaMulticast ();
+
+	/**
+	 * @brief Processes an OTA answer from a node in a multicast update
+	 * @param node Node that sent the answer
+	 * @param data Control message payload
+	 * @param len Payload length
+	 * @return Returns `true` if answer is only useful for gateway and it should not be notified
+	 */
+	bool processOtaMulticastAnswer (Node* node, const uint8_t* data, size_t len);
+
+	/**
+	 * @brief Notifies multicast update result and stops it
+	 */
+	void endOtaMulticast ();
+
+	/**
+	 * @brief Processes an OTA answer from node that cached image is being sent to
+	 * @param node Node that sent the answer
+	 * @param data Control message payload
+	 * @param len Payload length
+	 * @return Returns `true` if answer is only useful for gateway and it should not be notified
+	 */
+	bool processOtaAnswer (Node* node, const uint8_t* data, size_t len);
+
+	/**
+	 * @brief Notifies an OTA status event generated by gateway as if it had been sent by node
+	 * @param node Node that OTA update is for
+	 * @param status One of `ota_status_t`
+	 * @param data Additional status data
+	 * @param len Additional data length
+	 */
+	void notifyOtaStatus (Node* node, uint8_t status, const uint8_t* data = NULL, size_t len = 0);
+
+	/**
+	 * @brief Stops OTA update from cache. An incomplete image is discarded
+	 */
+	void stopOtaStream ();
+#endif // USE_OTA_CACHE
+
 	/**
 	 * @brief Builds, encrypts and sends a **DownstreamData** message.
 	 * @param node Node that downstream data message is going to
@@ -459,6 +770,28 @@ public:
 		notifyData = handler;
     }
 
+	/**
+	 * @brief Defines a function callback that will be called when a node sends a data message that did not fit in a
+	 * single frame and has been reassembled from its fragments. It may be up to `MAX_FRAGMENTED_LENGTH` bytes long.
+	 *
+	 * If it is not defined, reassembled messages up to 255 bytes long are delivered to `onDataRx` callback and longer
+	 * ones are discarded
+	 * @param handler Pointer to the function
+	 */
+	void onLongDataRx (onGwLongDataRx_t handler) {
+		notifyLongData = handler;
+	}
+
+	/**
+	 * @brief Gets time when data that is being notified was measured. It is only valid inside data callback.
+	 *
+	 * For aggregated messages it is reconstructed from every reading age. For other messages it is reception time
+	 * @return Time in milliseconds since epoch
+	 */
+	int64_t getDataTimestamp () {
+		return dataTimestamp;
+	}
+
 #if SUPPORT_HA_DISCOVERY
     /**
      * @brief Defines a function callback that will be called when a Home Assistant discovery message is received from a node
@@ -497,6 +830,16 @@ public:
 	 */
 	double getPacketsHour (uint8_t* address);
 
+	/**
+	 * @brief Gets rate and power used to send to node that has a specific address, and its link quality
+	 * @param address Node address
+	 * @param state Gets link state
+	 * @return Returns `true` if communication layer tracks link to that node
+	 */
+	bool getLinkState (uint8_t* address, comms_link_state_t* state) {
+		return comm->getLinkState (address, state);
+	}
+
 	/**
 	 * @brief Starts a downstream data message transmission
 	 * @param mac Node address
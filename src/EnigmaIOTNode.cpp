@@ -12,6 +12,9 @@
 #include <Arduino.h>
 #include "EnigmaIOTNode.h"
 #include "timeManager.h"
+#if USE_FLASH_INSTEAD_RTC && USE_CONTEXT_LOG
+#include "ContextLog.h"
+#endif
 #include <FS.h>
 #include <MD5Builder.h>
 #ifdef ESP8266
@@ -40,6 +43,17 @@ bool nodeConnectionLedFlashing = false;
 RTC_DATA_ATTR rtcmem_data_t rtcmem_data_storage; ///< @brief Context data to be kept on persistent storage
 #endif
 
+#if USE_SAMPLE_BUFFER
+#ifdef ESP8266
+static const uint32_t SAMPLE_BUFFER_ADDRESS = RTC_ADDRESS + sizeof (rtcmem_data_t) / sizeof (uint32_t); ///< @brief RTC memory address of stored readings, just after context data
+#elif defined ESP32
+RTC_DATA_ATTR sample_buffer_t sampleBufferStorage; ///< @brief Readings stored across deep sleep cycles
+#endif
+static const size_t SAMPLE_BUFFER_HEADER_LENGTH = offsetof (sample_buffer_t, data) - offsetof (sample_buffer_t, clock); ///< @brief Stored readings header length covered by CRC
+static const uint8_t SAMPLE_HEADER_LENGTH = sizeof (uint32_t) + 2; ///< @brief Timestamp, encoding and length of every stored reading
+static const uint8_t BUFFERED_HEADER_LENGTH = sizeof (uint32_t) + 1; ///< @brief Age and length of every reading in a buffered data message
+#endif // USE_SAMPLE_BUFFER
+
 
 void EnigmaIOTNodeClass::resetConfig () {
 	restartReason = CONFIG_RESET;
@@ -107,6 +121,16 @@ void clearRtcData (rtcmem_data_t* data) {
 	data->nodeKeyValid = false;
 	data->broadcastKeyRequested = false;
 	data->broadcastKeyValid = false;
+	data->cipherSuite = CIPHER_CHACHAPOLY;
+	data->lastControlCounter = 0;
+	data->lastDownlinkMsgCounter = 0;
+	data->counter32 = false;
+	data->downlinkReplayWindow = 1;
+	data->keyEpoch = 0;
+	data->txSlotPeriod = 0;
+	memset (data->gwChannels, 0, GATEWAY_CHANNEL_HISTORY);
+	data->scanBackoff = 0;
+	data->scanSkipped = 0;
 	DEBUG_DBG ("RTC Cleared");
 }
 
@@ -114,13 +138,17 @@ void dumpRtcData (rtcmem_data_t* data, uint8_t* gateway = NULL) {
 	Serial.println ("RTC MEM DATA:");
 	if (data) {
 		Serial.printf (" -- CRC: %s\n", printHexBuffer ((uint8_t*)&(data->crc32), sizeof (uint32_t)));
+		Serial.printf (" -- Counters CRC: %s\n", printHexBuffer ((uint8_t*)&(data->countersCrc32), sizeof (uint32_t)));
 		Serial.printf (" -- Node Key: %s\n", printHexBuffer (data->nodeKey, KEY_LENGTH));
 		Serial.printf (" -- Node key is %svalid\n", data->nodeKeyValid ? "" : "NOT ");
 		Serial.printf (" -- Node status is %d: %s\n", data->nodeRegisterStatus, data->nodeRegisterStatus == REGISTERED ? "REGISTERED" : "NOT REGISTERED");
 		Serial.printf (" -- Node name: %s\n", data->nodeName);
-		Serial.printf (" -- Last message counter: %d\n", data->lastMessageCounter);
-		Serial.printf (" -- Last control counter: %d\n", data->lastControlCounter);
-		Serial.printf (" -- Last downlink counter: %d\n", data->lastDownlinkMsgCounter);
+		Serial.printf (" -- Last message counter: %u\n", data->lastMessageCounter);
+		Serial.printf (" -- Last control counter: %u\n", data->lastControlCounter);
+		Serial.printf (" -- Last downlink counter: %u\n", data->lastDownlinkMsgCounter);
+		Serial.printf (" -- Counter length: %d bits\n", data->counter32 ? 32 : 16);
+		Serial.printf (" -- Key epoch: %u\n", data->keyEpoch);
+		Serial.printf (" -- Cipher suite: %s\n", CryptModule::getSuiteName ((cipherSuite_t)data->cipherSuite));
 		Serial.printf (" -- NodeID: %d\n", data->nodeId);
 		Serial.printf (" -- Channel: %d\n", data->channel);
 		Serial.printf (" -- RSSI: %d\n", data->rssi);
@@ -132,6 +160,9 @@ void dumpRtcData (rtcmem_data_t* data, uint8_t* gateway = NULL) {
 			Serial.printf (" -- Gateway address: %s\n", mac2str (gateway, gwAddress));
 		Serial.printf (" -- Network Key: %s\n", printHexBuffer (data->networkKey, KEY_LENGTH));
 		Serial.printf (" -- Mode: %s\n", data->sleepy ? "sleepy" : "non sleepy");
+		Serial.printf (" -- Slot period: %u\n", data->txSlotPeriod);
+		Serial.printf (" -- Gateway channels: %s\n", printHexBuffer (data->gwChannels, GATEWAY_CHANNEL_HISTORY));
+		Serial.printf (" -- Scans skipped: %u of %u\n", data->scanSkipped, data->scanBackoff);
 		Serial.printf (" -- Broadcast key: %s\n", printHexBuffer (data->broadcastKey, KEY_LENGTH));
 		Serial.printf (" -- Broadcast key is %s and %s requested\n",
 					   data->broadcastKeyValid ? "valid" : "not valid",
@@ -143,76 +174,97 @@ void dumpRtcData (rtcmem_data_t* data, uint8_t* gateway = NULL) {
 
 #if USE_FLASH_INSTEAD_RTC
 const char* RTC_DATA_FILE = "/context.bin";
-bool EnigmaIOTNodeClass::loadRTCData () {
+bool EnigmaIOTNodeClass::loadRTCFile (rtcmem_data_t* context) {
     //FILESYSTEM.remove (RTC_DATA_FILE); // Only for testing
-	//bool file_correct = false;
-	clock_t start_load = millis ();
     FILESYSTEM.begin ();
 
+    if (!FILESYSTEM.exists (RTC_DATA_FILE)) {
+		DEBUG_WARN ("%s do not exist", RTC_DATA_FILE);
+		return false;
+	}
+	DEBUG_DBG ("Opening %s file", RTC_DATA_FILE);
+    File contextFile = FILESYSTEM.open (RTC_DATA_FILE, "r");
+	if (!contextFile) {
+		DEBUG_WARN ("Error opening file %s", RTC_DATA_FILE);
+        FILESYSTEM.remove (RTC_DATA_FILE);
+		return false;
+	}
+	DEBUG_DBG ("%s opened", RTC_DATA_FILE);
+	size_t size = contextFile.size ();
+	if (size != sizeof (rtcmem_data_t)) {
+		DEBUG_WARN ("File size error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
+		contextFile.close ();
+        FILESYSTEM.remove (RTC_DATA_FILE);
+		return false;
+	}
+	size = contextFile.readBytes ((char*)context, sizeof (rtcmem_data_t));
+	contextFile.close ();
+	if (size != sizeof (rtcmem_data_t)) {
+		DEBUG_WARN ("File read error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
+        FILESYSTEM.remove (RTC_DATA_FILE);
+		return false;
+	}
+	return true;
+}
+
+bool EnigmaIOTNodeClass::loadRTCData () {
+	clock_t start_load = millis ();
 	rtcmem_data_t context;
 
-    if (FILESYSTEM.exists (RTC_DATA_FILE)) {
-		DEBUG_DBG ("Opening %s file", RTC_DATA_FILE);
-        File contextFile = FILESYSTEM.open (RTC_DATA_FILE, "r");
-		if (contextFile) {
-			DEBUG_DBG ("%s opened", RTC_DATA_FILE);
-			size_t size = contextFile.size ();
-			if (size != sizeof (rtcmem_data_t)) {
-				DEBUG_WARN ("File size error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
-				contextFile.close ();
-                FILESYSTEM.remove (RTC_DATA_FILE);
-				return false;
-			}
-			size = contextFile.readBytes ((char*)&context, sizeof (rtcmem_data_t));
-			contextFile.close ();
-			if (size != sizeof (rtcmem_data_t)) {
-				DEBUG_WARN ("File read error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
-				//contextFile.close ();
-                FILESYSTEM.remove (RTC_DATA_FILE);
-				return false;
-			}
-			if (!checkCRC ((uint8_t*)context.nodeKey, sizeof (rtcmem_data_t) - sizeof (uint32_t), &context.crc32)) {
-				DEBUG_WARN ("RTC Data is not valid. Wrong CRC");
-				//contextFile.close ();
-                FILESYSTEM.remove (RTC_DATA_FILE);
-				return false;
-			} else {
-				memcpy (&rtcmem_data, &context, sizeof (rtcmem_data_t));
-				node.setEncryptionKey (rtcmem_data.nodeKey);
-				node.setKeyValid (rtcmem_data.nodeKeyValid);
-				if (rtcmem_data.nodeKeyValid)
-					node.setKeyValidFrom (millis ());
-				node.setLastMessageCounter (rtcmem_data.lastMessageCounter);
-				node.setLastControlCounter (rtcmem_data.lastControlCounter);
-				node.setLastDownlinkMsgCounter (rtcmem_data.lastDownlinkMsgCounter);
-				node.setLastMessageTime ();
-				node.setNodeId (rtcmem_data.nodeId);
-				// setChannel (rtcmem_data.channel);
-				//channel = rtcmem_data.channel;
-				//memcpy (gateway, rtcmem_data.gateway, comm->getAddressLength ()); // setGateway
-				//memcpy (networkKey, rtcmem_data.networkKey, KEY_LENGTH);
-				node.setSleepy (rtcmem_data.sleepy);
-				node.setNodeName (rtcmem_data.nodeName);
-				// set default sleep time if it was not set
-				if (rtcmem_data.sleepy && rtcmem_data.sleepTime == 0) {
-					rtcmem_data.sleepTime = DEFAULT_SLEEP_TIME;
-				}
-				node.setStatus (rtcmem_data.nodeRegisterStatus);
-				DEBUG_DBG ("Set %s mode", node.getSleepy () ? "sleepy" : "non sleepy");
-#if DEBUG_LEVEL >= VERBOSE
-				dumpRtcData (&rtcmem_data);
-#endif
-			}
-		} else {
-			DEBUG_WARN ("Error opening file %s", RTC_DATA_FILE);
-            FILESYSTEM.remove (RTC_DATA_FILE);
+#if USE_CONTEXT_LOG
+	// Only latest sector is read from raw flash. File is used if there is no place for context log
+	if (ContextLog.isReady () || ContextLog.begin (&ContextFlash_hal, sizeof (rtcmem_data_t))) {
+		if (!ContextLog.load ((uint8_t*)&context)) {
+			DEBUG_WARN ("No context found in flash log");
 			return false;
 		}
-	} else {
-		DEBUG_WARN ("%s do not exist", RTC_DATA_FILE);
+	} else
+#endif // USE_CONTEXT_LOG
+	if (!loadRTCFile (&context)) {
+		return false;
+	}
+
+	if (!checkRTCData (&context)) {
+		DEBUG_WARN ("RTC Data is not valid. Wrong CRC");
+#if USE_CONTEXT_LOG
+		if (ContextLog.isReady ()) {
+			return false;
+		}
+#endif // USE_CONTEXT_LOG
+        FILESYSTEM.remove (RTC_DATA_FILE);
 		return false;
 	}
 
+	memcpy (&rtcmem_data, &context, sizeof (rtcmem_data_t));
+	node.setEncryptionKey (rtcmem_data.nodeKey);
+	node.setCipherSuite ((cipherSuite_t)rtcmem_data.cipherSuite);
+	node.setKeyValid (rtcmem_data.nodeKeyValid);
+	if (rtcmem_data.nodeKeyValid)
+		node.setKeyValidFrom (millis ());
+	node.setLastMessageCounter (rtcmem_data.lastMessageCounter);
+	node.setLastControlCounter (rtcmem_data.lastControlCounter);
+	node.setLastDownlinkMsgCounter (rtcmem_data.lastDownlinkMsgCounter);
+	node.setDownlinkReplayWindow (rtcmem_data.downlinkReplayWindow);
+	node.setCounter32 (rtcmem_data.counter32);
+	node.setKeyEpoch (rtcmem_data.keyEpoch);
+	node.setLastMessageTime ();
+	node.setNodeId (rtcmem_data.nodeId);
+	// setChannel (rtcmem_data.channel);
+	//channel = rtcmem_data.channel;
+	//memcpy (gateway, rtcmem_data.gateway, comm->getAddressLength ()); // setGateway
+	//memcpy (networkKey, rtcmem_data.networkKey, KEY_LENGTH);
+	node.setSleepy (rtcmem_data.sleepy);
+	node.setNodeName (rtcmem_data.nodeName);
+	// set default sleep time if it was not set
+	if (rtcmem_data.sleepy && rtcmem_data.sleepTime == 0) {
+		rtcmem_data.sleepTime = DEFAULT_SLEEP_TIME;
+	}
+	node.setStatus (rtcmem_data.nodeRegisterStatus);
+	DEBUG_DBG ("Set %s mode", node.getSleepy () ? "sleepy" : "non sleepy");
+#if DEBUG_LEVEL >= VERBOSE
+	dumpRtcData (&rtcmem_data);
+#endif
+
 	DEBUG_DBG ("Load process finished in %lu ms", millis () - start_load);
 
 	return true;
@@ -231,18 +283,23 @@ bool EnigmaIOTNodeClass::loadRTCData () {
 	memcpy ((uint8_t*)&rtcmem_data, (uint8_t*)&rtcmem_data_storage, sizeof (rtcmem_data));
 	DEBUG_VERBOSE ("----- Read RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
 #endif
-	if (!checkCRC ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t), &rtcmem_data.crc32)) {
+	if (!checkRTCData (&rtcmem_data)) {
 		DEBUG_DBG ("RTC Data is not valid");
 		clearRtcData (&rtcmem_data);
 		return false;
 	} else {
+		rtcSessionChanged = false;
 		node.setEncryptionKey (rtcmem_data.nodeKey);
+		node.setCipherSuite ((cipherSuite_t)rtcmem_data.cipherSuite);
 		node.setKeyValid (rtcmem_data.nodeKeyValid);
 		if (rtcmem_data.nodeKeyValid)
 			node.setKeyValidFrom (millis ());
 		node.setLastMessageCounter (rtcmem_data.lastMessageCounter);
 		node.setLastControlCounter (rtcmem_data.lastControlCounter);
 		node.setLastDownlinkMsgCounter (rtcmem_data.lastDownlinkMsgCounter);
+		node.setDownlinkReplayWindow (rtcmem_data.downlinkReplayWindow);
+		node.setCounter32 (rtcmem_data.counter32);
+		node.setKeyEpoch (rtcmem_data.keyEpoch);
 		node.setLastMessageTime ();
 		node.setNodeId (rtcmem_data.nodeId);
 		// setChannel (rtcmem_data.channel);
@@ -254,6 +311,7 @@ bool EnigmaIOTNodeClass::loadRTCData () {
 		// set default sleep time if it was not set
 		if (rtcmem_data.sleepy && rtcmem_data.sleepTime == 0) {
 			rtcmem_data.sleepTime = DEFAULT_SLEEP_TIME;
+			rtcSessionChanged = true;
 		}
 		node.setStatus (rtcmem_data.nodeRegisterStatus);
 		DEBUG_DBG ("Set %s mode", node.getSleepy () ? "sleepy" : "non sleepy");
@@ -325,6 +383,9 @@ bool EnigmaIOTNodeClass::loadFlashData () {
 				str2mac (gwAddrStr, gwAddr);
 				memcpy (rtcmem_data.gateway, gwAddr, 6);
 			}
+			if (doc.containsKey ("channel")) {
+				rtcmem_data.channel = doc["channel"].as<int> ();
+			}
 
 			if (json_correct) {
 				DEBUG_VERBOSE ("Configuration successfuly read");
@@ -376,6 +437,7 @@ bool EnigmaIOTNodeClass::saveFlashData (bool fsOpen) {
 	}
 	doc["sleepTime"] = rtcmem_data.sleepTime;
 	doc["gateway"] = gwAddrStr;
+	doc["channel"] = rtcmem_data.channel;
 	doc["nodeName"] = rtcmem_data.nodeName;
 
 	if (serializeJson (doc, configFile) == 0) {
@@ -408,7 +470,20 @@ bool EnigmaIOTNodeClass::saveRTCData () {
 	clock_t start_save = millis ();
 	if (configCleared)
 		return false;
-	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
+	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, RTC_SESSION_LENGTH);
+	rtcmem_data.countersCrc32 = calculateCRC32 ((uint8_t*)&rtcmem_data.lastMessageCounter, RTC_COUNTERS_LENGTH);
+	rtcSessionChanged = false;
+#if USE_CONTEXT_LOG
+	if (ContextLog.isReady ()) {
+		// Unchanged context is not written. Counter updates are written as small delta records
+		if (!ContextLog.save ((uint8_t*)&rtcmem_data)) {
+			DEBUG_WARN ("Error writing context to flash log");
+			return false;
+		}
+		DEBUG_DBG ("Save process finished in %lu ms", millis () - start_save);
+		return true;
+	}
+#endif // USE_CONTEXT_LOG
     File contextFile = FILESYSTEM.open (RTC_DATA_FILE, "w");
 	if (!contextFile) {
 		DEBUG_WARN ("failed to open config file %s for writing", RTC_DATA_FILE);
@@ -428,6 +503,11 @@ bool EnigmaIOTNodeClass::saveRTCData () {
 	return true;
 }
 
+bool EnigmaIOTNodeClass::saveRTCCounters () {
+	// Context log writes only changed bytes anyway and file has to be written as a whole
+	return saveRTCData ();
+}
+
 #else
 
 bool EnigmaIOTNodeClass::saveRTCData () {
@@ -437,9 +517,11 @@ bool EnigmaIOTNodeClass::saveRTCData () {
 		DEBUG_WARN ("Cannot write to RTC memory");
 		return true;
 	}
+	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, RTC_SESSION_LENGTH);
+	rtcmem_data.countersCrc32 = calculateCRC32 ((uint8_t*)&rtcmem_data.lastMessageCounter, RTC_COUNTERS_LENGTH);
 #ifdef ESP8266
-	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
 	if (ESP.rtcUserMemoryWrite (RTC_ADDRESS, (uint32_t*)&rtcmem_data, sizeof (rtcmem_data))) {
+		rtcSessionChanged = false;
 		DEBUG_DBG ("Write configuration data to RTC memory");
 #if DEBUG_LEVEL >= VERBOSE
 		DEBUG_VERBOSE ("Write RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
@@ -448,9 +530,8 @@ bool EnigmaIOTNodeClass::saveRTCData () {
 		return true;
 	}
 #elif defined ESP32
-	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
 	memcpy ((uint8_t*)&rtcmem_data_storage, (uint8_t*)&rtcmem_data, sizeof (rtcmem_data));
-	rtcmem_data_storage.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data_storage.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
+	rtcSessionChanged = false;
 	DEBUG_VERBOSE ("Write RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
 #if DEBUG_LEVEL >= VERBOSE
 	dumpRtcData (&rtcmem_data);
@@ -459,6 +540,31 @@ bool EnigmaIOTNodeClass::saveRTCData () {
 #endif
 	return false;
 }
+
+bool EnigmaIOTNodeClass::saveRTCCounters () {
+	if (configCleared)
+		return false;
+	if (protectOTA || otaRunning) {
+		DEBUG_WARN ("Cannot write to RTC memory");
+		return true;
+	}
+	if (rtcSessionChanged) {
+		return saveRTCData ();
+	}
+	// Session block in RTC memory is still valid. Only counters and their CRC are written
+	rtcmem_data.countersCrc32 = calculateCRC32 ((uint8_t*)&rtcmem_data.lastMessageCounter, RTC_COUNTERS_LENGTH);
+#ifdef ESP8266
+	if (ESP.rtcUserMemoryWrite (RTC_ADDRESS + RTC_COUNTERS_OFFSET / sizeof (uint32_t), &rtcmem_data.countersCrc32, RTC_COUNTERS_LENGTH + sizeof (uint32_t))) {
+		DEBUG_VERBOSE ("Write counters to RTC memory");
+		return true;
+	}
+#elif defined ESP32
+	memcpy ((uint8_t*)&rtcmem_data_storage.countersCrc32, (uint8_t*)&rtcmem_data.countersCrc32, RTC_COUNTERS_LENGTH + sizeof (uint32_t));
+	DEBUG_VERBOSE ("Write counters to RTC memory");
+	return true;
+#endif
+	return false;
+}
 #endif
 
 void EnigmaIOTNodeClass::clearFlash () {
@@ -602,7 +708,8 @@ bool EnigmaIOTNodeClass::configWiFiManager (rtcmem_data_t* data) {
 		}
 
 		data->nodeKeyValid = false;
-		data->crc32 = calculateCRC32 ((uint8_t*)(data->nodeKey), sizeof (rtcmem_data_t) - sizeof (uint32_t));
+		data->crc32 = calculateCRC32 ((uint8_t*)(data->nodeKey), RTC_SESSION_LENGTH);
+		data->countersCrc32 = calculateCRC32 ((uint8_t*)&(data->lastMessageCounter), RTC_COUNTERS_LENGTH);
 	}
 
 	if (notifyWiFiManagerExit) {
@@ -695,6 +802,9 @@ void EnigmaIOTNodeClass::checkResetButton () {
 
 void EnigmaIOTNodeClass::begin (Comms_halClass* comm, uint8_t* gateway, uint8_t* networkKey, bool useCounter, bool sleepy) {
 	cycleStartedTime = 0; // Calculate time from start
+	if (!rxQueue) {
+		rxQueue = new EnigmaIOTRingBuffer<node_rx_item_t> (NODE_RX_QUEUE_SIZE);
+	}
 	pinMode (led, OUTPUT);
 #ifdef ESP8266
 	ets_timer_setfn (&ledTimer, flashLed, (void*)&led);
@@ -722,6 +832,7 @@ void EnigmaIOTNodeClass::begin (Comms_halClass* comm, uint8_t* gateway, uint8_t*
 		DEBUG_DBG ("Own address: %s", mac2str (node.getMacAddress (), gwAddress));
 #endif
 	} else { // No RTC data, first boot or not configured
+		rtcSessionChanged = true;
 		if (gateway && networkKey) { // If connection data has been passed to library
 			DEBUG_DBG ("EnigmaIot started with config data con begin() call");
 			memcpy (rtcmem_data.gateway, gateway, comm->getAddressLength ()); // setGateway
@@ -804,6 +915,7 @@ void EnigmaIOTNodeClass::begin (Comms_halClass* comm, uint8_t* gateway, uint8_t*
 		DEBUG_ERROR ("Error setting promiscuous mode off: %s", esp_err_to_name (err_ok));
 	}
 #endif
+	comm->channelChanged ();
 
 	DEBUG_DBG ("Comms started. Channel %u", rtcmem_data.channel);
 }
@@ -857,17 +969,92 @@ int scanGatewaySSID (char* name, int& wifiIndex) {
 }
 #endif
 
-bool EnigmaIOTNodeClass::searchForGateway (rtcmem_data_t* data, bool shouldStoreData) {
-	DEBUG_DBG ("Searching for AP %s", data->networkName);
+#ifdef ESP8266
+bool probeGatewayChannel (const char* name, uint8_t channel, const uint8_t* bssid, uint8_t* gateway, int& rssi) {
+	// Active scan on a single channel sends a probe request for network name only
+	int numAP = WiFi.scanNetworks (false, false, channel, (uint8_t*)name);
+	bool found = false;
+
+	for (int i = 0; i < numAP; i++) {
+		if (!bssid || !memcmp (bssid, WiFi.BSSID (i), ENIGMAIOT_ADDR_LEN)) {
+			memcpy (gateway, WiFi.BSSID (i), ENIGMAIOT_ADDR_LEN);
+			rssi = WiFi.RSSI (i);
+			found = true;
+			break;
+		}
+	}
+	WiFi.scanDelete ();
+	return found;
+}
+#elif defined ESP32
+bool probeGatewayChannel (const char* name, uint8_t channel, const uint8_t* bssid, uint8_t* gateway, int& rssi) {
+	wifi_scan_config_t config;
+	wifi_ap_record_t apRecord;
+	uint16_t numAP = 1;
+	esp_err_t err_ok;
+
+	memset (&config, 0, sizeof (config));
+	config.ssid = (uint8_t*)name;
+	config.bssid = (uint8_t*)bssid;
+	config.channel = channel;
+	config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+	config.scan_time.active.max = GATEWAY_PROBE_TIME;
+
+	// Probe request is directed to cached gateway if its address is known
+	if ((err_ok = esp_wifi_scan_start (&config, true))) {
+		DEBUG_WARN ("Error probing channel %u: %s", channel, esp_err_to_name (err_ok));
+		return false;
+	}
+	if (esp_wifi_scan_get_ap_records (&numAP, &apRecord) || !numAP) {
+		return false;
+	}
+	memcpy (gateway, apRecord.bssid, ENIGMAIOT_ADDR_LEN);
+	rssi = apRecord.rssi;
+	return true;
+}
+#endif // ESP8266
+
+bool EnigmaIOTNodeClass::probeGateway (rtcmem_data_t* data, uint8_t& channel, uint8_t* gateway, int& rssi) {
+	uint32_t probeStarted = millis ();
+	const uint8_t* cachedGw = NULL;
+
+	for (int i = 0; i < ENIGMAIOT_ADDR_LEN; i++) {
+		if (data->gateway[i]) {
+			cachedGw = data->gateway;
+			break;
+		}
+	}
+
+	// Try cached channel and gateway address first
+	if (data->channel && probeGatewayChannel (data->networkName, data->channel, cachedGw, gateway, rssi)) {
+		channel = data->channel;
+		DEBUG_DBG ("Gateway found on cached channel %u in %lu ms", channel, millis () - probeStarted);
+		return true;
+	}
+
+	// Then channels where gateway has been found before
+	for (int i = 0; i < GATEWAY_CHANNEL_HISTORY; i++) {
+		uint8_t ch = data->gwChannels[i];
+		if (!ch || ch == data->channel) {
+			continue;
+		}
+		if (probeGatewayChannel (data->networkName, ch, NULL, gateway, rssi)) {
+			channel = ch;
+			DEBUG_DBG ("Gateway found on previous channel %u in %lu ms", channel, millis () - probeStarted);
+			return true;
+		}
+	}
+
+	DEBUG_DBG ("Gateway not found on known channels after %lu ms", millis () - probeStarted);
+	return false;
+}
 
-	//WiFi.mode (WIFI_STA);
+bool EnigmaIOTNodeClass::scanForGateway (rtcmem_data_t* data, uint8_t& channel, uint8_t* gateway, int& rssi) {
 	int numWifi = 0;
 	int wifiIndex = 0;
 
-    comm->enableTransmit (false);
-    DEBUG_DBG ("Transmission disabled");
 #ifdef ESP8266
-    time_t scanStarted = millis ();
+	time_t scanStarted = millis ();
 	numWifi = WiFi.scanNetworks (false, false, 0, (uint8_t*)(data->networkName));
 	while (!(WiFi.scanComplete () || (millis () - scanStarted) > 1500)) {
 #if DEBUG_LEVEL >= DBG
@@ -877,62 +1064,125 @@ bool EnigmaIOTNodeClass::searchForGateway (rtcmem_data_t* data, bool shouldStore
 		delay (50);
 #endif
 	}
-	WiFiMode_t mode = WiFi.getMode ();
-	DEBUG_DBG ("WiFi mode is %d. Restarting network interface after scan", mode);
-	WiFi.mode (WIFI_OFF);
-	WiFi.mode (mode);
 #elif defined ESP32
 	numWifi = scanGatewaySSID (data->networkName, wifiIndex);
 #endif // ESP8266
-    comm->enableTransmit (true);
-    DEBUG_DBG ("Transmission enabled");
-
-	uint8_t prevGwAddr[ENIGMAIOT_ADDR_LEN];
-	memcpy (prevGwAddr, data->gateway, 6);
 
 	if (numWifi > 0) {
 		DEBUG_INFO ("Gateway %s found: %d", data->networkName, numWifi);
 		DEBUG_INFO ("BSSID: %s", WiFi.BSSIDstr (wifiIndex).c_str ());
 		DEBUG_INFO ("Channel: %d", WiFi.channel (wifiIndex));
 		DEBUG_INFO ("RSSI: %d", WiFi.RSSI (wifiIndex));
-		data->channel = WiFi.channel (wifiIndex);
-		data->rssi = WiFi.RSSI (wifiIndex);
-		memcpy (data->gateway, WiFi.BSSID (wifiIndex), 6);
+		channel = WiFi.channel (wifiIndex);
+		rssi = WiFi.RSSI (wifiIndex);
+		memcpy (gateway, WiFi.BSSID (wifiIndex), ENIGMAIOT_ADDR_LEN);
+	}
+	WiFi.scanDelete ();
+
+	return numWifi > 0;
+}
+
+bool EnigmaIOTNodeClass::searchForGateway (rtcmem_data_t* data, bool shouldStoreData) {
+	DEBUG_DBG ("Searching for AP %s", data->networkName);
+
+	uint8_t channel = 0;
+	uint8_t gateway[ENIGMAIOT_ADDR_LEN];
+	int rssi = 0;
+	bool found;
+
+	comm->enableTransmit (false);
+	DEBUG_DBG ("Transmission disabled");
+
+	found = probeGateway (data, channel, gateway, rssi);
+
+	// Full scan is done only after some searches, doubling that number after every failed scan
+	if (!found) {
+		if (data->scanSkipped < data->scanBackoff) {
+			data->scanSkipped++;
+			DEBUG_WARN ("Full scan skipped. %u of %u", data->scanSkipped, data->scanBackoff);
+		} else {
+			data->scanSkipped = 0;
+			found = scanForGateway (data, channel, gateway, rssi);
+			if (!found) {
+				data->scanBackoff = data->scanBackoff ? data->scanBackoff * 2 : 1;
+				if (data->scanBackoff > MAX_SCAN_BACKOFF) {
+					data->scanBackoff = MAX_SCAN_BACKOFF;
+				}
+			}
+		}
+	}
+
+#ifdef ESP8266
+	WiFiMode_t mode = WiFi.getMode ();
+	DEBUG_DBG ("WiFi mode is %d. Restarting network interface after scan", mode);
+	WiFi.mode (WIFI_OFF);
+	WiFi.mode (mode);
+#endif // ESP8266
+	comm->enableTransmit (true);
+	DEBUG_DBG ("Transmission enabled");
+	rtcSessionChanged = true; // Scan backoff or gateway data have changed
 
+	if (!found) {
 		if (shouldStoreData) {
-			DEBUG_DBG ("Found gateway. Storing");
 			if (!saveRTCData ()) {
 				DEBUG_ERROR ("Error saving data on RTC");
 			}
-			if (memcmp (prevGwAddr, data->gateway, 6)) {
-				if (!saveFlashData ()) {
-					DEBUG_ERROR ("Error saving data on flash");
-				}
-			}
 		}
+		DEBUG_WARN ("Gateway %s not found", data->networkName);
+		return false;
+	}
 
-		WiFi.scanDelete ();
-
-#ifdef ESP8266
-		wifi_set_channel (data->channel);
-#elif defined ESP32
-		esp_err_t err_ok;
-		if ((err_ok = esp_wifi_set_promiscuous (true))) {
-			DEBUG_ERROR ("Error setting promiscuous mode: %s", esp_err_to_name (err_ok));
+	uint8_t prevGwAddr[ENIGMAIOT_ADDR_LEN];
+	uint8_t prevChannel = data->channel;
+	memcpy (prevGwAddr, data->gateway, ENIGMAIOT_ADDR_LEN);
+
+	data->channel = channel;
+	data->rssi = rssi;
+	memcpy (data->gateway, gateway, ENIGMAIOT_ADDR_LEN);
+	data->scanBackoff = 0;
+	data->scanSkipped = 0;
+
+	// Keep most recent channel first
+	int pos = GATEWAY_CHANNEL_HISTORY - 1;
+	for (int i = 0; i < GATEWAY_CHANNEL_HISTORY; i++) {
+		if (data->gwChannels[i] == channel) {
+			pos = i;
+			break;
 		}
-		if ((err_ok = esp_wifi_set_channel (data->channel, WIFI_SECOND_CHAN_NONE))) {
-			DEBUG_ERROR ("Error setting wifi channel: %s", esp_err_to_name (err_ok));
+	}
+	memmove (data->gwChannels + 1, data->gwChannels, pos);
+	data->gwChannels[0] = channel;
+
+	if (shouldStoreData) {
+		DEBUG_DBG ("Found gateway. Storing");
+		if (!saveRTCData ()) {
+			DEBUG_ERROR ("Error saving data on RTC");
 		}
-		if ((err_ok = esp_wifi_set_promiscuous (false))) {
-			DEBUG_ERROR ("Error setting promiscuous mode off: %s", esp_err_to_name (err_ok));
+		if (memcmp (prevGwAddr, data->gateway, ENIGMAIOT_ADDR_LEN) || prevChannel != data->channel) {
+			if (!saveFlashData ()) {
+				DEBUG_ERROR ("Error saving data on flash");
+			}
 		}
-#endif
+	}
 
-		// requestReportRSSI = true;
-		return true;
+#ifdef ESP8266
+	wifi_set_channel (data->channel);
+#elif defined ESP32
+	esp_err_t err_ok;
+	if ((err_ok = esp_wifi_set_promiscuous (true))) {
+		DEBUG_ERROR ("Error setting promiscuous mode: %s", esp_err_to_name (err_ok));
 	}
-	DEBUG_WARN ("Gateway %s not found", data->networkName);
-	return false;
+	if ((err_ok = esp_wifi_set_channel (data->channel, WIFI_SECOND_CHAN_NONE))) {
+		DEBUG_ERROR ("Error setting wifi channel: %s", esp_err_to_name (err_ok));
+	}
+	if ((err_ok = esp_wifi_set_promiscuous (false))) {
+		DEBUG_ERROR ("Error setting promiscuous mode off: %s", esp_err_to_name (err_ok));
+	}
+#endif
+	comm->channelChanged ();
+
+	// requestReportRSSI = true;
+	return true;
 }
 
 void EnigmaIOTNodeClass::stop () {
@@ -950,6 +1200,7 @@ void EnigmaIOTNodeClass::setSleepTime (uint32_t sleepTime, bool forceSleepForeve
 #ifdef ESP8266 // ESP32 does not have this limitation
 		uint64_t maxSleepTime = (ESP.deepSleepMax () / (uint64_t)1000000);
 #endif
+		uint32_t prevSleepTime = rtcmem_data.sleepTime;
 
 		if (sleepTime == 0 && !forceSleepForever) {
 			node.setSleepy (false);
@@ -969,6 +1220,9 @@ void EnigmaIOTNodeClass::setSleepTime (uint32_t sleepTime, bool forceSleepForeve
 			rtcmem_data.sleepTime = (uint32_t)maxSleepTime;
 		}
 #endif
+		if (rtcmem_data.sleepTime != prevSleepTime) {
+			rtcSessionChanged = true;
+		}
 		this->sleepTime = (uint64_t)rtcmem_data.sleepTime * (uint64_t)1000000;
 		DEBUG_DBG ("Sleep time set to %d. Sleepy mode is %s",
 				   rtcmem_data.sleepTime,
@@ -1031,13 +1285,60 @@ void EnigmaIOTNodeClass::handle () {
 		}
 	}
 
+	// Process messages received from gateway
+	handleInputQueue ();
+
+	// Send aggregated readings if oldest one reached its deadline
+	if (aggregationLength && millis () - aggregationStarted > aggregationDeadline) {
+		flushAggregatedData ();
+	}
+
+	// Send pending fragments of a long message
+	handleFragments ();
+
+#if USE_SAMPLE_BUFFER
+	// Send readings stored along previous sleep cycles
+	handleSampleBuffer ();
+#endif // USE_SAMPLE_BUFFER
+
+#if USE_TX_SLOTS
+	// Report sleep period to gateway to get a transmission slot
+	if (node.getSleepy () && node.isRegistered () && rtcmem_data.sleepTime && !txSlotRequested
+		&& rtcmem_data.txSlotPeriod != rtcmem_data.sleepTime) {
+		txSlotRequested = true;
+		requestTxSlot ();
+	}
+#endif // USE_TX_SLOTS
+
 	// Check if this should go to sleep
 	if (node.getSleepy () && !shouldRestart) {
-		if (sleepRequested && millis () - node.getLastMessageTime () > DOWNLINK_WAIT_TIME && node.isRegistered () && !indentifying) {
+		bool downlinkWaitDone = millis () - node.getLastMessageTime () > DOWNLINK_WAIT_TIME;
+#if USE_DOWNLINK_END
+		if (downlinkEndTime && millis () - downlinkEndTime > DOWNLINK_END_GUARD) {
+			downlinkWaitDone = true;
+		}
+#endif // USE_DOWNLINK_END
+		if (sleepRequested && downlinkWaitDone && node.isRegistered () && !indentifying && !fragmentLength && rxQueue->empty ()
+			&& comm->getQueueDepth (rtcmem_data.gateway) == 0 // Queued messages would be lost
+#if USE_SAMPLE_BUFFER
+			&& !sampleBatchPending
+#endif // USE_SAMPLE_BUFFER
+			) {
 			// Substract running time
             int64_t sleep_t = 0;
             if (sleepTime) {
                 sleep_t = sleepTime - ((millis () - cycleStartedTime) * 1000);
+#if USE_TX_SLOTS
+                int64_t period = (int64_t)rtcmem_data.sleepTime * 1000;
+                if (txSlotWake && period) {
+                    // Wake up so that next message is sent inside assigned slot. Periods already missed are skipped
+                    int64_t untilSlot = (int32_t)(txSlotWake - millis ());
+                    if (untilSlot < 1000) {
+                        untilSlot += (1000 - untilSlot + period - 1) / period * period;
+                    }
+                    sleep_t = untilSlot * 1000;
+                }
+#endif // USE_TX_SLOTS
             }
             if (sleep_t && sleep_t < 1000) {
 				// Avoid negative values
@@ -1050,60 +1351,25 @@ void EnigmaIOTNodeClass::handle () {
                 DEBUG_WARN ("Go to sleep indefinitely");
             }
             DEBUG_WARN ("%d", millis ());
+			bool radioNeeded = true;
+#if USE_SAMPLE_BUFFER
+			if (sampleBufferLoaded && sleep_t) {
+				sampleBuffer.period = rtcmem_data.sleepTime * 1000;
+				radioNeeded = sampleBufferSleep (sleep_t / 1000);
+			}
+#endif // USE_SAMPLE_BUFFER
             comm->enableTransmit (false);
 #ifdef ESP8266
-			ESP.deepSleep (sleep_t);
+			// Radio calibration is skipped if next wake up is expected to store a reading only
+			ESP.deepSleep (sleep_t, radioNeeded ? RF_DEFAULT : RF_DISABLED);
 #elif defined ESP32
+			(void)radioNeeded; // Radio is not powered until WiFi is started
 			esp_deep_sleep (sleep_t);
 #endif
 		}
 	}
 
-	// Check registration timeout
-	static time_t lastRegistration = millis ();
-	status_t status = node.getStatus ();
-	if (status == WAIT_FOR_SERVER_HELLO /*|| status == WAIT_FOR_CIPHER_FINISHED*/) {
-		if (node.getSleepy ()) { // Sleep after registration timeout
-			if (millis () - node.getLastMessageTime () > RECONNECTION_PERIOD) {
-				DEBUG_INFO ("Current node status: %d", node.getStatus ());
-				node.reset ();
-				rtcmem_data.nodeRegisterStatus = UNREGISTERED;
-
-				if (!saveRTCData ()) {
-					DEBUG_ERROR ("Error saving data on RTC");
-				}
-
-				uint32_t rnd = Crypto.random (PRE_REG_DELAY * 1000); // nanoseconds
-
-				DEBUG_INFO ("Registration timeout. Go to sleep for %lu ms", (uint32_t)(RECONNECTION_PERIOD * 4 + rnd / 1000));
-#ifdef ESP8266
-				ESP.deepSleep (RECONNECTION_PERIOD * 4000 + rnd, RF_NO_CAL);
-#elif defined ESP32
-				ESP.deepSleep (RECONNECTION_PERIOD * 4000 + rnd);
-#endif
-			}
-		} else { // Retry registration
-			if (millis () - node.getLastMessageTime () > RECONNECTION_PERIOD * 5) {
-				DEBUG_INFO ("Current node status: %d", node.getStatus ());
-				node.reset ();
-				node.setLastMessageTime (); // Set wait time start
-			}
-		}
-	}
-
-	// Retry registration
-	if (node.getStatus () == UNREGISTERED) {
-		if (millis () - lastRegistration > RECONNECTION_PERIOD) {
-			DEBUG_DBG ("Current node status: %d", node.getStatus ());
-			lastRegistration = millis (); // Set wait time start
-			node.reset ();
-			uint32_t rnd = Crypto.random (PRE_REG_DELAY);
-			DEBUG_INFO ("Random delay (%u)", rnd);
-			delay (1500 + rnd);
-			clientHello ();
-			delay (1500 + Crypto.random (POST_REG_DELAY)); // Wait for Server Hello
-		}
-	}
+	handleRegistration ();
 
 	// Check OTA update timeout
 	if (otaRunning) {
@@ -1115,8 +1381,14 @@ void EnigmaIOTNodeClass::handle () {
 				DEBUG_INFO ("OTA TIMEOUT");
 			}
 			otaRunning = false;
+			otaMulticast = false;
+			otaWindow.end ();
+			otaDecompressor.end ();
 			DEBUG_WARN ("Restart due to OTA timeout");
 			restart (IRRELEVANT);
+		} else if (otaSackPending && millis () - lastOTAmsg > (otaMulticast ? otaReportDelay : OTA_SACK_IDLE_TIME)) {
+			// Sender may be waiting for missing chunks to be reported
+			sendOtaSack ();
 		}
 	}
 
@@ -1171,8 +1443,76 @@ void EnigmaIOTNodeClass::handle () {
 
 }
 
+bool EnigmaIOTNodeClass::addInputMsgQueue (const uint8_t* addr, const uint8_t* msg, size_t len, signed int rssi) {
+	node_rx_item_t message;
+
+	if (len > MAX_MESSAGE_LENGTH) {
+		return false;
+	}
+	message.len = len;
+	memcpy (message.data, msg, len);
+	memcpy (message.addr, addr, ENIGMAIOT_ADDR_LEN);
+	message.rssi = rssi;
+
+#ifdef ESP32
+	portENTER_CRITICAL (&rxQueueMux);
+#else
+	noInterrupts ();
+#endif
+	bool stored = rxQueue->push (&message);
+	rxStats.received++;
+	if (!stored) {
+		rxStats.overflows++;
+	}
+	if (rxQueue->size () > rxStats.maxDepth) {
+		rxStats.maxDepth = rxQueue->size ();
+	}
+#ifdef ESP32
+	portEXIT_CRITICAL (&rxQueueMux);
+#else
+	interrupts ();
+#endif
+	return stored;
+}
+
+void EnigmaIOTNodeClass::handleInputQueue () {
+	for (int i = 0; i < NODE_RX_BATCH; i++) {
+		node_rx_item_t* message;
+
+#ifdef ESP32
+		portENTER_CRITICAL (&rxQueueMux);
+#else
+		noInterrupts ();
+#endif
+		message = rxQueue->front ();
+		if (message) {
+			memcpy (rxItem.addr, message->addr, ENIGMAIOT_ADDR_LEN);
+			memcpy (rxItem.data, message->data, message->len);
+			rxItem.len = message->len;
+			rxItem.rssi = message->rssi;
+			rxQueue->pop ();
+		}
+#ifdef ESP32
+		portEXIT_CRITICAL (&rxQueueMux);
+#else
+		interrupts ();
+#endif
+		if (!message) {
+			break;
+		}
+		rxStats.processed++;
+		DEBUG_DBG ("Input message from queue. MsgType: 0x%02X", rxItem.data[0]);
+		manageMessage (rxItem.addr, rxItem.data, rxItem.len, rxItem.rssi);
+	}
+
+	if (rxStats.overflows != rxOverflowsReported) {
+		DEBUG_WARN ("%u received messages dropped. Input queue was full", rxStats.overflows - rxOverflowsReported);
+		rxOverflowsReported = rxStats.overflows;
+	}
+}
+
 void EnigmaIOTNodeClass::rx_cb (uint8_t* mac_addr, uint8_t* data, uint8_t len, signed int rssi) {
-	EnigmaIOTNode.manageMessage (mac_addr, data, len, rssi);
+	EnigmaIOTNode.addInputMsgQueue (mac_addr, data, len, rssi);
 }
 
 void EnigmaIOTNodeClass::tx_cb (uint8_t* mac_addr, uint8_t status) {
@@ -1189,28 +1529,135 @@ bool EnigmaIOTNodeClass::checkCRC (const uint8_t* buf, size_t count, uint32_t* c
 	return (_crc == recvdCRC);
 }
 
-bool EnigmaIOTNodeClass::clientHello () {
-	/*
-	* ------------------------------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | Tag (16) |
-	* ------------------------------------------------------------------------------------------------------------
-	*/
-
-	struct __attribute__ ((packed, aligned (1))) {
-		uint8_t msgType;
-		uint8_t iv[IV_LENGTH];
-		uint8_t publicKey[KEY_LENGTH];
-		uint32_t random;
-		uint8_t tag[TAG_LENGTH];
-	} clientHello_msg;
-
-#define CHMSG_LEN sizeof(clientHello_msg)
+bool EnigmaIOTNodeClass::checkRTCData (rtcmem_data_t* data) {
+	if (!checkCRC ((uint8_t*)data->nodeKey, RTC_SESSION_LENGTH, &data->crc32)) {
+		DEBUG_DBG ("Context session block is not valid");
+		return false;
+	}
+	if (!checkCRC ((uint8_t*)&data->lastMessageCounter, RTC_COUNTERS_LENGTH, &data->countersCrc32)) {
+		DEBUG_DBG ("Context counter block is not valid");
+		return false;
+	}
+	return true;
+}
 
-	invalidateReason = UNKNOWN_ERROR; // reset any previous force disconnect
+void EnigmaIOTNodeClass::handleRegistration () {
+	status_t status = node.getStatus ();
 
-	Crypto.getDH1 ();
+	switch (registrationPhase) {
+	case REGISTRATION_IDLE:
+		if (status == REGISTERED) { // Context recovered from RTC or flash
+			registrationPhase = REGISTRATION_DONE;
+		} else if (status == WAIT_FOR_SERVER_HELLO || status == INIT) { // Boot while waiting for ServerHello
+			registrationPhase = REGISTRATION_WAIT_SERVER_HELLO;
+			registrationDeadline = millis () + RECONNECTION_PERIOD;
+		} else if (status == UNREGISTERED && millis () - registrationStart > RECONNECTION_PERIOD) {
+			DEBUG_DBG ("Current node status: %d", status);
+			registrationStart = millis ();
+			node.reset ();
+			uint32_t rnd = Crypto.random (PRE_REG_DELAY);
+			DEBUG_INFO ("Random delay (%u)", rnd);
+			registrationDeadline = millis () + RECONNECTION_PERIOD + rnd;
+			registrationPhase = REGISTRATION_BACKOFF;
+		}
+		break;
+	case REGISTRATION_BACKOFF:
+		if ((int32_t)(millis () - registrationDeadline) < 0) {
+			break;
+		}
+		if (!clientHello ()) {
+			DEBUG_WARN ("Error sending Client Hello");
+			node.reset ();
+			registrationPhase = REGISTRATION_IDLE;
+			break;
+		}
+		// Sleepy nodes give up soon and retry after deep sleep. Non sleepy ones keep radio on and may wait longer
+		if (node.getSleepy ()) {
+			registrationDeadline = millis () + RECONNECTION_PERIOD + Crypto.random (POST_REG_DELAY);
+		} else {
+			registrationDeadline = millis () + RECONNECTION_PERIOD * 5;
+		}
+		registrationPhase = REGISTRATION_WAIT_SERVER_HELLO;
+		break;
+	case REGISTRATION_WAIT_SERVER_HELLO:
+		if (status == REGISTERED) {
+			DEBUG_INFO ("Registration took %lu ms", millis () - registrationStart);
+			registrationPhase = REGISTRATION_DONE;
+			break;
+		}
+		if (status != WAIT_FOR_SERVER_HELLO && status != INIT) { // Rejected or restarted by gateway messages
+			registrationPhase = REGISTRATION_IDLE;
+			break;
+		}
+		if ((int32_t)(millis () - registrationDeadline) < 0) {
+			break;
+		}
+		DEBUG_INFO ("Current node status: %d", status);
+		node.reset ();
+		registrationPhase = REGISTRATION_IDLE;
+		if (node.getSleepy ()) { // Sleep after registration timeout
+			rtcmem_data.nodeRegisterStatus = UNREGISTERED;
+
+			if (!saveRTCData ()) {
+				DEBUG_ERROR ("Error saving data on RTC");
+			}
+
+			uint32_t rnd = Crypto.random (PRE_REG_DELAY * 1000); // nanoseconds
+
+			DEBUG_INFO ("Registration timeout. Go to sleep for %lu ms", (uint32_t)(RECONNECTION_PERIOD * 4 + rnd / 1000));
+#if USE_SAMPLE_BUFFER
+			sampleBufferSleep (RECONNECTION_PERIOD * 4 + rnd / 1000); // Stored readings are kept for next wake up
+#endif // USE_SAMPLE_BUFFER
+#ifdef ESP8266
+			ESP.deepSleep (RECONNECTION_PERIOD * 4000 + rnd, RF_NO_CAL);
+#elif defined ESP32
+			ESP.deepSleep (RECONNECTION_PERIOD * 4000 + rnd);
+#endif
+		} else { // Retry registration
+			node.setLastMessageTime (); // Set wait time start
+		}
+		break;
+	case REGISTRATION_DONE:
+		if (status != REGISTERED) {
+			DEBUG_INFO ("Registration lost. Current node status: %d", status);
+			registrationPhase = REGISTRATION_IDLE;
+		}
+		break;
+	}
+}
+
+bool EnigmaIOTNodeClass::clientHello (bool echoCookie) {
+	/*
+	* ------------------------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | Tag (16) |
+	* ------------------------------------------------------------------------------------------------------------
+	* Random bits 8-15 carry the mask of cipher suites supported by node. Bits 16-31 carry HELLO_CAPABILITY_MARKER
+	* If gateway answered with a handshake cookie it is added after Random field, before Tag
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t publicKey[KEY_LENGTH];
+		uint32_t random;
+		uint8_t cookie[HELLO_COOKIE_LENGTH];
+		uint8_t tag[TAG_LENGTH];
+	} clientHello_msg;
+
+	invalidateReason = UNKNOWN_ERROR; // reset any previous force disconnect
+
+	if (echoCookie && !helloCookieValid) {
+		DEBUG_WARN ("No handshake cookie to echo");
+		return false;
+	}
+
+	if (!echoCookie) {
+		helloCookieValid = false;
+		Crypto.getDH1 ();
+	}
 	node.setStatus (INIT);
 	rtcmem_data.nodeRegisterStatus = INIT;
+	rtcSessionChanged = true;
 	/*uint8_t macAddress[ENIGMAIOT_ADDR_LEN];
 #ifdef ESP8266
 	if (wifi_get_macaddr (STATION_IF, macAddress)) {
@@ -1258,11 +1705,41 @@ bool EnigmaIOTNodeClass::clientHello () {
 		DEBUG_DBG ("Signal non sleepy node");
 	}
 
+	random = (random & 0x0000000FU) | ((uint32_t)HELLO_CAPABILITY_MARKER << 16); // Signal that capabilities are present. Bits 5-7 are reserved
+	random = random | ((uint32_t)SUPPORTED_CIPHER_SUITES << 8); // Offer supported cipher suites
+	DEBUG_DBG ("Offer cipher suites mask 0x%02X", SUPPORTED_CIPHER_SUITES);
+
+#if USE_32BIT_COUNTERS
+	random = random | 0x00000004U; // Signal 32 bit counters support
+#else
+	random = random & 0xFFFFFFFBU; // Signal 16 bit counters only
+#endif
+
+#if USE_KEY_UPDATE
+	random = random | 0x00000008U; // Signal key update support
+#else
+	random = random & 0xFFFFFFF7U; // Signal that key expiration needs a new registration
+#endif
+
+#if USE_DOWNLINK_END
+	random = random | 0x00000010U; // Signal that node may sleep as soon as gateway reports end of downlink
+#endif
+
 	memcpy (&(clientHello_msg.random), &random, RANDOM_LENGTH);
 
-	DEBUG_VERBOSE ("Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, CHMSG_LEN - TAG_LENGTH));
+	size_t cryptLen = KEY_LENGTH + sizeof (uint32_t);
+	uint8_t* tag = clientHello_msg.cookie; // Tag goes just after last field
+	if (echoCookie) {
+		memcpy (clientHello_msg.cookie, helloCookie, HELLO_COOKIE_LENGTH);
+		cryptLen += HELLO_COOKIE_LENGTH;
+		tag = clientHello_msg.tag;
+		DEBUG_DBG ("Echo handshake cookie");
+	}
+	size_t msgLen = 1 + IV_LENGTH + cryptLen + TAG_LENGTH;
+
+	DEBUG_VERBOSE ("Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, msgLen - TAG_LENGTH));
 
-	uint8_t addDataLen = CHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - KEY_LENGTH;
+	uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
 	memcpy (aad, (uint8_t*)&clientHello_msg, addDataLen); // Copy message upto iv
@@ -1270,298 +1747,834 @@ bool EnigmaIOTNodeClass::clientHello () {
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, rtcmem_data.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::encryptBuffer (clientHello_msg.publicKey, KEY_LENGTH + sizeof (uint32_t), // Encrypt only from public key
+	if (!CryptModule::encryptBuffer (clientHello_msg.publicKey, cryptLen, // Encrypt only from public key
 									 clientHello_msg.iv, IV_LENGTH,
 									 rtcmem_data.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clientHello_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), tag, TAG_LENGTH)) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, CHMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, msgLen));
 
 	node.setStatus (WAIT_FOR_SERVER_HELLO);
 	rtcmem_data.nodeRegisterStatus = WAIT_FOR_SERVER_HELLO;
 
 	DEBUG_INFO (" -------> CLIENT HELLO");
 
-	return comm->send (rtcmem_data.gateway, (uint8_t*)&clientHello_msg, CHMSG_LEN) == 0;
+	return comm->send (rtcmem_data.gateway, (uint8_t*)&clientHello_msg, msgLen) == 0;
+}
+
+bool EnigmaIOTNodeClass::processHelloCookie (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* ---------------------------
+	*| msgType (1) | Cookie (16) |
+	* ---------------------------
+	*/
+
+	if (count < 1 + HELLO_COOKIE_LENGTH) {
+		DEBUG_WARN ("Message too short");
+		return false;
+	}
+
+	memcpy (helloCookie, buf + 1, HELLO_COOKIE_LENGTH);
+	helloCookieValid = true;
+	DEBUG_VERBOSE ("Handshake cookie: %s", printHexBuffer (helloCookie, HELLO_COOKIE_LENGTH));
+
+	return true;
 }
 
 bool EnigmaIOTNodeClass::clockRequest () {
 	/*
-	 * ---------------------------------------------------------
-	 *| msgType (1) | IV (12) | Counter (2) | T1 (8) | tag (16) |
-	 * ---------------------------------------------------------
+	 * ---------------------------------------------------------------
+	 *| msgType (1) | IV (12) | Counter (2 or 4) | T1 (8) | tag (16) |
+	 * ---------------------------------------------------------------
 	 */
-	struct  __attribute__ ((packed, aligned (1))) {
-		uint8_t msgType;
-		uint8_t iv[IV_LENGTH];
-		int16_t counter;
-		int64_t t1;
-		uint8_t tag[TAG_LENGTH];
-	} clockRequest_msg;
-	uint16_t counter;
+	uint8_t counterLen = node.getCounterLength ();
+	uint8_t iv_idx = 1;
+	uint8_t counter_idx = iv_idx + IV_LENGTH;
+	uint8_t t1_idx = counter_idx + counterLen;
+	uint8_t tag_idx = t1_idx + sizeof (int64_t);
+	const uint8_t CRMSG_LEN = tag_idx + TAG_LENGTH;
 
-	static const uint8_t CRMSG_LEN = sizeof (clockRequest_msg);
+	uint8_t clockRequest_msg[1 + IV_LENGTH + sizeof (uint32_t) + sizeof (int64_t) + TAG_LENGTH];
+	uint32_t counter;
 
-	clockRequest_msg.msgType = CLOCK_REQUEST;
+	clockRequest_msg[0] = CLOCK_REQUEST;
 
-	CryptModule::random (clockRequest_msg.iv, IV_LENGTH);
+	CryptModule::random (clockRequest_msg + iv_idx, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (clockRequest_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", printHexBuffer (clockRequest_msg + iv_idx, IV_LENGTH));
 
 	if (useCounter) {
 		counter = node.getLastControlCounter () + 1;
 		node.setLastControlCounter (counter);
 		rtcmem_data.lastControlCounter = counter;
 	} else {
-		counter = (uint16_t)(Crypto.random ());
+		counter = node.useCounter32 () ? Crypto.random () : (uint16_t)(Crypto.random ());
 	}
 
-	DEBUG_INFO ("Control message #%d", counter);
+	DEBUG_INFO ("Control message #%u", counter);
 
-	memcpy (&(clockRequest_msg.counter), &counter, sizeof (uint16_t));
+	memcpy (clockRequest_msg + counter_idx, &counter, counterLen);
 
 	uint64_t t1 = TimeManager.clock_us ();
 
-	memcpy (&(clockRequest_msg.t1), &t1, sizeof (int64_t));
+	memcpy (clockRequest_msg + t1_idx, &t1, sizeof (int64_t));
 
-	DEBUG_VERBOSE ("Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Clock Request message: %s", printHexBuffer (clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
 	DEBUG_DBG ("T1: %llu", t1);
 
 	uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
-	memcpy (aad, (uint8_t*)&clockRequest_msg, addDataLen); // Copy message upto iv
+	memcpy (aad, clockRequest_msg, addDataLen); // Copy message upto iv
 
 	// Copy 8 last bytes from Node Key
 	memcpy (aad + addDataLen, node.getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::encryptBuffer ((uint8_t*)&(clockRequest_msg.counter), CRMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Encrypt only from counter
-									 clockRequest_msg.iv, IV_LENGTH,
+	if (!CryptModule::encryptBuffer (clockRequest_msg + counter_idx, tag_idx - counter_idx, // Encrypt only from counter
+									 clockRequest_msg + iv_idx, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockRequest_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), clockRequest_msg + tag_idx, TAG_LENGTH, node.getCipherSuite ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, CRMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted Clock Request message: %s", printHexBuffer (clockRequest_msg, CRMSG_LEN));
 
 	DEBUG_INFO (" -------> CLOCK REQUEST");
 
 	node.setLastMessageTime ();
+#if USE_DOWNLINK_END
+	downlinkEndTime = 0;
+#endif // USE_DOWNLINK_END
 
 	flashBlue = true;
 
 	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
-		if (!saveRTCData ()) {
+		if (!saveRTCCounters ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
 	}
 
-	return comm->send (rtcmem_data.gateway, (uint8_t*)&clockRequest_msg, CRMSG_LEN) == 0;
+	return comm->send (rtcmem_data.gateway, clockRequest_msg, CRMSG_LEN) == 0;
 
 }
 
 bool EnigmaIOTNodeClass::processClockResponse (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	 * ---------------------------------------------------------------------------------------
+	 *| msgType (1) | IV (12) | Counter (2 or 4) | T1 (8) | T2 (8) | T3 (8) | tag (16) |
+	 * ---------------------------------------------------------------------------------------
+	 */
+	uint8_t counterLen = node.getCounterLength ();
+	uint8_t iv_idx = 1;
+	uint8_t counter_idx = iv_idx + IV_LENGTH;
+	uint8_t t1_idx = counter_idx + counterLen;
+	uint8_t t2_idx = t1_idx + sizeof (int64_t);
+	uint8_t t3_idx = t2_idx + sizeof (int64_t);
+	uint8_t tag_idx = t3_idx + sizeof (int64_t);
+	const unsigned int CRSMSG_LEN = tag_idx + TAG_LENGTH;
+
+	uint8_t clockResponse_msg[1 + IV_LENGTH + sizeof (uint32_t) + 3 * sizeof (int64_t) + TAG_LENGTH];
+
+	uint64_t t1, t2, t3, t4;
+
+	uint32_t counter = 0;
+
+	if (count < CRSMSG_LEN) {
+		DEBUG_WARN ("Message too short");
+		return false;
+	}
+
+	memcpy (clockResponse_msg, buf, CRSMSG_LEN);
+
+	uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, buf, addDataLen); // Copy message upto iv
+
+	// Copy 8 last bytes from Node Key
+	memcpy (aad + addDataLen, node.getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::decryptBuffer (clockResponse_msg + counter_idx, tag_idx - counter_idx, // Decrypt from counter
+									 clockResponse_msg + iv_idx, IV_LENGTH,
+									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
+									 aad, sizeof (aad), clockResponse_msg + tag_idx, TAG_LENGTH, node.getCipherSuite ())) {
+		DEBUG_ERROR ("Error during decryption");
+		return false;
+	}
+
+	DEBUG_VERBOSE ("Decripted Clock Response message: %s", printHexBuffer (clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
+
+	memcpy (&counter, clockResponse_msg + counter_idx, counterLen);
+	DEBUG_INFO ("Downlink msg #%u", counter);
+	if (useCounter) {
+		if (node.acceptDownlinkCounter (counter)) {
+			DEBUG_INFO ("Accepted");
+			rtcmem_data.lastDownlinkMsgCounter = node.getLastDownlinkMsgCounter ();
+			rtcmem_data.downlinkReplayWindow = node.getDownlinkReplayWindow ();
+		} else {
+			DEBUG_WARN ("Downlink msg rejected");
+			return false;
+		}
+	}
+
+	memcpy (&t1, clockResponse_msg + t1_idx, sizeof (int64_t));
+	memcpy (&t2, clockResponse_msg + t2_idx, sizeof (int64_t));
+	memcpy (&t3, clockResponse_msg + t3_idx, sizeof (int64_t));
+	t4 = TimeManager.clock_us ();
+
+	int64_t offset = TimeManager.adjustTime (t1, t2, t3, t4);
+
+	if (offset < MIN_SYNC_ACCURACY && offset > (MIN_SYNC_ACCURACY * -1)) {
+		timeSyncPeriod = TIME_SYNC_PERIOD;
+	} else {
+		timeSyncPeriod = QUICK_SYNC_TIME;
+	}
+
+	DEBUG_DBG ("T1: %llu", t1);
+    DEBUG_DBG ("T2: %llu", t2);
+    DEBUG_DBG ("T3: %llu", t3);
+    DEBUG_DBG ("T4: %llu", t4);
+    DEBUG_INFO ("Offest adjusted to %lld us, Roundtrip delay is %lld", offset, TimeManager.getDelay ());
+
+	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
+		if (!saveRTCCounters ()) {
+			DEBUG_ERROR ("Error saving data on RTC");
+		}
+	}
+
+	return true;
+}
+
+int64_t EnigmaIOTNodeClass::clock () {
+	return TimeManager.clock ();
+
+}
+
+time_t EnigmaIOTNodeClass::unixtime () {
+	return TimeManager.unixtime ();
+}
+
+bool EnigmaIOTNodeClass::hasClockSync () {
+	if (!node.getInitAsSleepy ())
+		return TimeManager.isTimeAdjusted ();
+	else
+		return false;
+}
+
+bool EnigmaIOTNodeClass::processServerHello (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* -----------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kslave (32) | NodeID (2) | Random (4) | Tag (16) |
+	* -----------------------------------------------------------------------------
+	* Random lower byte carries cipher suite selected by gateway. Bits 16-31 carry HELLO_CAPABILITY_MARKER
+	*/
+
 	struct __attribute__ ((packed, aligned (1))) {
 		uint8_t msgType;
 		uint8_t iv[IV_LENGTH];
-		uint16_t counter;
-        int64_t t1;
-		int64_t t2;
-		int64_t t3;
+		uint8_t publicKey[KEY_LENGTH];
+		uint16_t nodeId;
+		uint32_t random;
 		uint8_t tag[TAG_LENGTH];
-	} clockResponse_msg;
-    
-    uint64_t t1, t2, t3, t4;
+	} serverHello_msg;
 
-	uint16_t counter;
+#define SHMSG_LEN sizeof(serverHello_msg)
 
-	const unsigned int CRSMSG_LEN = sizeof (clockResponse_msg);
+	uint16_t nodeId;
+
+	if (count < SHMSG_LEN) {
+		DEBUG_WARN ("Message too short");
+		return false;
+	}
 
-	memcpy (&clockResponse_msg, buf, count);
+	memcpy (&serverHello_msg, buf, count);
 
-	uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t addDataLen = SHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - sizeof (uint16_t) - KEY_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
-	memcpy (aad, buf, addDataLen); // Copy message upto iv
+	memcpy (aad, (uint8_t*)&serverHello_msg, addDataLen); // Copy message upto iv
+
+	// Copy 8 last bytes from NetworkKey
+	memcpy (aad + addDataLen, rtcmem_data.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::decryptBuffer (serverHello_msg.publicKey, KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t),
+									 serverHello_msg.iv, IV_LENGTH,
+									 rtcmem_data.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
+									 aad, sizeof (aad), serverHello_msg.tag, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error during decryption");
+		return false;
+	}
+
+	DEBUG_VERBOSE ("Decrypted Server Hello message: %s", printHexBuffer ((uint8_t*)&serverHello_msg, SHMSG_LEN - TAG_LENGTH));
+
+	bool cError = Crypto.getDH2 (serverHello_msg.publicKey);
+
+	if (!cError) {
+		DEBUG_ERROR ("DH2 error");
+		return false;
+	}
+
+	memcpy (&nodeId, &serverHello_msg.nodeId, sizeof (uint16_t));
+	node.setNodeId (nodeId);
+	rtcmem_data.nodeKeyValid = nodeId;
+	DEBUG_DBG ("Node ID: %u", node.getNodeId ());
+
+	node.setEncryptionKey (CryptModule::getSHA256 (serverHello_msg.publicKey, KEY_LENGTH));
+	memcpy (rtcmem_data.nodeKey, node.getEncriptionKey (), KEY_LENGTH);
+	DEBUG_INFO ("Node key: %s", printHexBuffer (node.getEncriptionKey (), KEY_LENGTH));
+
+	// A gateway that does not set capability marker fills Random with random data, so it cannot be read as capabilities
+	bool capable = (serverHello_msg.random >> 16) == HELLO_CAPABILITY_MARKER && (serverHello_msg.random & 0x0000FE00U) == 0;
+	if (!capable) {
+		DEBUG_INFO ("Gateway does not signal capabilities");
+	}
+
+	cipherSuite_t suite = capable ? (cipherSuite_t)(serverHello_msg.random & 0x000000FFU) : CIPHER_CHACHAPOLY;
+	if (!CryptModule::isSuiteSupported (suite)) {
+		DEBUG_ERROR ("Gateway selected unsupported cipher suite %u", suite);
+		return false;
+	}
+	node.setCipherSuite (suite);
+	rtcmem_data.cipherSuite = suite;
+	DEBUG_INFO ("Cipher suite: %s", CryptModule::getSuiteName (suite));
+
+	bool counter32 = capable && (serverHello_msg.random & 0x00000100U) == 0x00000100U;
+	if (counter32 && !USE_32BIT_COUNTERS) {
+		DEBUG_ERROR ("Gateway selected 32 bit counters but they were not offered");
+		return false;
+	}
+	node.setCounter32 (counter32);
+	rtcmem_data.counter32 = counter32;
+	rtcSessionChanged = true;
+	DEBUG_INFO ("Using %d bit counters", counter32 ? 32 : 16);
+
+	return true;
+}
+
+bool EnigmaIOTNodeClass::sendData (const uint8_t* data, size_t len, dataMessageType_t dataMsgType, bool encrypt, nodePayloadEncoding_t payloadType) {
+	if (encrypt && (dataMsgType == DATA_TYPE || dataMsgType == HA_DISC_TYPE) && len > dataPayloadCapacity ()) {
+		return sendFragmented (data, len, dataMsgType, payloadType);
+	}
+	if (dataMsgType == DATA_TYPE || dataMsgType == AGGREGATED_TYPE) {
+		if (!dataSentTime) {
+			dataSentTime = millis ();
+		}
+		memcpy (dataMessageSent, data, len);
+		dataMessageSentLength = len;
+		dataMessageEncrypt = encrypt;
+		dataMessageSendPending = true;
+		dataMessageSendEncoding = payloadType;
+		dataMessageSendType = dataMsgType;
+	}
+	node.setLastMessageTime (); // Mark message time to start RX window start
+
+	if (node.getStatus () == REGISTERED && node.isKeyValid ()) {
+		if (dataMsgType == CONTROL_TYPE) {
+            DEBUG_VERBOSE ("Control message sent: %s", printHexBuffer (data, len));
+        } else if (dataMsgType == HA_DISC_TYPE) {
+            DEBUG_VERBOSE ("HA discovery message sent: %s", printHexBuffer (data, len));
+        } else if (dataMsgType == AGGREGATED_TYPE || dataMsgType == BUFFERED_TYPE) {
+            DEBUG_VERBOSE ("%s data sent: %s", dataMsgType == AGGREGATED_TYPE ? "Aggregated" : "Buffered", printHexBuffer (data, len));
+        } else {
+			DEBUG_VERBOSE ("%s data sent: %s", encrypt ? "Encrypted" : "Unencrypted", printHexBuffer (data, len));
+		}
+		flashBlue = true;
+		if (dataMessage (data, len, dataMsgType, encrypt, payloadType)) {
+			dataMessageSendPending = false; // Data sent. This setting can still be overriden by invalidateCommand
+			return true;
+		} else
+			return false;
+
+	}
+	return false;
+}
+
+bool EnigmaIOTNodeClass::aggregateData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding) {
+	/*
+	* ----------------------------------------------------------------------
+	*| Age (2) | Length (1) | Reading (....) | Age (2) | Length (1) | ... |
+	* ----------------------------------------------------------------------
+	* Age is stored as capture time and changed to milliseconds before sending when buffer is sent
+	*/
+	const uint8_t header_len = sizeof (uint16_t) + sizeof (uint8_t);
+	uint8_t capacity = dataPayloadCapacity ();
+
+	if (capacity > sizeof (aggregationBuffer)) {
+		capacity = sizeof (aggregationBuffer);
+	}
+
+	if (!data || !len) {
+		return false;
+	}
+
+	if (len + header_len > capacity) {
+		// Does not fit even alone. Send it as a normal message keeping order
+		DEBUG_DBG ("Reading too long to be aggregated: %d bytes", len);
+		flushAggregatedData ();
+		return sendData (data, len, DATA_TYPE, true, payloadEncoding);
+	}
+
+	if (aggregationLength && (aggregationEncoding != payloadEncoding || aggregationLength + header_len + len > capacity)) {
+		flushAggregatedData ();
+	}
+
+	if (!aggregationLength) {
+		aggregationStarted = millis ();
+		aggregationEncoding = payloadEncoding;
+	}
+	uint16_t captureTime = millis ();
+	memcpy (aggregationBuffer + aggregationLength, &captureTime, sizeof (uint16_t));
+	aggregationBuffer[aggregationLength + sizeof (uint16_t)] = len;
+	memcpy (aggregationBuffer + aggregationLength + header_len, data, len);
+	aggregationLength += header_len + len;
+	DEBUG_DBG ("Reading aggregated. Buffer length %u", aggregationLength);
+
+	return true;
+}
+
+bool EnigmaIOTNodeClass::flushAggregatedData () {
+	const uint8_t header_len = sizeof (uint16_t) + sizeof (uint8_t);
+	uint16_t now = millis ();
+	uint8_t idx = 0;
+
+	if (!aggregationLength) {
+		return true;
+	}
+
+	// Change capture time to age. 16 bit arithmetic is enough as deadline is lower than 65536 ms
+	while (idx + header_len <= aggregationLength) {
+		uint16_t age;
+		memcpy (&age, aggregationBuffer + idx, sizeof (uint16_t));
+		age = now - age;
+		memcpy (aggregationBuffer + idx, &age, sizeof (uint16_t));
+		idx += header_len + aggregationBuffer[idx + sizeof (uint16_t)];
+	}
+
+	DEBUG_INFO ("Sending %u bytes of aggregated readings", aggregationLength);
+	uint8_t len = aggregationLength;
+	aggregationLength = 0;
+	return sendData (aggregationBuffer, len, AGGREGATED_TYPE, true, aggregationEncoding);
+}
+
+#if USE_SAMPLE_BUFFER
+void EnigmaIOTNodeClass::loadSampleBuffer () {
+	if (sampleBufferLoaded) {
+		return;
+	}
+	sampleBufferLoaded = true;
+#ifdef ESP8266
+	if (!ESP.rtcUserMemoryRead (SAMPLE_BUFFER_ADDRESS, (uint32_t*)&sampleBuffer, sizeof (sample_buffer_t))) {
+		DEBUG_ERROR ("Error reading stored readings from RTC memory");
+		sampleBuffer.length = UINT16_MAX; // Forces buffer reset
+	}
+#elif defined ESP32
+	memcpy (&sampleBuffer, &sampleBufferStorage, sizeof (sample_buffer_t));
+#endif
+	if (sampleBuffer.length > SAMPLE_BUFFER_SIZE
+		|| !checkCRC ((uint8_t*)&sampleBuffer.clock, SAMPLE_BUFFER_HEADER_LENGTH + sampleBuffer.length, &sampleBuffer.crc32)) {
+		DEBUG_DBG ("No valid stored readings");
+		memset (&sampleBuffer, 0, sizeof (sample_buffer_t));
+	}
+	DEBUG_DBG ("%u stored readings. %u bytes", sampleBuffer.wakes, sampleBuffer.length);
+}
+
+bool EnigmaIOTNodeClass::saveSampleBuffer () {
+	size_t len = offsetof (sample_buffer_t, data) + sampleBuffer.length;
+
+	sampleBuffer.crc32 = calculateCRC32 ((uint8_t*)&sampleBuffer.clock, SAMPLE_BUFFER_HEADER_LENGTH + sampleBuffer.length);
+#ifdef ESP8266
+	// Only used part of buffer is written
+	if (!ESP.rtcUserMemoryWrite (SAMPLE_BUFFER_ADDRESS, (uint32_t*)&sampleBuffer, (len + 3) & ~3)) {
+		DEBUG_ERROR ("Error writing stored readings to RTC memory");
+		return false;
+	}
+#elif defined ESP32
+	memcpy (&sampleBufferStorage, &sampleBuffer, len);
+#endif
+	return true;
+}
+
+bool EnigmaIOTNodeClass::sampleBufferSleep (uint32_t sleepMs) {
+	if (!sampleBufferLoaded) {
+		return true;
+	}
+	sampleBuffer.clock += millis () + sleepMs;
+	// Next wake up will only store its reading unless it completes the batch
+	bool radioNeeded = sampleBuffer.wakes + 1 >= sampleBatchWakes;
+	sampleBuffer.radioOff = !radioNeeded;
+	saveSampleBuffer ();
+	return radioNeeded;
+}
+
+bool EnigmaIOTNodeClass::bufferData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding, bool urgent) {
+	if (!data || !len || SAMPLE_HEADER_LENGTH + len > SAMPLE_BUFFER_SIZE) {
+		DEBUG_WARN ("Reading cannot be stored. Length: %d", len);
+		return false;
+	}
+
+	loadSampleBuffer ();
+	if (!sampleBuffer.length) {
+		// Clock starts again with every batch so that it does not overflow
+		sampleBuffer.clock = 0;
+		sampleBuffer.wakes = 0;
+	}
+
+	uint8_t entryLen = SAMPLE_HEADER_LENGTH + len;
+	while (sampleBuffer.length + entryLen > SAMPLE_BUFFER_SIZE) {
+		uint8_t oldestLen = SAMPLE_HEADER_LENGTH + sampleBuffer.data[sizeof (uint32_t) + 1];
+		memmove (sampleBuffer.data, sampleBuffer.data + oldestLen, sampleBuffer.length - oldestLen);
+		sampleBuffer.length -= oldestLen;
+		DEBUG_WARN ("Reading buffer full. Oldest reading discarded");
+	}
+
+	uint32_t timestamp = sampleBuffer.clock + millis ();
+	uint8_t* entry = sampleBuffer.data + sampleBuffer.length;
+	memcpy (entry, &timestamp, sizeof (uint32_t));
+	entry[sizeof (uint32_t)] = payloadEncoding;
+	entry[sizeof (uint32_t) + 1] = len;
+	memcpy (entry + SAMPLE_HEADER_LENGTH, data, len);
+	sampleBuffer.length += entryLen;
+	if (sampleBuffer.wakes < UINT8_MAX) {
+		sampleBuffer.wakes++;
+	}
+	DEBUG_DBG ("Reading stored. %u readings, %u bytes", sampleBuffer.wakes, sampleBuffer.length);
+
+	// Radio is needed if batch is complete, if a similar reading would not fit or if sleep cycle duration is unknown
+	sampleBatchPending = urgent || !sampleBuffer.period || sampleBuffer.wakes >= sampleBatchWakes
+		|| sampleBuffer.length + entryLen > SAMPLE_BUFFER_SIZE;
+	if (!sampleBatchPending) {
+		return true;
+	}
+
+#ifdef ESP8266
+	if (sampleBuffer.radioOff) {
+		// Radio cannot be started on this wake up. Next one is done with radio enabled and sends the batch
+		DEBUG_INFO ("Restarting with radio enabled");
+		sampleBuffer.wakes = sampleBatchWakes;
+		sampleBufferSleep (1);
+		ESP.deepSleep (1000, RF_DEFAULT);
+	}
+#endif // ESP8266
+	return false;
+}
+
+void EnigmaIOTNodeClass::bufferedSleep () {
+	loadSampleBuffer ();
+	if (!sampleBuffer.period) {
+		DEBUG_WARN ("Sleep cycle duration is unknown");
+		return;
+	}
 
-	// Copy 8 last bytes from Node Key
-	memcpy (aad + addDataLen, node.getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	// Keep sleep cycle period as if the whole cycle was spent sleeping
+	uint32_t elapsed = millis ();
+	uint32_t sleepMs = elapsed < sampleBuffer.period ? sampleBuffer.period - elapsed : 1;
+	bool radioNeeded = sampleBufferSleep (sleepMs);
 
-	//uint8_t packetLen = count - TAG_LENGTH;
+	DEBUG_DBG ("Go to sleep for %u ms. Radio %s on next wake up", sleepMs, radioNeeded ? "enabled" : "disabled");
+#ifdef ESP8266
+	ESP.deepSleep ((uint64_t)sleepMs * 1000, radioNeeded ? RF_DEFAULT : RF_DISABLED);
+#elif defined ESP32
+	esp_deep_sleep ((uint64_t)sleepMs * 1000);
+#endif
+}
 
-	if (!CryptModule::decryptBuffer ((uint8_t*)&(clockResponse_msg.counter), CRSMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Decrypt from counter, 18 bytes
-									 clockResponse_msg.iv, IV_LENGTH,
-									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockResponse_msg.tag, TAG_LENGTH)) {
-		DEBUG_ERROR ("Error during decryption");
-		return false;
+void EnigmaIOTNodeClass::handleSampleBuffer () {
+	/*
+	* ----------------------------------------------------------------------
+	*| Age (4) | Length (1) | Reading (....) | Age (4) | Length (1) | ... |
+	* ----------------------------------------------------------------------
+	* Age is in milliseconds. Every message carries readings with the same encoding
+	*/
+	if (!sampleBatchPending || !node.isRegistered ()) {
+		return;
 	}
 
-    DEBUG_VERBOSE ("Decripted Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, count - TAG_LENGTH));
+	uint8_t capacity = dataPayloadCapacity ();
+	uint32_t now = sampleBuffer.clock + millis ();
 
-	memcpy (&counter, &(clockResponse_msg.counter), sizeof (uint16_t));
-	DEBUG_INFO ("Downlink msg #%d", counter);
-	if (useCounter) {
-		if (counter > node.getLastDownlinkMsgCounter ()) {
-			DEBUG_INFO ("Accepted");
-			node.setLastDownlinkMsgCounter (counter);
-			rtcmem_data.lastDownlinkMsgCounter = counter;
+	// Messages are paced so that they do not overflow transmission queue
+	while (sampleBuffer.length && comm->getQueueDepth (rtcmem_data.gateway) < COMMS_QUEUE_PER_DESTINATION) {
+		uint8_t msg[MAX_DATA_PAYLOAD_LENGTH];
+		uint8_t msgLen = 0;
+		uint16_t idx = 0;
+		uint8_t encoding = sampleBuffer.data[sizeof (uint32_t)];
+
+		while (idx < sampleBuffer.length) {
+			uint8_t* entry = sampleBuffer.data + idx;
+			uint8_t readingLen = entry[sizeof (uint32_t) + 1];
+			if (entry[sizeof (uint32_t)] != encoding || msgLen + BUFFERED_HEADER_LENGTH + readingLen > capacity) {
+				break;
+			}
+			uint32_t age;
+			memcpy (&age, entry, sizeof (uint32_t));
+			age = now - age;
+			memcpy (msg + msgLen, &age, sizeof (uint32_t));
+			msg[msgLen + sizeof (uint32_t)] = readingLen;
+			memcpy (msg + msgLen + BUFFERED_HEADER_LENGTH, entry + SAMPLE_HEADER_LENGTH, readingLen);
+			msgLen += BUFFERED_HEADER_LENGTH + readingLen;
+			idx += SAMPLE_HEADER_LENGTH + readingLen;
+		}
+
+		if (!msgLen) {
+			idx = SAMPLE_HEADER_LENGTH + sampleBuffer.data[sizeof (uint32_t) + 1];
+			DEBUG_WARN ("Stored reading does not fit in a message. Discarded");
 		} else {
-			DEBUG_WARN ("Downlink msg rejected");
-			return false;
+			DEBUG_INFO ("Sending %u bytes of stored readings", msgLen);
+			if (!sendData (msg, msgLen, BUFFERED_TYPE, true, (nodePayloadEncoding_t)encoding)) {
+				DEBUG_WARN ("Error sending stored readings. They are kept for next batch");
+				sampleBatchPending = false;
+				return;
+			}
 		}
+		memmove (sampleBuffer.data, sampleBuffer.data + idx, sampleBuffer.length - idx);
+		sampleBuffer.length -= idx;
 	}
 
-    t1 = clockResponse_msg.t1;
-	t2 = clockResponse_msg.t2;
-	t3 = clockResponse_msg.t3;
-	t4 = TimeManager.clock_us ();
+	if (!sampleBuffer.length) {
+		sampleBuffer.wakes = 0;
+		sampleBatchPending = false;
+		saveSampleBuffer ();
+	}
+}
+#endif // USE_SAMPLE_BUFFER
 
-	if (count < CRSMSG_LEN) {
-		DEBUG_WARN ("Message too short");
+bool EnigmaIOTNodeClass::sendFragmented (const uint8_t* data, size_t len, dataMessageType_t dataMsgType, nodePayloadEncoding_t payloadEncoding) {
+	if (!data || !len) {
 		return false;
 	}
 
-	memcpy (&clockResponse_msg, buf, count);
-
-	int64_t offset = TimeManager.adjustTime (t1, t2, t3, t4);
+	if (len > MAX_FRAGMENTED_LENGTH) {
+		DEBUG_WARN ("Message too long: %d bytes", len);
+		return false;
+	}
 
-	if (offset < MIN_SYNC_ACCURACY && offset > (MIN_SYNC_ACCURACY * -1)) {
-		timeSyncPeriod = TIME_SYNC_PERIOD;
-	} else {
-		timeSyncPeriod = QUICK_SYNC_TIME;
+	if (fragmentLength) {
+		DEBUG_WARN ("Fragmented message %u is still being sent", fragmentSeq);
+		return false;
 	}
-	DEBUG_VERBOSE ("Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
 
-	DEBUG_DBG ("T1: %llu", t1);
-    DEBUG_DBG ("T2: %llu", t2);
-    DEBUG_DBG ("T3: %llu", t3);
-    DEBUG_DBG ("T4: %llu", t4);
-    DEBUG_INFO ("Offest adjusted to %lld us, Roundtrip delay is %lld", offset, TimeManager.getDelay ());
+	node.setLastMessageTime (); // Mark message time to start RX window start
 
-	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
-		if (!saveRTCData ()) {
-			DEBUG_ERROR ("Error saving data on RTC");
-		}
+	if (node.getStatus () != REGISTERED || !node.isKeyValid ()) {
+		return false;
 	}
 
+	fragmentBuffer = (uint8_t*)malloc (len);
+	if (!fragmentBuffer) {
+		DEBUG_WARN ("Not enough memory for fragmented message");
+		return false;
+	}
+	memcpy (fragmentBuffer, data, len);
+	fragmentLength = len;
+	fragmentSeq++;
+	fragmentTotal = (len + FRAGMENT_DATA_LENGTH - 1) / FRAGMENT_DATA_LENGTH;
+	fragmentMsgType = dataMsgType == HA_DISC_TYPE ? HA_DISCOVERY_MESSAGE : SENSOR_DATA;
+	fragmentEncoding = payloadEncoding;
+	fragmentPending = (1 << fragmentTotal) - 1;
+	fragmentRetries = 0;
+	DEBUG_INFO ("Sending %d bytes in %u fragments. Sequence %u", len, fragmentTotal, fragmentSeq);
+
+	handleFragments ();
 	return true;
 }
 
-int64_t EnigmaIOTNodeClass::clock () {
-	return TimeManager.clock ();
-
-}
-
-time_t EnigmaIOTNodeClass::unixtime () {
-	return TimeManager.unixtime ();
-}
-
-bool EnigmaIOTNodeClass::hasClockSync () {
-	if (!node.getInitAsSleepy ())
-		return TimeManager.isTimeAdjusted ();
-	else
-		return false;
+void EnigmaIOTNodeClass::endFragmented () {
+	free (fragmentBuffer);
+	fragmentBuffer = NULL;
+	fragmentLength = 0;
+	fragmentPending = 0;
 }
 
-bool EnigmaIOTNodeClass::processServerHello (const uint8_t* mac, const uint8_t* buf, size_t count) {
+bool EnigmaIOTNodeClass::sendFragment (uint8_t index) {
 	/*
-	* ------------------------------------------------------
-	*| msgType (1) | random (12) | DH Kslave (32) | Tag (16) |
-	* ------------------------------------------------------
+	* ----------------------------------------------------------------------------
+	*| Sequence (1) | Index (1) | Total (1) | MsgType (1) | Fragment data (....) |
+	* ----------------------------------------------------------------------------
 	*/
+	uint8_t buf[FRAGMENT_HEADER_LENGTH + FRAGMENT_DATA_LENGTH];
+	size_t offset = index * FRAGMENT_DATA_LENGTH;
+	size_t len = fragmentLength - offset;
 
-	struct __attribute__ ((packed, aligned (1))) {
-		uint8_t msgType;
-		uint8_t iv[IV_LENGTH];
-		uint8_t publicKey[KEY_LENGTH];
-		uint16_t nodeId;
-		uint32_t random;
-		uint8_t tag[TAG_LENGTH];
-	} serverHello_msg;
+	if (len > FRAGMENT_DATA_LENGTH) {
+		len = FRAGMENT_DATA_LENGTH;
+	}
 
-#define SHMSG_LEN sizeof(serverHello_msg)
+	buf[0] = fragmentSeq;
+	buf[1] = index;
+	buf[2] = fragmentTotal;
+	buf[3] = fragmentMsgType;
+	memcpy (buf + FRAGMENT_HEADER_LENGTH, fragmentBuffer + offset, len);
 
-	uint16_t nodeId;
+	DEBUG_DBG ("Fragment %u/%u of message %u", index + 1, fragmentTotal, fragmentSeq);
+	flashBlue = true;
+	return dataMessage (buf, FRAGMENT_HEADER_LENGTH + len, FRAGMENT_TYPE, true, fragmentEncoding);
+}
 
-	if (count < SHMSG_LEN) {
-		DEBUG_WARN ("Message too short");
-		return false;
+void EnigmaIOTNodeClass::handleFragments () {
+	if (!fragmentLength || !node.isRegistered ()) {
+		return;
 	}
 
-	memcpy (&serverHello_msg, buf, count);
+	if (fragmentPending) {
+		// Fragments are paced so that they do not overflow transmission queue
+		while (fragmentPending && comm->getQueueDepth (rtcmem_data.gateway) < COMMS_QUEUE_PER_DESTINATION) {
+			uint8_t index = 0;
+			while (!(fragmentPending & (1 << index))) {
+				index++;
+			}
+			if (!sendFragment (index)) {
+				DEBUG_WARN ("Error sending fragment %u", index);
+				break;
+			}
+			fragmentPending &= ~(1 << index);
+			fragmentLastSent = millis ();
+		}
+	} else if (millis () - fragmentLastSent > FRAGMENT_STATUS_TIMEOUT) {
+		if (fragmentRetries >= FRAGMENT_MAX_RETRIES) {
+			DEBUG_WARN ("Fragmented message %u not acknowledged. Discarded", fragmentSeq);
+			endFragmented ();
+			return;
+		}
+		// Last fragment makes gateway report missing ones
+		DEBUG_INFO ("No fragment status. Sending last fragment again");
+		fragmentRetries++;
+		fragmentPending = 1 << (fragmentTotal - 1);
+	}
+}
 
-	uint8_t addDataLen = SHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - sizeof (uint16_t) - KEY_LENGTH;
-	uint8_t aad[AAD_LENGTH + addDataLen];
+bool EnigmaIOTNodeClass::processFragmentStatus (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* ---------------------------------------------------------------
+	*| FRAGMENT_STATUS (1) | Sequence (1) | Missing fragments (1) |
+	* ---------------------------------------------------------------
+	*/
+	if (!buf || count != 3) {
+		DEBUG_WARN ("Invalid fragment status message. Incorrect length %d", count);
+		return false;
+	}
 
-	memcpy (aad, (uint8_t*)&serverHello_msg, addDataLen); // Copy message upto iv
+	if (!fragmentLength || buf[1] != fragmentSeq) {
+		DEBUG_DBG ("Status of unknown fragmented message %u", buf[1]);
+		return true;
+	}
 
-	// Copy 8 last bytes from NetworkKey
-	memcpy (aad + addDataLen, rtcmem_data.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	uint8_t missing = buf[2] & ((1 << fragmentTotal) - 1);
+	if (!missing) {
+		DEBUG_INFO ("Fragmented message %u delivered", fragmentSeq);
+		endFragmented ();
+		return true;
+	}
 
-	if (!CryptModule::decryptBuffer (serverHello_msg.publicKey, KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t),
-									 serverHello_msg.iv, IV_LENGTH,
-									 rtcmem_data.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), serverHello_msg.tag, TAG_LENGTH)) {
-		DEBUG_ERROR ("Error during decryption");
-		return false;
+	if (fragmentRetries >= FRAGMENT_MAX_RETRIES) {
+		DEBUG_WARN ("Fragmented message %u not delivered. Discarded", fragmentSeq);
+		endFragmented ();
+		return true;
 	}
+	DEBUG_INFO ("Gateway is missing fragments 0x%02X of message %u", missing, fragmentSeq);
+	fragmentRetries++;
+	fragmentPending |= missing;
+	return true;
+}
 
-	DEBUG_VERBOSE ("Decrypted Server Hello message: %s", printHexBuffer ((uint8_t*)&serverHello_msg, SHMSG_LEN - TAG_LENGTH));
+#if USE_TX_SLOTS
+bool EnigmaIOTNodeClass::requestTxSlot () {
+	/*
+	* ----------------------------------
+	*| TX_SLOT_REQUEST (1) | Period (4) |
+	* ----------------------------------
+	*/
+	uint8_t buffer[1 + sizeof (uint32_t)];
 
-	bool cError = Crypto.getDH2 (serverHello_msg.publicKey);
+	buffer[0] = control_message_type::TX_SLOT_REQUEST;
+	memcpy (buffer + 1, &rtcmem_data.sleepTime, sizeof (uint32_t));
 
-	if (!cError) {
-		DEBUG_ERROR ("DH2 error");
+	DEBUG_INFO (" -------> TX SLOT REQUEST");
+	return sendData (buffer, sizeof (buffer), CONTROL_TYPE);
+}
+
+bool EnigmaIOTNodeClass::processTxSlot (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* ----------------------------------------------
+	*| TX_SLOT (1) | Period (4) | Delay to slot (4) |
+	* ----------------------------------------------
+	*/
+	if (!buf || count != 1 + 2 * sizeof (uint32_t)) {
+		DEBUG_WARN ("Invalid transmission slot message. Incorrect length %d", count);
 		return false;
 	}
 
-	memcpy (&nodeId, &serverHello_msg.nodeId, sizeof (uint16_t));
-	node.setNodeId (nodeId);
-	rtcmem_data.nodeKeyValid = nodeId;
-	DEBUG_DBG ("Node ID: %u", node.getNodeId ());
+	uint32_t period;
+	uint32_t delay;
+	memcpy (&period, buf + 1, sizeof (uint32_t));
+	memcpy (&delay, buf + 1 + sizeof (uint32_t), sizeof (uint32_t));
 
-	node.setEncryptionKey (CryptModule::getSHA256 (serverHello_msg.publicKey, KEY_LENGTH));
-	memcpy (rtcmem_data.nodeKey, node.getEncriptionKey (), KEY_LENGTH);
-	DEBUG_INFO ("Node key: %s", printHexBuffer (node.getEncriptionKey (), KEY_LENGTH));
+	if (rtcmem_data.txSlotPeriod != period) {
+		rtcmem_data.txSlotPeriod = period;
+		if (!otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
+			if (!saveRTCData ()) {
+				DEBUG_ERROR ("Error saving data on RTC");
+			}
+		}
+	}
+	if (period != rtcmem_data.sleepTime) {
+		DEBUG_WARN ("Slot was assigned for a %u s period. Current one is %u s", period, rtcmem_data.sleepTime);
+		return true;
+	}
 
+	// Gateway measures slot on message reception. Wake up earlier by the time it took to send data since start
+	uint32_t latency = dataSentTime ? dataSentTime - cycleStartedTime : 0;
+	txSlotWake = millis () + delay - latency;
+	if (!txSlotWake) {
+		txSlotWake = 1;
+	}
+	DEBUG_INFO ("Next transmission slot in %u ms", delay);
 	return true;
 }
+#endif // USE_TX_SLOTS
 
-bool EnigmaIOTNodeClass::sendData (const uint8_t* data, size_t len, dataMessageType_t dataMsgType, bool encrypt, nodePayloadEncoding_t payloadType) {
-	if (!dataMsgType) {
-		memcpy (dataMessageSent, data, len);
-		dataMessageSentLength = len;
-		dataMessageEncrypt = encrypt;
-		dataMessageSendPending = true;
-		dataMessageSendEncoding = payloadType;
+#if USE_DOWNLINK_END
+bool EnigmaIOTNodeClass::processDownlinkEnd (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* -------------------------------------------------------------
+	*| DOWNLINK_END (1) | Data counter (4) | Control counter (4) |
+	* -------------------------------------------------------------
+	*/
+	if (!buf || count != 1 + 2 * sizeof (uint32_t)) {
+		DEBUG_WARN ("Invalid downlink end message. Incorrect length %d", count);
+		return false;
 	}
-	node.setLastMessageTime (); // Mark message time to start RX window start
 
-	if (node.getStatus () == REGISTERED && node.isKeyValid ()) {
-		if (dataMsgType == CONTROL_TYPE) {
-            DEBUG_VERBOSE ("Control message sent: %s", printHexBuffer (data, len));
-        } else if (dataMsgType == HA_DISC_TYPE) {
-            DEBUG_VERBOSE ("HA discovery message sent: %s", printHexBuffer (data, len));
-        } else {
-			DEBUG_VERBOSE ("%s data sent: %s", encrypt ? "Encrypted" : "Unencrypted", printHexBuffer (data, len));
-		}
-		flashBlue = true;
-		if (dataMessage (data, len, dataMsgType, encrypt, payloadType)) {
-			dataMessageSendPending = false; // Data sent. This setting can still be overriden by invalidateCommand
-			return true;
-		} else
-			return false;
+	// Without counters it is not possible to know which message is being answered
+	if (!useCounter) {
+		return true;
+	}
+
+	uint32_t dataCounter;
+	uint32_t controlCounter;
+	memcpy (&dataCounter, buf + 1, sizeof (uint32_t));
+	memcpy (&controlCounter, buf + 1 + sizeof (uint32_t), sizeof (uint32_t));
+
+	uint32_t counterMask = node.useCounter32 () ? 0xFFFFFFFF : 0xFFFF;
+	if (dataCounter != (node.getLastMessageCounter () & counterMask) || controlCounter != (node.getLastControlCounter () & counterMask)) {
+		DEBUG_DBG ("Downlink end for an older message. Data counter %u, control counter %u", dataCounter, controlCounter);
+		return true;
+	}
 
+	DEBUG_INFO ("Nothing else to receive");
+	downlinkEndTime = millis ();
+	if (!downlinkEndTime) {
+		downlinkEndTime = 1;
 	}
-	return false;
+	return true;
 }
+#endif // USE_DOWNLINK_END
 
 void EnigmaIOTNodeClass::sleep () {
+	flushAggregatedData ();
 	if (node.getSleepy ()) {
 		DEBUG_DBG ("Sleep programmed for %lu ms", rtcmem_data.sleepTime * 1000);
 		sleepTime = (uint64_t)rtcmem_data.sleepTime * (uint64_t)1000000;
@@ -1573,18 +2586,19 @@ void EnigmaIOTNodeClass::sleep () {
 
 bool EnigmaIOTNodeClass::unencryptedDataMessage (const uint8_t* data, size_t len, dataMessageType_t dataMsgType, nodePayloadEncoding_t payloadEncoding) {
 	/*
-	* ------------------------------------------------------------------------
-	*| msgType (1) | NodeId (2) | Counter (2) | PayloadType (1) | Data (....) |
-	* ------------------------------------------------------------------------
+	* -------------------------------------------------------------------------------
+	*| msgType (1) | NodeId (2) | Counter (2 or 4) | PayloadType (1) | Data (....) |
+	* -------------------------------------------------------------------------------
 	*/
 
 	uint8_t buf[MAX_MESSAGE_LENGTH];
-	uint16_t counter;
+	uint32_t counter;
+	uint8_t counterLen = node.getCounterLength ();
 	uint16_t nodeId = node.getNodeId ();
 
 	uint8_t nodeId_idx = 1;
 	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
-	uint8_t encoding_idx = counter_idx + sizeof (int16_t);
+	uint8_t encoding_idx = counter_idx + counterLen;
 	uint8_t data_idx = encoding_idx + sizeof (int8_t);
 
 	uint8_t packet_length = data_idx + len;
@@ -1606,9 +2620,9 @@ bool EnigmaIOTNodeClass::unencryptedDataMessage (const uint8_t* data, size_t len
 		node.setLastMessageCounter (counter);
 		rtcmem_data.lastMessageCounter = counter;
 	} else {
-		counter = (uint16_t)(Crypto.random ());
+		counter = node.useCounter32 () ? Crypto.random () : (uint16_t)(Crypto.random ());
 	}
-	memcpy (buf + counter_idx, &counter, sizeof (uint16_t));
+	memcpy (buf + counter_idx, &counter, counterLen);
 
 	buf[encoding_idx] = (uint8_t)payloadEncoding;
 
@@ -1623,7 +2637,7 @@ bool EnigmaIOTNodeClass::unencryptedDataMessage (const uint8_t* data, size_t len
 #endif
 
 	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
-		if (!saveRTCData ()) {
+		if (!saveRTCCounters ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
 	}
@@ -1634,18 +2648,23 @@ bool EnigmaIOTNodeClass::unencryptedDataMessage (const uint8_t* data, size_t len
 
 bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessageType_t dataMsgType, bool encrypt, nodePayloadEncoding_t payloadEncoding) {
 	/*
-	* ----------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2) | Data (....) | tag (16) |
-	* ----------------------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2 or 4) | Data (....) | tag (16) |
+	* -----------------------------------------------------------------------------------------------
 	*/
 
+#if USE_DOWNLINK_END
+	downlinkEndTime = 0; // Any gateway answer refers to an older message from now on
+#endif // USE_DOWNLINK_END
+
 	if (!encrypt) {
         return unencryptedDataMessage (data, len, dataMsgType, payloadEncoding);
 	}
 
 	uint8_t buf[MAX_MESSAGE_LENGTH];
 	//uint8_t tag[TAG_LENGTH];
-	uint16_t counter;
+	uint32_t counter;
+	uint8_t counterLen = node.getCounterLength ();
 	uint16_t nodeId = node.getNodeId ();
 
 	uint8_t iv_idx = 1;
@@ -1655,10 +2674,10 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessa
 	uint8_t encoding_idx;
 	uint8_t data_idx;
 	if (dataMsgType != CONTROL_TYPE) {
-		encoding_idx = counter_idx + sizeof (int16_t);
+		encoding_idx = counter_idx + counterLen;
 		data_idx = encoding_idx + sizeof (int8_t);
 	} else {
-		data_idx = counter_idx + sizeof (int16_t);
+		data_idx = counter_idx + counterLen;
 	}
 	uint8_t tag_idx = data_idx + len;
 
@@ -1667,10 +2686,21 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessa
 		return false;
 	}
 
+	if (data_idx + len + TAG_LENGTH > MAX_MESSAGE_LENGTH) {
+		DEBUG_WARN ("Data message too long: %d bytes", len);
+		return false;
+	}
+
     if (dataMsgType == CONTROL_TYPE) {
         buf[0] = (uint8_t)CONTROL_DATA;
     } else if (dataMsgType == HA_DISC_TYPE) {
         buf[0] = (uint8_t)HA_DISCOVERY_MESSAGE;
+    } else if (dataMsgType == AGGREGATED_TYPE) {
+        buf[0] = (uint8_t)SENSOR_AGGREGATED_DATA;
+    } else if (dataMsgType == BUFFERED_TYPE) {
+        buf[0] = (uint8_t)SENSOR_BUFFERED_DATA;
+    } else if (dataMsgType == FRAGMENT_TYPE) {
+        buf[0] = (uint8_t)DATA_FRAGMENT;
 	} else {
 		buf[0] = (uint8_t)SENSOR_DATA;
 	}
@@ -1687,7 +2717,7 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessa
 			node.setLastMessageCounter (counter);
 			rtcmem_data.lastMessageCounter = counter;
 		} else {
-			counter = (uint16_t)(Crypto.random ());
+			counter = node.useCounter32 () ? Crypto.random () : (uint16_t)(Crypto.random ());
 		}
 	} else {
 		if (useCounter) {
@@ -1695,17 +2725,17 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessa
 			node.setLastControlCounter (counter);
 			rtcmem_data.lastControlCounter = counter;
 		} else {
-			counter = (uint16_t)(Crypto.random ());
+			counter = node.useCounter32 () ? Crypto.random () : (uint16_t)(Crypto.random ());
 		}
 	}
 
     if (dataMsgType != CONTROL_TYPE) {
-		DEBUG_INFO ("Data message #%d", counter);
+		DEBUG_INFO ("Data message #%u", counter);
 	} else {
-		DEBUG_INFO ("Control message #%d", counter);
+		DEBUG_INFO ("Control message #%u", counter);
 	}
 
-	memcpy (buf + counter_idx, &counter, sizeof (uint16_t));
+	memcpy (buf + counter_idx, &counter, counterLen);
 
 	buf[encoding_idx] = payloadEncoding;
 
@@ -1733,7 +2763,7 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessa
 	if (!CryptModule::encryptBuffer (crypt_buf, cryptLen, // Encrypt from length
 									 buf + iv_idx, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node.getCipherSuite ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
@@ -1744,6 +2774,8 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessa
         DEBUG_INFO (" -------> CONTROL MESSAGE");
     } else if (dataMsgType == HA_DISC_TYPE) {
         DEBUG_INFO (" -------> HA DISCOVERY MESSAGE");
+    } else if (dataMsgType == FRAGMENT_TYPE) {
+        DEBUG_INFO (" -------> DATA FRAGMENT");
 	} else {
 		DEBUG_INFO (" -------> DATA");
 	}
@@ -1753,7 +2785,7 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, dataMessa
 #endif
 
 	if (useCounter) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
-		if (!saveRTCData ()) {
+		if (!saveRTCCounters ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
 	}
@@ -1828,67 +2860,67 @@ bool EnigmaIOTNodeClass::processGetNameCommand (const uint8_t* mac, const uint8_
 
 bool EnigmaIOTNodeClass::processSetNameResponse (const uint8_t* mac, const uint8_t* data, uint8_t len) {
 	/*
-	 * ---------------------------------------------------
-	 *| msgType (1) | IV (12) | Result code (1) | tag (16) |
-	 * ---------------------------------------------------
+	 * ------------------------------------------------------------------------
+	 *| msgType (1) | IV (12) | Counter (2 or 4) | Result code (1) | tag (16) |
+	 * ------------------------------------------------------------------------
 	 */
-	struct __attribute__ ((packed, aligned (1))) {
-		uint8_t msgType;
-		uint8_t iv[IV_LENGTH];
-		uint16_t counter;
-		int8_t errorCode;
-		uint8_t tag[TAG_LENGTH];
-	} nodeNameSetResponse_msg;
+	uint8_t counterLen = node.getCounterLength ();
+	uint8_t iv_idx = 1;
+	uint8_t counter_idx = iv_idx + IV_LENGTH;
+	uint8_t errorCode_idx = counter_idx + counterLen;
+	uint8_t tag_idx = errorCode_idx + sizeof (int8_t);
+	const unsigned int NNSRMSG_LEN = tag_idx + TAG_LENGTH;
 
-	uint16_t counter;
+	uint8_t nodeNameSetResponse_msg[1 + IV_LENGTH + sizeof (uint32_t) + sizeof (int8_t) + TAG_LENGTH];
 
-	const unsigned int NNSRMSG_LEN = sizeof (nodeNameSetResponse_msg);
+	uint32_t counter = 0;
 
 	if (len < NNSRMSG_LEN) {
 		DEBUG_WARN ("Message too short");
 		return false;
 	}
-	memcpy (&nodeNameSetResponse_msg, data, len);
+	memcpy (nodeNameSetResponse_msg, data, NNSRMSG_LEN);
 
 	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
-	memcpy (aad, (uint8_t*)&nodeNameSetResponse_msg, addDataLen); // Copy message upto iv
+	memcpy (aad, nodeNameSetResponse_msg, addDataLen); // Copy message upto iv
 
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, node.getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::decryptBuffer ((uint8_t*)&(nodeNameSetResponse_msg.errorCode), sizeof (uint8_t),
-									 nodeNameSetResponse_msg.iv, IV_LENGTH,
+	if (!CryptModule::decryptBuffer (nodeNameSetResponse_msg + errorCode_idx, sizeof (uint8_t),
+									 nodeNameSetResponse_msg + iv_idx, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), nodeNameSetResponse_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), nodeNameSetResponse_msg + tag_idx, TAG_LENGTH, node.getCipherSuite ())) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Decrypted Node Name Set response message: %s", printHexBuffer ((uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Decrypted Node Name Set response message: %s", printHexBuffer (nodeNameSetResponse_msg, NNSRMSG_LEN - TAG_LENGTH));
 
-	memcpy (&counter, &(nodeNameSetResponse_msg.counter), sizeof (uint16_t));
-	DEBUG_INFO ("Downlink msg #%d", counter);
+	memcpy (&counter, nodeNameSetResponse_msg + counter_idx, counterLen);
+	DEBUG_INFO ("Downlink msg #%u", counter);
 	if (useCounter) {
-		if (counter > node.getLastDownlinkMsgCounter ()) {
+		if (node.acceptDownlinkCounter (counter)) {
 			DEBUG_INFO ("Accepted");
-			node.setLastDownlinkMsgCounter (counter);
-			rtcmem_data.lastDownlinkMsgCounter = counter;
+			rtcmem_data.lastDownlinkMsgCounter = node.getLastDownlinkMsgCounter ();
+			rtcmem_data.downlinkReplayWindow = node.getDownlinkReplayWindow ();
 		} else {
 			DEBUG_WARN ("Downlink msg rejected");
 			return false;
 		}
 	}
 
-	if (nodeNameSetResponse_msg.errorCode != NAME_OK) {
-		DEBUG_WARN ("Name error: %d", nodeNameSetResponse_msg.errorCode);
+	int8_t errorCode = (int8_t)nodeNameSetResponse_msg[errorCode_idx];
+	if (errorCode != NAME_OK) {
+		DEBUG_WARN ("Name error: %d", errorCode);
 	} else {
 		DEBUG_DBG ("Name set correctly");
 	}
 
 	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
-		if (!saveRTCData ()) {
+		if (!saveRTCCounters ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
 	}
@@ -1946,23 +2978,24 @@ bool EnigmaIOTNodeClass::sendNodeNameSet (const char* name) {
 	}
 
    /*
-	* ------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | NodeID (2) | Counter (2) | Node name (up to 32) | tag (16) |
-	* ------------------------------------------------------------------------------------
+	* -------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | NodeID (2) | Counter (2 or 4) | Node name (up to 32) | tag (16) |
+	* -------------------------------------------------------------------------------------------
 	*/
 
 	uint8_t buf[MAX_MESSAGE_LENGTH];
 	//uint8_t tag[TAG_LENGTH];
 	uint16_t nodeId = node.getNodeId ();
-	uint16_t counter;
+	uint32_t counter;
+	uint8_t counterLen = node.getCounterLength ();
 
 	uint8_t iv_idx = 1;
 	uint8_t nodeId_idx = iv_idx + IV_LENGTH;
 	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
-	uint8_t nodeName_idx = counter_idx + sizeof (int16_t);
+	uint8_t nodeName_idx = counter_idx + counterLen;
 	uint8_t tag_idx = nodeName_idx + nameLength;
 
-	size_t packet_length = 1 + IV_LENGTH + sizeof (int16_t) + sizeof (int16_t) + nameLength;
+	size_t packet_length = nodeName_idx + nameLength;
 
 
 	buf[0] = (uint8_t)NODE_NAME_SET;
@@ -1976,12 +3009,12 @@ bool EnigmaIOTNodeClass::sendNodeNameSet (const char* name) {
 		node.setLastControlCounter (counter);
 		rtcmem_data.lastControlCounter = counter;
 	} else {
-		counter = (uint16_t)(Crypto.random ());
+		counter = node.useCounter32 () ? Crypto.random () : (uint16_t)(Crypto.random ());
 	}
 
-	DEBUG_INFO ("Control message #%d", counter);
+	DEBUG_INFO ("Control message #%u", counter);
 
-	memcpy (buf + counter_idx, &counter, sizeof (uint16_t));
+	memcpy (buf + counter_idx, &counter, counterLen);
 
 	memcpy (buf + nodeId_idx, &nodeId, sizeof (uint16_t));
 
@@ -2004,7 +3037,7 @@ bool EnigmaIOTNodeClass::sendNodeNameSet (const char* name) {
 	if (!CryptModule::encryptBuffer (crypt_buf, cryptLen, // Encrypt from length
 									 buf + iv_idx, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node.getCipherSuite ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
@@ -2021,7 +3054,7 @@ bool EnigmaIOTNodeClass::sendNodeNameSet (const char* name) {
 	DEBUG_INFO ("-------> NODE NAME SEND");
 
 	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
-		if (!saveRTCData ()) {
+		if (!saveRTCCounters ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
 	}
@@ -2107,6 +3140,11 @@ void EnigmaIOTNodeClass::clearRTC () {
 #endif
     
 #if USE_FLASH_INSTEAD_RTC
+#if USE_CONTEXT_LOG
+	if (ContextLog.isReady ()) {
+		ContextLog.clear ();
+	}
+#endif // USE_CONTEXT_LOG
     FILESYSTEM.begin ();
     FILESYSTEM.remove (RTC_DATA_FILE);
     FILESYSTEM.end ();
@@ -2178,7 +3216,7 @@ bool EnigmaIOTNodeClass::processVersionCommand (const uint8_t* mac, const uint8_
 	}
 }
 
-bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len) {
+bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len, bool broadcast) {
 	const uint8_t MAX_OTA_RESPONSE_LENGTH = 4;
 
 	uint8_t responseBuffer[MAX_OTA_RESPONSE_LENGTH];
@@ -2189,7 +3227,7 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 	char md5calc[32];
 	static uint16_t numMsgs;
 	static uint32_t otaSize;
-	static uint16_t oldIdx;
+	static size_t totalBytes = 0;
 	static bool otaRecoverRequested = false;
 	static MD5Builder _md5;
 	uint8_t* dataPtr = (uint8_t*)(data + 1);
@@ -2204,25 +3242,46 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 	dataPtr += sizeof (uint16_t);
 	dataLen -= sizeof (uint16_t);
 	DEBUG_INFO ("OTA message #%u", msgIdx);
+	if (broadcast && msgIdx == 0) {
+		// Image size and MD5 are only accepted with node key. Any node knows broadcast key
+		DEBUG_WARN ("Broadcast OTA message #0 discarded");
+		return false;
+	}
+	lastOTAmsg = millis ();
 	if (msgIdx > 0 && otaRunning) {
-		if (msgIdx != (oldIdx + 1)) {
+		switch (otaWindow.add (msgIdx, dataPtr, dataLen)) {
+		case OTA_CHUNK_OUT_OF_WINDOW:
+			if (otaMulticast) {
+				// Gateway only broadcasts chunks in window of slowest node, so this node has been left out of update
+				DEBUG_WARN ("Multicast OTA message #%u out of window", msgIdx);
+				return true;
+			}
+			// Sender is too far ahead. It has to go back to first missing chunk
+			otaSackPending = true;
 			if (!otaRecoverRequested) {
 				otaRecoverRequested = true;
+				uint16_t lastGoodIdx = otaWindow.getBase () - 1;
 				responseBuffer[0] = control_message_type::OTA_ANS;
 				responseBuffer[1] = ota_status::OTA_OUT_OF_SEQUENCE;
-				memcpy (responseBuffer + 2, (uint8_t*)&oldIdx, sizeof (oldIdx));
+				memcpy (responseBuffer + 2, (uint8_t*)&lastGoodIdx, sizeof (lastGoodIdx));
 				sendData (responseBuffer, 4, CONTROL_TYPE);
-				DEBUG_ERROR ("%u OTA messages missing before %u", msgIdx - oldIdx - 1, msgIdx);
-				//otaRunning = false;
-				//otaError = true;
+				DEBUG_ERROR ("OTA message %u out of window. First missing one is %u", msgIdx, lastGoodIdx + 1);
 			}
 			return true;
-		} else {
-			oldIdx = msgIdx;
-			otaRecoverRequested = false;
+		case OTA_CHUNK_DUPLICATE:
+			// Sender missed last acknowledgement. It is repeated when chunks stop arriving
+			DEBUG_DBG ("OTA message #%u was already received", msgIdx);
+			otaSackPending = true;
+			return true;
+		case OTA_CHUNK_INVALID:
+			DEBUG_ERROR ("Invalid OTA message #%u. Length: %u", msgIdx, dataLen);
+			return false;
+		default:
+			break;
 		}
+		otaSackPending = true;
+		otaChunksSinceSack++;
 	}
-	lastOTAmsg = millis ();
 
 	if (msgIdx == 0) {
 		if (dataLen < 38) {
@@ -2240,6 +3299,30 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 		memcpy (md5buffer, dataPtr, 32);
 		md5buffer[32] = '\0';
 		DEBUG_VERBOSE ("MD5: %s", printHexBuffer ((uint8_t*)md5buffer, 32));
+		dataPtr += 32;
+		dataLen -= 32;
+		// Format is optional. Older update tools send raw images only. Size and MD5 refer always to decompressed image
+		otaFormat = dataLen > 0 ? dataPtr[0] : OTA_FORMAT_RAW;
+		DEBUG_INFO ("OTA format: %u", otaFormat);
+		otaMulticast = dataLen > 1 && dataPtr[1] == OTA_MODE_MULTICAST;
+		DEBUG_INFO ("OTA mode: %s", otaMulticast ? "multicast" : "unicast");
+		bool formatOk = otaFormat == OTA_FORMAT_RAW || (otaFormat == OTA_FORMAT_LZSS && otaDecompressor.begin ());
+		if (!formatOk || !otaWindow.begin (numMsgs)) {
+			if (!formatOk) {
+				DEBUG_ERROR ("OTA format %u not supported", otaFormat);
+			}
+			otaDecompressor.end ();
+			responseBuffer[0] = control_message_type::OTA_ANS;
+			responseBuffer[1] = ota_status::OTA_START_ERROR;
+			sendData (responseBuffer, 2, CONTROL_TYPE);
+			return false;
+		}
+		otaChunksSinceSack = 0;
+		otaSackPending = false;
+		otaGapReported = 0;
+		otaRecoverRequested = false;
+		otaReportDelay = OTA_MULTICAST_REPORT_DELAY + Crypto.random (OTA_MULTICAST_REPORT_JITTER);
+		totalBytes = 0;
 		otaRunning = true;
 		otaError = false;
 		_md5.begin ();
@@ -2263,18 +3346,51 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 		}
 	} else {
 		if (otaRunning) {
-			static size_t totalBytes = 0;
-
-			_md5.add (dataPtr, dataLen);
-            comm->enableTransmit (false);
-			// Process OTA Update
+			const uint8_t* chunk;
+			size_t chunkLen;
+			uint8_t plainBuffer[OTA_CHUNK_MAX_LENGTH];
+
+			// Flash is written in sequence. Chunks received ahead of a missing one wait in reorder buffer
+			while (otaWindow.pop (&chunk, &chunkLen)) {
+				const uint8_t* plain = chunk;
+				size_t plainLen = chunkLen;
+				if (otaFormat == OTA_FORMAT_LZSS) {
+					otaDecompressor.setInput (chunk, chunkLen);
+					plain = plainBuffer;
+					plainLen = otaDecompressor.read (plainBuffer, sizeof (plainBuffer));
+				}
+				// A compressed chunk is written as several blocks. Raw one is written at once
+				while (plainLen && totalBytes < otaSize) {
+					if (totalBytes + plainLen > otaSize) {
+						DEBUG_ERROR ("OTA image is longer than %u bytes", otaSize);
+						plainLen = otaSize - totalBytes;
+					}
+					_md5.add ((uint8_t*)plain, plainLen);
+					comm->enableTransmit (false);
+					// Process OTA Update. Messages are got from input queue in handle (), so flash is never written from WiFi task
 #if DEBUG_LEVEL >= INFO || CORE_DEBUG_LEVEL >= 3
-			size_t numBytes = 
+					size_t numBytes =
 #endif
-                Update.write (dataPtr, dataLen);
-            comm->enableTransmit (true);
-			totalBytes += dataLen;
-			DEBUG_INFO ("%u bytes written. Total %u", numBytes, totalBytes);
+						Update.write ((uint8_t*)plain, plainLen);
+					comm->enableTransmit (true);
+					totalBytes += plainLen;
+					DEBUG_INFO ("%u bytes written. Total %u", numBytes, totalBytes);
+					plainLen = otaFormat == OTA_FORMAT_LZSS ? otaDecompressor.read (plainBuffer, sizeof (plainBuffer)) : 0;
+				}
+				otaRecoverRequested = false;
+			}
+
+			// During a multicast update nodes only report when a round ends, so they do not answer every chunk at once
+			if (!otaWindow.isComplete () && !otaMulticast) {
+				// A new gap is reported at once so that sender repairs it before window is exhausted
+				bool newGap = otaWindow.hasGap () && otaGapReported != otaWindow.getBase ();
+				if (newGap || otaChunksSinceSack >= OTA_SACK_INTERVAL) {
+					if (newGap) {
+						otaGapReported = otaWindow.getBase ();
+					}
+					sendOtaSack ();
+				}
+			}
 		} else {
 			if (!otaError) {
 				otaError = true;
@@ -2286,9 +3402,16 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 		}
 	}
 
-	if (msgIdx == numMsgs && otaRunning) {
+	if (msgIdx > 0 && otaRunning && otaWindow.isComplete ()) {
 		StreamString otaErrorStr;
 
+		otaWindow.end ();
+		otaDecompressor.end ();
+		otaMulticast = false;
+		if (totalBytes != otaSize) {
+			DEBUG_ERROR ("OTA image length is %u bytes. %u expected", totalBytes, otaSize);
+		}
+
 		DEBUG_INFO ("OTA end");
 		_md5.calculate ();
 		DEBUG_DBG ("OTA MD5 %s", _md5.toString ().c_str ());
@@ -2348,6 +3471,28 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 	return true;
 }
 
+bool EnigmaIOTNodeClass::sendOtaSack () {
+	/*
+	* ---------------------------------------------------------------
+	*| OTA_ANS (1) | OTA_SACK (1) | Base (2) | Received chunks (4) |
+	* ---------------------------------------------------------------
+	* Base is first chunk not written yet. Bit n of received chunks is set if chunk Base + n is stored
+	*/
+	uint8_t responseBuffer[2 + sizeof (uint16_t) + sizeof (uint32_t)];
+	uint16_t base = otaWindow.getBase ();
+	uint32_t received = otaWindow.getReceived ();
+
+	responseBuffer[0] = control_message_type::OTA_ANS;
+	responseBuffer[1] = ota_status::OTA_SACK;
+	memcpy (responseBuffer + 2, &base, sizeof (uint16_t));
+	memcpy (responseBuffer + 2 + sizeof (uint16_t), &received, sizeof (uint32_t));
+	otaChunksSinceSack = 0;
+	otaSackPending = false;
+	otaReportDelay = OTA_MULTICAST_REPORT_DELAY + Crypto.random (OTA_MULTICAST_REPORT_JITTER);
+	DEBUG_INFO ("OTA SACK. Base %u. Received 0x%08X", base, received);
+	return sendData (responseBuffer, sizeof (responseBuffer), CONTROL_TYPE);
+}
+
 void EnigmaIOTNodeClass::restart (restartReason_t reason, bool reboot) {
 	rtcmem_data.nodeRegisterStatus = UNREGISTERED;
 	rtcmem_data.nodeKeyValid = false; // Force resync
@@ -2391,8 +3536,40 @@ bool EnigmaIOTNodeClass::processControlCommand (const uint8_t* mac, const uint8_
 		return processSetRestartCommand (mac, data, len);
 	case control_message_type::BRCAST_KEY:
 		return processBroadcastKeyMessage (mac, data, len);
+	case control_message_type::FRAGMENT_STATUS:
+		if (!broadcast) {
+			return processFragmentStatus (mac, data, len);
+		}
+		break;
+#if USE_TX_SLOTS
+	case control_message_type::TX_SLOT:
+		if (!broadcast) {
+			return processTxSlot (mac, data, len);
+		}
+		break;
+#endif // USE_TX_SLOTS
+#if USE_DOWNLINK_END
+	case control_message_type::DOWNLINK_END:
+		if (!broadcast) {
+			return processDownlinkEnd (mac, data, len);
+		}
+		break;
+#endif // USE_DOWNLINK_END
+#if USE_KEY_UPDATE
+	case control_message_type::KEY_UPDATE:
+		if (!broadcast) { // Broadcast key is not rotated this way
+			return processKeyUpdateMessage (mac, data, len);
+		}
+		break;
+#endif // USE_KEY_UPDATE
 	case control_message_type::OTA:
-		if (!broadcast) { // DO NOT PROCESS BROADCAST OTA MESSAGES
+		if (broadcast) {
+			// Only chunks of a multicast update that node joined with a unicast message are accepted as broadcast.
+			// An invalid one is discarded without restarting, as any node could send it
+			if (otaRunning && otaMulticast) {
+				return processOTACommand (mac, data, len, true);
+			}
+		} else {
 			if (processOTACommand (mac, data, len)) {
 				return true;
 			} else {
@@ -2418,17 +3595,71 @@ bool EnigmaIOTNodeClass::processBroadcastKeyMessage (const uint8_t* mac, const u
 	memcpy (rtcmem_data.broadcastKey, &buf[broadcastKey_idx], KEY_LENGTH);
 	rtcmem_data.broadcastKeyRequested = false;
 	rtcmem_data.broadcastKeyValid = true;
+	rtcSessionChanged = true;
 
 	return true;
 }
 
+#if USE_KEY_UPDATE
+bool EnigmaIOTNodeClass::processKeyUpdateMessage (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* --------------------------------------
+	*| KEY_UPDATE (1) | Epoch (2) | Salt (16) |
+	* --------------------------------------
+	*/
+	if (!buf || count != 1 + sizeof (uint16_t) + KEY_UPDATE_SALT_LENGTH) {
+		DEBUG_WARN ("Invalid key update message. Incorrect length %d", count);
+		return false;
+	}
+
+	uint16_t epoch;
+	memcpy (&epoch, buf + 1, sizeof (uint16_t));
+	if (epoch != (uint16_t)(node.getKeyEpoch () + 1)) {
+		DEBUG_WARN ("Unexpected key epoch %u. Current is %u", epoch, node.getKeyEpoch ());
+		return false;
+	}
+
+	uint8_t newKey[KEY_LENGTH];
+	if (!node.deriveNextKey (buf + 1 + sizeof (uint16_t), epoch, newKey)) {
+		DEBUG_ERROR ("Error deriving next key");
+		return false;
+	}
+
+	node.setEncryptionKey (newKey);
+	node.setKeyEpoch (epoch);
+	node.setKeyValidFrom (millis ());
+	memcpy (rtcmem_data.nodeKey, newKey, KEY_LENGTH);
+	rtcmem_data.keyEpoch = epoch;
+	memset (newKey, 0, KEY_LENGTH);
+	DEBUG_INFO ("Key updated to epoch %u", epoch);
+
+	if (!otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
+		if (!saveRTCData ()) {
+			DEBUG_ERROR ("Error saving data on RTC");
+		}
+	}
+
+	// Confirmation is encrypted with new key. Gateway switches as soon as it authenticates any message with it
+	uint8_t answer[1 + sizeof (uint16_t)];
+	answer[0] = control_message_type::KEY_UPDATE_ANS;
+	memcpy (answer + 1, &epoch, sizeof (uint16_t));
+
+	DEBUG_INFO (" -------> KEY UPDATE ANSWER");
+	return sendData (answer, sizeof (answer), CONTROL_TYPE);
+}
+#endif // USE_KEY_UPDATE
+
 bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_t* buf, size_t count, bool control) {
 	/*
-	* --------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | length (2) | Counter (2) | NodeId (2) | Data (....) | Tag (16) |
-	* --------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2 or 4) | Data (....) | Tag (16) |
+	* -----------------------------------------------------------------------------------------------
+	* Broadcast messages always use a 2 byte counter
 	*/
 
+	bool broadcast = (buf[0] & 0x80);
+	uint8_t counterLen = broadcast ? sizeof (uint16_t) : node.getCounterLength ();
+
 	uint8_t iv_idx = 1;
 	uint8_t length_idx = iv_idx + IV_LENGTH;
 	uint8_t nodeId_idx = length_idx + sizeof (int16_t);
@@ -2436,16 +3667,15 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 	uint8_t encoding_idx;
 	uint8_t data_idx;
 	if (!control) {
-		encoding_idx = counter_idx + sizeof (int16_t);
+		encoding_idx = counter_idx + counterLen;
 		data_idx = encoding_idx + sizeof (int8_t);
 	} else {
-		data_idx = counter_idx + sizeof (int16_t);
+		data_idx = counter_idx + counterLen;
 	}
 	uint8_t tag_idx = count - TAG_LENGTH;
 
-	uint16_t counter;
+	uint32_t counter = 0;
 	uint16_t nodeId;
-	bool broadcast = (buf[0] & 0x80);
 
 	//if (broadcast) {
 	//	DEBUG_WARN ("Broadcast message. Type: 0x%X", buf[0]);
@@ -2472,7 +3702,7 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 		if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
 										 buf + iv_idx, IV_LENGTH,
 										 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-										 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+										 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node.getCipherSuite ())) {
 			DEBUG_ERROR ("Error during decryption");
 			return false;
 		}
@@ -2482,8 +3712,8 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 
 	memcpy (&nodeId, &(buf[nodeId_idx]), sizeof (uint16_t));
 
-	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
-	DEBUG_INFO ("Downlink msg #%d", counter);
+	memcpy (&counter, &(buf[counter_idx]), counterLen);
+	DEBUG_INFO ("Downlink msg #%u", counter);
 	if (useCounter) {
 		if (broadcast) {
 			if (counter > lastBroadcastMsgCounter) {
@@ -2491,10 +3721,11 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 				lastBroadcastMsgCounter = counter;
 			}
 		} else {
-			if (counter > node.getLastDownlinkMsgCounter ()) {
-				DEBUG_INFO ("Accepted. Counter was %u", node.getLastDownlinkMsgCounter ());
-				node.setLastDownlinkMsgCounter (counter);
-				rtcmem_data.lastDownlinkMsgCounter = counter;
+			uint32_t lastCounter = node.getLastDownlinkMsgCounter ();
+			if (node.acceptDownlinkCounter (counter)) {
+				DEBUG_INFO ("Accepted. Counter was %u", lastCounter);
+				rtcmem_data.lastDownlinkMsgCounter = node.getLastDownlinkMsgCounter ();
+				rtcmem_data.downlinkReplayWindow = node.getDownlinkReplayWindow ();
 			} else {
 				DEBUG_WARN ("Downlink msg rejected");
 				return false;
@@ -2503,7 +3734,7 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 	}
 
 	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
-		if (!saveRTCData ()) {
+		if (!saveRTCCounters ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
 	}
@@ -2565,17 +3796,23 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		return;
 	}
 
+	bool authenticated = false; // RSSI is given to link controller only if message is authenticated
+
 	switch (buf[0]) {
 	case SERVER_HELLO:
 		DEBUG_INFO (" <------- SERVER HELLO");
 		if (node.getStatus () == WAIT_FOR_SERVER_HELLO) {
 			if (processServerHello (mac, buf, count)) {
+				authenticated = true;
 				// mark node as registered
 				//stopFlash (); // Do not flash during setup for less battery drain
 				node.setKeyValid (true);
 				rtcmem_data.nodeKeyValid = true;
 				node.setKeyValidFrom (millis ());
 				node.setLastMessageCounter (0);
+				node.setLastControlCounter (0);
+				node.setLastDownlinkMsgCounter (0);
+				node.setDownlinkReplayWindow (1);
 				node.setStatus (REGISTERED);
 				rtcmem_data.nodeRegisterStatus = REGISTERED;
 
@@ -2584,6 +3821,9 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 				rtcmem_data.lastMessageCounter = 0;
 				rtcmem_data.lastDownlinkMsgCounter = 0;
 				rtcmem_data.lastControlCounter = 0;
+				rtcmem_data.downlinkReplayWindow = 1;
+				rtcmem_data.keyEpoch = 0;
+				rtcmem_data.txSlotPeriod = 0; // Slot is assigned again after every registration
 				rtcmem_data.nodeId = node.getNodeId ();
 				DEBUG_INFO ("Reset counters");
 				if (!saveRTCData ()) {
@@ -2612,7 +3852,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 						if (dataMessageSendPending && dataMessageSentLength > 0) {
 							DEBUG_INFO ("Data pending to be sent. Length: %u", dataMessageSentLength);
 							DEBUG_VERBOSE ("Data sent: %s", printHexBuffer (dataMessageSent, dataMessageSentLength));
-							dataMessage ((uint8_t*)dataMessageSent, dataMessageSentLength, DATA_TYPE, dataMessageEncrypt, dataMessageSendEncoding);
+							dataMessage ((uint8_t*)dataMessageSent, dataMessageSentLength, dataMessageSendType, dataMessageEncrypt, dataMessageSendEncoding);
 							//dataMessageSentLength = 0;
 							dataMessageSendPending = false;
 
@@ -2630,6 +3870,17 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 			node.reset ();
 		}
 		break;
+	case HELLO_COOKIE:
+		DEBUG_INFO (" <------- HELLO COOKIE");
+		// Only one cookie is accepted per registration attempt so that forged cookies cannot trigger a hello storm
+		if (node.getStatus () == WAIT_FOR_SERVER_HELLO && !helloCookieValid) {
+			if (processHelloCookie (mac, buf, count)) {
+				if (!clientHello (true)) {
+					DEBUG_WARN ("Error sending Client Hello with cookie");
+				}
+			}
+		}
+		break;
 	case INVALIDATE_KEY:
 		DEBUG_INFO (" <------- INVALIDATE KEY");
 		invalidateReason = processInvalidateKey (mac, buf, count);
@@ -2638,6 +3889,11 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		rtcmem_data.lastMessageCounter = 0;
 		rtcmem_data.lastControlCounter = 0;
 		rtcmem_data.lastDownlinkMsgCounter = 0;
+		rtcmem_data.downlinkReplayWindow = 1;
+		rtcmem_data.counter32 = false;
+		rtcmem_data.keyEpoch = 0;
+		rtcmem_data.txSlotPeriod = 0;
+		rtcSessionChanged = true;
 		lastBroadcastMsgCounter = 0;
 		TimeManager.reset ();
 		timeSyncPeriod = QUICK_SYNC_TIME;
@@ -2654,6 +3910,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		DEBUG_INFO (" <------- DOWNSTREAM DATA SET");
 		if (processDownstreamData (mac, buf, count)) {
 			DEBUG_INFO ("Downstream Data set OK");
+			authenticated = true;
 		}
 		break;
 
@@ -2665,6 +3922,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		DEBUG_INFO (" <------- DOWNSTREAM DATA GET");
 		if (processDownstreamData (mac, buf, count)) {
 			DEBUG_INFO ("Downstream Data set OK");
+			authenticated = true;
 		}
 		break;
 
@@ -2676,6 +3934,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		DEBUG_INFO (" <------- DOWNSTREAM CONTROL DATA");
 		if (processDownstreamData (mac, buf, count, true)) {
 			DEBUG_INFO ("Downstream Data OK");
+			authenticated = true;
 		}
 		break;
 
@@ -2684,6 +3943,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		if (clockSyncEnabled) {
 			if (processClockResponse (mac, buf, count)) {
 				DEBUG_INFO ("Clock Response OK");
+				authenticated = true;
 			}
 		}
 		break;
@@ -2691,15 +3951,21 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		DEBUG_INFO (" <------- SET NODE NAME RESULT");
 		if (processSetNameResponse (mac, buf, count)) {
 			DEBUG_INFO ("Set Node Name OK");
+			authenticated = true;
 		}
 		break;
 	case BROADCAST_KEY_RESPONSE:
 		DEBUG_INFO (" <------- BROADCAST KEY MESSAGE");
 		if (processBroadcastKeyMessage (mac, buf, count)) {
 			DEBUG_INFO ("Broadcast Key OK");
+			authenticated = true;
 		}
 		break;
 	}
+
+	if (authenticated) {
+		comm->linkRssiUpdate (mac, rssi);
+	}
 }
 
 void EnigmaIOTNodeClass::getStatus (uint8_t* mac_addr, uint8_t status) {
@@ -2709,7 +3975,7 @@ void EnigmaIOTNodeClass::getStatus (uint8_t* mac_addr, uint8_t status) {
 		rtcmem_data.commErrors = 0;
 	} else {
 		rtcmem_data.commErrors++;
-		if (!saveRTCData ()) {
+		if (!saveRTCCounters ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
 		DEBUG_ERROR ("SENDStatus ERROR %d. Comm errors %u", status, rtcmem_data.commErrors);
@@ -21,6 +21,9 @@
 #include "helperFunctions.h"
 #include "Comms_hal.h"
 #include "NodeList.h"
+#include "EnigmaIOTRingBuffer.h"
+#include "OtaWindow.h"
+#include "OtaDecompressor.h"
 #include <cstddef>
 #include <cstdint>
 #include <ESPAsyncWebServer.h>
@@ -35,6 +38,9 @@
 enum nodeMessageType {
 	SENSOR_DATA = 0x01, /**< Data message from sensor node */
 	SENSOR_BRCAST_DATA = 0x81, /**< Data broadcast message from sensor node */
+	SENSOR_AGGREGATED_DATA = 0x09, /**< Data message from sensor node with several readings, each one with its relative timestamp */
+	DATA_FRAGMENT = 0x0A, /**< Part of a data or discovery message that is too long to be sent in a single message */
+	SENSOR_BUFFERED_DATA = 0x0B, /**< Data message from sensor node with readings stored along several sleep cycles, each one with its age */
 	UNENCRYPTED_NODE_DATA = 0x11, /**< Data message from sensor node. Unencrypted */
 	DOWNSTREAM_DATA_SET = 0x02, /**< Data message from gateway. Downstream data for commands */
 	DOWNSTREAM_BRCAST_DATA_SET = 0x82, /**< Data broadcast message from gateway. Downstream data for user commands */
@@ -52,6 +58,7 @@ enum nodeMessageType {
 	BROADCAST_KEY_RESPONSE = 0x18, /**< Message from gateway with broadcast key */
 	CLIENT_HELLO = 0xFF, /**< ClientHello message from node */
 	SERVER_HELLO = 0xFE, /**< ServerHello message from gateway */
+	HELLO_COOKIE = 0xFD, /**< Handshake cookie from gateway that has to be echoed on ClientHello */
 	INVALIDATE_KEY = 0xFB /**< InvalidateKey message from gateway */
 };
 
@@ -68,7 +75,10 @@ enum nodePayloadEncoding_t {
 enum dataMessageType_t {
     DATA_TYPE,      /**< User data message */
     CONTROL_TYPE,   /**< Control message */
-    HA_DISC_TYPE    /**< Home Assistant Discovery message */
+    HA_DISC_TYPE,   /**< Home Assistant Discovery message */
+    AGGREGATED_TYPE, /**< Several user data readings in one message */
+    FRAGMENT_TYPE,  /**< Fragment of a long data or discovery message */
+    BUFFERED_TYPE   /**< User data readings stored along several sleep cycles */
 };
 
 
@@ -83,11 +93,41 @@ enum nodeInvalidateReason_t {
 	KEY_EXPIRED = 0x05 /**< Node key has reached maximum validity time */
 };
 
+/**
+  * @brief Message received from gateway that waits to be processed out of radio callback
+  */
+typedef struct {
+	uint8_t addr[ENIGMAIOT_ADDR_LEN]; /**< Sender address */
+	uint8_t data[MAX_MESSAGE_LENGTH]; /**< Message buffer */
+	uint8_t len; /**< Message length */
+	signed int rssi; /**< Message RSSI */
+} node_rx_item_t;
+
+/**
+  * @brief Input queue counters
+  */
+typedef struct {
+	uint32_t received; /**< Messages stored by radio callback */
+	uint32_t processed; /**< Messages processed from `handle ()` */
+	uint32_t overflows; /**< Oldest messages dropped because queue was full */
+	uint8_t maxDepth; /**< Highest number of messages that have been waiting in queue */
+} node_rx_stats_t;
+
+/**
+  * @brief Registration progress. It is driven by timers from `handle ()` so that application keeps running meanwhile
+  */
+enum nodeRegistrationPhase_t {
+	REGISTRATION_IDLE = 0x00, /**< Node is not registered. Waiting for next attempt */
+	REGISTRATION_BACKOFF = 0x01, /**< Waiting a random time before sending ClientHello so that nodes do not collide */
+	REGISTRATION_WAIT_SERVER_HELLO = 0x02, /**< ClientHello has been sent. Waiting for ServerHello until deadline */
+	REGISTRATION_DONE = 0x03 /**< Node is registered */
+};
+
 /**
   * @brief Context data to be stored con persistent storage to be used after wake from sleep mode
   */
 typedef struct {
-	uint32_t crc32; /**< CRC to check RTC data integrity */
+	uint32_t crc32; /**< CRC to check session block integrity. Session block goes from `nodeKey` to `scanSkipped` */
 	uint8_t nodeKey[KEY_LENGTH]; /**< Node shared key */
 	uint16_t nodeId; /**< Node identification */
 	uint8_t channel /*= DEFAULT_CHANNEL*/; /**< WiFi channel used on ESP-NOW communication */
@@ -98,18 +138,53 @@ typedef struct {
 	bool sleepy; /**< Sleepy node */
 	uint32_t sleepTime /*= 0*/; /**< Time to sleep between sensor data delivery */
 	char nodeName[NODE_NAME_LENGTH + 1]; /**< Node name. Use as a human friendly name to avoid use of numeric address*/
-	uint8_t commErrors /*= 0*/; /**< number of non acknowledged packets. May mean that gateway is not available or its channel has changed.
-								This is used to retrigger Gateway scan*/
 	bool nodeKeyValid /* = false*/; /**< true if key has been negotiated successfully */
 	uint8_t broadcastKey[KEY_LENGTH]; /**< Key to encrypt broadcast messages */
 	bool broadcastKeyValid /* = false*/; /**< true if broadcast key has been received from gateway */
 	bool broadcastKeyRequested /* = false*/; /**< true if broadcast key has been requested to gateway */
 	status_t nodeRegisterStatus /*= UNREGISTERED*/; /**< Node registration status */
-	uint16_t lastMessageCounter; /**< Node last message counter */
-	uint16_t lastControlCounter; /**< Control message last counter */
-	uint16_t lastDownlinkMsgCounter; /**< Downlink message last counter */
+	uint8_t cipherSuite; /**< Cipher suite agreed with gateway for node key */
+	bool counter32; /**< true if 32 bit counters were agreed with gateway */
+	uint16_t keyEpoch; /**< Number of key updates since registration */
+	uint32_t txSlotPeriod; /**< Sleep period that gateway assigned a transmission slot for. 0 if it has not been reported */
+	uint8_t gwChannels[GATEWAY_CHANNEL_HISTORY]; /**< Channels where gateway has been found, most recent first. Probed before doing a full scan */
+	uint8_t scanBackoff; /**< Number of gateway searches to skip full scan after last failed one */
+	uint8_t scanSkipped; /**< Number of gateway searches that have skipped full scan since last one */
+	// Counter block. It changes on every message so it is checked and written on its own
+	uint32_t countersCrc32; /**< CRC to check counter block integrity. Counter block goes from `lastMessageCounter` to the end */
+	uint32_t lastMessageCounter; /**< Node last message counter */
+	uint32_t lastControlCounter; /**< Control message last counter */
+	uint32_t lastDownlinkMsgCounter; /**< Downlink message last counter */
+	uint32_t downlinkReplayWindow; /**< Replay window bitmap for downlink messages */
+	uint8_t commErrors /*= 0*/; /**< number of non acknowledged packets. May mean that gateway is not available or its channel has changed.
+								This is used to retrigger Gateway scan*/
 } rtcmem_data_t;
 
+static const size_t RTC_SESSION_LENGTH = offsetof (rtcmem_data_t, countersCrc32) - offsetof (rtcmem_data_t, nodeKey); ///< @brief Length of context session block
+static const size_t RTC_COUNTERS_OFFSET = offsetof (rtcmem_data_t, countersCrc32); ///< @brief Offset of context counter block, including its CRC. It is a multiple of 4
+static const size_t RTC_COUNTERS_LENGTH = sizeof (rtcmem_data_t) - offsetof (rtcmem_data_t, lastMessageCounter); ///< @brief Length of context counter block, without its CRC
+
+#if USE_SAMPLE_BUFFER
+/**
+  * @brief Readings stored in RTC memory across deep sleep cycles to be sent together
+  *
+  * Every reading is stored as
+  * ----------------------------------------------------------
+  *| Timestamp (4) | Encoding (1) | Length (1) | Reading (....) |
+  * ----------------------------------------------------------
+  * Timestamp is taken from `clock`, that keeps counting during deep sleep. It is changed to age when readings are sent
+  */
+typedef struct {
+	uint32_t crc32; /**< CRC from `clock` to the end of used buffer */
+	uint32_t clock; /**< Milliseconds elapsed since buffer was empty, at current wake up */
+	uint32_t period; /**< Sleep cycle duration in milliseconds. 0 if it is not known yet */
+	uint16_t length; /**< Used buffer length */
+	uint8_t wakes; /**< Readings stored since last batch was sent */
+	bool radioOff; /**< Current wake up was done with radio disabled. Only used on ESP8266 */
+	uint8_t data[SAMPLE_BUFFER_SIZE]; /**< Stored readings */
+} sample_buffer_t;
+#endif // USE_SAMPLE_BUFFER
+
 typedef nodeMessageType nodeMessageType_t;
 
 #if defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32
@@ -150,11 +225,56 @@ protected:
 	bool dataMessageSendPending = false; ///< @brief True in case of message retransmission is needed
 	nodePayloadEncoding_t dataMessageSendEncoding = RAW; ///< @brief Encoding of the message pending to be sent
 	bool dataMessageEncrypt = true; ///< @brief Message encryption enabled. Stored for use in case of message retransmission is needed
+	dataMessageType_t dataMessageSendType = DATA_TYPE; ///< @brief Type of the message pending to be sent
+	uint8_t aggregationBuffer[MAX_DATA_PAYLOAD_LENGTH]; ///< @brief Readings waiting to be sent together
+	uint8_t aggregationLength = 0; ///< @brief Used length of aggregation buffer
+	nodePayloadEncoding_t aggregationEncoding = CAYENNELPP; ///< @brief Encoding of aggregated readings. All of them must have the same
+	uint32_t aggregationStarted; ///< @brief Time when first aggregated reading was stored
+	uint16_t aggregationDeadline = 0; ///< @brief Maximum time a reading may wait in aggregation buffer. 0 if aggregation is disabled
+#if USE_SAMPLE_BUFFER
+	sample_buffer_t sampleBuffer; ///< @brief Copy of readings stored in RTC memory
+	bool sampleBufferLoaded = false; ///< @brief `true` if `sampleBuffer` has been read from RTC memory during this wake period
+	bool sampleBatchPending = false; ///< @brief Stored readings have to be sent during this wake period
+	uint8_t sampleBatchWakes = SAMPLE_BATCH_WAKES; ///< @brief Number of stored readings that are sent together
+#endif // USE_SAMPLE_BUFFER
+	uint8_t* fragmentBuffer = NULL; ///< @brief Long message being sent in fragments. It is allocated when transfer starts and kept until gateway acknowledges all fragments
+	size_t fragmentLength = 0; ///< @brief Length of message being sent in fragments. 0 if there is no fragmented transfer in progress
+	uint8_t fragmentSeq = 0; ///< @brief Sequence number of current fragmented message
+	uint8_t fragmentTotal = 0; ///< @brief Number of fragments of current message
+	uint8_t fragmentMsgType = SENSOR_DATA; ///< @brief Message type that gateway uses to deliver reassembled message
+	nodePayloadEncoding_t fragmentEncoding = MSG_PACK; ///< @brief Encoding of fragmented message payload
+	uint8_t fragmentPending = 0; ///< @brief Bitmap of fragments waiting to be sent
+	uint8_t fragmentRetries = 0; ///< @brief Number of retransmission rounds of current fragmented message
+	uint32_t fragmentLastSent; ///< @brief Time when last fragment was queued
+	uint32_t dataSentTime = 0; ///< @brief Time when first data message of this wake period was sent
+	bool txSlotRequested = false; ///< @brief Transmission slot has been requested during this wake period
+	uint32_t txSlotWake = 0; ///< @brief `millis ()` value when node has to wake up to transmit inside its slot. 0 if gateway has not sent it
+	EnigmaIOTRingBuffer<node_rx_item_t>* rxQueue = NULL; ///< @brief Messages got from radio callback. They are processed from `handle ()`
+	node_rx_item_t rxItem; ///< @brief Temporary storage for a message got from input queue
+	node_rx_stats_t rxStats = {}; ///< @brief Input queue counters
+	uint32_t rxOverflowsReported = 0; ///< @brief Overflow count when it was last logged
+#ifdef ESP32
+	portMUX_TYPE rxQueueMux = portMUX_INITIALIZER_UNLOCKED; ///< @brief Protects input queue between WiFi task and loop
+#endif
+	nodeRegistrationPhase_t registrationPhase = REGISTRATION_IDLE; ///< @brief Current registration step
+	uint32_t registrationStart = 0; ///< @brief `millis ()` value when last registration attempt started
+	uint32_t registrationDeadline = 0; ///< @brief `millis ()` value when current registration step times out
+#if USE_DOWNLINK_END
+	uint32_t downlinkEndTime = 0; ///< @brief `millis ()` value when gateway signaled that it has nothing else to send. 0 if it has not done it since last sent message
+#endif // USE_DOWNLINK_END
 	nodeInvalidateReason_t invalidateReason = UNKNOWN_ERROR; ///< @brief Last key invalidation reason
 	bool otaRunning = false; ///< @brief True if OTA update has started
 	bool otaError = false; ///< @brief True if OTA update has failed. This normally produces a restart
 	bool protectOTA = false; ///< @brief True if OTA update was launched. OTA flag is stored on RTC so this disables writting.
 	time_t lastOTAmsg; ///< @brief Time when last OTA update message has received. This is used to control timeout
+	OtaWindowClass otaWindow; ///< @brief Receive window and reorder buffer of OTA chunks
+	OtaDecompressorClass otaDecompressor; ///< @brief Decompresses OTA chunks when image is sent compressed
+	uint8_t otaFormat = OTA_FORMAT_RAW; ///< @brief Format of OTA image being received. One of `ota_format_t`
+	uint8_t otaChunksSinceSack = 0; ///< @brief OTA chunks received since last selective acknowledgement
+	bool otaSackPending = false; ///< @brief Some OTA chunk has been received after last selective acknowledgement
+	uint16_t otaGapReported = 0; ///< @brief Window base when a missing chunk was last reported at once
+	bool otaMulticast = false; ///< @brief True if node joined a multicast OTA update, so it accepts chunks sent as broadcast
+	uint16_t otaReportDelay = OTA_MULTICAST_REPORT_DELAY; ///< @brief Time without chunks before next report during a multicast OTA update (ms)
 	boolean indentifying = false; ///< @brief True if node has its led flashing to be identified
 	time_t identifyStart; ///< @brief Time when identification started flashing. Used to control identification timeout
 	clock_t timeSyncPeriod = QUICK_SYNC_TIME; ///< @brief Clock synchronization period
@@ -165,12 +285,15 @@ protected:
 	bool requestSearchGateway = false; ///< @brief Flag to control updating gateway address, RSSI and channel
 	// bool requestReportRSSI = false; ///< @brief Flag to control RSSI reporting
 	bool configCleared = false; ///< @brief This flag disables asy configuration save after triggering a factory reset
+	bool rtcSessionChanged = true; ///< @brief Context session block may differ from stored one, so counter block cannot be saved alone
 	int resetPin = -1; ///< @brief  Pin used to reset configuration if it is connected to ground during startup
 	AsyncWiFiManager* wifiManager; ///< @brief Wifi configuration portal
 	onWiFiManagerExit_t notifyWiFiManagerExit; ///< @brief Function called when configuration portal exits
 	simpleEventHandler_t notifyWiFiManagerStarted; ///< @brief Function called when configuration portal is started
 	time_t cycleStartedTime; ///< @brief Used to calculate exact sleep time by substracting awake time
-	int16_t lastBroadcastMsgCounter; ///< @brief Counter for broadcast messages from gateway */
+	uint16_t lastBroadcastMsgCounter; ///< @brief Counter for broadcast messages from gateway */
+	uint8_t helloCookie[HELLO_COOKIE_LENGTH]; ///< @brief Handshake cookie got from gateway during current registration attempt
+	bool helloCookieValid = false; ///< @brief `true` if a handshake cookie has been received during current registration attempt
 
 	/**
 	  * @brief Check that a given CRC matches to calulated value from a buffer
@@ -192,6 +315,15 @@ protected:
 	  */
 	void stopIdentifying ();
 
+#if USE_FLASH_INSTEAD_RTC
+	/**
+	 * @brief Reads context from file in flash. Used if context log is not available
+	 * @param context Buffer to store context
+	 * @return Returns `true` if file has a context with the right size
+	 */
+	bool loadRTCFile (rtcmem_data_t* context);
+#endif // USE_FLASH_INSTEAD_RTC
+
 	/**
    * @brief Loads configuration from RTC data. Uses a CRC to check data integrity
    * @return Returns `true` if data is valid. `false` otherwise
@@ -224,11 +356,42 @@ protected:
 	*/
 	void sendRestart ();
 
+	/**
+	  * @brief Stores a received message to be processed later. Called from radio callback so it must be short
+	  * @param addr Sender address
+	  * @param msg Message buffer
+	  * @param len Message length
+	  * @param rssi Message RSSI
+	  * @return Returns `false` if queue was full and oldest message was dropped
+	  */
+	bool addInputMsgQueue (const uint8_t* addr, const uint8_t* msg, size_t len, signed int rssi);
+
+	/**
+	  * @brief Processes up to `NODE_RX_BATCH` received messages. Called from `handle ()`, so decryption, flash writes
+	  * and user callbacks do not run on WiFi task
+	  */
+	void handleInputQueue ();
+
+	/**
+	  * @brief Advances registration state machine. Called from `handle ()`. It never waits, every step ends on a deadline
+	  */
+	void handleRegistration ();
+
 	/**
 	  * @brief Build a **ClientHello** messange and send it to gateway
+	  * @param echoCookie `true` to repeat last ClientHello including handshake cookie got from gateway. Same DH key pair is used
 	  * @return Returns `true` if ClientHello message was successfully sent. `false` otherwise
 	  */
-	bool clientHello ();
+	bool clientHello (bool echoCookie = false);
+
+	/**
+	  * @brief Gets a buffer containing a **HelloCookie** message and stores cookie to be echoed on next ClientHello
+	  * @param mac Address where this message was received from
+	  * @param buf Pointer to the buffer that contains the message
+	  * @param count Message length in number of bytes of HelloCookie message
+	  * @return Returns `true` if message could be correcly processed
+	  */
+	bool processHelloCookie (const uint8_t* mac, const uint8_t* buf, size_t count);
 
 	/**
 	  * @brief Build a **ClockRequest** messange and send it to gateway
@@ -273,6 +436,18 @@ protected:
 	  */
 	bool processBroadcastKeyMessage (const uint8_t* mac, const uint8_t* buf, size_t count);
 
+#if USE_KEY_UPDATE
+	/**
+	  * @brief Gets a buffer containing a **KeyUpdate** control message. Next key is derived from current one and confirmed to gateway
+	  * using the new key
+	  * @param mac Address where this message was received from
+	  * @param buf Pointer to the buffer that contains the message
+	  * @param count Message length in number of bytes of KeyUpdate message
+	  * @return Returns `true` if key was updated and confirmation was sent
+	  */
+	bool processKeyUpdateMessage (const uint8_t* mac, const uint8_t* buf, size_t count);
+#endif // USE_KEY_UPDATE
+
 	/**
 	  * @brief Builds, encrypts and sends a **Data** message.
 	  * @param data Buffer to store payload to be sent
@@ -299,9 +474,16 @@ protected:
 	  * @param mac Gateway address
 	  * @param data Buffer to store received message
 	  * @param len Length of payload data
+	  * @param broadcast `true` if message was sent as broadcast. Only chunks of a multicast update are accepted this way
 	  * @return Returns `true` if message could be correcly decoded and processed
 	  */
-	bool processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len);
+	bool processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len, bool broadcast = false);
+
+	/**
+	  * @brief Reports OTA chunks received so far, so that sender only resends missing ones
+	  * @return Returns `true` if message could be sent
+	  */
+	bool sendOtaSack ();
 
 	/**
 	  * @brief Processes a control command. Does not propagate to user code
@@ -424,7 +606,137 @@ protected:
     bool sendData (const uint8_t* data, size_t len, dataMessageType_t dataMsgType, bool encrypt = true, nodePayloadEncoding_t payloadEncoding = CAYENNELPP);
 
 	/**
-	 * @brief Starts searching for a gateway that it using configured Network Name as WiFi AP. Stores this info for subsequent use
+	  * @brief Gets maximum payload length that fits in a single encrypted data message with current counter length
+	  * @return Payload length in bytes
+	  */
+	uint8_t dataPayloadCapacity () {
+		return MAX_MESSAGE_LENGTH - TAG_LENGTH - (1 + IV_LENGTH + sizeof (uint16_t) + sizeof (uint16_t) + node.getCounterLength () + sizeof (uint8_t));
+	}
+
+	/**
+	  * @brief Starts sending a payload that does not fit in a single message. It is split in fragments that are sent from `handle`
+	  * and kept until gateway acknowledges all of them
+	  * @param data Payload buffer
+	  * @param len Payload length. Up to `MAX_FRAGMENTED_LENGTH`
+	  * @param dataMsgType Data or HomeAssistant discovery message
+	  * @param payloadEncoding Identifies data encoding of payload
+	  * @return Returns `true` if transfer could be started
+	  */
+	bool sendFragmented (const uint8_t* data, size_t len, dataMessageType_t dataMsgType, nodePayloadEncoding_t payloadEncoding);
+
+	/**
+	  * @brief Finishes current fragmented transfer and frees its buffer
+	  */
+	void endFragmented ();
+
+	/**
+	  * @brief Sends a single fragment of current fragmented message
+	  * @param index Fragment index
+	  * @return Returns `true` if fragment could be queued
+	  */
+	bool sendFragment (uint8_t index);
+
+	/**
+	  * @brief Sends pending fragments while there is room in transmission queue and retransmits last one if gateway
+	  * does not report transfer status in time
+	  */
+	void handleFragments ();
+
+	/**
+	  * @brief Processes fragment status from gateway. Missing fragments are sent again
+	  * @param mac Gateway address
+	  * @param buf Buffer that contains the message
+	  * @param count Message length
+	  * @return Returns `true` if message format is correct
+	  */
+	bool processFragmentStatus (const uint8_t* mac, const uint8_t* buf, size_t count);
+
+#if USE_TX_SLOTS
+	/**
+	  * @brief Reports sleep period to gateway so that it assigns a transmission slot to this node
+	  * @return Returns `true` if message could be sent
+	  */
+	bool requestTxSlot ();
+
+	/**
+	  * @brief Processes transmission slot message from gateway. Next sleep time is adjusted to wake up on the slot
+	  * @param mac Gateway address
+	  * @param buf Buffer that contains the message
+	  * @param count Message length
+	  * @return Returns `true` if message format is correct
+	  */
+	bool processTxSlot (const uint8_t* mac, const uint8_t* buf, size_t count);
+#endif // USE_TX_SLOTS
+
+#if USE_DOWNLINK_END
+	/**
+	  * @brief Processes downlink end message from gateway. It is only accepted if it answers last sent message, so
+	  * that a late one does not cut the wait for an answer to a newer message
+	  * @param mac Gateway address
+	  * @param buf Buffer that contains the message
+	  * @param count Message length
+	  * @return Returns `true` if message format is correct
+	  */
+	bool processDownlinkEnd (const uint8_t* mac, const uint8_t* buf, size_t count);
+#endif // USE_DOWNLINK_END
+
+	/**
+	  * @brief Stores a reading in aggregation buffer. Buffer is sent first if reading does not fit or has a different encoding
+	  * @param data Reading buffer
+	  * @param len Reading length
+	  * @param payloadEncoding Reading encoding
+	  * @return Returns `true` if reading was stored or sent
+	  */
+	bool aggregateData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding);
+
+#if USE_SAMPLE_BUFFER
+	/**
+	  * @brief Reads stored readings from RTC memory. It is done only once per wake period. Buffer is emptied if its CRC is wrong
+	  */
+	void loadSampleBuffer ();
+
+	/**
+	  * @brief Writes stored readings to RTC memory
+	  * @return Returns `true` on success
+	  */
+	bool saveSampleBuffer ();
+
+	/**
+	  * @brief Advances stored readings clock with time that is about to be spent on deep sleep and saves them
+	  * @param sleepMs Deep sleep duration in milliseconds
+	  * @return Returns `true` if radio will be needed on next wake up
+	  */
+	bool sampleBufferSleep (uint32_t sleepMs);
+
+	/**
+	  * @brief Sends stored readings, grouped in messages by encoding, once node is registered
+	  */
+	void handleSampleBuffer ();
+#endif // USE_SAMPLE_BUFFER
+
+	/**
+	 * @brief Probes known channels for gateway. Cached channel and address are tried first, then channels where gateway was found before
+	 * @param data Node context structure
+	 * @param channel Gets channel where gateway was found
+	 * @param gateway Gets gateway address
+	 * @param rssi Gets gateway signal strength
+	 * @return Returns `true` if gateway could be found. `false` otherwise
+	 */
+	bool probeGateway (rtcmem_data_t* data, uint8_t& channel, uint8_t* gateway, int& rssi);
+
+	/**
+	 * @brief Scans all channels for gateway
+	 * @param data Node context structure
+	 * @param channel Gets channel where gateway was found
+	 * @param gateway Gets gateway address
+	 * @param rssi Gets gateway signal strength
+	 * @return Returns `true` if gateway could be found. `false` otherwise
+	 */
+	bool scanForGateway (rtcmem_data_t* data, uint8_t& channel, uint8_t* gateway, int& rssi);
+
+	/**
+	 * @brief Starts searching for a gateway that it using configured Network Name as WiFi AP. Stores this info for subsequent use.
+	 * Known channels are probed first. Full scan is done with an exponential backoff if gateway is not found there
 	 * @param data Node context structure
 	 * @param shouldStoreData True if this method should save context in flash
 	 * @return Returns `true` if gateway could be found. `false` otherwise
@@ -447,6 +759,20 @@ protected:
 	 */
 	bool saveRTCData ();
 
+	/**
+	 * @brief Save only context counter block. Used after every message, when counters are the only fields that changed.
+	 * Whole context is saved if session block changed since last save
+	 * @return Returns `true` if result is successful. `false` otherwise
+	 */
+	bool saveRTCCounters ();
+
+	/**
+	 * @brief Checks session and counter block CRC of a context
+	 * @param data Context to check
+	 * @return Returns `true` if both blocks are valid
+	 */
+	bool checkRTCData (rtcmem_data_t* data);
+
 	/**
 	 * @brief Checks reset button status during startup
 	 */
@@ -609,9 +935,62 @@ public:
 	  * @param payloadEncoding Identifies data encoding of payload. It can be RAW, CAYENNELPP, MSGPACK
 	  */
 	bool sendData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding = CAYENNELPP) {
+		if (aggregationDeadline) {
+			return aggregateData (data, len, payloadEncoding);
+		}
 		return sendData (data, len, DATA_TYPE, true, payloadEncoding);
     }
 
+	/**
+	  * @brief Enables reading aggregation. If enabled, `sendData` stores every reading with its timestamp and all of them
+	  * are sent in a single message when buffer is full, when encoding changes or when oldest reading reaches deadline.
+	  * Buffer is also sent when `sleep` is called. Gateway notifies every reading separately
+	  * @param deadline Maximum time in ms that a reading may wait before it is sent. 0 disables aggregation and sends pending readings
+	  */
+	void setAggregation (uint16_t deadline = AGGREGATION_DEADLINE) {
+		aggregationDeadline = deadline;
+		if (!deadline) {
+			flushAggregatedData ();
+		}
+	}
+
+	/**
+	  * @brief Sends aggregated readings now
+	  * @return Returns `true` if there were no readings or message could be sent
+	  */
+	bool flushAggregatedData ();
+
+#if USE_SAMPLE_BUFFER
+	/**
+	  * @brief Stores a reading in RTC memory so that it is sent later together with readings of next wake ups.
+	  * It has to be called before `begin ()`. If it returns `true` node should call `bufferedSleep ()` without starting
+	  * radio. Otherwise `begin ()` has to be called and stored readings are sent as soon as node is registered.
+	  *
+	  * Oldest readings are discarded if buffer gets full
+	  * @param data Reading buffer
+	  * @param len Reading length
+	  * @param payloadEncoding Reading encoding
+	  * @param urgent `true` to send stored readings on this wake up, e.g. if a value crossed an alarm threshold
+	  * @return Returns `true` if radio is not needed on this wake up
+	  */
+	bool bufferData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding = CAYENNELPP, bool urgent = false);
+
+	/**
+	  * @brief Goes to deep sleep for the rest of sleep cycle after a reading has been stored with `bufferData ()`.
+	  * On ESP8266 node wakes up with radio disabled if next reading is expected to be stored only.
+	  * It only returns if sleep cycle duration is not known yet
+	  */
+	void bufferedSleep ();
+
+	/**
+	  * @brief Sets how many readings stored with `bufferData ()` are sent together
+	  * @param wakes Number of readings, one per wake up
+	  */
+	void setSampleBatch (uint8_t wakes) {
+		sampleBatchWakes = wakes ? wakes : 1;
+	}
+#endif // USE_SAMPLE_BUFFER
+
     /**
       * @brief Builds, encrypts and sends a **HomeAssistant discovery** message.
       * @param data Buffer to store payload to be sent
@@ -773,12 +1152,37 @@ public:
 		return node.isRegistered ();
 	}
 
+	/**
+	  * @brief Gets registration progress, so that application may show it or decide what to do while it goes on
+	  * @return Current registration step
+	  */
+	nodeRegistrationPhase_t getRegistrationPhase () {
+		return registrationPhase;
+	}
+
+	/**
+	  * @brief Gets input queue counters. They may be used to check whether `handle ()` is called often enough
+	  * @return Pointer to counters
+	  */
+	const node_rx_stats_t* getRxStats () {
+		return &rxStats;
+	}
+
 	/**
 	 * @brief Gets latest RSSI measurement. It is updated during start up or in case of transmission errors
 	 * @return RSSI value
 	 */
 	signed int getRSSI ();
 
+	/**
+	 * @brief Gets rate and power used to send to gateway, and link quality
+	 * @param state Gets link state
+	 * @return Returns `true` if communication layer tracks link to gateway
+	 */
+	bool getLinkState (comms_link_state_t* state) {
+		return comm->getLinkState (rtcmem_data.gateway, state);
+	}
+
 	/**
 	 * @brief Deletes configuration file stored on flash. It makes neccessary to configure it again using WiFi Portal
 	 */
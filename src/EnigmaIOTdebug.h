@@ -72,6 +72,36 @@ const char* extractFileName (const char* path);
 #define DEBUG_INFO(format,...) ESP_LOGI (DEFAULT_LOG_TAG,"%d Heap: %6d " format, millis(), ESP.getFreeHeap(), ##__VA_ARGS__)
 #define DEBUG_WARN(format,...) ESP_LOGW (DEFAULT_LOG_TAG,"%d Heap: %6d " format, millis(), ESP.getFreeHeap(), ##__VA_ARGS__)
 #define DEBUG_ERROR(format,...) ESP_LOGE (DEFAULT_LOG_TAG,"%d Heap: %6d " format, millis(), ESP.getFreeHeap(), ##__VA_ARGS__)
+#else // Host build. Output goes to stderr so that it does not mix with program output
+#if DEBUG_LEVEL >= VERBOSE
+#define DEBUG_VERBOSE(format,...) fprintf (stderr, "V [%lu] %s() | " format "\n", millis (), __FUNCTION__, ##__VA_ARGS__)
+#else
+#define DEBUG_VERBOSE(...)
+#endif
+
+#if DEBUG_LEVEL >= DBG
+#define DEBUG_DBG(format,...) fprintf (stderr, "D [%lu] %s() | " format "\n", millis (), __FUNCTION__, ##__VA_ARGS__)
+#else
+#define DEBUG_DBG(...)
+#endif
+
+#if DEBUG_LEVEL >= INFO
+#define DEBUG_INFO(format,...) fprintf (stderr, "I [%lu] %s() | " format "\n", millis (), __FUNCTION__, ##__VA_ARGS__)
+#else
+#define DEBUG_INFO(...)
+#endif
+
+#if DEBUG_LEVEL >= WARN
+#define DEBUG_WARN(format,...) fprintf (stderr, "W [%lu] %s() | " format "\n", millis (), __FUNCTION__, ##__VA_ARGS__)
+#else
+#define DEBUG_WARN(...)
+#endif
+
+#if DEBUG_LEVEL >= ERROR
+#define DEBUG_ERROR(format,...) fprintf (stderr, "E [%lu] %s() | " format "\n", millis (), __FUNCTION__, ##__VA_ARGS__)
+#else
+#define DEBUG_ERROR(...)
+#endif
 #endif
 #else
 #define DEBUG_VERBOSE(...)
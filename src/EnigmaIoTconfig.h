@@ -28,6 +28,7 @@ static const size_t MAX_MQTT_QUEUE_SIZE = 3; ///< @brief Maximum number of MQTT
 #define ENABLE_STATUS_MESSAGES 1 ///< @brief Enable sending status message after every data message
 static const int RATE_AVE_ORDER = 5; ///< @brief Message rate filter order
 static const int MAX_INPUT_QUEUE_SIZE = 3; ///< @brief Input queue size for EnigmaIOT messages. Acts as a buffer to be able to handle messages during high load
+static const int NODE_RX_QUEUE_SIZE = 6; ///< @brief Node input queue size. Messages are stored by radio callback and processed from `handle ()`. Oldest one is dropped when it is full
 #ifndef NUM_NODES
 static const int NUM_NODES = 35; ///< @brief Maximum number of nodes that this gateway can handle
 #endif //NUM_NODES
@@ -38,6 +39,12 @@ static const int NUM_NODES = 35; ///< @brief Maximum number of nodes that this g
 // Node configuration
 static const int16_t RECONNECTION_PERIOD = 1500; ///< @brief Time to retry Gateway connection
 static const uint16_t DOWNLINK_WAIT_TIME = 350; ///< @brief Time to wait for downlink message before sleep. Setting less than 180 ms causes ESP-NOW errors due to lack of ACK processing
+#ifndef AGGREGATION_DEADLINE
+static const uint16_t AGGREGATION_DEADLINE = 5000; ///< @brief Default maximum time in ms that a reading may wait in aggregation buffer before it is sent
+#endif // AGGREGATION_DEADLINE
+#ifndef SAMPLE_BATCH_WAKES
+static const uint8_t SAMPLE_BATCH_WAKES = 10; ///< @brief Default number of readings stored with `bufferData` across deep sleep cycles before they are sent together
+#endif // SAMPLE_BATCH_WAKES
 static const uint32_t DEFAULT_SLEEP_TIME = 10; ///< @brief Default sleep time if it was not set
 static const time_t IDENTIFY_TIMEOUT = 10000; ///< @brief How long LED will be flashing during identification
 #ifndef TIME_SYNC_PERIOD
@@ -47,7 +54,7 @@ static const unsigned int QUICK_SYNC_TIME = 5000; ///< @brief Period of clock sy
 #ifndef PRE_REG_DELAY
 static const uint32_t PRE_REG_DELAY = 5000; ///< @brief Time to wait before registration so that other nodes have time to communicate. Real delay is a random lower than this value.
 #endif // PRE_REG_DELAY
-static const uint32_t POST_REG_DELAY = 1500; ///< @brief Time to wait before sending data after registration so that other nodes have time to finish their registration. Real delay is a random lower than this value.
+static const uint32_t POST_REG_DELAY = 1500; ///< @brief Extra time that a sleepy node waits for ServerHello, on top of `RECONNECTION_PERIOD`, before giving up and going to sleep. Real time is a random lower than this value so that retries of different nodes spread out.
 static const uint8_t COMM_ERRORS_BEFORE_SCAN = 2; ///< @brief Node will search for a gateway if this number of communication errors have happened.
 
 //Web API
@@ -25,13 +25,57 @@ static const uint8_t NETWORK_NAME_LENGTH = 21; ///< @brief Maximum number of cha
 static const uint8_t NODE_NAME_LENGTH = 33; ///< @brief Maximum number of characters of node name
 static const uint8_t BROADCAST_ADDRESS[] = { 0xff,0xff,0xff,0xff,0xff,0xff }; ///< @brief Broadcast address
 static const char BROADCAST_NONE_NAME[] = "broadcast"; ///< @brief Name to reference broadcast node
-static const uint8_t COMMS_QUEUE_SIZE = 5;
+static const uint8_t COMMS_QUEUE_SIZE = 5; ///< @brief Total number of outgoing messages that may be queued
+static const uint8_t COMMS_QUEUE_PER_DESTINATION = 3; ///< @brief Maximum number of messages queued for the same destination. Oldest one is dropped when it is exceeded
+static const uint8_t NODE_RX_BATCH = 3; ///< @brief Maximum number of received messages that node processes on every `handle ()` call, so that application loop is not delayed too much
+static const uint8_t COMMS_MAX_RETRIES = 3; ///< @brief Retransmissions of a not acknowledged message before it is given up
+static const uint16_t COMMS_RETRY_BACKOFF = 10; ///< @brief First retry delay in milliseconds. It is doubled on every retry
+static const uint16_t COMMS_RETRY_BACKOFF_MAX = 160; ///< @brief Maximum retry delay in milliseconds
+static const uint16_t COMMS_TX_TIMEOUT = 100; ///< @brief Time in milliseconds to wait for send status before transmission is considered failed
+static const uint8_t ESPNOW_PEER_CACHE_SIZE = 8; ///< @brief Number of ESP-NOW peers kept registered on ESP32, including broadcast address that is never removed. Least recently used one is removed when a new one is needed. It is limited to ESP-NOW peer table size
+#ifndef USE_LINK_ADAPTATION
+#define USE_LINK_ADAPTATION 1 ///< @brief PHY rate and transmission power are adapted to every peer link quality. If set to 0 default rate and power are used
+#endif // USE_LINK_ADAPTATION
+static const uint8_t LINK_ADAPT_PEERS = 16; ///< @brief Number of peers whose link state is tracked. Least recently used one is replaced when a new one is needed
+static const uint8_t LINK_RSSI_MARGIN = 8; ///< @brief Margin in dB over rate sensitivity that RSSI must have for that rate to be selected
+static const uint8_t LINK_PROBE_SUCCESSES = 10; ///< @brief Delivered messages in a row needed to try a higher rate after it was lowered by failures
+static const int8_t LINK_MAX_TX_POWER = 80; ///< @brief Maximum transmission power in 0.25 dBm units (20 dBm)
+static const int8_t LINK_MIN_TX_POWER = 32; ///< @brief Minimum transmission power in 0.25 dBm units (8 dBm)
+#ifndef MAX_FRAGMENTED_LENGTH
+#define MAX_FRAGMENTED_LENGTH 1024 ///< @brief Maximum length of a data payload that is split in several fragments. Up to 8 fragments, that is 1664 bytes. Buffers of this size are only allocated while a fragmented message is in progress
+#endif
+static const uint8_t FRAGMENT_HEADER_LENGTH = 4; ///< @brief Sequence, index, total number of fragments and original message type
+static const uint8_t FRAGMENT_DATA_LENGTH = MAX_DATA_PAYLOAD_LENGTH - sizeof (uint16_t) - FRAGMENT_HEADER_LENGTH; ///< @brief Payload carried by every fragment but last one. It fits with 32 bit counters
+static const uint8_t MAX_FRAGMENTS = (MAX_FRAGMENTED_LENGTH + FRAGMENT_DATA_LENGTH - 1) / FRAGMENT_DATA_LENGTH; ///< @brief Maximum number of fragments of a message. It must not be higher than 8
+#ifndef FRAGMENT_POOL_SIZE
+#define FRAGMENT_POOL_SIZE 2 ///< @brief Number of fragmented messages that gateway may reassemble at the same time
+#endif
+static const uint16_t FRAGMENT_REASSEMBLY_TIMEOUT = 2000; ///< @brief Time in milliseconds that gateway keeps an incomplete or just completed message since its last fragment
+static const uint16_t FRAGMENT_STATUS_TIMEOUT = 500; ///< @brief Time in milliseconds that node waits for fragment status before sending last fragment again
+static const uint8_t FRAGMENT_MAX_RETRIES = 3; ///< @brief Retransmission rounds before a fragmented message is given up
 
 // Gateway configuration
 static const int OTA_GW_TIMEOUT = 11000; ///< @brief OTA mode timeout. In OTA mode all data messages are ignored
 #ifndef DISCONNECT_ON_DATA_ERROR
 static const bool DISCONNECT_ON_DATA_ERROR = true; ///< @brief Activates node invalidation in case of data error
 #endif //DISCONNECT_ON_DATA_ERROR
+#ifndef USE_HELLO_COOKIE
+#define USE_HELLO_COOKIE 0 ///< @brief Set to 1 to make gateway answer ClientHello with a stateless cookie. Only hellos echoing a valid cookie use a node slot and a key agreement
+#endif // USE_HELLO_COOKIE
+static const uint32_t HELLO_COOKIE_PERIOD = 10000; ///< @brief Cookie secret window in milliseconds. A cookie is accepted during current and previous window
+static const uint8_t HELLO_COOKIE_LENGTH = 16; ///< @brief Handshake cookie length. Truncated HMAC-SHA256
+#ifndef USE_OTA_CACHE
+#define USE_OTA_CACHE 1 ///< @brief Set to 1 to let gateway store a whole OTA image on its file system and send it to node by itself
+#endif // USE_OTA_CACHE
+#if USE_OTA_CACHE
+#define OTA_CACHE_FILE "/otacache.bin" ///< @brief File that stores OTA image on gateway
+static const uint16_t OTA_STREAM_ACK_TIMEOUT = 1000; ///< @brief Time in milliseconds without answer from node before gateway sends first missing OTA chunk again
+static const uint8_t OTA_STREAM_MAX_TIMEOUTS = 10; ///< @brief OTA from gateway cache is given up after this number of consecutive timeouts
+static const uint8_t OTA_STREAM_CHUNK_INTERVAL = 10; ///< @brief Minimum time in milliseconds between two OTA chunks sent from gateway cache
+static const uint16_t OTA_MULTICAST_START_TIMEOUT = 5000; ///< @brief Nodes that have not started a multicast OTA update after this time in milliseconds are left out of it
+static const uint16_t OTA_MULTICAST_REPORT_TIMEOUT = 300; ///< @brief Time in milliseconds that gateway waits for node reports after every multicast OTA round. It has to be longer than `OTA_MULTICAST_REPORT_DELAY` plus `OTA_MULTICAST_REPORT_JITTER`
+static const uint16_t OTA_MULTICAST_CHECK_TIMEOUT = 10000; ///< @brief Time in milliseconds that a node has to confirm multicast OTA result after it got last chunk
+#endif // USE_OTA_CACHE
 #ifndef ENABLE_REST_API
 #define ENABLE_REST_API 1 ///< @brief Set to 1 to enable REST API
 #endif // ENABLE_REST_API
@@ -44,15 +88,51 @@ static const char HA_DISCOVERY_PREFIX[] = "homeassistant"; ///< @brief Used to b
 
 // Node configuration
 static const uint32_t OTA_TIMEOUT_TIME = 10000; ///< @brief Timeout between OTA messages. In milliseconds
+static const uint8_t OTA_WINDOW = 8; ///< @brief Number of OTA chunks, from first missing one, that node accepts in any order and keeps in reorder buffer. It may be up to 32
+static const uint8_t OTA_CHUNK_MAX_LENGTH = 212; ///< @brief Maximum OTA chunk length. It has to match update tool chunk size
+static const uint8_t OTA_SACK_INTERVAL = OTA_WINDOW / 2; ///< @brief Node reports received OTA chunks every this number of chunks
+static const uint16_t OTA_SACK_IDLE_TIME = 300; ///< @brief Node reports received OTA chunks if no new one arrives in this time (ms)
+static const uint16_t OTA_MULTICAST_REPORT_DELAY = 50; ///< @brief During a multicast OTA update node reports received chunks if no new one arrives in this time (ms)
+static const uint16_t OTA_MULTICAST_REPORT_JITTER = 150; ///< @brief Random time up to this value (ms) is added to multicast OTA report delay, so that nodes do not answer at the same time
+static const uint8_t OTA_LZSS_WINDOW_BITS = 11; ///< @brief Compressed OTA images may refer back up to 2^n bytes. Node keeps this history in RAM during OTA. It has to match update tool
+static const uint8_t OTA_LZSS_LOOKAHEAD_BITS = 4; ///< @brief Compressed OTA images repeat up to 2^n bytes on every back reference. It has to match update tool
 static const int MIN_SYNC_ACCURACY = 5000; ///< @brief If calculated offset absolute value is higher than this value resync is done more often. us units
-static const int MAX_DATA_PAYLOAD_SIZE = 214; ///< @brief Maximun payload size for data packets
+static const int MAX_DATA_PAYLOAD_SIZE = 214; ///< @brief Maximun payload size for data packets. It is 2 bytes lower if 32 bit counters are used
 #ifndef CHECK_COMM_ERRORS
 static const bool CHECK_COMM_ERRORS = true; ///< @brief Try to reconnect in case of communication errors
 #endif // CHECK_COMM_ERRORS
+static const uint8_t GATEWAY_CHANNEL_HISTORY = 3; ///< @brief Number of channels where gateway was found that are probed before doing a full scan
+static const uint8_t GATEWAY_PROBE_TIME = 30; ///< @brief Time to wait for gateway answer on every probed channel (ms). Only used on ESP32
+static const uint8_t MAX_SCAN_BACKOFF = 32; ///< @brief Maximum number of gateway searches that skip full scan after failed ones
+#ifndef USE_TX_SLOTS
+#define USE_TX_SLOTS 1 ///< @brief Sleepy nodes report their sleep period and gateway assigns them a transmission slot inside it, so that nodes with similar periods do not collide
+#endif // USE_TX_SLOTS
+static const uint16_t TX_SLOT_LENGTH = 500; ///< @brief Transmission slot width in milliseconds. It should cover node awake time
+static const uint16_t TX_SLOT_TOLERANCE = 100; ///< @brief Gateway sends a slot correction if a sleepy node transmits farther than this from its slot (ms)
+#ifndef USE_DOWNLINK_END
+#define USE_DOWNLINK_END 1 ///< @brief Gateway tells a sleepy node that it has nothing else queued for it just after processing its message, so node may sleep without waiting for `DOWNLINK_WAIT_TIME`
+#endif // USE_DOWNLINK_END
+static const uint8_t DOWNLINK_END_GUARD = 10; ///< @brief Time that node keeps radio on after gateway signals end of downlink, to let ESP-NOW finish acknowledgement (ms)
 static const uint32_t RTC_ADDRESS = 8; ///< @brief RTC memory address where to store context. Modify it if you need place to store your own data during deep sleep. Take care not to overwrite above that address. It is 8 to give space for FailSafeMode library
+#ifndef USE_SAMPLE_BUFFER
+#define USE_SAMPLE_BUFFER 1 ///< @brief Sleepy nodes may store readings in RTC memory on wake ups that do not use radio and send them together every some cycles
+#endif // USE_SAMPLE_BUFFER
+static const uint8_t SAMPLE_BUFFER_SIZE = 200; ///< @brief RTC memory used to store readings between deep sleep cycles. It is placed after context data. ESP8266 has 512 bytes of RTC user memory
 #ifndef USE_FLASH_INSTEAD_RTC
 #define USE_FLASH_INSTEAD_RTC 0 ///< @brief Use flash instead RTC for temporary context data. ATTENTION: This allows connection to survive power off cycles but may damage flash memory persistently.
 #endif // USE_FLASH_INSTEAD_RTC
+#ifndef USE_CONTEXT_LOG
+#define USE_CONTEXT_LOG 1 ///< @brief If USE_FLASH_INSTEAD_RTC is set, context is appended as records to raw flash sectors instead of rewriting a file. ESP8266 uses EEPROM sector, ESP32 needs a data partition named CONTEXT_LOG_PARTITION. File is used if they are not available
+#endif // USE_CONTEXT_LOG
+#define CONTEXT_LOG_PARTITION "eiotctx" ///< @brief Label of ESP32 data partition used for context log
+static const uint8_t CONTEXT_LOG_SECTORS = 4; ///< @brief Maximum number of ESP32 partition sectors used for context log. They are written in turn
+#define CRC32_BITWISE 0 ///< @brief CRC32 calculated bit by bit. No table
+#define CRC32_NIBBLE 1 ///< @brief CRC32 calculated 4 bits at a time. 64 byte table in flash
+#define CRC32_TABLE 2 ///< @brief CRC32 calculated a byte at a time. 1 kB table in flash
+#define CRC32_SLICE_BY_8 3 ///< @brief CRC32 calculated 8 bytes at a time. 8 kB table built in RAM on first use
+#ifndef CRC32_IMPLEMENTATION
+#define CRC32_IMPLEMENTATION CRC32_TABLE ///< @brief CRC32 engine used to check context data. Choose it depending on available flash and RAM
+#endif // CRC32_IMPLEMENTATION
 #ifndef HA_FIRST_DISCOVERY_DELAY
 #define HA_FIRST_DISCOVERY_DELAY 5000
 #endif // HA_FIRST_DISCOVERY_DELAY
@@ -73,6 +153,49 @@ const uint8_t TAG_LENGTH = 16; ///< @brief Authentication tag length. For Poly13
 const uint8_t AAD_LENGTH = 8; ///< @brief Number of bytes from last part of key that will be used for additional authenticated data
 #define CYPHER_TYPE ChaChaPoly
 
+/**
+  * @brief Cipher suites that node and gateway may agree during registration. Value is used as bit position on ClientHello suite mask
+  */
+typedef enum {
+	CIPHER_CHACHAPOLY = 0, ///< @brief ChaCha20-Poly1305. Always available. Used for handshake and broadcast messages
+	CIPHER_AES128_GCM = 1, ///< @brief AES-128-GCM. Uses hardware AES on ESP32
+	CIPHER_AES256_GCM = 2  ///< @brief AES-256-GCM. Uses hardware AES on ESP32
+} cipherSuite_t;
+#ifndef SUPPORTED_CIPHER_SUITES
+#if defined ESP32
+#define SUPPORTED_CIPHER_SUITES 0x07 ///< @brief Bit mask of locally supported suites. Bit 0: ChaChaPoly, bit 1: AES-128-GCM, bit 2: AES-256-GCM
+#else
+#define SUPPORTED_CIPHER_SUITES 0x01 ///< @brief Bit mask of locally supported suites. Bit 0: ChaChaPoly, bit 1: AES-128-GCM, bit 2: AES-256-GCM
+#endif // ESP32
+#endif // SUPPORTED_CIPHER_SUITES
+#ifndef PREFERRED_CIPHER_SUITE
+#if defined ESP32
+#define PREFERRED_CIPHER_SUITE CIPHER_AES128_GCM ///< @brief Suite that gateway selects if node offers it. Otherwise ChaChaPoly is used
+#else
+#define PREFERRED_CIPHER_SUITE CIPHER_CHACHAPOLY ///< @brief Suite that gateway selects if node offers it. Otherwise ChaChaPoly is used
+#endif // ESP32
+#endif // PREFERRED_CIPHER_SUITE
+static const uint16_t HELLO_CAPABILITY_MARKER = 0xE10A; ///< @brief Value of Random bits 16-31 on ClientHello and ServerHello that signals that lower bits carry capabilities. Peers without it are handled as 0.9.8 ones
+#ifndef USE_32BIT_COUNTERS
+#define USE_32BIT_COUNTERS 1 ///< @brief Offer or accept 32 bit message counters during registration. 16 bit counters are used if any peer does not support them
+#endif // USE_32BIT_COUNTERS
+static const uint8_t REPLAY_WINDOW_SIZE = 32; ///< @brief Number of counters tracked by replay window. Must not be higher than 32
+#ifndef USE_KEY_UPDATE
+#define USE_KEY_UPDATE 1 ///< @brief Rotate node key through a HKDF ratchet when MAX_KEY_VALIDITY expires instead of forcing a new registration
+#endif // USE_KEY_UPDATE
+static const uint8_t KEY_UPDATE_SALT_LENGTH = 16; ///< @brief Random salt sent by gateway on every key update
+static const uint32_t KEY_UPDATE_RETRY_PERIOD = 10000; ///< @brief Minimum time in milliseconds between key update retries
+static const uint32_t KEY_UPDATE_TIMEOUT = 3600000; ///< @brief Node is invalidated if key update is not confirmed this time (ms) after key has expired
+#ifndef USE_FAST_DRBG
+#define USE_FAST_DRBG 1 ///< @brief Serve random numbers from a ChaCha20 DRBG seeded from hardware RNG instead of reading hardware RNG for every word
+#endif // USE_FAST_DRBG
+#ifndef DRBG_RESEED_INTERVAL
+#define DRBG_RESEED_INTERVAL 16384 ///< @brief Number of random bytes served by DRBG before it is reseeded from hardware RNG
+#endif // DRBG_RESEED_INTERVAL
+#ifndef USE_HW_AES_GCM
+#define USE_HW_AES_GCM 1 ///< @brief On ESP32 use mbedTLS GCM, backed by AES peripheral, instead of software AES-GCM
+#endif // USE_HW_AES_GCM
+
 //Web API
 const int WEB_API_PORT = 80; ///< @brief TCP port where Web API will listen through
 
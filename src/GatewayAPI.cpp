@@ -7,6 +7,7 @@
   */
 
 #include "GatewayAPI.h"
+#include "cryptModule.h"
 #include <functional>
 
 using namespace std;
@@ -20,10 +21,15 @@ const char* getGwInfoUri = "/api/gw/info";
 const char* getGwRestartUri = "/api/gw/restart";
 const char* getGwResettUri = "/api/gw/reset";
 const char* getNodeRestartUri = "/api/node/restart";
+const char* nodeOtaUri = "/api/node/ota";
+const char* otaStatusUri = "/api/gw/ota";
 const char* nodeIdParam = "nodeid";
 const char* nodeNameParam = "nodename";
 const char* nodeAddrParam = "nodeaddr";
 const char* confirmParam = "confirm";
+const char* md5Param = "md5";
+const char* sizeParam = "size";
+const char* formatParam = "format";
 
 void GatewayAPI::begin () {
 	//if (!gw) {
@@ -39,6 +45,11 @@ void GatewayAPI::begin () {
 	server->on (getGwRestartUri, HTTP_PUT, std::bind (&GatewayAPI::restartGw, this, _1));
     server->on (getGwResettUri, HTTP_PUT, std::bind (&GatewayAPI::resetGw, this, _1));
 	server->on (getNodeRestartUri, HTTP_PUT, std::bind (&GatewayAPI::restartNode, this, _1));
+#if USE_OTA_CACHE
+	server->on (nodeOtaUri, HTTP_PUT, std::bind (&GatewayAPI::nodeOta, this, _1), NULL,
+				std::bind (&GatewayAPI::nodeOtaBody, this, _1, _2, _3, _4, _5));
+	server->on (otaStatusUri, HTTP_GET, std::bind (&GatewayAPI::getOtaStatus, this, _1));
+#endif // USE_OTA_CACHE
 	server->onNotFound (std::bind (&GatewayAPI::onNotFound, this, _1));
 	server->begin ();
 }
@@ -192,6 +203,12 @@ char* GatewayAPI::getNodeInfo (Node* node, int& resultCode, char* nodeInfo, size
             index = index + snprintf (nodeInfo + index, len - index,
                                       "\"TimeSync\":%s,",
                                       node->useTimeSync () ? "True" : "False");
+            index = index + snprintf (nodeInfo + index, len - index,
+                                      "\"cipher\":\"%s\",",
+                                      CryptModule::getSuiteName (node->getCipherSuite ()));
+            index = index + snprintf (nodeInfo + index, len - index,
+                                      "\"keyEpoch\":%u,",
+                                      node->getKeyEpoch ());
             index = index + snprintf (nodeInfo + index, len - index,
                                       "\"rssi\":%d,",
                                       rssi);
@@ -240,6 +257,96 @@ void GatewayAPI::restartNode (AsyncWebServerRequest* request) {
 	request->send (resultCode, "application/json", response);
 }
 
+#if USE_OTA_CACHE
+void GatewayAPI::nodeOtaBody (AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+	if (!index) {
+		Node* node = getOtaNodeFromParam (request);
+		AsyncWebParameter* md5 = request->getParam (md5Param);
+		AsyncWebParameter* size = request->getParam (sizeParam);
+		AsyncWebParameter* format = request->getParam (formatParam);
+
+		// Size and format are only needed for compressed images. Raw image size is body length
+		otaUploadOk = node && md5 && md5->value ().length () == 32
+			&& (!size || isNumber (size->value ()))
+			&& (!format || isNumber (format->value ()));
+		if (otaUploadOk) {
+			DEBUG_INFO ("OTA image upload for node %d. %u bytes", node->getNodeId (), total);
+			otaUploadOk = EnigmaIOTGateway.beginOtaImage (node, size ? atoi (size->value ().c_str ()) : total,
+														  (total + OTA_CHUNK_MAX_LENGTH - 1) / OTA_CHUNK_MAX_LENGTH,
+														  md5->value ().c_str (),
+														  format ? atoi (format->value ().c_str ()) : OTA_FORMAT_RAW);
+		}
+	}
+	if (otaUploadOk) {
+		otaUploadOk = EnigmaIOTGateway.addOtaImageData (data, len);
+	}
+	if (otaUploadOk && index + len == total) {
+		otaUploadOk = EnigmaIOTGateway.requestOtaImageEnd ();
+	}
+}
+
+void GatewayAPI::nodeOta (AsyncWebServerRequest* request) {
+	int resultCode = 404;
+	char response[30];
+
+	if (!getOtaNodeFromParam (request)) {
+		snprintf (response, 25, "{\"result\":\"not found\"}");
+	} else if (otaUploadOk) {
+		resultCode = 200;
+		snprintf (response, 30, "{\"node_ota\":\"processed\"}");
+	} else {
+		resultCode = 400;
+		snprintf (response, 30, "{\"node_ota\":\"fail\"}");
+	}
+	otaUploadOk = false;
+	DEBUG_WARN ("Response: %d --> %s", resultCode, response);
+	request->send (resultCode, "application/json", response);
+}
+
+Node* GatewayAPI::getOtaNodeFromParam (AsyncWebServerRequest* request) {
+	AsyncWebParameter* nodeName = request->getParam (nodeNameParam);
+
+	// Image for broadcast node is sent to every node that may receive it
+	if (nodeName && !strcmp (nodeName->value ().c_str (), BROADCAST_NONE_NAME)) {
+		return EnigmaIOTGateway.nodelist.getBroadcastNode ();
+	}
+	return getNodeFromParam (request);
+}
+
+void GatewayAPI::getOtaStatus (AsyncWebServerRequest* request) {
+	const char* phases[] = { "idle", "storing", "starting", "sending" };
+	const char* statuses[] = { "none", "starting", "receiving", "checking", "done", "failed" };
+	OtaMulticastClass* session = &EnigmaIOTGateway.otaMulticast;
+	Node* streamNode = EnigmaIOTGateway.otaStreamNode;
+	bool first = true;
+
+	AsyncResponseStream* response = request->beginResponseStream ("application/json");
+	response->setCode (200);
+
+	response->printf ("{\"phase\":\"%s\"", phases[EnigmaIOTGateway.otaStreamPhase]);
+	if (streamNode) {
+		response->printf (",\"nodeId\":%u", streamNode->getNodeId ());
+	}
+	// Result of every node in last multicast update is kept until next one starts
+	response->printf (",\"multicast\":{\"chunks\":%u,\"acknowledged\":%u,\"sent\":%u,\"rounds\":%u,\"nodes\":[",
+					  session->getNumChunks (), session->getAcknowledged (), session->getSentCount (), session->getRounds ());
+	for (uint16_t nodeId = 0; nodeId < NUM_NODES; nodeId++) {
+		ota_member_status_t status = session->getStatus (nodeId);
+		if (status == OTA_MEMBER_NONE) {
+			continue;
+		}
+		if (!first) {
+			response->print (',');
+		}
+		first = false;
+		response->printf ("{\"nodeId\":%u,\"status\":\"%s\",\"chunks\":%u}", nodeId, statuses[status], session->getChunksDone (nodeId));
+	}
+	response->print ("]}}");
+	request->send (response);
+}
+
+#endif // USE_OTA_CACHE
+
 void GatewayAPI::nodeOp (AsyncWebServerRequest* request) {
 	Node* node;
 	int resultCode = 404;
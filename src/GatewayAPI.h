@@ -25,6 +25,9 @@ String methodToString (WebRequestMethodComposite method);
 class GatewayAPI {
 protected:
 	AsyncWebServer* server; ///< @brief Web server instance
+#if USE_OTA_CACHE
+	bool otaUploadOk = false; ///< @brief `true` while OTA image being uploaded is stored correctly
+#endif // USE_OTA_CACHE
 	//EnigmaIOTGatewayClass* gateway;
 
     /**
@@ -75,6 +78,36 @@ protected:
      * @param request Node information request
      */
 	void restartNode (AsyncWebServerRequest* request);
+
+#if USE_OTA_CACHE
+    /**
+     * @brief Answers node OTA request after image has been uploaded
+     * @param request Node OTA request
+     */
+	void nodeOta (AsyncWebServerRequest* request);
+
+    /**
+     * @brief Stores OTA image uploaded as request body in gateway cache. Gateway checks it and starts update from its loop when it is complete
+     * @param request Node OTA request
+     * @param data Image data
+     * @param len Data length
+     * @param index Position of data in image
+     * @param total Image length
+     */
+	void nodeOtaBody (AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total);
+
+    /**
+     * @brief Gets node that OTA image is uploaded for. Broadcast node may be used to update every node at once
+     * @param request Request with node parameter (NodeID, Name or MAC address)
+     */
+	Node* getOtaNodeFromParam (AsyncWebServerRequest* request);
+
+    /**
+     * @brief Processes OTA status request. It includes result of every node in last multicast update
+     * @param request OTA status request
+     */
+	void getOtaStatus (AsyncWebServerRequest* request);
+#endif // USE_OTA_CACHE
 	// TODO: Reset node
 	// TODO: Reset Gw
 
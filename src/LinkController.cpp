@@ -0,0 +1,179 @@
+/**
+  * @file LinkController.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief PHY rate and transmission power control driven by link quality
+  */
+
+#include "LinkController.h"
+#include "EnigmaIOTdebug.h"
+
+/**
+  * @brief Rate speed and typical receiver sensitivity, from most robust to fastest
+  */
+static const struct {
+	uint16_t speed; ///< @brief Rate in 100 kbps units
+	int8_t sensitivity; ///< @brief Weakest signal rate is expected to work with (dBm)
+} LINK_RATES[LINK_NUM_RATES] = {
+	{ 10, -97 },
+	{ 20, -94 },
+	{ 55, -91 },
+	{ 110, -88 },
+	{ 120, -87 },
+	{ 240, -83 },
+	{ 540, -75 }
+};
+
+uint16_t LinkControllerClass::getRateSpeed (uint8_t rate) {
+	return rate < LINK_NUM_RATES ? LINK_RATES[rate].speed : 0;
+}
+
+int8_t LinkControllerClass::getRateSensitivity (uint8_t rate) {
+	return rate < LINK_NUM_RATES ? LINK_RATES[rate].sensitivity : 0;
+}
+
+void LinkControllerClass::reset () {
+	rssiAvg = 0;
+	rate = LINK_RATE_1M;
+	rateCeiling = LINK_NUM_RATES - 1;
+	txPower = LINK_MAX_TX_POWER;
+	history = 0;
+	successStreak = 0;
+}
+
+uint8_t LinkControllerClass::lowerRate (uint8_t rate) {
+	while (rate > LINK_RATE_1M) {
+		rate--;
+		if (rateMask & (1 << rate)) {
+			return rate;
+		}
+	}
+	return LINK_RATE_1M;
+}
+
+uint8_t LinkControllerClass::higherRate (uint8_t rate) {
+	for (uint8_t i = rate + 1; i < LINK_NUM_RATES; i++) {
+		if (rateMask & (1 << i)) {
+			return i;
+		}
+	}
+	return rate;
+}
+
+void LinkControllerClass::rssiUpdate (int rssi) {
+	if (rssi >= 0) {
+		return; // Not a valid measurement
+	}
+	if (!rssiAvg) {
+		rssiAvg = rssi * 16;
+	} else {
+		// Exponential average with 1/8 weight for new samples
+		rssiAvg += (rssi * 16 - rssiAvg) / 8;
+	}
+	decide ();
+}
+
+void LinkControllerClass::txResult (bool delivered) {
+	history = (history << 1) | (delivered ? 0 : 1);
+	if (delivered) {
+		if (++successStreak >= LINK_PROBE_SUCCESSES) {
+			// Let rate go up again if RSSI allows it
+			rateCeiling = higherRate (rateCeiling);
+			successStreak = 0;
+		}
+	} else {
+		successStreak = 0;
+		if ((history & 0x03) == 0x03) { // Two consecutive failures
+			if (txPower < LINK_MAX_TX_POWER) {
+				txPower = LINK_MAX_TX_POWER; // Try first at full power on current rate
+			} else {
+				rateCeiling = lowerRate (rate);
+			}
+		}
+	}
+	decide ();
+}
+
+void LinkControllerClass::decide () {
+	uint8_t target = LINK_RATE_1M;
+	int8_t rssi = getRssi ();
+	bool recentFailure = history & 0x0F;
+
+	// Fastest rate that keeps the margin over its sensitivity
+	if (rssi) {
+		for (uint8_t i = LINK_RATE_1M; i < LINK_NUM_RATES; i++) {
+			if ((rateMask & (1 << i)) && rssi >= LINK_RATES[i].sensitivity + LINK_RSSI_MARGIN) {
+				target = i;
+			}
+		}
+	}
+	if (target > rateCeiling) {
+		target = rateCeiling;
+	}
+	if (target != rate) {
+		DEBUG_DBG ("Link rate changed from %u to %u x 100 kbps. RSSI %d dBm", LINK_RATES[rate].speed, LINK_RATES[target].speed, rssi);
+		rate = target;
+	}
+
+	if (!rssi || recentFailure) {
+		txPower = LINK_MAX_TX_POWER;
+		return;
+	}
+
+	// Extra margin over selected rate is used to lower power. It goes down 1 dB per decision to keep it stable
+	int headroom = rssi - (LINK_RATES[rate].sensitivity + LINK_RSSI_MARGIN);
+	int power = LINK_MAX_TX_POWER - headroom * 4;
+	if (power < LINK_MIN_TX_POWER) {
+		power = LINK_MIN_TX_POWER;
+	} else if (power > LINK_MAX_TX_POWER) {
+		power = LINK_MAX_TX_POWER;
+	}
+	if (power < txPower - 4) {
+		power = txPower - 4;
+	}
+	txPower = power;
+}
+
+void LinkControllerClass::getState (comms_link_state_t* state) {
+	uint8_t failures = 0;
+
+	for (uint8_t h = history; h; h >>= 1) {
+		failures += h & 1;
+	}
+	state->rate = LINK_RATES[rate].speed;
+	state->txPower = txPower;
+	state->rssi = getRssi ();
+	state->failures = failures;
+}
+
+void LinkTableClass::setRateMask (uint8_t mask) {
+	rateMask = mask;
+	for (int i = 0; i < LINK_ADAPT_PEERS; i++) {
+		peers[i].controller.setRateMask (mask);
+	}
+}
+
+LinkControllerClass* LinkTableClass::get (const uint8_t* address, bool create) {
+	int entry = -1;
+
+	for (int i = 0; i < LINK_ADAPT_PEERS; i++) {
+		if (peers[i].used && !memcmp (peers[i].address, address, ENIGMAIOT_ADDR_LEN)) {
+			peers[i].lastUsed = ++useCounter;
+			return &peers[i].controller;
+		}
+		if (entry < 0 || (peers[entry].used && (!peers[i].used || peers[i].lastUsed < peers[entry].lastUsed))) {
+			entry = i; // Free or least recently used entry
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+
+	memcpy (peers[entry].address, address, ENIGMAIOT_ADDR_LEN);
+	peers[entry].lastUsed = ++useCounter;
+	peers[entry].used = true;
+	peers[entry].controller.reset ();
+	peers[entry].controller.setRateMask (rateMask);
+	return &peers[entry].controller;
+}
@@ -0,0 +1,190 @@
+/**
+  * @file LinkController.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief PHY rate and transmission power control driven by link quality
+  *
+  * Rate is chosen from smoothed RSSI of frames received from peer, limited by a ceiling that goes down on consecutive
+  * failed transmissions and up again after a number of delivered ones. Power is reduced while there is margin over
+  * selected rate sensitivity and restored to maximum on any failure.
+  *
+  * It does not use any platform function so it may be run on a host against a simulated link.
+  */
+
+#ifndef _LINK_CONTROLLER_h
+#define _LINK_CONTROLLER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "Comms_hal.h"
+
+/**
+  * @brief PHY rates that may be selected, from most robust to fastest
+  */
+enum link_rate_t {
+	LINK_RATE_1M = 0, /**< 1 Mbps DSSS. ESP-NOW default */
+	LINK_RATE_2M = 1, /**< 2 Mbps DSSS */
+	LINK_RATE_5M5 = 2, /**< 5.5 Mbps CCK */
+	LINK_RATE_11M = 3, /**< 11 Mbps CCK */
+	LINK_RATE_12M = 4, /**< 12 Mbps OFDM */
+	LINK_RATE_24M = 5, /**< 24 Mbps OFDM */
+	LINK_RATE_54M = 6, /**< 54 Mbps OFDM */
+	LINK_NUM_RATES = 7 /**< Number of rates */
+};
+
+/**
+  * @brief Rate and power controller for a single link
+  */
+class LinkControllerClass {
+protected:
+	int16_t rssiAvg = 0; ///< @brief Smoothed RSSI in 1/16 dB units. 0 if no frame has been received
+	uint8_t rate = LINK_RATE_1M; ///< @brief Selected rate
+	uint8_t rateCeiling = LINK_NUM_RATES - 1; ///< @brief Highest rate allowed by transmission history
+	uint8_t rateMask = 0xFF; ///< @brief Rates supported by physical layer. Bit position is rate index
+	int8_t txPower = LINK_MAX_TX_POWER; ///< @brief Selected transmission power in 0.25 dBm units
+	uint8_t history = 0; ///< @brief Result of last 8 transmissions. Bit set means failure, LSB is the newest
+	uint8_t successStreak = 0; ///< @brief Delivered transmissions since last failure or rate ceiling raise
+
+	/**
+	  * @brief Gets next supported rate below a given one
+	  * @param rate Rate index
+	  * @return Lower rate index. `LINK_RATE_1M` if there is none
+	  */
+	uint8_t lowerRate (uint8_t rate);
+
+	/**
+	  * @brief Gets next supported rate above a given one
+	  * @param rate Rate index
+	  * @return Higher rate index. Same rate if there is none
+	  */
+	uint8_t higherRate (uint8_t rate);
+
+	/**
+	  * @brief Calculates rate and power from current inputs
+	  */
+	void decide ();
+
+public:
+	/**
+	  * @brief Sets rates that physical layer is able to use. Most robust one is always allowed
+	  * @param mask Bitmap of supported rates, using `link_rate_t` as bit position
+	  */
+	void setRateMask (uint8_t mask) {
+		rateMask = mask | (1 << LINK_RATE_1M);
+		decide ();
+	}
+
+	/**
+	  * @brief Sets controller to its initial state. Most robust rate and maximum power
+	  */
+	void reset ();
+
+	/**
+	  * @brief Updates signal strength with a new received frame
+	  * @param rssi Frame RSSI in dBm
+	  */
+	void rssiUpdate (int rssi);
+
+	/**
+	  * @brief Updates transmission history with a new attempt result
+	  * @param delivered `true` if frame was acknowledged
+	  */
+	void txResult (bool delivered);
+
+	/**
+	  * @brief Gets selected rate
+	  * @return Rate index from `link_rate_t`
+	  */
+	uint8_t getRate () {
+		return rate;
+	}
+
+	/**
+	  * @brief Gets selected transmission power
+	  * @return Power in 0.25 dBm units
+	  */
+	int8_t getTxPower () {
+		return txPower;
+	}
+
+	/**
+	  * @brief Gets smoothed signal strength
+	  * @return RSSI in dBm. 0 if no frame has been received
+	  */
+	int8_t getRssi () {
+		return rssiAvg / 16;
+	}
+
+	/**
+	  * @brief Gets controller state to be shown on statistics
+	  * @param state Gets rate, power and link quality
+	  */
+	void getState (comms_link_state_t* state);
+
+	/**
+	  * @brief Gets rate speed
+	  * @param rate Rate index from `link_rate_t`
+	  * @return Rate in 100 kbps units
+	  */
+	static uint16_t getRateSpeed (uint8_t rate);
+
+	/**
+	  * @brief Gets weakest signal strength a rate is expected to work with, without any margin
+	  * @param rate Rate index from `link_rate_t`
+	  * @return Sensitivity in dBm
+	  */
+	static int8_t getRateSensitivity (uint8_t rate);
+};
+
+/**
+  * @brief Set of link controllers, one for every peer. Least recently used one is reused when it gets full
+  */
+class LinkTableClass {
+protected:
+	struct {
+		uint8_t address[ENIGMAIOT_ADDR_LEN]; ///< @brief Peer address
+		uint32_t lastUsed; ///< @brief Use sequence number. Lowest one is reused first
+		bool used; ///< @brief `true` if this entry belongs to a peer
+		LinkControllerClass controller; ///< @brief Peer link controller
+	} peers[LINK_ADAPT_PEERS]; ///< @brief Peer controllers
+	uint32_t useCounter = 0; ///< @brief Use sequence number for LRU order
+	uint8_t rateMask = 0xFF; ///< @brief Rates supported by physical layer
+
+public:
+	/**
+	  * @brief Class constructor
+	  */
+	LinkTableClass () {
+		clear ();
+	}
+
+	/**
+	  * @brief Sets rates that physical layer is able to use on every controller
+	  * @param mask Bitmap of supported rates, using `link_rate_t` as bit position
+	  */
+	void setRateMask (uint8_t mask);
+
+	/**
+	  * @brief Gets controller for a peer
+	  * @param address Peer address
+	  * @param create `true` to assign a new controller if peer has none
+	  * @return Peer controller. `NULL` if peer has none and `create` is `false`
+	  */
+	LinkControllerClass* get (const uint8_t* address, bool create = true);
+
+	/**
+	  * @brief Removes all peers
+	  */
+	void clear () {
+		for (int i = 0; i < LINK_ADAPT_PEERS; i++) {
+			peers[i].used = false;
+		}
+	}
+};
+
+#endif // _LINK_CONTROLLER_h
@@ -7,6 +7,7 @@
   */
 #include "NodeList.h"
 #include "helperFunctions.h"
+#include "cryptModule.h"
 
 void Node::setEncryptionKey (const uint8_t* key) {
 	if (key) {
@@ -38,6 +39,8 @@ void Node::printToSerial (Stream* port) {
 	port->printf ("\tLast counter: %u\n", lastMessageCounter);
 	port->printf ("\tKey valid from: %lu ms ago\n", (millis () - keyValidFrom));
 	port->printf ("\tKey: %s\n", keyValid ? "Valid" : "Invalid");
+	port->printf ("\tCipher suite: %s\n", CryptModule::getSuiteName (cipherSuite));
+	port->printf ("\tKey epoch: %u%s\n", keyEpoch, keyUpdatePending ? " (update pending)" : "");
 	port->print ("\tStatus: ");
 	switch (status) {
 	case UNREGISTERED:
@@ -112,6 +115,17 @@ void Node::reset () {
 	lastMessageCounter = 0;
 	lastControlCounter = 0;
 	lastDownlinkMsgCounter = 0;
+	messageReplayWindow = 1;
+	controlReplayWindow = 1;
+	downlinkReplayWindow = 1;
+	counter32 = false;
+	keyEpoch = 0;
+	sleepPeriod = 0;
+	keyUpdateSupport = false;
+	downlinkEndSupport = false;
+	keyUpdatePending = false;
+	memset (pendingKey, 0, KEY_LENGTH);
+	lastKeyUpdateSent = 0;
 	keyValidFrom = 0;
     status = UNREGISTERED;
     rssi = 0;
@@ -120,6 +134,7 @@ void Node::reset () {
 	enigmaIOTVersion[2] = 0;
 	//broadcastEnabled = false;
 	broadcastKeyRequested = false;
+	cipherSuite = CIPHER_CHACHAPOLY;
 	if (rateFilter) {
 		DEBUG_DBG ("Reset packet rate");
 		rateFilter->clear ();
@@ -127,6 +142,60 @@ void Node::reset () {
 	//sleepyNode = true;
 }
 
+bool Node::deriveNextKey (const uint8_t* salt, uint16_t epoch, uint8_t* newKey) {
+	static const char KEY_UPDATE_LABEL[] = "EnigmaIOT key update";
+	uint8_t info[sizeof (KEY_UPDATE_LABEL) - 1 + sizeof (uint16_t)];
+
+	memcpy (info, KEY_UPDATE_LABEL, sizeof (KEY_UPDATE_LABEL) - 1);
+	memcpy (info + sizeof (KEY_UPDATE_LABEL) - 1, &epoch, sizeof (uint16_t));
+
+	return CryptModule::deriveKey (key, KEY_LENGTH, salt, KEY_UPDATE_SALT_LENGTH, info, sizeof (info), newKey, KEY_LENGTH);
+}
+
+bool Node::prepareKeyUpdate () {
+	if (keyUpdatePending) {
+		return true;
+	}
+	CryptModule::random (keyUpdateSalt, KEY_UPDATE_SALT_LENGTH);
+	if (!deriveNextKey (keyUpdateSalt, keyEpoch + 1, pendingKey)) {
+		return false;
+	}
+	keyUpdatePending = true;
+	lastKeyUpdateSent = 0;
+	return true;
+}
+
+void Node::commitKeyUpdate () {
+	if (!keyUpdatePending) {
+		return;
+	}
+	memcpy (key, pendingKey, KEY_LENGTH);
+	memset (pendingKey, 0, KEY_LENGTH);
+	keyEpoch++;
+	keyUpdatePending = false;
+	keyValidFrom = millis ();
+}
+
+bool Node::checkReplayWindow (uint32_t counter, uint32_t& last, uint32_t& window) {
+	if (counter > last) {
+		uint32_t shift = counter - last;
+		window = shift < REPLAY_WINDOW_SIZE ? (window << shift) | 1 : 1;
+		last = counter;
+		return true;
+	}
+	uint32_t offset = last - counter;
+	if (offset >= REPLAY_WINDOW_SIZE) {
+		DEBUG_DBG ("Counter %u too old. Last is %u", counter, last);
+		return false;
+	}
+	if (window & ((uint32_t)1 << offset)) {
+		DEBUG_DBG ("Counter %u duplicated", counter);
+		return false;
+	}
+	window |= (uint32_t)1 << offset;
+	return true;
+}
+
 NodeList::NodeList () {
 	for (int i = 0; i < NUM_NODES; i++) {
 		nodes[i].nodeId = i;
@@ -208,7 +277,7 @@ int8_t NodeList::checkNodeName (const char* name, const uint8_t* address) {
 	}
 
 	if (!strlen (name)) {
-		DEBUG_ERROR ("Empty name", name);
+		DEBUG_ERROR ("Empty name");
 		return EMPTY_NAME; // Too long name
 	}
 
@@ -65,8 +65,15 @@ typedef enum control_message_type {
     RESTART_NODE = 0x09,
     RESTART_CONFIRM = 0x89,
     BRCAST_KEY = 0x10,
+    KEY_UPDATE = 0x11,
+    KEY_UPDATE_ANS = 0x91,
+    FRAGMENT_STATUS = 0x12,
+    TX_SLOT = 0x13,
+    TX_SLOT_REQUEST = 0x93,
+    DOWNLINK_END = 0x14,
 	OTA = 0xEF,
 	OTA_ANS = 0xFF,
+	OTA_IMAGE = 0xEE, // Only used between gateway output and gateway. It never reaches a node
 	USERDATA_GET = 0x00,
 	USERDATA_SET = 0x20,
     INVALID = 0xF0
@@ -80,9 +87,24 @@ typedef enum ota_status {
 	  OTA_CHECK_FAIL = 3,
 	  OTA_OUT_OF_SEQUENCE =4 ,
 	  OTA_TIMEOUT = 5,
-	  OTA_FINISHED = 6
+	  OTA_FINISHED = 6,
+	  OTA_SACK = 7,
+	  OTA_CACHE_STORED = 8,
+	  OTA_CACHE_ERROR = 9,
+	  OTA_PROGRESS = 10,
+	  OTA_MULTICAST_END = 11
 } ota_status_t;
 
+typedef enum ota_format {
+	  OTA_FORMAT_RAW = 0,
+	  OTA_FORMAT_LZSS = 1
+} ota_format_t;
+
+typedef enum ota_mode {
+	  OTA_MODE_UNICAST = 0,
+	  OTA_MODE_MULTICAST = 1
+} ota_mode_t;
+
 /**
   * @brief Struct that define node fields. Used for long term storage needs
   */
@@ -90,9 +112,9 @@ struct node_instance {
     uint8_t mac[ENIGMAIOT_ADDR_LEN]; ///< @brief Node address
     uint16_t nodeId; ///< @brief Node identifier asigned by gateway
     uint8_t key[32]; ///< @brief Shared key
-    uint16_t lastMessageCounter; ///< @brief Last message counter state for specific Node
-    uint16_t lastControlCounter; ///< @brief Last control message counter state for specific Node
-    uint16_t lastDownlinkMsgCounter; ///< @brief Last downlink message counter state for specific Node
+    uint32_t lastMessageCounter; ///< @brief Last message counter state for specific Node
+    uint32_t lastControlCounter; ///< @brief Last control message counter state for specific Node
+    uint32_t lastDownlinkMsgCounter; ///< @brief Last downlink message counter state for specific Node
     time_t keyValidFrom; ///< @brief Last time that Node and Gateway agreed a key
     time_t lastMessageTime; ///< @brief Last time a message was received by Node
     status_t status = UNREGISTERED; ///< @brief Node state
@@ -180,6 +202,114 @@ public:
       */
     void setEncryptionKey (const uint8_t* key);
 
+    /**
+      * @brief Derives next session key from current one. newKey = HKDF-SHA256 (key, salt, "EnigmaIOT key update" | epoch)
+      * @param salt Random salt chosen by gateway. `KEY_UPDATE_SALT_LENGTH` bytes
+      * @param epoch Key epoch that new key will have
+      * @param newKey Buffer to store derived key. `KEY_LENGTH` bytes
+      * @return `true` if key was derived
+      */
+    bool deriveNextKey (const uint8_t* salt, uint16_t epoch, uint8_t* newKey);
+
+    /**
+      * @brief Gets number of key updates done since registration
+      * @return Key epoch
+      */
+    uint16_t getKeyEpoch () {
+        return keyEpoch;
+    }
+
+    /**
+      * @brief Sets number of key updates done since registration
+      * @param epoch Key epoch
+      */
+    void setKeyEpoch (uint16_t epoch) {
+        keyEpoch = epoch;
+    }
+
+    /**
+      * @brief Checks if node signalled key update support during registration
+      * @return `true` if key can be rotated without a new registration
+      */
+    bool supportsKeyUpdate () {
+        return keyUpdateSupport;
+    }
+
+    /**
+      * @brief Sets key update support for this node
+      * @param support `true` if node supports key update messages
+      */
+    void setKeyUpdateSupport (bool support) {
+        keyUpdateSupport = support;
+    }
+
+    /**
+      * @brief Checks if node signalled during registration that it processes end of downlink messages
+      * @return `true` if node may be told that nothing else is queued for it
+      */
+    bool supportsDownlinkEnd () {
+        return downlinkEndSupport;
+    }
+
+    /**
+      * @brief Sets end of downlink support for this node
+      * @param support `true` if node processes end of downlink messages
+      */
+    void setDownlinkEndSupport (bool support) {
+        downlinkEndSupport = support;
+    }
+
+    /**
+      * @brief Checks if a key update has been sent and it is not confirmed yet
+      * @return `true` if there is a pending key
+      */
+    bool isKeyUpdatePending () {
+        return keyUpdatePending;
+    }
+
+    /**
+      * @brief Starts a key update if none is pending. Chooses a random salt and derives next key, that is kept apart
+      * until node confirms it. Current key is still used meanwhile
+      * @return `true` if a key update is pending after this call
+      */
+    bool prepareKeyUpdate ();
+
+    /**
+      * @brief Replaces current key with pending one and increases key epoch
+      */
+    void commitKeyUpdate ();
+
+    /**
+      * @brief Gets key that will be used after current key update is confirmed
+      * @return Pointer to pending key
+      */
+    uint8_t* getPendingKey () {
+        return pendingKey;
+    }
+
+    /**
+      * @brief Gets salt used to derive pending key
+      * @return Pointer to `KEY_UPDATE_SALT_LENGTH` bytes salt
+      */
+    uint8_t* getKeyUpdateSalt () {
+        return keyUpdateSalt;
+    }
+
+    /**
+      * @brief Gets last time that key update message was sent to node
+      * @return Time in milliseconds
+      */
+    time_t getLastKeyUpdateSent () {
+        return lastKeyUpdateSent;
+    }
+
+    /**
+      * @brief Sets current moment as last key update message time
+      */
+    void setLastKeyUpdateSent () {
+        lastKeyUpdateSent = millis ();
+    }
+
     /**
       * @brief Gets last time that key was agreed with gateway
       * @return Time in milliseconds of last key agreement
@@ -215,7 +345,7 @@ public:
       * @brief Gets counter for last received message from node
       * @return Message counter
       */
-    uint16_t getLastMessageCounter () {
+    uint32_t getLastMessageCounter () {
         return lastMessageCounter;
     }
 
@@ -223,7 +353,7 @@ public:
       * @brief Gets counter for last received control message from node
       * @return Message counter
       */
-    uint16_t getLastControlCounter () {
+    uint32_t getLastControlCounter () {
         return lastControlCounter;
     }
 
@@ -231,7 +361,7 @@ public:
       * @brief Gets counter for last downlink message from gateway
       * @return Message counter
       */
-    uint16_t getLastDownlinkMsgCounter () {
+    uint32_t getLastDownlinkMsgCounter () {
         return lastDownlinkMsgCounter;
     }
 
@@ -239,7 +369,7 @@ public:
       * @brief Sets counter for last received message from node
       * @param counter Message counter
       */
-    void setLastMessageCounter (uint16_t counter) {
+    void setLastMessageCounter (uint32_t counter) {
         lastMessageCounter = counter;
     }
 
@@ -247,7 +377,7 @@ public:
       * @brief Sets counter for last received control message from node
       * @param counter Message counter
       */
-    void setLastControlCounter (uint16_t counter) {
+    void setLastControlCounter (uint32_t counter) {
         lastControlCounter = counter;
     }
 
@@ -255,10 +385,77 @@ public:
       * @brief Sets counter for last downlink message from gateway
       * @param counter Message counter
       */
-    void setLastDownlinkMsgCounter (uint16_t counter) {
+    void setLastDownlinkMsgCounter (uint32_t counter) {
         lastDownlinkMsgCounter = counter;
     }
 
+    /**
+      * @brief Checks a received data message counter against replay window and updates window if it is accepted
+      * @param counter Message counter
+      * @return `true` if counter has not been seen before and it is not older than replay window
+      */
+    bool acceptMessageCounter (uint32_t counter) {
+        return checkReplayWindow (counter, lastMessageCounter, messageReplayWindow);
+    }
+
+    /**
+      * @brief Checks a received control message counter against replay window and updates window if it is accepted
+      * @param counter Message counter
+      * @return `true` if counter has not been seen before and it is not older than replay window
+      */
+    bool acceptControlCounter (uint32_t counter) {
+        return checkReplayWindow (counter, lastControlCounter, controlReplayWindow);
+    }
+
+    /**
+      * @brief Checks a received downlink message counter against replay window and updates window if it is accepted
+      * @param counter Message counter
+      * @return `true` if counter has not been seen before and it is not older than replay window
+      */
+    bool acceptDownlinkCounter (uint32_t counter) {
+        return checkReplayWindow (counter, lastDownlinkMsgCounter, downlinkReplayWindow);
+    }
+
+    /**
+      * @brief Gets downlink replay window bitmap. Used to store it during deep sleep
+      * @return Bitmap of received counters below last downlink counter
+      */
+    uint32_t getDownlinkReplayWindow () {
+        return downlinkReplayWindow;
+    }
+
+    /**
+      * @brief Restores downlink replay window bitmap
+      * @param window Bitmap of received counters below last downlink counter
+      */
+    void setDownlinkReplayWindow (uint32_t window) {
+        downlinkReplayWindow = window;
+    }
+
+    /**
+      * @brief Checks if 32 bit counters were agreed with this node
+      * @return `true` if counters use 4 bytes on messages, `false` if they use 2 bytes
+      */
+    bool useCounter32 () {
+        return counter32;
+    }
+
+    /**
+      * @brief Sets counter width agreed with this node
+      * @param enable `true` to use 32 bit counters on messages
+      */
+    void setCounter32 (bool enable) {
+        counter32 = enable;
+    }
+
+    /**
+      * @brief Gets number of bytes that counter field takes on messages from or to this node
+      * @return Counter length
+      */
+    uint8_t getCounterLength () {
+        return counter32 ? sizeof (uint32_t) : sizeof (uint16_t);
+    }
+
     /**
       * @brief Sets node address
       * @param macAddress Node address
@@ -364,6 +561,34 @@ public:
         return sleepyNode;
     }
 
+    /**
+      * @brief Sets sleep period reported by node to get a transmission slot
+      * @param period Sleep period in seconds. 0 if node does not use slots
+      */
+    void setSleepPeriod (uint32_t period) {
+        sleepPeriod = period;
+    }
+
+    /**
+      * @brief Gets sleep period reported by node
+      * @return Sleep period in seconds. 0 if node does not use slots
+      */
+    uint32_t getSleepPeriod () {
+        return sleepPeriod;
+    }
+
+    /**
+      * @brief Gets start of node transmission slot inside its sleep period. Slots are assigned in node id order,
+      * so nodes with the same period do not overlap while they fit in it
+      * @return Slot offset in milliseconds from the start of the period, using gateway clock
+      */
+    uint32_t getTxSlotOffset () {
+        if (!sleepPeriod) {
+            return 0;
+        }
+        return ((uint32_t)nodeId * TX_SLOT_LENGTH) % (sleepPeriod * 1000);
+    }
+
     /**
       * @brief Returns if node broadcast mode is enabled. In that case, node is able to send and receive encrypted broadcast
       * messages. If this is enabled this will be notified to gateway so that it sends broadcast key.
@@ -462,6 +687,22 @@ public:
         enigmaIOTVersion[2] = incremental;
     }
 
+    /**
+      * @brief Gets cipher suite agreed with node during registration
+      * @return Cipher suite used with node key
+      */
+    cipherSuite_t getCipherSuite () {
+        return cipherSuite;
+    }
+
+    /**
+      * @brief Sets cipher suite agreed with node during registration
+      * @param suite Cipher suite to use with node key
+      */
+    void setCipherSuite (cipherSuite_t suite) {
+        cipherSuite = suite;
+    }
+
     uint8_t queuedMessage[MAX_MESSAGE_LENGTH]; ///< @brief Message queued for sending to node in case of sleepy mode
     size_t qMessageLength;  ///< @brief Queued message length
     bool qMessagePending = false; ///< @brief `True` if message should be sent just after next data message
@@ -476,29 +717,52 @@ protected:
 //#define KEYLENGTH 32
     bool keyValid; ///< @brief Node shared key valid
     status_t status; ///< @brief Current node status. See `enum node_status`
-    uint16_t lastMessageCounter; ///< @brief Last message counter state for specific Node
-    uint16_t lastControlCounter; ///< @brief Last message counter state for specific Node
-    uint16_t lastDownlinkMsgCounter; ///< @brief Last downlink message counter state for specific Node
+    uint32_t lastMessageCounter; ///< @brief Last message counter state for specific Node
+    uint32_t lastControlCounter; ///< @brief Last message counter state for specific Node
+    uint32_t lastDownlinkMsgCounter; ///< @brief Last downlink message counter state for specific Node
+    uint32_t messageReplayWindow = 1; ///< @brief Bitmap of accepted data message counters. Bit n means `lastMessageCounter - n` was received
+    uint32_t controlReplayWindow = 1; ///< @brief Bitmap of accepted control message counters
+    uint32_t downlinkReplayWindow = 1; ///< @brief Bitmap of accepted downlink message counters
+    bool counter32 = false; ///< @brief `true` if 32 bit counters were agreed during registration
+    uint16_t keyEpoch = 0; ///< @brief Number of key updates since registration
+    bool keyUpdateSupport = false; ///< @brief `true` if node signalled key update support during registration
+    bool downlinkEndSupport = false; ///< @brief `true` if node signalled end of downlink support during registration
+    bool keyUpdatePending = false; ///< @brief `true` if a key update was started and it has not been confirmed yet
+    uint8_t pendingKey[KEY_LENGTH]; ///< @brief Key that will be used after key update confirmation
+    uint8_t keyUpdateSalt[KEY_UPDATE_SALT_LENGTH]; ///< @brief Salt used to derive pending key
+    time_t lastKeyUpdateSent = 0; ///< @brief Last time key update message was sent
     uint16_t nodeId; ///< @brief Node identifier asigned by gateway
-    timer_t keyValidFrom; ///< @brief Last time that Node and Gateway agreed a key
+    time_t keyValidFrom; ///< @brief Last time that Node and Gateway agreed a key
     bool sleepyNode = true; ///< @brief Node sleepy definition
+    uint32_t sleepPeriod = 0; ///< @brief Sleep period reported by node to get a transmission slot, in seconds
     bool broadcastEnabled = false; ///< @brief Node is able to send broadcast messages
     bool broadcastKeyRequested = false; ///< @brief Node is waiting for broadcast key
     bool initAsSleepy; ///< @brief Stores initial sleepy node. If this is false, this node does not accept sleep time changes
     bool askedTimeSync = false; ////< @brief Gateway marks this true to track if a node uses timeSync
     uint8_t mac[ENIGMAIOT_ADDR_LEN]; ///< @brief Node address
     uint8_t key[KEY_LENGTH]; ///< @brief Shared key
-    timer_t lastMessageTime; ///< @brief Node state
+    time_t lastMessageTime; ///< @brief Node state
     FilterClass* rateFilter; ///< @brief Filter for message rate smoothing
     char nodeName[NODE_NAME_LENGTH]; ///< @brief Node name. Use as a human friendly name to avoid use of numeric address
     signed int rssi; ///< @brief Stores last RSSI measurement
     uint8_t enigmaIOTVersion[3]; ///< @brief Protocol version, filled when a version message is received
+    cipherSuite_t cipherSuite = CIPHER_CHACHAPOLY; ///< @brief Cipher suite agreed with node
 
      /**
       * @brief Starts smoothing filter
       */
     void initRateFilter ();
 
+    /**
+      * @brief Sliding window replay check. Accepts counters higher than last one and counters up to `REPLAY_WINDOW_SIZE` - 1
+      * positions older that have not been received yet
+      * @param counter Received counter
+      * @param last Highest accepted counter. Updated if counter is accepted
+      * @param window Bitmap of accepted counters. Updated if counter is accepted
+      * @return `true` if counter is accepted
+      */
+    static bool checkReplayWindow (uint32_t counter, uint32_t& last, uint32_t& window);
+
     friend class NodeList;
 };
 
@@ -0,0 +1,131 @@
+/**
+  * @file OtaCache.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief OTA image store on gateway file system
+  */
+
+#include "OtaCache.h"
+
+#if USE_OTA_CACHE
+#include <MD5Builder.h>
+#include "OtaDecompressor.h"
+#include "EnigmaIOTdebug.h"
+
+bool OtaCacheClass::begin (uint32_t size, uint16_t numChunks, const char* md5, uint8_t format) {
+	end ();
+	if (format != OTA_FORMAT_RAW && format != OTA_FORMAT_LZSS) {
+		DEBUG_ERROR ("OTA format %u not supported", format);
+		return false;
+	}
+	image = FILESYSTEM.open (OTA_CACHE_FILE, "w");
+	if (!image) {
+		DEBUG_ERROR ("Error creating OTA cache file");
+		return false;
+	}
+	imageSize = size;
+	this->numChunks = numChunks;
+	memcpy (this->md5, md5, 32);
+	this->md5[32] = '\0';
+	this->format = format;
+	DEBUG_INFO ("OTA cache started. Size: %u bytes in %u chunks. Format %u", size, numChunks, format);
+	return true;
+}
+
+bool OtaCacheClass::write (const uint8_t* data, size_t len) {
+	if (!image || ready) {
+		return false;
+	}
+	if (image.write (data, len) != len) {
+		DEBUG_ERROR ("Error writing OTA cache file. %u bytes stored", length);
+		return false;
+	}
+	length += len;
+	return true;
+}
+
+bool OtaCacheClass::finish () {
+	if (!image || ready) {
+		return false;
+	}
+	image.close ();
+	if ((length + OTA_CHUNK_MAX_LENGTH - 1) / OTA_CHUNK_MAX_LENGTH != numChunks) {
+		DEBUG_ERROR ("OTA cache has %u bytes. %u chunks expected", length, numChunks);
+		end ();
+		return false;
+	}
+	image = FILESYSTEM.open (OTA_CACHE_FILE, "r");
+	if (!image || !check ()) {
+		end ();
+		return false;
+	}
+	ready = true;
+	DEBUG_WARN ("OTA image cached. %u bytes", length);
+	return true;
+}
+
+bool OtaCacheClass::check () {
+	MD5Builder md5Calc;
+	OtaDecompressorClass decompressor;
+	uint8_t buffer[OTA_CHUNK_MAX_LENGTH];
+	uint8_t plain[OTA_CHUNK_MAX_LENGTH];
+	char md5Str[33];
+	uint32_t plainLength = 0;
+	size_t len;
+
+	if (format == OTA_FORMAT_LZSS && !decompressor.begin ()) {
+		return false;
+	}
+	md5Calc.begin ();
+	image.seek (0);
+	while ((len = image.read (buffer, sizeof (buffer))) > 0) {
+		if (format == OTA_FORMAT_LZSS) {
+			size_t plainLen;
+			decompressor.setInput (buffer, len);
+			while (plainLength <= imageSize && (plainLen = decompressor.read (plain, sizeof (plain))) > 0) {
+				md5Calc.add (plain, plainLen);
+				plainLength += plainLen;
+			}
+		} else {
+			md5Calc.add (buffer, len);
+			plainLength += len;
+		}
+	}
+	md5Calc.calculate ();
+	md5Calc.getChars (md5Str);
+
+	if (plainLength != imageSize) {
+		DEBUG_ERROR ("OTA cache image is %u bytes long. %u expected", plainLength, imageSize);
+		return false;
+	}
+	if (memcmp (md5Str, md5, 32)) {
+		DEBUG_ERROR ("OTA cache MD5 check failed");
+		return false;
+	}
+	DEBUG_INFO ("OTA cache MD5 check OK");
+	return true;
+}
+
+size_t OtaCacheClass::readChunk (uint16_t idx, uint8_t* data) {
+	if (!ready || !idx || idx > numChunks) {
+		return 0;
+	}
+	if (!image.seek ((uint32_t)(idx - 1) * OTA_CHUNK_MAX_LENGTH)) {
+		return 0;
+	}
+	return image.read (data, OTA_CHUNK_MAX_LENGTH);
+}
+
+void OtaCacheClass::end () {
+	if (image) {
+		image.close ();
+	}
+	if (FILESYSTEM.exists (OTA_CACHE_FILE)) {
+		FILESYSTEM.remove (OTA_CACHE_FILE);
+	}
+	length = 0;
+	ready = false;
+}
+
+#endif // USE_OTA_CACHE
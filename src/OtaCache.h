@@ -0,0 +1,136 @@
+/**
+  * @file OtaCache.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief OTA image store on gateway file system
+  *
+  * Gateway may receive a whole OTA image before it is sent to node. It is stored as a file, exactly as it is going to
+  * be sent, and checked against size and MD5 of the image that node will write to flash. Compressed images are
+  * decompressed on the fly to do that check, so a corrupted upload never reaches a node.
+  */
+
+#ifndef _OTA_CACHE_h
+#define _OTA_CACHE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+#if USE_OTA_CACHE
+#include <FS.h>
+#include "NodeList.h"
+
+/**
+  * @brief OTA image stored on gateway file system
+  */
+class OtaCacheClass {
+protected:
+	File image; ///< @brief Image file
+	uint32_t imageSize = 0; ///< @brief Size of image written to node flash, after decompression
+	uint16_t numChunks = 0; ///< @brief Number of chunks image is sent in
+	char md5[33]; ///< @brief MD5 of image written to node flash, as hex string
+	uint8_t format = OTA_FORMAT_RAW; ///< @brief Image format. One of `ota_format_t`
+	uint32_t length = 0; ///< @brief Bytes stored so far
+	bool ready = false; ///< @brief `true` if whole image has been stored and checked
+
+	/**
+	  * @brief Checks stored image against its size and MD5
+	  * @return `true` if image is correct
+	  */
+	bool check ();
+
+public:
+	/**
+	  * @brief Starts storing a new image. Previous one is discarded
+	  * @param size Size of image written to node flash, after decompression
+	  * @param numChunks Number of chunks image is going to be sent in
+	  * @param md5 MD5 of image written to node flash, as a 32 character hex string
+	  * @param format Image format. One of `ota_format_t`
+	  * @return `true` if image file could be created
+	  */
+	bool begin (uint32_t size, uint16_t numChunks, const char* md5, uint8_t format);
+
+	/**
+	  * @brief Appends data to image being stored
+	  * @param data Image data
+	  * @param len Data length
+	  * @return `true` if data could be written
+	  */
+	bool write (const uint8_t* data, size_t len);
+
+	/**
+	  * @brief Finishes storing image and checks it. Image is kept open to read chunks from it
+	  * @return `true` if image is complete and correct
+	  */
+	bool finish ();
+
+	/**
+	  * @brief Reads a chunk from stored image
+	  * @param idx Chunk index. First one is 1
+	  * @param data Buffer to store chunk. It must be `OTA_CHUNK_MAX_LENGTH` bytes long
+	  * @return Chunk length. 0 if it could not be read
+	  */
+	size_t readChunk (uint16_t idx, uint8_t* data);
+
+	/**
+	  * @brief Discards stored image and removes its file
+	  */
+	void end ();
+
+	/**
+	  * @brief Checks if a complete and correct image is stored
+	  * @return `true` if image may be sent to a node
+	  */
+	bool isReady () {
+		return ready;
+	}
+
+	/**
+	  * @brief Gets number of bytes stored so far
+	  * @return Stored length
+	  */
+	uint32_t getLength () {
+		return length;
+	}
+
+	/**
+	  * @brief Gets size of image written to node flash
+	  * @return Size in bytes
+	  */
+	uint32_t getImageSize () {
+		return imageSize;
+	}
+
+	/**
+	  * @brief Gets number of chunks image is sent in
+	  * @return Number of chunks
+	  */
+	uint16_t getNumChunks () {
+		return numChunks;
+	}
+
+	/**
+	  * @brief Gets MD5 of image written to node flash
+	  * @return 32 character hex string
+	  */
+	const char* getMD5 () {
+		return md5;
+	}
+
+	/**
+	  * @brief Gets image format
+	  * @return One of `ota_format_t`
+	  */
+	uint8_t getFormat () {
+		return format;
+	}
+};
+
+#endif // USE_OTA_CACHE
+
+#endif // _OTA_CACHE_h
@@ -0,0 +1,110 @@
+/**
+  * @file OtaDecompressor.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Streaming decompressor for compressed OTA images
+  */
+
+#include "OtaDecompressor.h"
+#include "EnigmaIOTdebug.h"
+
+static const uint16_t OTA_LZSS_WINDOW_MASK = (1 << OTA_LZSS_WINDOW_BITS) - 1; ///< @brief Mask to wrap window positions
+
+bool OtaDecompressorClass::begin () {
+	if (!window) {
+		window = new uint8_t[1 << OTA_LZSS_WINDOW_BITS];
+		if (!window) {
+			DEBUG_ERROR ("Not enough memory for OTA decompression window");
+			return false;
+		}
+	}
+	// Encoder may refer to bytes before stream start. They are zeros
+	memset (window, 0, 1 << OTA_LZSS_WINDOW_BITS);
+	head = 0;
+	state = OTA_LZSS_TAG;
+	count = 0;
+	bitsLeft = 0;
+	fieldValue = 0;
+	fieldBits = 0;
+	setInput (NULL, 0);
+	return true;
+}
+
+void OtaDecompressorClass::end () {
+	if (window) {
+		delete[] window;
+		window = NULL;
+	}
+}
+
+bool OtaDecompressorClass::getBits (uint8_t bits, uint16_t* value) {
+	// Field may span two input chunks, so bits read so far are kept until it is complete
+	while (fieldBits < bits) {
+		if (!bitsLeft) {
+			if (inputPos >= inputLen) {
+				return false;
+			}
+			currentByte = input[inputPos++];
+			bitsLeft = 8;
+		}
+		bitsLeft--;
+		fieldValue = (fieldValue << 1) | ((currentByte >> bitsLeft) & 1);
+		fieldBits++;
+	}
+	*value = fieldValue;
+	fieldValue = 0;
+	fieldBits = 0;
+	return true;
+}
+
+size_t OtaDecompressorClass::read (uint8_t* data, size_t maxLen) {
+	size_t len = 0;
+	uint16_t field;
+
+	if (!window) {
+		return 0;
+	}
+
+	while (len < maxLen) {
+		switch (state) {
+		case OTA_LZSS_TAG:
+			if (!getBits (1, &field)) {
+				return len;
+			}
+			state = field ? OTA_LZSS_LITERAL : OTA_LZSS_INDEX;
+			break;
+		case OTA_LZSS_LITERAL:
+			if (!getBits (8, &field)) {
+				return len;
+			}
+			window[head++ & OTA_LZSS_WINDOW_MASK] = field;
+			data[len++] = field;
+			state = OTA_LZSS_TAG;
+			break;
+		case OTA_LZSS_INDEX:
+			if (!getBits (OTA_LZSS_WINDOW_BITS, &field)) {
+				return len;
+			}
+			distance = field + 1;
+			state = OTA_LZSS_COUNT;
+			break;
+		case OTA_LZSS_COUNT:
+			if (!getBits (OTA_LZSS_LOOKAHEAD_BITS, &field)) {
+				return len;
+			}
+			count = field + 1;
+			state = OTA_LZSS_COPY;
+			break;
+		case OTA_LZSS_COPY:
+			// Reference may overlap bytes being copied, so it is done byte by byte
+			data[len] = window[(head - distance) & OTA_LZSS_WINDOW_MASK];
+			window[head++ & OTA_LZSS_WINDOW_MASK] = data[len++];
+			if (!--count) {
+				state = OTA_LZSS_TAG;
+			}
+			break;
+		}
+	}
+	return len;
+}
@@ -0,0 +1,103 @@
+/**
+  * @file OtaDecompressor.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Streaming decompressor for compressed OTA images
+  *
+  * Images are compressed with LZSS using heatshrink bit format: a tag bit set to 1 is followed by a literal byte, a tag
+  * bit set to 0 is followed by a back reference made of `OTA_LZSS_WINDOW_BITS` bits of distance minus one and
+  * `OTA_LZSS_LOOKAHEAD_BITS` bits of length minus one. Bits are packed MSB first. Only the history window is kept in
+  * memory, so input may be fed in chunks of any size and output is produced as soon as it is available.
+  *
+  * It does not use any platform function so it may be run on a host against images produced by update tool.
+  */
+
+#ifndef _OTA_DECOMPRESSOR_h
+#define _OTA_DECOMPRESSOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+/**
+  * @brief Decoder state, that is, the next field expected in bit stream
+  */
+enum ota_lzss_state_t {
+	OTA_LZSS_TAG = 0, /**< Tag bit */
+	OTA_LZSS_LITERAL = 1, /**< Literal byte */
+	OTA_LZSS_INDEX = 2, /**< Back reference distance */
+	OTA_LZSS_COUNT = 3, /**< Back reference length */
+	OTA_LZSS_COPY = 4 /**< Back reference is being copied to output */
+};
+
+/**
+  * @brief Streaming LZSS decompressor
+  */
+class OtaDecompressorClass {
+protected:
+	uint8_t* window = NULL; ///< @brief Last `2^OTA_LZSS_WINDOW_BITS` output bytes
+	uint16_t head = 0; ///< @brief Position of next output byte in window
+	uint8_t state = OTA_LZSS_TAG; ///< @brief Next field expected. One of `ota_lzss_state_t`
+	uint16_t distance = 0; ///< @brief Distance of back reference being copied
+	uint16_t count = 0; ///< @brief Bytes of back reference that are still to be copied
+	const uint8_t* input = NULL; ///< @brief Compressed data being decoded
+	size_t inputLen = 0; ///< @brief Compressed data length
+	size_t inputPos = 0; ///< @brief Next input byte to be read
+	uint8_t currentByte = 0; ///< @brief Input byte whose bits are being read
+	uint8_t bitsLeft = 0; ///< @brief Bits of `currentByte` not read yet
+	uint16_t fieldValue = 0; ///< @brief Bits of field being read that have been got so far
+	uint8_t fieldBits = 0; ///< @brief Number of bits in `fieldValue`
+
+	/**
+	  * @brief Reads a field from bit stream. If input ends before field is complete it goes on with next input
+	  * @param bits Field length in bits. Up to 16
+	  * @param value Gets field value
+	  * @return `true` if field could be read
+	  */
+	bool getBits (uint8_t bits, uint16_t* value);
+
+public:
+	/**
+	  * @brief Class destructor. Frees history window
+	  */
+	~OtaDecompressorClass () {
+		end ();
+	}
+
+	/**
+	  * @brief Starts a new stream. History window is allocated here so it only uses memory during OTA
+	  * @return `true` if there was memory for history window
+	  */
+	bool begin ();
+
+	/**
+	  * @brief Finishes stream and frees history window
+	  */
+	void end ();
+
+	/**
+	  * @brief Sets next piece of compressed data. Any previous one has to be completely read before
+	  * @param data Compressed data. It has to be valid until `read` returns 0
+	  * @param len Data length
+	  */
+	void setInput (const uint8_t* data, size_t len) {
+		input = data;
+		inputLen = len;
+		inputPos = 0;
+	}
+
+	/**
+	  * @brief Gets decompressed data
+	  * @param data Buffer to store decompressed data
+	  * @param maxLen Buffer length
+	  * @return Number of bytes stored. 0 means that more input is needed
+	  */
+	size_t read (uint8_t* data, size_t maxLen);
+};
+
+#endif // _OTA_DECOMPRESSOR_h
@@ -0,0 +1,227 @@
+/**
+  * @file OtaMulticast.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Multicast OTA update session on gateway
+  */
+
+#include "OtaMulticast.h"
+
+#if USE_OTA_CACHE
+void OtaMulticastClass::begin (uint16_t numChunks, uint32_t now) {
+	this->numChunks = numChunks;
+	memset (members, 0, sizeof (members));
+	roundBase = 1;
+	pending = 0;
+	headerCursor = 0;
+	sweepStart = now;
+	sentCount = 0;
+	rounds = 0;
+}
+
+bool OtaMulticastClass::addMember (uint16_t nodeId) {
+	if (nodeId >= NUM_NODES) {
+		return false;
+	}
+	members[nodeId].status = OTA_MEMBER_STARTING;
+	members[nodeId].base = 1;
+	members[nodeId].received = 0;
+	return true;
+}
+
+int OtaMulticastClass::getNextHeader (uint32_t now) {
+	if (headerCursor >= NUM_NODES) {
+		if (now - sweepStart <= OTA_STREAM_ACK_TIMEOUT) {
+			return -1;
+		}
+		headerCursor = 0;
+		sweepStart = now;
+	}
+	while (headerCursor < NUM_NODES) {
+		uint16_t nodeId = headerCursor++;
+		if (members[nodeId].status == OTA_MEMBER_STARTING) {
+			return nodeId;
+		}
+	}
+	return -1;
+}
+
+bool OtaMulticastClass::isStarted () {
+	return getCount (OTA_MEMBER_STARTING) == 0;
+}
+
+bool OtaMulticastClass::dropIfStarting (uint16_t nodeId) {
+	if (nodeId >= NUM_NODES || members[nodeId].status != OTA_MEMBER_STARTING) {
+		return false;
+	}
+	members[nodeId].status = OTA_MEMBER_FAILED;
+	return true;
+}
+
+bool OtaMulticastClass::processStarted (uint16_t nodeId, uint32_t now) {
+	if (nodeId >= NUM_NODES || members[nodeId].status != OTA_MEMBER_STARTING) {
+		return false;
+	}
+	ota_member_t* member = &members[nodeId];
+	member->status = OTA_MEMBER_RECEIVING;
+	member->base = 1;
+	member->roundBase = 1;
+	member->received = 0;
+	member->idleRounds = 0;
+	member->reported = false;
+	member->lastReport = now;
+	return true;
+}
+
+bool OtaMulticastClass::processSack (uint16_t nodeId, uint16_t base, uint32_t received, uint32_t now) {
+	if (nodeId >= NUM_NODES || members[nodeId].status != OTA_MEMBER_RECEIVING) {
+		return false;
+	}
+	ota_member_t* member = &members[nodeId];
+	member->reported = true;
+	member->lastReport = now;
+	if (base < member->base) {
+		return true; // Old report. Node has written more chunks since then
+	}
+	member->base = base;
+	member->received = received;
+	if (base > numChunks) {
+		member->status = OTA_MEMBER_CHECKING;
+	}
+	return true;
+}
+
+void OtaMulticastClass::processCheck (uint16_t nodeId, uint32_t now) {
+	if (nodeId >= NUM_NODES) {
+		return;
+	}
+	ota_member_t* member = &members[nodeId];
+	if (member->status == OTA_MEMBER_RECEIVING || member->status == OTA_MEMBER_CHECKING) {
+		member->status = OTA_MEMBER_CHECKING;
+		member->base = numChunks + 1;
+		member->received = 0;
+		member->lastReport = now;
+	}
+}
+
+bool OtaMulticastClass::processResult (uint16_t nodeId, bool ok) {
+	if (nodeId >= NUM_NODES) {
+		return false;
+	}
+	ota_member_t* member = &members[nodeId];
+	if (member->status == OTA_MEMBER_NONE || member->status == OTA_MEMBER_DONE || member->status == OTA_MEMBER_FAILED) {
+		return false;
+	}
+	member->status = ok ? OTA_MEMBER_DONE : OTA_MEMBER_FAILED;
+	return true;
+}
+
+void OtaMulticastClass::planRound () {
+	pending = 0;
+	roundBase = numChunks + 1;
+	for (uint16_t i = 0; i < NUM_NODES; i++) {
+		if (members[i].status == OTA_MEMBER_RECEIVING && members[i].base < roundBase) {
+			roundBase = members[i].base;
+		}
+	}
+	// Union of gaps in window of slowest node. Faster nodes never miss chunks beyond it, since their base is higher
+	for (uint16_t i = 0; i < NUM_NODES; i++) {
+		ota_member_t* member = &members[i];
+		if (member->status != OTA_MEMBER_RECEIVING) {
+			continue;
+		}
+		member->reported = false;
+		member->roundBase = member->base;
+		for (uint8_t offset = 0; offset < OTA_WINDOW && roundBase + offset <= numChunks; offset++) {
+			uint16_t idx = roundBase + offset;
+			if (idx >= member->base && !(member->received & ((uint32_t)1 << (idx - member->base)))) {
+				pending |= (uint32_t)1 << offset;
+			}
+		}
+	}
+	if (pending) {
+		rounds++;
+	}
+}
+
+uint16_t OtaMulticastClass::getNextChunk () {
+	if (!pending) {
+		return 0;
+	}
+	uint8_t offset = 0;
+	while (!(pending & ((uint32_t)1 << offset))) {
+		offset++;
+	}
+	pending &= ~((uint32_t)1 << offset);
+	sentCount++;
+	return roundBase + offset;
+}
+
+bool OtaMulticastClass::isRoundReported () {
+	for (uint16_t i = 0; i < NUM_NODES; i++) {
+		if (members[i].status == OTA_MEMBER_RECEIVING && !members[i].reported) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool OtaMulticastClass::closeRound (uint16_t nodeId, uint32_t now) {
+	if (nodeId >= NUM_NODES) {
+		return false;
+	}
+	ota_member_t* member = &members[nodeId];
+	if (member->status == OTA_MEMBER_RECEIVING) {
+		if (member->reported && member->base > member->roundBase) {
+			member->idleRounds = 0;
+		} else if (!member->reported || member->base == roundBase) {
+			// Node did not answer or it did not get any chunk it was missing. A faster node may just be waiting for window
+			member->idleRounds++;
+		}
+		if (member->idleRounds > OTA_STREAM_MAX_TIMEOUTS) {
+			member->status = OTA_MEMBER_FAILED;
+			return true;
+		}
+	} else if (member->status == OTA_MEMBER_CHECKING && now - member->lastReport > OTA_MULTICAST_CHECK_TIMEOUT) {
+		member->status = OTA_MEMBER_FAILED;
+		return true;
+	}
+	return false;
+}
+
+bool OtaMulticastClass::isFinished () {
+	return !getCount (OTA_MEMBER_STARTING) && !getCount (OTA_MEMBER_RECEIVING) && !getCount (OTA_MEMBER_CHECKING);
+}
+
+uint16_t OtaMulticastClass::getCount (ota_member_status_t status) {
+	uint16_t count = 0;
+	for (uint16_t i = 0; i < NUM_NODES; i++) {
+		if (members[i].status == status) {
+			count++;
+		}
+	}
+	return count;
+}
+
+uint16_t OtaMulticastClass::getChunksDone (uint16_t nodeId) {
+	if (nodeId >= NUM_NODES || members[nodeId].status == OTA_MEMBER_NONE) {
+		return 0;
+	}
+	if (members[nodeId].status == OTA_MEMBER_CHECKING || members[nodeId].status == OTA_MEMBER_DONE) {
+		return numChunks;
+	}
+	return members[nodeId].base - 1;
+}
+
+uint16_t OtaMulticastClass::getAcknowledged () {
+	uint16_t acknowledged = numChunks;
+	for (uint16_t i = 0; i < NUM_NODES; i++) {
+		if (members[i].status == OTA_MEMBER_RECEIVING && members[i].base - 1 < acknowledged) {
+			acknowledged = members[i].base - 1;
+		}
+	}
+	return acknowledged;
+}
+
+#endif // USE_OTA_CACHE
@@ -0,0 +1,226 @@
+/**
+  * @file OtaMulticast.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Multicast OTA update session on gateway
+  *
+  * Gateway may send a cached OTA image to several nodes at once. Every node joins update with a unicast first message,
+  * so image size and MD5 are protected with its own key. Chunks are then broadcast in rounds. Every round covers
+  * `OTA_WINDOW` chunks from first one that some node is still missing, and only chunks that some node reported as
+  * missing are sent. After every round nodes report received chunks and next round repairs union of their gaps.
+  * Progress and result of every node is tracked here.
+  *
+  * It does not use any platform function so it may be run on a host against a simulated link.
+  */
+
+#ifndef _OTA_MULTICAST_h
+#define _OTA_MULTICAST_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+#if USE_OTA_CACHE
+/**
+  * @brief Status of a node in a multicast OTA update
+  */
+enum ota_member_status_t {
+	OTA_MEMBER_NONE = 0, /**< Node is not part of update */
+	OTA_MEMBER_STARTING = 1, /**< First OTA message is being sent to node. Waiting for it to start update */
+	OTA_MEMBER_RECEIVING = 2, /**< Node is receiving chunks */
+	OTA_MEMBER_CHECKING = 3, /**< Node got every chunk and is checking image */
+	OTA_MEMBER_DONE = 4, /**< Node finished update correctly */
+	OTA_MEMBER_FAILED = 5 /**< Node failed or stopped answering. It is not waited for anymore */
+};
+
+/**
+  * @brief State of a node in a multicast OTA update
+  */
+typedef struct {
+	uint8_t status; ///< @brief One of `ota_member_status_t`
+	uint16_t base; ///< @brief First chunk that node has not written yet
+	uint16_t roundBase; ///< @brief Value of `base` when current round started
+	uint32_t received; ///< @brief Bit n is set if node has stored chunk `base + n`
+	uint8_t idleRounds; ///< @brief Consecutive rounds without report or without progress while node holds window back
+	bool reported; ///< @brief `true` if node has reported during current round
+	uint32_t lastReport; ///< @brief Time of last report, in milliseconds
+} ota_member_t;
+
+/**
+  * @brief Multicast OTA update session. Decides which chunks are broadcast and tracks every node
+  */
+class OtaMulticastClass {
+protected:
+	ota_member_t members[NUM_NODES]; ///< @brief State of every node. Index is node id
+	uint16_t numChunks = 0; ///< @brief Number of chunks in image
+	uint16_t roundBase = 1; ///< @brief First chunk covered by current round
+	uint32_t pending = 0; ///< @brief Chunks of current round that have not been sent yet. Bit n is chunk `roundBase + n`
+	uint16_t headerCursor = 0; ///< @brief Next node to check when sending first OTA message
+	uint32_t sweepStart = 0; ///< @brief Time when first OTA message was last sent to every starting node
+	uint32_t sentCount = 0; ///< @brief Chunks broadcast since session started
+	uint16_t rounds = 0; ///< @brief Rounds planned since session started
+
+public:
+	/**
+	  * @brief Starts a new session. Every node is removed from it
+	  * @param numChunks Number of chunks in image
+	  * @param now Current time in milliseconds
+	  */
+	void begin (uint16_t numChunks, uint32_t now);
+
+	/**
+	  * @brief Adds a node to session. It has to be sent first OTA message
+	  * @param nodeId Node id
+	  * @return `true` if node could be added
+	  */
+	bool addMember (uint16_t nodeId);
+
+	/**
+	  * @brief Gets next node that has to be sent first OTA message. Every starting node gets it again every
+	  * `OTA_STREAM_ACK_TIMEOUT` milliseconds
+	  * @param now Current time in milliseconds
+	  * @return Node id. -1 if first message does not have to be sent now
+	  */
+	int getNextHeader (uint32_t now);
+
+	/**
+	  * @brief Checks if every node has either started update or failed
+	  * @return `true` if no node is waiting to start
+	  */
+	bool isStarted ();
+
+	/**
+	  * @brief Gives up a node that has not started update yet
+	  * @param nodeId Node id
+	  * @return `true` if node was starting and it has been dropped
+	  */
+	bool dropIfStarting (uint16_t nodeId);
+
+	/**
+	  * @brief Processes start confirmation from a node
+	  * @param nodeId Node id
+	  * @param now Current time in milliseconds
+	  * @return `true` if node was waiting to start
+	  */
+	bool processStarted (uint16_t nodeId, uint32_t now);
+
+	/**
+	  * @brief Processes a selective acknowledgement from a node
+	  * @param nodeId Node id
+	  * @param base First chunk that node has not written yet
+	  * @param received Bit n is set if node has stored chunk `base + n`
+	  * @param now Current time in milliseconds
+	  * @return `true` if node is receiving chunks
+	  */
+	bool processSack (uint16_t nodeId, uint16_t base, uint32_t received, uint32_t now);
+
+	/**
+	  * @brief Processes a node that got every chunk and checked image
+	  * @param nodeId Node id
+	  * @param now Current time in milliseconds
+	  */
+	void processCheck (uint16_t nodeId, uint32_t now);
+
+	/**
+	  * @brief Processes final result of update on a node
+	  * @param nodeId Node id
+	  * @param ok `true` if node finished update correctly
+	  * @return `true` if node was part of session and had not finished yet
+	  */
+	bool processResult (uint16_t nodeId, bool ok);
+
+	/**
+	  * @brief Plans a new round with chunks that some receiving node is missing
+	  */
+	void planRound ();
+
+	/**
+	  * @brief Gets next chunk to broadcast in current round
+	  * @return Chunk index. 0 if round has been completely sent
+	  */
+	uint16_t getNextChunk ();
+
+	/**
+	  * @brief Checks if every receiving node has reported during current round
+	  * @return `true` if there is no need to wait more for reports
+	  */
+	bool isRoundReported ();
+
+	/**
+	  * @brief Closes current round for a node. A node that does not report or does not progress for
+	  * `OTA_STREAM_MAX_TIMEOUTS` rounds is dropped, so it cannot stall the rest of them. A node that does not confirm its
+	  * image in `OTA_MULTICAST_CHECK_TIMEOUT` milliseconds is dropped too
+	  * @param nodeId Node id
+	  * @param now Current time in milliseconds
+	  * @return `true` if node has been dropped
+	  */
+	bool closeRound (uint16_t nodeId, uint32_t now);
+
+	/**
+	  * @brief Checks if session has finished
+	  * @return `true` if no node is still updating
+	  */
+	bool isFinished ();
+
+	/**
+	  * @brief Gets number of nodes with a given status
+	  * @param status One of `ota_member_status_t`
+	  * @return Number of nodes
+	  */
+	uint16_t getCount (ota_member_status_t status);
+
+	/**
+	  * @brief Gets status of a node
+	  * @param nodeId Node id
+	  * @return One of `ota_member_status_t`
+	  */
+	ota_member_status_t getStatus (uint16_t nodeId) {
+		return nodeId < NUM_NODES ? (ota_member_status_t)members[nodeId].status : OTA_MEMBER_NONE;
+	}
+
+	/**
+	  * @brief Gets number of chunks that a node has written
+	  * @param nodeId Node id
+	  * @return Number of chunks
+	  */
+	uint16_t getChunksDone (uint16_t nodeId);
+
+	/**
+	  * @brief Gets number of chunks that every receiving node has written
+	  * @return Number of chunks
+	  */
+	uint16_t getAcknowledged ();
+
+	/**
+	  * @brief Gets number of chunks in image
+	  * @return Number of chunks
+	  */
+	uint16_t getNumChunks () {
+		return numChunks;
+	}
+
+	/**
+	  * @brief Gets number of chunks broadcast since session started
+	  * @return Number of chunks
+	  */
+	uint32_t getSentCount () {
+		return sentCount;
+	}
+
+	/**
+	  * @brief Gets number of rounds since session started
+	  * @return Number of rounds
+	  */
+	uint16_t getRounds () {
+		return rounds;
+	}
+};
+
+#endif // USE_OTA_CACHE
+
+#endif // _OTA_MULTICAST_h
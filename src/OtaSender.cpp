@@ -0,0 +1,85 @@
+/**
+  * @file OtaSender.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Windowed sender for OTA chunks
+  */
+
+#include "OtaSender.h"
+
+void OtaSenderClass::begin (uint16_t numChunks, uint32_t now) {
+	this->numChunks = numChunks;
+	base = 1;
+	nextChunk = 1;
+	lastSackBase = 1;
+	resend = 0;
+	memset (sentOrder, 0, sizeof (sentOrder));
+	sentCount = 0;
+	lastAck = now;
+	timeouts = 0;
+}
+
+uint16_t OtaSenderClass::getNextChunk (uint32_t now) {
+	uint16_t idx;
+
+	if (resend) {
+		uint8_t offset = 0;
+		while (!(resend & ((uint32_t)1 << offset))) {
+			offset++;
+		}
+		resend &= ~((uint32_t)1 << offset);
+		idx = base + offset;
+	} else if (nextChunk < base + OTA_WINDOW && nextChunk <= numChunks) {
+		idx = nextChunk++;
+	} else if (now - lastAck > OTA_STREAM_ACK_TIMEOUT) {
+		// Node did not answer. First missing chunk is sent again to get a new acknowledgement
+		timeouts++;
+		lastAck = now;
+		idx = base;
+	} else {
+		return 0;
+	}
+
+	sentOrder[idx % OTA_WINDOW] = ++sentCount;
+	return idx;
+}
+
+void OtaSenderClass::processSack (uint16_t sackBase, uint32_t received, uint32_t now) {
+	lastAck = now;
+	timeouts = 0;
+	if (sackBase < base) {
+		return; // Old acknowledgement. Chunks may have been acknowledged later
+	}
+	base = sackBase;
+	if (nextChunk < base) {
+		nextChunk = base;
+	}
+	resend = 0;
+	if (received) {
+		// Only gaps below highest received chunk are lost. Later ones may still be on their way
+		uint8_t highest = 31;
+		while (!(received & ((uint32_t)1 << highest))) {
+			highest--;
+		}
+		uint32_t highestOrder = sentOrder[(base + highest) % OTA_WINDOW];
+		for (uint8_t i = 0; i < highest; i++) {
+			if (!(received & ((uint32_t)1 << i)) && sentOrder[(base + i) % OTA_WINDOW] < highestOrder) {
+				resend |= (uint32_t)1 << i;
+			}
+		}
+	} else if (sackBase == lastSackBase) {
+		// Node got nothing new since last report, so every outstanding chunk was lost
+		for (uint16_t i = base; i < nextChunk; i++) {
+			resend |= (uint32_t)1 << (i - base);
+		}
+	}
+	lastSackBase = sackBase;
+}
+
+void OtaSenderClass::rewind (uint16_t lastGood, uint32_t now) {
+	base = lastGood + 1;
+	nextChunk = base;
+	resend = 0;
+	lastAck = now;
+}
@@ -0,0 +1,96 @@
+/**
+  * @file OtaSender.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Windowed sender for OTA chunks
+  *
+  * Decides which OTA chunk has to be sent next to keep node receive window full. Up to `OTA_WINDOW` chunks are sent
+  * ahead of first one not acknowledged by node. Selective acknowledgements report received chunks so that only lost
+  * ones are sent again. It is the same algorithm that update tool uses when it drives OTA over MQTT.
+  *
+  * It does not use any platform function so it may be run on a host against a simulated link.
+  */
+
+#ifndef _OTA_SENDER_h
+#define _OTA_SENDER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+/**
+  * @brief Windowed sender of OTA chunks
+  */
+class OtaSenderClass {
+protected:
+	uint16_t numChunks = 0; ///< @brief Number of chunks of image. First one is 1
+	uint16_t base = 1; ///< @brief First chunk not acknowledged by node
+	uint16_t nextChunk = 1; ///< @brief Next chunk that has never been sent
+	uint16_t lastSackBase = 1; ///< @brief Base reported on previous selective acknowledgement
+	uint32_t resend = 0; ///< @brief Bit n is set if chunk `base + n` has to be sent again
+	uint32_t sentOrder[OTA_WINDOW]; ///< @brief Send sequence number of last transmission of every chunk in window
+	uint32_t sentCount = 0; ///< @brief Number of chunks sent, including repeated ones
+	uint32_t lastAck = 0; ///< @brief Time of last answer from node
+	uint8_t timeouts = 0; ///< @brief Consecutive times that node has not answered on time
+
+public:
+	/**
+	  * @brief Starts a new transfer
+	  * @param numChunks Number of chunks in image
+	  * @param now Current time in milliseconds
+	  */
+	void begin (uint16_t numChunks, uint32_t now);
+
+	/**
+	  * @brief Gets next chunk to be sent and records it as sent
+	  * @param now Current time in milliseconds
+	  * @return Chunk index or 0 if nothing has to be sent now
+	  */
+	uint16_t getNextChunk (uint32_t now);
+
+	/**
+	  * @brief Processes a selective acknowledgement
+	  * @param sackBase First chunk that node misses
+	  * @param received Bitmap of chunks received after `sackBase`
+	  * @param now Current time in milliseconds
+	  */
+	void processSack (uint16_t sackBase, uint32_t received, uint32_t now);
+
+	/**
+	  * @brief Goes back to first chunk that node misses, after it has discarded chunks too far ahead
+	  * @param lastGood Last chunk received in sequence by node
+	  * @param now Current time in milliseconds
+	  */
+	void rewind (uint16_t lastGood, uint32_t now);
+
+	/**
+	  * @brief Checks if node has stopped answering
+	  * @return `true` if there have been more than `OTA_STREAM_MAX_TIMEOUTS` consecutive timeouts
+	  */
+	bool isFailed () {
+		return timeouts > OTA_STREAM_MAX_TIMEOUTS;
+	}
+
+	/**
+	  * @brief Gets first chunk not acknowledged by node
+	  * @return Chunk index
+	  */
+	uint16_t getBase () {
+		return base;
+	}
+
+	/**
+	  * @brief Gets number of chunks sent, including repeated ones
+	  * @return Number of chunks
+	  */
+	uint32_t getSentCount () {
+		return sentCount;
+	}
+};
+
+#endif // _OTA_SENDER_h
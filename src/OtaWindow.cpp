@@ -0,0 +1,75 @@
+/**
+  * @file OtaWindow.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Receive window for OTA chunks
+  */
+
+#include "OtaWindow.h"
+#include "EnigmaIOTdebug.h"
+
+bool OtaWindowClass::begin (uint16_t lastChunk) {
+	if (!slots) {
+		slots = new uint8_t[OTA_WINDOW][OTA_CHUNK_MAX_LENGTH];
+		if (!slots) {
+			DEBUG_ERROR ("Not enough memory for OTA reorder buffer");
+			return false;
+		}
+	}
+	this->lastChunk = lastChunk;
+	base = 1;
+	received = 0;
+	stats = {};
+	return true;
+}
+
+void OtaWindowClass::end () {
+	if (slots) {
+		delete[] slots;
+		slots = NULL;
+	}
+	received = 0;
+}
+
+ota_chunk_result_t OtaWindowClass::add (uint16_t idx, const uint8_t* data, size_t len) {
+	if (!slots || !len || len > OTA_CHUNK_MAX_LENGTH) {
+		return OTA_CHUNK_INVALID;
+	}
+	if (idx < base) {
+		stats.duplicates++;
+		return OTA_CHUNK_DUPLICATE;
+	}
+	if (idx > lastChunk || idx - base >= OTA_WINDOW) {
+		stats.outOfWindow++;
+		return OTA_CHUNK_OUT_OF_WINDOW;
+	}
+
+	uint8_t offset = idx - base;
+	if (received & ((uint32_t)1 << offset)) {
+		stats.duplicates++;
+		return OTA_CHUNK_DUPLICATE;
+	}
+
+	uint8_t slot = idx % OTA_WINDOW;
+	memcpy (slots[slot], data, len);
+	slotLength[slot] = len;
+	received |= (uint32_t)1 << offset;
+	stats.stored++;
+	if (offset) {
+		stats.reordered++;
+	}
+	return OTA_CHUNK_STORED;
+}
+
+bool OtaWindowClass::pop (const uint8_t** data, size_t* len) {
+	if (!slots || !(received & 1)) {
+		return false;
+	}
+	uint8_t slot = base % OTA_WINDOW;
+	*data = slots[slot];
+	*len = slotLength[slot];
+	received >>= 1;
+	base++;
+	return true;
+}
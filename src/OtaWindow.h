@@ -0,0 +1,136 @@
+/**
+  * @file OtaWindow.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Receive window for OTA chunks
+  *
+  * Node accepts chunks from first one that has not been written yet up to `OTA_WINDOW` chunks after it, in any order.
+  * They are kept in a small reorder buffer and given back in sequence, so firmware is still written to flash
+  * sequentially. Received chunks are reported to sender as a bitmap so that it resends only missing ones.
+  *
+  * It does not use any platform function so it may be run on a host against a simulated link.
+  */
+
+#ifndef _OTA_WINDOW_h
+#define _OTA_WINDOW_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+/**
+  * @brief Result of adding a chunk to window
+  */
+enum ota_chunk_result_t {
+	OTA_CHUNK_STORED = 0, /**< Chunk was stored */
+	OTA_CHUNK_DUPLICATE = 1, /**< Chunk had already been received */
+	OTA_CHUNK_OUT_OF_WINDOW = 2, /**< Chunk is too far from first missing one or beyond last chunk. It was discarded */
+	OTA_CHUNK_INVALID = 3 /**< Chunk is too long or window was not started */
+};
+
+/**
+  * @brief OTA receive window counters
+  */
+typedef struct {
+	uint16_t stored; ///< @brief Chunks accepted
+	uint16_t reordered; ///< @brief Chunks accepted ahead of a missing one
+	uint16_t duplicates; ///< @brief Chunks received again
+	uint16_t outOfWindow; ///< @brief Chunks discarded because they did not fit in window
+} ota_window_stats_t;
+
+/**
+  * @brief Receive window and reorder buffer for OTA chunks
+  */
+class OtaWindowClass {
+protected:
+	uint8_t (*slots)[OTA_CHUNK_MAX_LENGTH] = NULL; ///< @brief Reorder buffer. Chunk `n` is stored on slot `n % OTA_WINDOW`
+	uint8_t slotLength[OTA_WINDOW]; ///< @brief Length of every stored chunk
+	uint16_t base = 1; ///< @brief First chunk that has not been given back yet
+	uint16_t lastChunk = 0; ///< @brief Index of last chunk of image
+	uint32_t received = 0; ///< @brief Bit n is set if chunk `base + n` is stored
+	ota_window_stats_t stats = {}; ///< @brief Window counters
+
+public:
+	/**
+	  * @brief Class destructor. Frees reorder buffer
+	  */
+	~OtaWindowClass () {
+		end ();
+	}
+
+	/**
+	  * @brief Starts a new transfer. Reorder buffer is allocated here so it only uses memory during OTA
+	  * @param lastChunk Index of last chunk. First one is 1
+	  * @return `true` if there was memory for reorder buffer
+	  */
+	bool begin (uint16_t lastChunk);
+
+	/**
+	  * @brief Finishes transfer and frees reorder buffer
+	  */
+	void end ();
+
+	/**
+	  * @brief Stores a received chunk
+	  * @param idx Chunk index
+	  * @param data Chunk data
+	  * @param len Chunk length
+	  * @return Result from `ota_chunk_result_t`
+	  */
+	ota_chunk_result_t add (uint16_t idx, const uint8_t* data, size_t len);
+
+	/**
+	  * @brief Gets next chunk in sequence, if it has been received, and moves window forward
+	  * @param data Gets pointer to chunk data. It is valid until next call to `add`
+	  * @param len Gets chunk length
+	  * @return `true` if a chunk was available
+	  */
+	bool pop (const uint8_t** data, size_t* len);
+
+	/**
+	  * @brief Gets first chunk that has not been given back yet
+	  * @return Chunk index. It is `lastChunk + 1` when transfer is complete
+	  */
+	uint16_t getBase () {
+		return base;
+	}
+
+	/**
+	  * @brief Gets chunks received ahead of base
+	  * @return Bitmap. Bit n is set if chunk `base + n` has been received
+	  */
+	uint32_t getReceived () {
+		return received;
+	}
+
+	/**
+	  * @brief Checks if some chunk is missing before a received one
+	  * @return `true` if there is a gap in window
+	  */
+	bool hasGap () {
+		return received && !(received & 1);
+	}
+
+	/**
+	  * @brief Checks if every chunk has been given back
+	  * @return `true` if transfer is complete
+	  */
+	bool isComplete () {
+		return slots && base > lastChunk;
+	}
+
+	/**
+	  * @brief Gets window counters
+	  * @return Pointer to counters
+	  */
+	const ota_window_stats_t* getStats () {
+		return &stats;
+	}
+};
+
+#endif // _OTA_WINDOW_h
@@ -0,0 +1,134 @@
+/**
+  * @file PeerCache.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Cache of peers registered on a radio driver with a limited peer table
+  */
+
+#include "PeerCache.h"
+#include "helperFunctions.h"
+#include "EnigmaIOTdebug.h"
+
+void PeerCacheClass::begin (uint8_t size, peer_cache_add_t addPeer, peer_cache_del_t delPeer) {
+	this->size = size < PEER_CACHE_MAX_SIZE ? size : PEER_CACHE_MAX_SIZE;
+	this->addPeer = addPeer;
+	this->delPeer = delPeer;
+	memset (entries, 0, sizeof (entries));
+	channelKnown = false;
+	channel = 0;
+}
+
+peer_cache_entry_t* PeerCacheClass::find (const uint8_t* address) {
+	for (int i = 0; i < size; i++) {
+		if ((entries[i].used || entries[i].pinned) && !memcmp (entries[i].address, address, ENIGMAIOT_ADDR_LEN)) {
+			return &entries[i];
+		}
+	}
+	return NULL;
+}
+
+peer_cache_entry_t* PeerCacheClass::evict () {
+	peer_cache_entry_t* oldest = NULL;
+
+	for (int i = 0; i < size; i++) {
+		if (entries[i].used && !entries[i].pinned && (!oldest || entries[i].lastUsed < oldest->lastUsed)) {
+			oldest = &entries[i];
+		}
+	}
+	if (!oldest) {
+		return NULL;
+	}
+	DEBUG_DBG ("Peer %s evicted from cache", mac2str (oldest->address));
+	delPeer (oldest->address);
+	oldest->used = false;
+	stats.evictions++;
+	return oldest;
+}
+
+peer_cache_entry_t* PeerCacheClass::freeEntry () {
+	for (int i = 0; i < size; i++) {
+		if (!entries[i].used && !entries[i].pinned) {
+			return &entries[i];
+		}
+	}
+	return evict ();
+}
+
+bool PeerCacheClass::registerPeer (peer_cache_entry_t* entry) {
+	for (;;) {
+		peer_add_result_t result = addPeer (entry->address, channel);
+		if (result == PEER_ADD_OK) {
+			entry->used = true;
+			return true;
+		}
+		// Some peer was registered outside cache. Make room and try again
+		if (result != PEER_ADD_FULL || !evict ()) {
+			DEBUG_WARN ("Cannot register peer %s. Error %d", mac2str (entry->address), result);
+			return false;
+		}
+		stats.fullRetries++;
+	}
+}
+
+void PeerCacheClass::setChannel (uint8_t channel) {
+	if (channel != this->channel) {
+		// Peers are bound to a channel. Register them again on the new one
+		DEBUG_DBG ("Channel changed from %u to %u. Flushing peer cache", this->channel, channel);
+		flush ();
+		this->channel = channel;
+		stats.flushes++;
+	}
+	channelKnown = true;
+}
+
+bool PeerCacheClass::pin (const uint8_t* address) {
+	peer_cache_entry_t* entry = find (address);
+
+	if (!entry) {
+		entry = freeEntry ();
+		if (!entry) {
+			return false;
+		}
+		memcpy (entry->address, address, ENIGMAIOT_ADDR_LEN);
+	}
+	entry->pinned = true;
+	return true;
+}
+
+bool PeerCacheClass::get (const uint8_t* address) {
+	peer_cache_entry_t* entry = find (address);
+
+	if (entry && entry->used) {
+		entry->lastUsed = ++useCounter;
+		stats.hits++;
+		return true;
+	}
+	stats.misses++;
+	if (!entry) {
+		entry = freeEntry ();
+		if (!entry) {
+			return false; // Every entry is pinned
+		}
+		memcpy (entry->address, address, ENIGMAIOT_ADDR_LEN);
+	}
+	entry->lastUsed = ++useCounter;
+	return registerPeer (entry);
+}
+
+void PeerCacheClass::flush () {
+	for (int i = 0; i < size; i++) {
+		if (entries[i].used) {
+			delPeer (entries[i].address);
+			entries[i].used = false;
+		}
+	}
+}
+
+void PeerCacheClass::reset () {
+	for (int i = 0; i < size; i++) {
+		entries[i].used = false;
+	}
+	channelKnown = false;
+	channel = 0;
+}
@@ -0,0 +1,186 @@
+/**
+  * @file PeerCache.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Cache of peers registered on a radio driver with a limited peer table
+  *
+  * Destinations are registered on demand and least recently used one is removed when table is full. Pinned peers,
+  * like broadcast address, are never removed. Peers are bound to the channel they were registered on, so every peer
+  * is registered again when channel changes. If driver reports its table full, some peer was registered outside this
+  * cache and least recently used one is removed to make room.
+  *
+  * Driver is accessed through two functions, so it does not use any platform function and may be run on a host
+  * against a fake driver.
+  */
+
+#ifndef _PEER_CACHE_h
+#define _PEER_CACHE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+static const uint8_t PEER_CACHE_MAX_SIZE = 20; ///< @brief Maximum number of cached peers. Same as ESP-NOW peer table
+
+/**
+  * @brief Result of a peer registration on driver
+  */
+enum peer_add_result_t {
+	PEER_ADD_OK = 0, /**< Peer is registered */
+	PEER_ADD_FULL = 1, /**< Driver peer table is full */
+	PEER_ADD_ERROR = 2 /**< Any other error */
+};
+
+/**
+  * @brief Registers a peer on driver
+  * @param address Peer address
+  * @param channel Channel to register peer on
+  * @return Registration result
+  */
+typedef peer_add_result_t (*peer_cache_add_t)(const uint8_t* address, uint8_t channel);
+
+/**
+  * @brief Removes a peer from driver
+  * @param address Peer address
+  */
+typedef void (*peer_cache_del_t)(const uint8_t* address);
+
+/**
+  * @brief Peer cache counters
+  */
+typedef struct {
+	uint32_t hits; ///< @brief Sends whose destination was already registered
+	uint32_t misses; ///< @brief Sends that needed a peer registration
+	uint32_t evictions; ///< @brief Peers removed to make room for a new one
+	uint32_t flushes; ///< @brief Full cache refreshes because of a channel change
+	uint32_t fullRetries; ///< @brief Registrations retried after driver reported its table full
+} peer_cache_stats_t;
+
+/**
+  * @brief Cached peer
+  */
+typedef struct {
+	uint8_t address[ENIGMAIOT_ADDR_LEN]; ///< @brief Peer address
+	uint32_t lastUsed; ///< @brief Use sequence number. Lowest one is evicted first
+	bool used; ///< @brief `true` if peer is registered on driver
+	bool pinned; ///< @brief `true` if peer is never evicted
+} peer_cache_entry_t;
+
+/**
+  * @brief Peer cache with LRU eviction
+  */
+class PeerCacheClass {
+protected:
+	peer_cache_entry_t entries[PEER_CACHE_MAX_SIZE]; ///< @brief Cached peers
+	uint8_t size = 0; ///< @brief Number of entries in use
+	uint32_t useCounter = 0; ///< @brief Use sequence number for LRU order
+	uint8_t channel = 0; ///< @brief Channel cached peers are registered on
+	volatile bool channelKnown = false; ///< @brief `false` if channel has to be read from driver again
+	peer_cache_add_t addPeer = NULL; ///< @brief Driver registration function
+	peer_cache_del_t delPeer = NULL; ///< @brief Driver removal function
+	peer_cache_stats_t stats = {}; ///< @brief Peer cache counters
+
+	/**
+	  * @brief Finds a cached peer
+	  * @param address Peer address
+	  * @return Cache entry. `NULL` if peer is not cached
+	  */
+	peer_cache_entry_t* find (const uint8_t* address);
+
+	/**
+	  * @brief Removes least recently used peer that is not pinned
+	  * @return Entry that has been freed. `NULL` if there was none to remove
+	  */
+	peer_cache_entry_t* evict ();
+
+	/**
+	  * @brief Gets an entry for a new peer. Least recently used one is evicted if there is no free entry
+	  * @return Free entry. `NULL` if every entry is pinned
+	  */
+	peer_cache_entry_t* freeEntry ();
+
+	/**
+	  * @brief Registers peer on driver. Peers are evicted while driver reports its table full
+	  * @param entry Cache entry that gets the peer
+	  * @return `true` if peer is registered
+	  */
+	bool registerPeer (peer_cache_entry_t* entry);
+
+public:
+	/**
+	  * @brief Starts cache. Every entry is forgotten
+	  * @param size Number of peers to keep registered
+	  * @param addPeer Driver registration function
+	  * @param delPeer Driver removal function
+	  */
+	void begin (uint8_t size, peer_cache_add_t addPeer, peer_cache_del_t delPeer);
+
+	/**
+	  * @brief Checks if channel has to be read from driver before next `get`
+	  * @return `true` if cached channel is valid
+	  */
+	bool isChannelKnown () {
+		return channelKnown;
+	}
+
+	/**
+	  * @brief Marks cached channel as stale. It may be called from any task
+	  */
+	void invalidateChannel () {
+		channelKnown = false;
+	}
+
+	/**
+	  * @brief Sets current channel. Every registered peer is removed if it changed
+	  * @param channel WiFi channel
+	  */
+	void setChannel (uint8_t channel);
+
+	/**
+	  * @brief Adds a peer that is never evicted. It is registered on next `get`
+	  * @param address Peer address
+	  * @return `true` if there was room for it
+	  */
+	bool pin (const uint8_t* address);
+
+	/**
+	  * @brief Makes sure peer is registered on driver
+	  * @param address Peer address
+	  * @return `true` if peer is registered
+	  */
+	bool get (const uint8_t* address);
+
+	/**
+	  * @brief Removes every registered peer from driver. Pinned peers are kept in cache and registered again on use
+	  */
+	void flush ();
+
+	/**
+	  * @brief Forgets every registered peer without removing it from driver. Used when driver has been reset
+	  */
+	void reset ();
+
+	/**
+	  * @brief Gets peer cache counters
+	  * @return Pointer to counters
+	  */
+	const peer_cache_stats_t* getStats () {
+		return &stats;
+	}
+
+	/**
+	  * @brief Gets ratio of sends that found its destination already registered
+	  * @return Hit rate, from 0 to 1
+	  */
+	float getHitRate () {
+		uint32_t total = stats.hits + stats.misses;
+		return total ? (float)stats.hits / total : 0;
+	}
+};
+
+#endif // _PEER_CACHE_h
@@ -11,11 +11,31 @@
 #include "cryptModule.h"
 #include <Curve25519.h>
 #include <ChaChaPoly.h>
+#include <ChaCha.h>
 #include <Poly1305.h>
 #include <SHA256.h>
+#include <AES.h>
+#include <GCM.h>
+#if defined ESP32 && USE_HW_AES_GCM
+#include <mbedtls/gcm.h>
+#endif
 #include "helperFunctions.h"
+#if !defined ESP8266 && !defined ESP32 && defined __linux__
+#include <sys/random.h>
+#endif
+#if USE_FAST_DRBG
+#include "ChaChaDrbg.h"
+#endif
 
 CYPHER_TYPE cipher;
+#if !(defined ESP32 && USE_HW_AES_GCM)
+#if SUPPORTED_CIPHER_SUITES & 0x02
+GCM<AES128> aes128gcm; ///< @brief Software AES-128-GCM instance
+#endif
+#if SUPPORTED_CIPHER_SUITES & 0x04
+GCM<AES256> aes256gcm; ///< @brief Software AES-256-GCM instance
+#endif
+#endif // !(ESP32 && USE_HW_AES_GCM)
 
 uint8_t* CryptModule::getSHA256 (uint8_t* buffer, uint8_t length) {
 	const uint8_t HASH_LEN = 32;
@@ -49,22 +69,191 @@ uint8_t* CryptModule::getSHA256 (uint8_t* buffer, uint8_t length) {
 	return buffer;
 }
 
+void CryptModule::getHMAC (const uint8_t* key, size_t keyLen, const uint8_t* data, size_t length, uint8_t* hmac, size_t hmacLen) {
+	SHA256 hash;
+
+	hash.resetHMAC (key, keyLen);
+	hash.update (data, length);
+	hash.finalizeHMAC (key, keyLen, hmac, hmacLen);
+	hash.clear ();
+}
+
+bool CryptModule::deriveKey (const uint8_t* ikm, size_t ikmLen, const uint8_t* salt, size_t saltLen,
+							 const uint8_t* info, size_t infoLen, uint8_t* okm, size_t okmLen) {
+	const size_t HASH_LEN = 32;
+	uint8_t zeroSalt[HASH_LEN];
+	uint8_t prk[HASH_LEN];
+	uint8_t block[HASH_LEN];
+	uint8_t counter = 1;
+	size_t done = 0;
+	SHA256 hash;
+
+	if (!ikm || !okm || okmLen > 255 * HASH_LEN) {
+		return false;
+	}
+
+	// Extract
+	if (!salt || !saltLen) {
+		memset (zeroSalt, 0, HASH_LEN);
+		salt = zeroSalt;
+		saltLen = HASH_LEN;
+	}
+	getHMAC (salt, saltLen, ikm, ikmLen, prk, HASH_LEN);
+
+	// Expand. T(n) = HMAC (PRK, T(n-1) | info | n)
+	while (done < okmLen) {
+		hash.resetHMAC (prk, HASH_LEN);
+		if (counter > 1) {
+			hash.update (block, HASH_LEN);
+		}
+		if (info && infoLen) {
+			hash.update (info, infoLen);
+		}
+		hash.update (&counter, 1);
+		hash.finalizeHMAC (prk, HASH_LEN, block, HASH_LEN);
+		size_t chunk = okmLen - done < HASH_LEN ? okmLen - done : HASH_LEN;
+		memcpy (okm + done, block, chunk);
+		done += chunk;
+		counter++;
+	}
+
+	hash.clear ();
+	memset (prk, 0, HASH_LEN);
+	memset (block, 0, HASH_LEN);
+	return true;
+}
+
+#if defined ESP32 && USE_HW_AES_GCM
+/**
+  * @brief Runs AES-GCM on ESP32 AES peripheral through mbedTLS
+  */
+static bool hwGcmCrypt (bool encrypt, uint8_t* data, size_t length,
+						const uint8_t* iv, uint8_t ivlen, const uint8_t* key, unsigned int keyBits,
+						const uint8_t* aad, uint8_t aadLen, uint8_t* tag, uint8_t tagLen) {
+	mbedtls_gcm_context ctx;
+	int result;
+
+	mbedtls_gcm_init (&ctx);
+	result = mbedtls_gcm_setkey (&ctx, MBEDTLS_CIPHER_ID_AES, key, keyBits);
+	if (result) {
+		DEBUG_ERROR ("Error setting key. Code -0x%04X", -result);
+		mbedtls_gcm_free (&ctx);
+		return false;
+	}
+	if (encrypt) {
+		result = mbedtls_gcm_crypt_and_tag (&ctx, MBEDTLS_GCM_ENCRYPT, length, iv, ivlen, aad, aadLen,
+											data, data, tagLen, tag);
+	} else {
+		result = mbedtls_gcm_auth_decrypt (&ctx, length, iv, ivlen, aad, aadLen, tag, tagLen, data, data);
+	}
+	mbedtls_gcm_free (&ctx);
+	if (result) {
+		DEBUG_ERROR ("AES-GCM error. Code -0x%04X", -result);
+	}
+	return result == 0;
+}
+#endif // ESP32 && USE_HW_AES_GCM
+
+/**
+  * @brief Gets software cipher instance for selected suite
+  * @param suite Cipher suite
+  * @return Cipher instance. NULL if suite is not enabled on this build
+  */
+static AuthenticatedCipher* getCipher (cipherSuite_t suite) {
+	switch (suite) {
+	case CIPHER_CHACHAPOLY:
+		return &cipher;
+#if !(defined ESP32 && USE_HW_AES_GCM)
+#if SUPPORTED_CIPHER_SUITES & 0x02
+	case CIPHER_AES128_GCM:
+		return &aes128gcm;
+#endif
+#if SUPPORTED_CIPHER_SUITES & 0x04
+	case CIPHER_AES256_GCM:
+		return &aes256gcm;
+#endif
+#endif // !(ESP32 && USE_HW_AES_GCM)
+	default:
+		return NULL;
+	}
+}
+
+/**
+  * @brief Adapts a key to cipher suite key size. Shorter keys are padded with zeros, the same way ChaCha does it internally
+  * @param suiteKey Buffer to store adapted key. It must be KEY_LENGTH bytes long
+  * @param key Original key
+  * @param keylen Original key length
+  * @param keySize Key size required by cipher suite
+  */
+static void prepareSuiteKey (uint8_t* suiteKey, const uint8_t* key, uint8_t keylen, size_t keySize) {
+	memset (suiteKey, 0, KEY_LENGTH);
+	memcpy (suiteKey, key, keylen < keySize ? keylen : keySize);
+}
+
+const char* CryptModule::getSuiteName (cipherSuite_t suite) {
+	switch (suite) {
+	case CIPHER_CHACHAPOLY:
+		return "ChaChaPoly";
+	case CIPHER_AES128_GCM:
+		return "AES-128-GCM";
+	case CIPHER_AES256_GCM:
+		return "AES-256-GCM";
+	default:
+		return "Unknown";
+	}
+}
+
 bool CryptModule::decryptBuffer (const uint8_t* data, size_t length,
 								 const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen) {
+								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+								 cipherSuite_t suite) {
 	if (key && iv && data) {
 
 		DEBUG_VERBOSE ("IV: %s", printHexBuffer (iv, ivlen));
 		DEBUG_VERBOSE ("Key: %s", printHexBuffer (key, keylen));
 		DEBUG_VERBOSE ("AAD: %s", printHexBuffer (aad, aadLen));
-		cipher.clear ();
-
-		if (cipher.setKey (key, keylen)) {
-			if (cipher.setIV ((uint8_t*)iv, ivlen)) {
-				cipher.addAuthData ((uint8_t*)aad, aadLen);
-				cipher.decrypt ((uint8_t*)data, (uint8_t*)data, length);
-				bool ok = cipher.checkTag ((uint8_t*)tag, tagLen);
-				cipher.clear ();
+
+		if (!isSuiteSupported (suite)) {
+			DEBUG_ERROR ("Cipher suite %s not supported", getSuiteName (suite));
+			return false;
+		}
+
+#if defined ESP32 && USE_HW_AES_GCM
+		if (suite != CIPHER_CHACHAPOLY) {
+			uint8_t suiteKey[KEY_LENGTH];
+			size_t keySize = suite == CIPHER_AES128_GCM ? 16 : 32;
+			prepareSuiteKey (suiteKey, key, keylen, keySize);
+			bool ok = hwGcmCrypt (false, (uint8_t*)data, length, iv, ivlen, suiteKey, keySize * 8,
+								  aad, aadLen, (uint8_t*)tag, tagLen);
+			memset (suiteKey, 0, KEY_LENGTH);
+			DEBUG_VERBOSE ("Tag: %s", printHexBuffer (tag, tagLen));
+			if (!ok) {
+				DEBUG_ERROR ("Data authentication error");
+			}
+			return ok;
+		}
+#endif // ESP32 && USE_HW_AES_GCM
+
+		AuthenticatedCipher* aead = getCipher (suite);
+		if (!aead) {
+			DEBUG_ERROR ("Cipher suite %s not available", getSuiteName (suite));
+			return false;
+		}
+		uint8_t suiteKey[KEY_LENGTH];
+		if (suite != CIPHER_CHACHAPOLY) {
+			prepareSuiteKey (suiteKey, key, keylen, aead->keySize ());
+			key = suiteKey;
+			keylen = aead->keySize ();
+		}
+		aead->clear ();
+
+		if (aead->setKey (key, keylen)) {
+			if (aead->setIV ((uint8_t*)iv, ivlen)) {
+				aead->addAuthData ((uint8_t*)aad, aadLen);
+				aead->decrypt ((uint8_t*)data, (uint8_t*)data, length);
+				bool ok = aead->checkTag ((uint8_t*)tag, tagLen);
+				aead->clear ();
+				memset (suiteKey, 0, KEY_LENGTH);
 				DEBUG_VERBOSE ("Tag: %s", printHexBuffer (tag, tagLen));
 				if (!ok) {
 					DEBUG_ERROR ("Data authentication error");
@@ -76,6 +265,7 @@ bool CryptModule::decryptBuffer (const uint8_t* data, size_t length,
 		} else {
 			DEBUG_ERROR ("Error setting key");
 		}
+		memset (suiteKey, 0, KEY_LENGTH);
 	} else {
 		DEBUG_ERROR ("Error in key or IV");
 	}
@@ -85,21 +275,53 @@ bool CryptModule::decryptBuffer (const uint8_t* data, size_t length,
 
 bool CryptModule::encryptBuffer (const uint8_t* data, size_t length,
 								 const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen) {
+								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+								 cipherSuite_t suite) {
 
 	if (key && iv && data) {
 
 		DEBUG_VERBOSE ("IV: %s", printHexBuffer (iv, ivlen));
 		DEBUG_VERBOSE ("Key: %s", printHexBuffer (key, keylen));
 		DEBUG_VERBOSE ("AAD: %s", printHexBuffer (aad, aadLen));
-		cipher.clear ();
-
-		if (cipher.setKey ((uint8_t*)key, keylen)) {
-			if (cipher.setIV ((uint8_t*)iv, ivlen)) {
-				cipher.addAuthData ((uint8_t*)aad, aadLen);
-				cipher.encrypt ((uint8_t*)data, (uint8_t*)data, length);
-				cipher.computeTag ((uint8_t*)tag, tagLen);
-				cipher.clear ();
+
+		if (!isSuiteSupported (suite)) {
+			DEBUG_ERROR ("Cipher suite %s not supported", getSuiteName (suite));
+			return false;
+		}
+
+#if defined ESP32 && USE_HW_AES_GCM
+		if (suite != CIPHER_CHACHAPOLY) {
+			uint8_t suiteKey[KEY_LENGTH];
+			size_t keySize = suite == CIPHER_AES128_GCM ? 16 : 32;
+			prepareSuiteKey (suiteKey, key, keylen, keySize);
+			bool ok = hwGcmCrypt (true, (uint8_t*)data, length, iv, ivlen, suiteKey, keySize * 8,
+								  aad, aadLen, (uint8_t*)tag, tagLen);
+			memset (suiteKey, 0, KEY_LENGTH);
+			DEBUG_VERBOSE ("Tag: %s", printHexBuffer (tag, tagLen));
+			return ok;
+		}
+#endif // ESP32 && USE_HW_AES_GCM
+
+		AuthenticatedCipher* aead = getCipher (suite);
+		if (!aead) {
+			DEBUG_ERROR ("Cipher suite %s not available", getSuiteName (suite));
+			return false;
+		}
+		uint8_t suiteKey[KEY_LENGTH];
+		if (suite != CIPHER_CHACHAPOLY) {
+			prepareSuiteKey (suiteKey, key, keylen, aead->keySize ());
+			key = suiteKey;
+			keylen = aead->keySize ();
+		}
+		aead->clear ();
+
+		if (aead->setKey ((uint8_t*)key, keylen)) {
+			if (aead->setIV ((uint8_t*)iv, ivlen)) {
+				aead->addAuthData ((uint8_t*)aad, aadLen);
+				aead->encrypt ((uint8_t*)data, (uint8_t*)data, length);
+				aead->computeTag ((uint8_t*)tag, tagLen);
+				aead->clear ();
+				memset (suiteKey, 0, KEY_LENGTH);
 				DEBUG_VERBOSE ("Tag: %s", printHexBuffer (tag, tagLen));
 				return true;
 			} else {
@@ -108,6 +330,7 @@ bool CryptModule::encryptBuffer (const uint8_t* data, size_t length,
 		} else {
 			DEBUG_ERROR ("Error setting key");
 		}
+		memset (suiteKey, 0, KEY_LENGTH);
 	} else {
 		DEBUG_ERROR ("Error on input data for encryption");
 	}
@@ -116,28 +339,112 @@ bool CryptModule::encryptBuffer (const uint8_t* data, size_t length,
 
 }
 
-uint32_t CryptModule::random () {
+uint32_t CryptModule::hardwareRandom () {
 #ifdef ESP8266
 	return *(volatile uint32_t*)RANDOM_32;
 #elif defined ESP32
 	return esp_random ();
+#elif defined __linux__
+	uint32_t value = 0;
+	while (getrandom (&value, sizeof (value), 0) != sizeof (value)) {} // Host builds, used by extras/host tools
+	return value;
 #endif
 }
 
+#if USE_FAST_DRBG
+static ChaChaDrbgClass drbg (CryptModule::hardwareRandom); ///< @brief Random number generator
+#ifdef ESP32
+// DRBG may be called from WiFi task and loop task. A refill runs ChaCha20 and a reseed reads hardware RNG, that is too
+// long to keep interrupts disabled in a critical section
+static SemaphoreHandle_t drbgMutex = xSemaphoreCreateMutex (); ///< @brief Serializes DRBG access
+#define DRBG_LOCK() xSemaphoreTake (drbgMutex, portMAX_DELAY)
+#define DRBG_UNLOCK() xSemaphoreGive (drbgMutex)
+#else
+#define DRBG_LOCK()
+#define DRBG_UNLOCK()
+#endif // ESP32
+
+/**
+  * @brief Copies random bytes from DRBG
+  * @param buf Destination buffer
+  * @param len Number of bytes
+  */
+static void drbgRead (uint8_t* buf, size_t len) {
+	DRBG_LOCK ();
+	drbg.read (buf, len);
+	DRBG_UNLOCK ();
+}
+#endif // USE_FAST_DRBG
+
+uint32_t CryptModule::random () {
+#if USE_FAST_DRBG
+	uint32_t rnd;
+	drbgRead ((uint8_t*)&rnd, sizeof (uint32_t));
+	return rnd;
+#else
+	return hardwareRandom ();
+#endif // USE_FAST_DRBG
+}
+
 uint8_t* CryptModule::random (const uint8_t* buf, size_t len) {
 	if (buf) {
+#if USE_FAST_DRBG
+		drbgRead (const_cast<uint8_t*>(buf), len);
+#else
 		for (unsigned int i = 0; i < len; i += sizeof (uint32_t)) {
-			uint32_t rnd = random ();
+			uint32_t rnd = hardwareRandom ();
 			if (i < len - (len % sizeof (int32_t))) {
 				memcpy (const_cast<uint8_t*>(buf) + i, &rnd, sizeof (uint32_t));
 			} else {
 				memcpy (const_cast<uint8_t*>(buf) + i, &rnd, len % sizeof (int32_t));
 			}
 		}
+#endif // USE_FAST_DRBG
 	}
 	return const_cast<uint8_t*>(buf);
 }
 
+void CryptModule::seedRandom (const uint8_t* seed, size_t len, bool deterministic) {
+#if USE_FAST_DRBG
+	uint8_t seedKey[KEY_LENGTH];
+
+	if (!seed || !len) {
+		return;
+	}
+	// Compress seed of any length into a key
+	SHA256 hash;
+	hash.update (seed, len);
+	hash.finalize (seedKey, KEY_LENGTH);
+	hash.clear ();
+
+	if (deterministic) {
+		DEBUG_WARN ("DRBG in deterministic mode. Do not use it in production");
+	}
+	DRBG_LOCK ();
+	drbg.seed (seedKey, deterministic);
+	DRBG_UNLOCK ();
+	memset (seedKey, 0, KEY_LENGTH);
+#else
+	DEBUG_WARN ("DRBG is disabled. Seed ignored");
+#endif // USE_FAST_DRBG
+}
+
+uint32_t CryptModule::getRandomBytesServed () {
+#if USE_FAST_DRBG
+	return drbg.getBytesServed ();
+#else
+	return 0;
+#endif // USE_FAST_DRBG
+}
+
+uint32_t CryptModule::getRandomReseedCount () {
+#if USE_FAST_DRBG
+	return drbg.getReseedCount ();
+#else
+	return 0;
+#endif // USE_FAST_DRBG
+}
+
 void CryptModule::getDH1 () {
 	Curve25519::dh1 (publicDHKey, privateDHKey);
 	DEBUG_VERBOSE ("Public key: %s", printHexBuffer (publicDHKey, KEY_LENGTH));
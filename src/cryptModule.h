@@ -35,11 +35,38 @@ const uint8_t CRC_LENGTH = sizeof (uint32_t); ///< @brief Length of CRC
 class CryptModule {
 public:
 	/**
-	  * @brief Gets a random number
+	  * @brief Gets a random number. If `USE_FAST_DRBG` is enabled it comes from ChaCha20 DRBG, otherwise from hardware RNG
 	  * @return Returns a random number
 	  */
 	static uint32_t random ();
 
+	/**
+	  * @brief Gets a random number directly from hardware RNG
+	  * @return Returns a random number
+	  */
+	static uint32_t hardwareRandom ();
+
+	/**
+	  * @brief Mixes a seed into DRBG state. In deterministic mode DRBG state depends only on given seed and it is never
+	  * reseeded from hardware RNG, so that random sequence is repeatable. Deterministic mode is intended for testing only
+	  * @param seed Seed buffer
+	  * @param len Seed length in number of bytes
+	  * @param deterministic `true` to disable hardware entropy
+	  */
+	static void seedRandom (const uint8_t* seed, size_t len, bool deterministic = false);
+
+	/**
+	  * @brief Gets number of random bytes served since boot
+	  * @return Number of bytes
+	  */
+	static uint32_t getRandomBytesServed ();
+
+	/**
+	  * @brief Gets number of times that DRBG has been reseeded from hardware RNG since boot
+	  * @return Number of reseeds
+	  */
+	static uint32_t getRandomReseedCount ();
+
 	static uint32_t random (uint32_t max, uint32_t min = 0) {
 		uint32_t _max, _min;
 
@@ -65,6 +92,32 @@ public:
 	  */
 	static uint8_t* random (const uint8_t* buf, size_t len);
 
+	/**
+	  * @brief Calculates HMAC-SHA256 of a buffer
+	  * @param key HMAC key
+	  * @param keyLen HMAC key length
+	  * @param data Data to authenticate
+	  * @param length Data length in number of bytes
+	  * @param hmac Buffer to store HMAC
+	  * @param hmacLen Number of HMAC bytes to store. Result is truncated if it is lower than 32
+	  */
+	static void getHMAC (const uint8_t* key, size_t keyLen, const uint8_t* data, size_t length, uint8_t* hmac, size_t hmacLen);
+
+	/**
+	  * @brief Derives key material using HKDF-SHA256 (RFC 5869)
+	  * @param ikm Input key material
+	  * @param ikmLen Input key material length
+	  * @param salt Salt. May be NULL
+	  * @param saltLen Salt length
+	  * @param info Context information that binds derived key to its usage
+	  * @param infoLen Context information length
+	  * @param okm Buffer to store derived key
+	  * @param okmLen Number of bytes to derive. It must not be higher than 8160
+	  * @return `true` if key was derived
+	  */
+	static bool deriveKey (const uint8_t* ikm, size_t ikmLen, const uint8_t* salt, size_t saltLen,
+						   const uint8_t* info, size_t infoLen, uint8_t* okm, size_t okmLen);
+
 	/**
 	  * @brief Decrypts a buffer using a shared key
 	  * @param data Buffer to decrypt. It will be used as input and output
@@ -77,11 +130,13 @@ public:
 	  * @param aadLen Additional Authentication Data length
 	  * @param tag Buffer to store authentication tag calculated by Poly1305
 	  * @param tagLen Additional Authentication Tag length
+	  * @param suite Cipher suite agreed with the other peer. ChaChaPoly by default
 	  * @return True if decryption and tag checking was correct
 	  */
 	static bool decryptBuffer (const uint8_t* data, size_t length,
 							   const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen);
+							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+							   cipherSuite_t suite = CIPHER_CHACHAPOLY);
 
 	/**
 	  * @brief Generates a SHA256 hash from input
@@ -103,11 +158,61 @@ public:
 	  * @param aadLen Additional Authentication Data length
 	  * @param tag Buffer to store authentication tag calculated by Poly1305
 	  * @param tagLen Additional Authentication Tag length
+	  * @param suite Cipher suite agreed with the other peer. ChaChaPoly by default
 	  * @return True if encryption and tag generation was correct
 	  */
 	static bool encryptBuffer (const uint8_t* data, size_t length,
 							   const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen);
+							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+							   cipherSuite_t suite = CIPHER_CHACHAPOLY);
+
+	/**
+	  * @brief Checks if a cipher suite is available on this build
+	  * @param suite Cipher suite to check
+	  * @return `true` if suite is enabled in `SUPPORTED_CIPHER_SUITES`
+	  */
+	static bool isSuiteSupported (cipherSuite_t suite) {
+		return (suite == CIPHER_CHACHAPOLY) || ((uint8_t)suite < 8 && (SUPPORTED_CIPHER_SUITES & (1 << suite)));
+	}
+
+	/**
+	  * @brief Selects cipher suite to use from a mask offered by the other peer
+	  * @param offered Bit mask of suites supported by the other peer
+	  * @return `PREFERRED_CIPHER_SUITE` if both peers support it, ChaChaPoly otherwise
+	  */
+	static cipherSuite_t selectSuite (uint8_t offered) {
+		if ((offered & (1 << PREFERRED_CIPHER_SUITE)) && isSuiteSupported (PREFERRED_CIPHER_SUITE)) {
+			return PREFERRED_CIPHER_SUITE;
+		}
+		return CIPHER_CHACHAPOLY;
+	}
+
+	/**
+	  * @brief Checks if ClientHello Random field carries capabilities
+	  *
+	  * A 0.9.8 node fills Random with random data, so it is only read as capabilities when bits 16-31 carry `HELLO_CAPABILITY_MARKER` and reserved bits 5-7 are clear
+	  * @param random ClientHello Random field
+	  * @return `true` if node signals capabilities
+	  */
+	static bool helloSignalsCapabilities (uint32_t random) {
+		return (random >> 16) == HELLO_CAPABILITY_MARKER && (random & 0x000000E0U) == 0;
+	}
+
+	/**
+	  * @brief Selects cipher suite for a node from its ClientHello Random field
+	  * @param random ClientHello Random field. Bits 8-15 carry offered suites mask
+	  * @return Suite given by `selectSuite` if node signals capabilities, ChaChaPoly otherwise
+	  */
+	static cipherSuite_t selectHelloSuite (uint32_t random) {
+		return helloSignalsCapabilities (random) ? selectSuite ((random >> 8) & 0x000000FFU) : CIPHER_CHACHAPOLY;
+	}
+
+	/**
+	  * @brief Gets cipher suite name for logging
+	  * @param suite Cipher suite
+	  * @return Human readable suite name
+	  */
+	static const char* getSuiteName (cipherSuite_t suite);
 
 	/**
 	  * @brief Starts first stage of Diffie Hellman key agreement algorithm
@@ -13,6 +13,9 @@ extern "C" {
 #elif defined ESP32
 #include <esp_now.h>
 #include <esp_wifi.h>
+#if __has_include (<esp_idf_version.h>)
+#include <esp_idf_version.h>
+#endif
 #endif
 }
 
@@ -74,8 +77,49 @@ typedef struct {
 
 Espnow_halClass Espnow_hal;
 
+#ifdef ESP32
+#define TX_LOCK() portENTER_CRITICAL (&txMux)
+#define TX_UNLOCK() portEXIT_CRITICAL (&txMux)
+#else
+#define TX_LOCK()
+#define TX_UNLOCK()
+#endif
+
 peerType_t _peerType;
 
+#if USE_LINK_ADAPTATION
+#ifdef ESP8266
+// Only OFDM rates may be fixed. 1 Mbps means default rate
+static const uint8_t LINK_RATE_MASK = (1 << LINK_RATE_1M) | (1 << LINK_RATE_12M) | (1 << LINK_RATE_24M) | (1 << LINK_RATE_54M);
+static const uint8_t PHY_RATES[LINK_NUM_RATES] = { 0, 0, 0, 0, PHY_RATE_12, PHY_RATE_24, PHY_RATE_54 };
+#elif defined ESP32 && ESP_IDF_VERSION_MAJOR >= 4
+static const uint8_t LINK_RATE_MASK = 0xFF;
+static const wifi_phy_rate_t PHY_RATES[LINK_NUM_RATES] = {
+    WIFI_PHY_RATE_1M_L, WIFI_PHY_RATE_2M_L, WIFI_PHY_RATE_5M_L, WIFI_PHY_RATE_11M_L,
+    WIFI_PHY_RATE_12M, WIFI_PHY_RATE_24M, WIFI_PHY_RATE_54M
+};
+#else
+// ESP-NOW rate cannot be configured on this SDK. Only power is adapted
+static const uint8_t LINK_RATE_MASK = (1 << LINK_RATE_1M);
+#endif
+#endif // USE_LINK_ADAPTATION
+
+#ifdef ESP32
+#if defined ESP_ARDUINO_VERSION_MAJOR && ESP_ARDUINO_VERSION_MAJOR >= 2
+static const WiFiEvent_t CHANNEL_CHANGE_EVENT = ARDUINO_EVENT_WIFI_STA_CONNECTED; ///< @brief WiFi event after which channel may be different
+#else
+static const WiFiEvent_t CHANNEL_CHANGE_EVENT = SYSTEM_EVENT_STA_CONNECTED; ///< @brief WiFi event after which channel may be different
+#endif
+
+/**
+  * @brief Connecting to an AP moves interface to AP channel. Cached channel is read again on next send
+  * @param event WiFi event
+  */
+static void channelEvent (WiFiEvent_t event) {
+	Espnow_hal.channelChanged ();
+}
+#endif
+
 void Espnow_halClass::initComms (peerType_t peerType) {
 	if (esp_now_init ()) {
 		ESP.restart ();
@@ -105,14 +149,17 @@ void Espnow_halClass::initComms (peerType_t peerType) {
 	esp_now_register_recv_cb (reinterpret_cast<esp_now_recv_cb_t>(rx_cb));
     esp_now_register_send_cb (reinterpret_cast<esp_now_send_cb_t>(tx_cb));
 
+#if USE_LINK_ADAPTATION
+    links.setRateMask (LINK_RATE_MASK);
+#endif
+
 #ifdef ESP32
+    channelEventId = WiFi.onEvent (channelEvent, CHANNEL_CHANGE_EVENT);
     xTaskCreateUniversal (runHandle, "espnow_loop", 2048, NULL, 1, &espnowLoopTask, CONFIG_ARDUINO_RUNNING_CORE);
 #else
     os_timer_setfn (&espnowLoopTask, runHandle, NULL);
-    os_timer_arm (&espnowLoopTask, 20, true);
-    // timer1_attachInterrupt (runHandle);
-    // timer1_enable (TIM_DIV16, TIM_EDGE, TIM_LOOP);
-    // timer1_write (25000); //5000 us
+    transmitEnabled = true;
+    scheduleHandle ();
 #endif
 }
 
@@ -121,17 +168,22 @@ void ICACHE_FLASH_ATTR Espnow_halClass::rx_cb (uint8_t* mac_addr, uint8_t* data,
     wifi_promiscuous_pkt_t* promiscuous_pkt = (wifi_promiscuous_pkt_t*)(data - sizeof (wifi_pkt_rx_ctrl_t) - sizeof (espnow_frame_format_t));
     wifi_pkt_rx_ctrl_t* rx_ctrl = &promiscuous_pkt->rx_ctrl;
     
+    // Link controller is updated by upper layer once message is authenticated
     if (Espnow_hal.dataRcvd) {
         Espnow_hal.dataRcvd (mac_addr, data, len, rx_ctrl->rssi - 98); // rssi should be in dBm but it has added almost 100 dB. Do not know why
 	}
 }
 
 void ICACHE_FLASH_ATTR Espnow_halClass::tx_cb (uint8_t* mac_addr, uint8_t status) {
-    Espnow_hal.readyToSend = true;
-    DEBUG_DBG ("Ready to send: true");
-	if (Espnow_hal.sentResult) {
-		Espnow_hal.sentResult (mac_addr, status);
-	}
+    // Status is processed in handle () so that retries and callbacks do not run in WiFi task context.
+    // ESP-NOW gives one status per accepted frame, in sending order, so callback count identifies the frame
+    Espnow_hal.txStatusSeq = ++Espnow_hal.txCallbackSeq;
+    if (mac_addr) {
+        memcpy ((uint8_t*)Espnow_hal.txStatusAddress, mac_addr, COMMS_HAL_ADDR_LEN);
+    }
+    Espnow_hal.txStatus = status;
+    Espnow_hal.txDone = true;
+    Espnow_hal.scheduleHandle ();
 }
 
 void Espnow_halClass::begin (uint8_t* gateway, uint8_t channel, peerType_t peerType) {
@@ -143,21 +195,20 @@ void Espnow_halClass::begin (uint8_t* gateway, uint8_t channel, peerType_t peerT
 		memcpy (this->gateway, gateway, COMMS_HAL_ADDR_LEN);
 		this->channel = channel;
 	}
+#ifdef ESP32
+	peers.begin (PEER_CACHE_SIZE, addPeer, delPeer);
+	peers.pin (BROADCAST_ADDRESS); // Broadcast peer is never evicted
+#endif
 	initComms (peerType);
-	if (_ownPeerType == COMM_NODE) {
-		addPeer (BROADCAST_ADDRESS);
-	}
 }
 
-bool Espnow_halClass::addPeer (const uint8_t* da) {
 #ifdef ESP32
+peer_add_result_t Espnow_halClass::addPeer (const uint8_t* da, uint8_t ch) {
 	esp_now_peer_info_t peer;
+	memset (&peer, 0, sizeof (peer));
 	memcpy (peer.peer_addr, da, COMMS_HAL_ADDR_LEN);
-	uint8_t ch;
-	wifi_second_chan_t secondCh;
-	esp_wifi_get_channel (&ch, &secondCh);
 	peer.channel = ch;
-    if (_ownPeerType == COMM_NODE) {
+    if (Espnow_hal._ownPeerType == COMM_NODE) {
         peer.ifidx = WIFI_IF_STA;
     } else {
         peer.ifidx = WIFI_IF_AP;
@@ -165,21 +216,100 @@ bool Espnow_halClass::addPeer (const uint8_t* da) {
 	peer.encrypt = false;
 	esp_err_t error = esp_now_add_peer (&peer);
 	DEBUG_DBG ("Peer %s added on channel %u. Result 0x%X %s", mac2str (da), ch, error, esp_err_to_name (error));
-	return error == ESP_OK;
-#else 
-	return true;
-#endif
+	if (error == ESP_OK || error == ESP_ERR_ESPNOW_EXIST) {
+		return PEER_ADD_OK;
+	}
+	return error == ESP_ERR_ESPNOW_FULL ? PEER_ADD_FULL : PEER_ADD_ERROR;
 }
 
+void Espnow_halClass::delPeer (const uint8_t* da) {
+	esp_now_del_peer (da);
+}
+
+bool Espnow_halClass::cachePeer (const uint8_t* da) {
+	if (!peers.isChannelKnown ()) {
+		uint8_t ch;
+		wifi_second_chan_t secondCh;
+		esp_wifi_get_channel (&ch, &secondCh);
+		peers.setChannel (ch);
+	}
+	return peers.get (da);
+}
+#endif
+
 void Espnow_halClass::stop () {
     DEBUG_INFO ("-------------> ESP-NOW STOP");
 	esp_now_unregister_recv_cb ();
     esp_now_unregister_send_cb ();
     esp_now_deinit ();
+#ifdef ESP32
+	peers.reset (); // Peer list is deleted on deinit
+	if (channelEventId) {
+		WiFi.removeEvent (channelEventId);
+		channelEventId = 0;
+	}
+#endif
+	txCallbackSeq = 0; // Pending send callbacks are not called after deinit
+	txSentSeq = 0;
+#if USE_LINK_ADAPTATION
+	links.clear ();
+	appliedTxPower = 0;
+#endif
+}
+
+uint8_t Espnow_halClass::countMessages (const uint8_t* da, espnow_tx_item_t** oldest) {
+    uint8_t count = 0;
+
+    if (oldest) {
+        *oldest = nullptr;
+    }
+    for (int i = 0; i < COMMS_QUEUE_SIZE; i++) {
+        espnow_tx_item_t* item = &txPool[i];
+        if (!item->used) {
+            continue;
+        }
+        if (da && memcmp (item->message.dstAddress, da, COMMS_HAL_ADDR_LEN)) {
+            continue;
+        }
+        count++;
+        if (oldest && item != inFlight && (!*oldest || item->order < (*oldest)->order)) {
+            *oldest = item;
+        }
+    }
+    return count;
+}
+
+espnow_tx_item_t* Espnow_halClass::getBusiestOldest () {
+    espnow_tx_item_t* victim = nullptr;
+    uint8_t victimCount = 0;
+
+    for (int i = 0; i < COMMS_QUEUE_SIZE; i++) {
+        espnow_tx_item_t* oldest;
+        if (!txPool[i].used || &txPool[i] == inFlight) {
+            continue;
+        }
+        uint8_t count = countMessages (txPool[i].message.dstAddress, &oldest);
+        if (oldest && (count > victimCount || (count == victimCount && oldest->order < victim->order))) {
+            victim = oldest;
+            victimCount = count;
+        }
+    }
+    return victim;
+}
+
+uint8_t Espnow_halClass::getQueueDepth (const uint8_t* da) {
+    uint8_t count;
+
+    TX_LOCK ();
+    count = countMessages (da);
+    TX_UNLOCK ();
+    return count;
 }
 
 int32_t Espnow_halClass::send (uint8_t* da, uint8_t* data, int len) {
-    comms_queue_item_t message;
+    espnow_tx_item_t* slot = nullptr;
+    espnow_tx_item_t* victim = nullptr;
+    espnow_tx_item_t dropped;
 
     if (!da || !data || !len) {
         DEBUG_WARN ("Parameters error");
@@ -191,16 +321,58 @@ int32_t Espnow_halClass::send (uint8_t* da, uint8_t* data, int len) {
         return -1;
     }
 
-    if (out_queue.size () >= COMMS_QUEUE_SIZE) {
-        out_queue.pop ();
+    TX_LOCK ();
+    // Drop oldest message for this destination if it has too many, or oldest message of busiest destination if queue is full
+    if (countMessages (da, &victim) < COMMS_QUEUE_PER_DESTINATION) {
+        victim = nullptr;
+        for (int i = 0; i < COMMS_QUEUE_SIZE; i++) {
+            if (!txPool[i].used) {
+                slot = &txPool[i];
+                break;
+            }
+        }
+        if (!slot) {
+            victim = getBusiestOldest ();
+        }
+    }
+    if (victim) {
+        memcpy (&dropped, victim, sizeof (espnow_tx_item_t));
+        slot = victim;
+        txStats.dropped++;
+        txStats.depth--;
     }
+    if (slot) {
+        memcpy (slot->message.dstAddress, da, COMMS_HAL_ADDR_LEN);
+        slot->message.payload_len = len;
+        memcpy (slot->message.payload, data, len);
+        if (!++txHandle) {
+            txHandle++; // 0 means no handle
+        }
+        slot->handle = txHandle;
+        slot->order = txOrder++;
+        slot->notBefore = millis ();
+        slot->queuedAt = micros ();
+        slot->attempts = 0;
+        slot->used = true;
+        lastTxHandle = txHandle;
+        txStats.queued++;
+        txStats.depth++;
+        if (txStats.depth > txStats.maxDepth) {
+            txStats.maxDepth = txStats.depth;
+        }
+    }
+    TX_UNLOCK ();
 
-    memcpy (message.dstAddress, da, ENIGMAIOT_ADDR_LEN);
-    message.payload_len = len;
-    memcpy (message.payload, data, len);
-    
-    if (out_queue.push (&message)) {
-        DEBUG_DBG ("%d Comms messages queued. Type: 0x%02X Len: %d", out_queue.size (), data[0], len);
+    if (victim) {
+        DEBUG_WARN ("Queue full. Message #%u to %s dropped", dropped.handle, mac2str (dropped.message.dstAddress));
+        if (txReceipt) {
+            txReceipt (dropped.handle, dropped.message.dstAddress, COMMS_TX_DROPPED, dropped.attempts);
+        }
+    }
+
+    if (slot) {
+        DEBUG_DBG ("%d Comms messages queued. Type: 0x%02X Len: %d Handle: %u", txStats.depth, data[0], len, lastTxHandle);
+        scheduleHandle ();
         return 0;
     } else {
         DEBUG_WARN ("Error queuing Comms message 0x%02X to %s", data[0], mac2str (da));
@@ -208,24 +380,107 @@ int32_t Espnow_halClass::send (uint8_t* da, uint8_t* data, int len) {
     }
 }
 
-comms_queue_item_t* Espnow_halClass::getCommsQueue () {
-    if (out_queue.size ()) {
-        DEBUG_DBG ("Comms message got from queue");
-        return out_queue.front ();
+espnow_tx_item_t* Espnow_halClass::getNextMessage () {
+    espnow_tx_item_t* next = nullptr;
+    uint32_t now = millis ();
+
+    TX_LOCK ();
+    for (int i = 0; i < COMMS_QUEUE_SIZE; i++) {
+        espnow_tx_item_t* item = &txPool[i];
+        if (!item->used || (int32_t)(now - item->notBefore) < 0) {
+            continue;
+        }
+        if (next && next->order < item->order) {
+            continue;
+        }
+        // Only first message of each destination may be sent so that order is kept while it waits for a retry
+        bool first = true;
+        for (int j = 0; j < COMMS_QUEUE_SIZE; j++) {
+            espnow_tx_item_t* other = &txPool[j];
+            if (other->used && other->order < item->order && !memcmp (other->message.dstAddress, item->message.dstAddress, COMMS_HAL_ADDR_LEN)) {
+                first = false;
+                break;
+            }
+        }
+        if (first) {
+            next = item;
+        }
     }
-    return nullptr;
+    TX_UNLOCK ();
+    return next;
 }
 
-void Espnow_halClass::popCommsQueue () {
-    if (out_queue.size ()) {
-        comms_queue_item_t* message;
+void Espnow_halClass::releaseMessage (espnow_tx_item_t* item, comms_tx_status_t status) {
+    uint8_t address[COMMS_HAL_ADDR_LEN];
+    uint32_t handle = item->handle;
+    uint8_t attempts = item->attempts;
+
+    memcpy (address, item->message.dstAddress, COMMS_HAL_ADDR_LEN);
+    TX_LOCK ();
+    item->used = false;
+    item->message.payload_len = 0;
+    txStats.depth--;
+    TX_UNLOCK ();
+    DEBUG_DBG ("Comms message #%u released after %u attempts. Status %d. Queue size %d", handle, attempts, status, txStats.depth);
+
+    if (txReceipt) {
+        txReceipt (handle, address, status, attempts);
+    }
+    if (sentResult) {
+        sentResult (address, status == COMMS_TX_DELIVERED ? 0 : 1);
+    }
+}
+
+void Espnow_halClass::processTxStatus () {
+    uint8_t status;
+
+    if (!inFlight) {
+        return;
+    }
+    if (txDone && (txStatusSeq != inFlightSeq || memcmp ((uint8_t*)txStatusAddress, inFlight->message.dstAddress, COMMS_HAL_ADDR_LEN))) {
+        // Late status of a frame that already timed out. It must not be credited to this one
+        DEBUG_DBG ("Send status for frame %u ignored. Waiting for %u", txStatusSeq, inFlightSeq);
+        txDone = false;
+    }
+    if (txDone) {
+        status = txStatus;
+    } else if (millis () - inFlightSince > COMMS_TX_TIMEOUT) {
+        DEBUG_WARN ("No send status for message #%u", inFlight->handle);
+        status = 1;
+    } else {
+        return;
+    }
+
+    espnow_tx_item_t* item = inFlight;
+    inFlight = nullptr;
 
-        message = out_queue.front ();
-        if (message) {
-            message->payload_len = 0;
+#if USE_LINK_ADAPTATION
+    if (memcmp (item->message.dstAddress, BROADCAST_ADDRESS, COMMS_HAL_ADDR_LEN)) { // Broadcast is never acknowledged
+        TX_LOCK ();
+        links.get (item->message.dstAddress)->txResult (status == 0);
+        TX_UNLOCK ();
+    }
+#endif
+
+    if (status == 0) {
+        uint32_t latency = micros () - item->queuedAt;
+        txStats.delivered++;
+        txStats.totalLatency += latency;
+        if (latency > txStats.maxLatency) {
+            txStats.maxLatency = latency;
+        }
+        releaseMessage (item, COMMS_TX_DELIVERED);
+    } else if (item->attempts > COMMS_MAX_RETRIES) {
+        DEBUG_WARN ("Message #%u to %s failed after %u attempts", item->handle, mac2str (item->message.dstAddress), item->attempts);
+        txStats.failed++;
+        releaseMessage (item, COMMS_TX_FAILED);
+    } else {
+        uint32_t backoff = (uint32_t)COMMS_RETRY_BACKOFF << (item->attempts - 1);
+        if (backoff > COMMS_RETRY_BACKOFF_MAX) {
+            backoff = COMMS_RETRY_BACKOFF_MAX;
         }
-        out_queue.pop ();
-        DEBUG_DBG ("Comms message pop. Queue size %d", out_queue.size ());
+        item->notBefore = millis () + backoff;
+        DEBUG_DBG ("Message #%u to %s not acknowledged. Retry in %u ms", item->handle, mac2str (item->message.dstAddress), backoff);
     }
 }
 
@@ -241,25 +496,89 @@ int32_t Espnow_halClass::sendEspNowMessage (comms_queue_item_t* message) {
     
 	DEBUG_DBG ("ESP-NOW message to %s", mac2str(message->dstAddress));
 #ifdef ESP32
-	//if (_ownPeerType == COMM_GATEWAY) {
-        addPeer (message->dstAddress);
-        DEBUG_DBG ("Peer added");
-    //}
+	if (!cachePeer (message->dstAddress)) {
+		DEBUG_WARN ("Cannot register peer %s", mac2str (message->dstAddress));
+		return -1;
+	}
+#endif
+
+#if USE_LINK_ADAPTATION
+    applyLinkSettings (message->dstAddress);
 #endif
 
-    DEBUG_DBG ("Ready to send: false");
-    readyToSend = false;
     error = esp_now_send (message->dstAddress, message->payload, message->payload_len);
 #ifdef ESP32
     DEBUG_DBG ("esp now send result = %s", esp_err_to_name(error));
-	//if (_ownPeerType == COMM_GATEWAY) {
-        error = esp_now_del_peer (message->dstAddress); // TODO: test
-        DEBUG_DBG ("Peer deleted. Result %s", esp_err_to_name(error));
-	//}
 #endif
 	return error;
 }
 
+void Espnow_halClass::linkRssiUpdate (const uint8_t* address, int rssi) {
+#if USE_LINK_ADAPTATION
+    TX_LOCK ();
+    links.get (address)->rssiUpdate (rssi);
+    TX_UNLOCK ();
+#endif
+}
+
+#if USE_LINK_ADAPTATION
+
+void Espnow_halClass::applyLinkSettings (const uint8_t* da) {
+    uint8_t rate = LINK_RATE_1M;
+    int8_t txPower = LINK_MAX_TX_POWER;
+
+    if (memcmp (da, BROADCAST_ADDRESS, COMMS_HAL_ADDR_LEN)) {
+        TX_LOCK ();
+        LinkControllerClass* link = links.get (da);
+        rate = link->getRate ();
+        txPower = link->getTxPower ();
+        TX_UNLOCK ();
+    }
+
+    // Rate and power are set per interface so they are changed only when destination needs different ones
+    if (rate != appliedRate) {
+#ifdef ESP8266
+        if (rate == LINK_RATE_1M) {
+            wifi_set_user_fixed_rate (FIXED_RATE_MASK_NONE, 0);
+        } else {
+            wifi_set_user_fixed_rate (FIXED_RATE_MASK_ALL, PHY_RATES[rate]);
+        }
+#elif defined ESP32 && ESP_IDF_VERSION_MAJOR >= 4
+        esp_err_t error = esp_wifi_config_espnow_rate (_ownPeerType == COMM_NODE ? WIFI_IF_STA : WIFI_IF_AP, PHY_RATES[rate]);
+        if (error != ESP_OK) {
+            DEBUG_WARN ("Error setting ESP-NOW rate: %s", esp_err_to_name (error));
+        }
+#endif
+        appliedRate = rate;
+    }
+    if (txPower != appliedTxPower) {
+#ifdef ESP8266
+        system_phy_set_max_tpw (txPower);
+#elif defined ESP32
+        esp_wifi_set_max_tx_power (txPower);
+#endif
+        appliedTxPower = txPower;
+    }
+}
+#endif // USE_LINK_ADAPTATION
+
+bool Espnow_halClass::getLinkState (const uint8_t* da, comms_link_state_t* state) {
+#if USE_LINK_ADAPTATION
+    bool found = false;
+
+    TX_LOCK ();
+    LinkControllerClass* link = links.get (da, false);
+    if (link) {
+        link->getState (state);
+        found = true;
+    }
+    TX_UNLOCK ();
+    return found;
+#else
+    return false;
+#endif
+}
+
 void Espnow_halClass::onDataRcvd (comms_hal_rcvd_data dataRcvd) {
 	this->dataRcvd = dataRcvd;
 }
@@ -269,30 +588,91 @@ void Espnow_halClass::onDataSent (comms_hal_sent_data sentResult) {
 }
 
 void Espnow_halClass::handle () {
-    if (readyToSend) {
-        //DEBUG_WARN ("Process queue: Elements: %d", out_queue.size ());
-        if (!out_queue.empty ()) {
-            comms_queue_item_t* message;
-            message = getCommsQueue ();
-            if (message) {
-                if (!sendEspNowMessage (message)) {
-                    DEBUG_DBG ("Message to %s sent. Type: 0x%02X. Len: %u", mac2str (message->dstAddress), (message->payload)[0], message->payload_len);
-                } else {
-                    DEBUG_WARN ("Error sendign message to %s. Type: 0x%02X. Len: %u", mac2str (message->dstAddress), (message->payload)[0], message->payload_len);
-                }
-                popCommsQueue ();
+    processTxStatus ();
+    if (inFlight) {
+        return;
+    }
+
+    espnow_tx_item_t* item = getNextMessage ();
+    if (!item) {
+        return;
+    }
+
+    if (item->attempts) {
+        txStats.retries++;
+    }
+    item->attempts++;
+    txStats.attempts++;
+    txDone = false;
+    inFlightSince = millis ();
+    inFlight = item;
+    inFlightSeq = 0;
+    if (!sendEspNowMessage (&item->message)) {
+        inFlightSeq = ++txSentSeq;
+        DEBUG_DBG ("Message #%u to %s sent. Type: 0x%02X. Len: %u. Attempt %u", item->handle, mac2str (item->message.dstAddress), (item->message.payload)[0], item->message.payload_len, item->attempts);
+    } else {
+        DEBUG_WARN ("Error sendign message to %s. Type: 0x%02X. Len: %u", mac2str (item->message.dstAddress), (item->message.payload)[0], item->message.payload_len);
+        memcpy ((uint8_t*)txStatusAddress, item->message.dstAddress, COMMS_HAL_ADDR_LEN);
+        txStatusSeq = 0; // No callback will come for this frame
+        txStatus = 1; // Counts as a failed attempt
+        txDone = true;
+    }
+}
+
+uint32_t Espnow_halClass::nextEventDelay () {
+    uint32_t now = millis ();
+    uint32_t delay = NO_TX_EVENT;
+
+    if (inFlight) {
+        if (txDone) {
+            return 0;
+        }
+        uint32_t elapsed = now - inFlightSince;
+        return elapsed > COMMS_TX_TIMEOUT ? 0 : COMMS_TX_TIMEOUT - elapsed + 1;
+    }
+    TX_LOCK ();
+    for (int i = 0; i < COMMS_QUEUE_SIZE; i++) {
+        if (txPool[i].used) {
+            int32_t wait = txPool[i].notBefore - now;
+            if (wait <= 0) {
+                delay = 0;
+                break;
+            }
+            if ((uint32_t)wait < delay) {
+                delay = wait;
             }
         }
     }
+    TX_UNLOCK ();
+    return delay;
+}
+
+void Espnow_halClass::scheduleHandle (uint32_t delay) {
+#ifdef ESP32
+    if (espnowLoopTask) {
+        xTaskNotifyGive (espnowLoopTask);
+    }
+#else
+    if (!transmitEnabled || delay == NO_TX_EVENT) {
+        return;
+    }
+    os_timer_disarm (&espnowLoopTask);
+    os_timer_arm (&espnowLoopTask, delay, false);
+#endif
 }
 
 void Espnow_halClass::runHandle (void* param) {
 #ifdef ESP32
     for (;;) {
-#endif
         Espnow_hal.handle ();
-#ifdef ESP32
-        vTaskDelay (1 / portTICK_PERIOD_MS);
+        uint32_t delay = Espnow_hal.nextEventDelay ();
+        if (delay) {
+            // Wait for send (), send callback or next retry, whatever comes first
+            ulTaskNotifyTake (pdTRUE, delay == NO_TX_EVENT ? portMAX_DELAY : pdMS_TO_TICKS (delay) + 1);
+        }
     }
+#else
+    Espnow_hal.handle ();
+    Espnow_hal.scheduleHandle (Espnow_hal.nextEventDelay ());
 #endif
 }
@@ -24,6 +24,29 @@
 #include "Comms_hal.h"
 #include "helperFunctions.h"
 #include "EnigmaIOTRingBuffer.h"
+#ifdef ESP32
+#include "PeerCache.h"
+#endif
+#if USE_LINK_ADAPTATION
+#include "LinkController.h"
+#endif
+
+/**
+  * @brief Outgoing message slot. Messages for the same destination are sent in `order` sequence
+  */
+typedef struct {
+	comms_queue_item_t message; ///< @brief Destination and payload
+	uint32_t handle; ///< @brief Handle returned to upper layer to identify delivery receipt
+	uint32_t order; ///< @brief Queuing sequence number
+	uint32_t notBefore; ///< @brief Retry backoff. Message is not sent before this time (ms)
+	uint32_t queuedAt; ///< @brief Time when message was queued (us)
+	uint8_t attempts; ///< @brief Number of transmissions done
+	bool used; ///< @brief `true` if this slot holds a message
+} espnow_tx_item_t;
+
+#ifdef ESP32
+static const uint8_t PEER_CACHE_SIZE = ESPNOW_PEER_CACHE_SIZE < ESP_NOW_MAX_TOTAL_PEER_NUM ? ESPNOW_PEER_CACHE_SIZE : ESP_NOW_MAX_TOTAL_PEER_NUM; ///< @brief Actual peer cache size
+#endif
 
 /**
   * @brief Definition for ESP-NOW hardware abstraction layer
@@ -32,15 +55,39 @@ class Espnow_halClass : public Comms_halClass {
 public:
 	static const size_t COMMS_HAL_MAX_MESSAGE_LENGTH = 250; ///< @brief Maximum message length for ESP-NOW
 	static const uint8_t COMMS_HAL_ADDR_LEN = 6; ///< @brief Address length for ESP-NOW. Correspond to mac address
+	static const uint32_t NO_TX_EVENT = 0xFFFFFFFF; ///< @brief Transmission has nothing pending
 
 protected:
 
-    EnigmaIOTRingBuffer<comms_queue_item_t> out_queue;
-    bool readyToSend = true;
+    espnow_tx_item_t txPool[COMMS_QUEUE_SIZE]; ///< @brief Outgoing messages. Shared by all destinations but keeping per destination order. When it is full busiest destination gives up its oldest message
+    espnow_tx_item_t* inFlight = nullptr; ///< @brief Message waiting for send status
+    uint32_t inFlightSince; ///< @brief Time when in flight message was sent
+    volatile bool txDone = false; ///< @brief Set by send callback when status for in flight message is available
+    volatile uint8_t txStatus; ///< @brief Status of last transmission, got from send callback
+    volatile uint32_t txStatusSeq = 0; ///< @brief Frame that `txStatus` belongs to
+    volatile uint8_t txStatusAddress[6]; ///< @brief Destination that `txStatus` belongs to
+    volatile uint32_t txCallbackSeq = 0; ///< @brief Number of send callbacks got
+    uint32_t txSentSeq = 0; ///< @brief Number of frames accepted by ESP-NOW
+    uint32_t inFlightSeq = 0; ///< @brief Frame number of in flight message
+    uint32_t txOrder = 0; ///< @brief Sequence number for next queued message
+    uint32_t txHandle = 0; ///< @brief Last assigned message handle
 #ifdef ESP32
-    TaskHandle_t espnowLoopTask;
+    PeerCacheClass peers; ///< @brief Registered peers. Broadcast address is pinned
+    wifi_event_id_t channelEventId = 0; ///< @brief WiFi event handler that marks cached channel as stale
+#endif
+#if USE_LINK_ADAPTATION
+    LinkTableClass links; ///< @brief Rate and power controller of every peer
+    uint8_t appliedRate = LINK_RATE_1M; ///< @brief Rate currently configured on WiFi interface
+    int8_t appliedTxPower = 0; ///< @brief Power currently configured on WiFi interface. 0 if it has not been set
+#endif
+#ifdef ESP32
+    portMUX_TYPE txMux = portMUX_INITIALIZER_UNLOCKED; ///< @brief Protects transmission queue and link controllers
+#endif
+#ifdef ESP32
+    TaskHandle_t espnowLoopTask = NULL; ///< @brief Transmission task. It sleeps until it is notified or a retry is due
 #else // ESP8266
-    ETSTimer espnowLoopTask;
+    ETSTimer espnowLoopTask; ///< @brief One shot timer that runs transmission when there is something to do
+    bool transmitEnabled = false; ///< @brief `false` while transmission is disabled by `enableTransmit`
 #endif
 
 	/**
@@ -49,11 +96,29 @@ protected:
 	  */
 	void initComms (peerType_t peerType) override;
 
+#ifdef ESP32
 	/**
-	  * @brief Adds a peer to esp-now peer list
+	  * @brief Adds a peer to esp-now peer list. Used by peer cache
 	  * @param da Peer address to be added to peer list
+	  * @param ch Peer channel
+	  * @return Registration result
 	  */
-    bool addPeer (const uint8_t* da);
+    static peer_add_result_t addPeer (const uint8_t* da, uint8_t ch);
+
+	/**
+	  * @brief Removes a peer from esp-now peer list. Used by peer cache
+	  * @param da Peer address
+	  */
+    static void delPeer (const uint8_t* da);
+
+	/**
+	  * @brief Makes sure destination is registered as peer. Least recently used peer is removed if table is full.
+	  * WiFi channel is only read again after it may have changed
+	  * @param da Destination address
+	  * @return `true` if peer is registered
+	  */
+    bool cachePeer (const uint8_t* da);
+#endif
 
 	/**
 	  * @brief Function that processes incoming messages and passes them to upper layer
@@ -71,15 +136,67 @@ protected:
     static void ICACHE_FLASH_ATTR tx_cb (uint8_t* mac_addr, uint8_t status);
 
     int32_t sendEspNowMessage (comms_queue_item_t* message);
-    comms_queue_item_t* getCommsQueue ();
-    void popCommsQueue ();
+
+#if USE_LINK_ADAPTATION
+    /**
+      * @brief Configures WiFi interface with rate and power selected for a destination. Broadcast uses most robust settings
+      * @param da Destination address
+      */
+    void applyLinkSettings (const uint8_t* da);
+#endif
+
+    /**
+      * @brief Gets next message that may be sent now. It is the oldest message of any destination whose first message is not waiting for a retry
+      * @return Message slot or `nullptr` if no message can be sent now
+      */
+    espnow_tx_item_t* getNextMessage ();
+
+    /**
+      * @brief Frees a message slot and notifies its final status
+      * @param item Message slot
+      * @param status Final message status
+      */
+    void releaseMessage (espnow_tx_item_t* item, comms_tx_status_t status);
+
+    /**
+      * @brief Processes send status of in flight message. Message is released or scheduled for retry
+      */
+    void processTxStatus ();
+
+    /**
+      * @brief Counts queued messages
+      * @param da Destination address. `NULL` to count all messages
+      * @param oldest If not `NULL` it gets oldest message not in flight for that destination
+      * @return Number of queued messages
+      */
+    uint8_t countMessages (const uint8_t* da, espnow_tx_item_t** oldest = nullptr);
+
+    /**
+      * @brief Gets message to drop when queue is full. It is oldest message not in flight of destination with more queued
+      * messages, so that a busy destination cannot push out messages for other ones
+      * @return Message slot or `nullptr` if every queued message is in flight
+      */
+    espnow_tx_item_t* getBusiestOldest ();
+
+    /**
+      * @brief Calculates time until transmission needs to be processed again
+      * @return Time in milliseconds. `NO_TX_EVENT` if there is nothing to send
+      */
+    uint32_t nextEventDelay ();
+
+    /**
+      * @brief Wakes up transmission processing
+      * @param delay Time in milliseconds to wait before processing. Only used on ESP8266, ESP32 task calculates it by itself
+      */
+    void scheduleHandle (uint32_t delay = 0);
 
 public:
     /**
      * @brief Class constructor
      */
-    Espnow_halClass () :
-        out_queue (COMMS_QUEUE_SIZE) {}
+    Espnow_halClass () {
+        memset (txPool, 0, sizeof (txPool));
+    }
 
     
    /**
@@ -100,10 +217,32 @@ public:
 	  * @param da Destination address to send the message to
 	  * @param data Data buffer that contain the message to be sent
 	  * @param len Data length in number of bytes
-	  * @return Returns sending status. 0 for success, 1 to indicate an error.
+	  * @return Returns queuing status. 0 for success, -1 to indicate an error. Delivery status is notified later by `onTxReceipt` and `onDataSent` callbacks
 	  */
     int32_t send (uint8_t* da, uint8_t* data, int len) override;
 
+	/**
+	  * @brief Gets number of messages queued for a destination
+	  * @param da Destination address
+	  * @return Number of queued messages
+	  */
+    uint8_t getQueueDepth (const uint8_t* da) override;
+
+	/**
+	  * @brief Gets rate and power selected for a peer and its link quality
+	  * @param da Peer address
+	  * @param state Gets link state
+	  * @return `true` if link to that peer is being tracked
+	  */
+    bool getLinkState (const uint8_t* da, comms_link_state_t* state) override;
+
+	/**
+	  * @brief Updates link controller of a peer with signal strength of an authenticated message
+	  * @param address Peer address
+	  * @param rssi RSSI in dBm
+	  */
+    void linkRssiUpdate (const uint8_t* address, int rssi) override;
+
 	/**
 	  * @brief Attach a callback function to be run on every received message
 	  * @param dataRcvd Pointer to the callback function
@@ -132,6 +271,15 @@ public:
 		return COMMS_HAL_MAX_MESSAGE_LENGTH;
     }
 
+    /**
+      * @brief Marks cached WiFi channel as stale, so it is read again before next send
+      */
+    void channelChanged () override {
+#ifdef ESP32
+        peers.invalidateChannel ();
+#endif
+    }
+
     /**
       * @brief Enables or disables transmission of queued messages. Used to disable communication during wifi scan
       * @param enable `true` to enable transmission, `false` to disable it
@@ -140,24 +288,44 @@ public:
         DEBUG_DBG ("Send esp-now task %s", enable ? "enabled" : "disabled");
         if (enable) {
 #ifdef ESP8266
-            os_timer_arm (&espnowLoopTask, 20, true);
-            //timer1_enable (TIM_DIV16, TIM_EDGE, TIM_LOOP);
+            transmitEnabled = true;
+            scheduleHandle ();
 #else
+            channelChanged (); // Transmission is disabled during scan, that changes channel
             if (espnowLoopTask) {
                 vTaskResume (espnowLoopTask);
+                scheduleHandle ();
             }
 #endif
         } else {
 #ifdef ESP8266
+            transmitEnabled = false;
             os_timer_disarm (&espnowLoopTask);
-            //timer1_disable ();
 #else
             if (espnowLoopTask) {
                 vTaskSuspend (espnowLoopTask);
             }
 #endif
         }
-    } 
+    }
+
+#ifdef ESP32
+    /**
+      * @brief Gets peer cache counters
+      * @return Pointer to counters
+      */
+    const peer_cache_stats_t* getPeerCacheStats () {
+        return peers.getStats ();
+    }
+
+    /**
+      * @brief Gets ratio of sends that found its destination already registered
+      * @return Hit rate, from 0 to 1
+      */
+    float getPeerCacheHitRate () {
+        return peers.getHitRate ();
+    }
+#endif
 
     /**
       * @brief Sends next message in the queue
@@ -165,7 +333,7 @@ public:
     void handle () override;
 
     /**
-      * @brief Static function that calls handle inside task
+      * @brief Static function that calls handle inside task or timer. It sleeps until next transmission event
       */
     static void runHandle (void* param);
 
@@ -169,7 +169,7 @@ public:
         //message = buffer;
         int len = measureMsgPack (*entityConfig);
 
-        if (len > MAX_DATA_PAYLOAD_LENGTH) {
+        if (len > (int)MAX_FRAGMENTED_LENGTH) { // Longer than MAX_DATA_PAYLOAD_LENGTH is sent in fragments
             DEBUG_WARN ("Too long message. Reduce HA anounce options");
             return 0;
         }
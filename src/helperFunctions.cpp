@@ -29,6 +29,7 @@ char* printHexBuffer (const uint8_t* buffer, uint16_t len) {
 	return tempStr;
 }
 
+#if defined(ESP8266) || defined(ESP32)
 void initWiFi (uint8_t channel, const char* networkName, const char* networkKey, uint8_t role) {
 	DEBUG_DBG ("initWifi");
 	if (role == 0) { // Node
@@ -66,24 +67,7 @@ void initWiFi (uint8_t channel, const char* networkName, const char* networkKey,
 	DEBUG_INFO ("STA MAC address of this device is %s", WiFi.macAddress ().c_str ());
 
 }
-
-uint32_t calculateCRC32 (const uint8_t* data, size_t length) {
-	uint32_t crc = 0xffffffff;
-	while (length--) {
-		uint8_t c = *data++;
-		for (uint32_t i = 0x80; i > 0; i >>= 1) {
-			bool bit = crc & 0x80000000;
-			if (c & i) {
-				bit = !bit;
-			}
-			crc <<= 1;
-			if (bit) {
-				crc ^= 0x04c11db7;
-			}
-		}
-	}
-	return crc;
-}
+#endif // ESP8266 || ESP32
 
 #undef MACSTR
 #define MACSTR "%02X:%02X:%02X:%02X:%02X:%02X"
@@ -57,7 +57,9 @@ uint8_t* str2mac (const char* mac, uint8_t* values);
   * @param networkName Name that gateway AP will take
   * @param networkKey Network key. This is not required normally as this is provided using configuration web portal
   */
+#if defined(ESP8266) || defined(ESP32)
 void initWiFi (uint8_t channel, const char* networkName, const char* networkKey = NULL, uint8_t role = 0);
+#endif
 
 /**
   * @brief Calculates CRC32 of a buffer
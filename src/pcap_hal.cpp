@@ -0,0 +1,520 @@
+/**
+  * @file pcap_hal.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Capture and replay communication system abstraction layer. Feeds ESP-NOW frames from a pcap or pcapng
+  * file to upper layer and records sent messages to a pcap file
+  */
+
+#ifdef __linux__
+
+#include "pcap_hal.h"
+
+static const uint16_t LINKTYPE_IEEE802_11 = 105; ///< @brief 802.11 frames without radio information
+static const uint16_t LINKTYPE_IEEE802_11_RADIOTAP = 127; ///< @brief 802.11 frames with radiotap header
+
+static const uint32_t PCAPNG_SHB = 0x0A0D0D0A; ///< @brief Section header block
+static const uint32_t PCAPNG_IDB = 0x00000001; ///< @brief Interface description block
+static const uint32_t PCAPNG_SPB = 0x00000003; ///< @brief Simple packet block
+static const uint32_t PCAPNG_EPB = 0x00000006; ///< @brief Enhanced packet block
+
+static const uint8_t ESPRESSIF_OUI[] = { 0x18, 0xfe, 0x34 }; ///< @brief OUI used on ESP-NOW action frames
+static const uint8_t WLAN_HEADER_LEN = 24; ///< @brief 802.11 management frame header length
+static const uint8_t ESPNOW_HEADER_LEN = 15; ///< @brief Category, OUI, random value and vendor specific element header
+static const uint8_t ESPNOW_TYPE = 4; ///< @brief Vendor specific content type for ESP-NOW
+static const uint8_t ESPNOW_VERSION = 1; ///< @brief ESP-NOW version written on captured frames
+
+Pcap_halClass Pcap_hal;
+
+static void put16 (uint8_t* buffer, uint16_t value) {
+	buffer[0] = value;
+	buffer[1] = value >> 8;
+}
+
+static void put32 (uint8_t* buffer, uint32_t value) {
+	put16 (buffer, value);
+	put16 (buffer + 2, value >> 16);
+}
+
+bool Pcap_halClass::openReplay (const char* fileName, float speed, bool loop) {
+	replayFile = fopen (fileName, "rb");
+	if (!replayFile) {
+		DEBUG_ERROR ("Cannot open %s", fileName);
+		return false;
+	}
+	if (!readFileHeader ()) {
+		DEBUG_ERROR ("%s is not a pcap or pcapng file", fileName);
+		fclose (replayFile);
+		replayFile = NULL;
+		return false;
+	}
+	this->speed = speed;
+	loopReplay = loop;
+	DEBUG_INFO ("Replaying %s %s at speed x%.1f", fileName, pcapng ? "pcapng" : "pcap", speed);
+	return true;
+}
+
+bool Pcap_halClass::openCapture (const char* fileName) {
+	uint8_t header[24];
+
+	captureFile = fopen (fileName, "wb");
+	if (!captureFile) {
+		DEBUG_ERROR ("Cannot create %s", fileName);
+		return false;
+	}
+	put32 (header, 0xa1b2c3d4); // Magic number, microsecond resolution
+	put16 (header + 4, 2); // Version 2.4
+	put16 (header + 6, 4);
+	put32 (header + 8, 0); // Timezone
+	put32 (header + 12, 0); // Timestamp accuracy
+	put32 (header + 16, 65535); // Snap length
+	put32 (header + 20, LINKTYPE_IEEE802_11_RADIOTAP);
+	fwrite (header, 1, sizeof (header), captureFile);
+	return true;
+}
+
+bool Pcap_halClass::readFileHeader () {
+	uint8_t header[24];
+
+	if (fread (header, 1, 4, replayFile) != 4) {
+		return false;
+	}
+	swapped = false;
+	uint32_t magic = get32 (header);
+	if (magic == PCAPNG_SHB) {
+		pcapng = true;
+		numInterfaces = 0;
+		fseek (replayFile, 0, SEEK_SET); // Section header is processed as any other block
+		return true;
+	}
+
+	pcapng = false;
+	if (fread (header + 4, 1, 20, replayFile) != 20) {
+		return false;
+	}
+	switch (magic) {
+	case 0xa1b2c3d4:
+		tsDivisor = 1;
+		break;
+	case 0xa1b23c4d:
+		tsDivisor = 1000;
+		break;
+	case 0xd4c3b2a1:
+		swapped = true;
+		tsDivisor = 1;
+		break;
+	case 0x4d3cb2a1:
+		swapped = true;
+		tsDivisor = 1000;
+		break;
+	default:
+		return false;
+	}
+	linkType = get32 (header + 20) & 0xFFFF;
+	return true;
+}
+
+bool Pcap_halClass::readFrame (uint8_t* buffer, size_t* len, uint64_t* timestamp, uint16_t* frameLinkType) {
+	uint8_t header[16];
+
+	if (!pcapng) {
+		for (;;) {
+			if (fread (header, 1, 16, replayFile) != 16) {
+				return false;
+			}
+			uint32_t capLen = get32 (header + 8);
+			if (capLen > PCAP_HAL_MAX_BLOCK) {
+				fseek (replayFile, capLen, SEEK_CUR);
+				continue;
+			}
+			if (fread (buffer, 1, capLen, replayFile) != capLen) {
+				return false;
+			}
+			*len = capLen;
+			*timestamp = (uint64_t)get32 (header) * 1000000 + get32 (header + 4) / tsDivisor;
+			*frameLinkType = linkType;
+			return true;
+		}
+	}
+
+	for (;;) {
+		if (fread (header, 1, 8, replayFile) != 8) {
+			return false;
+		}
+		uint32_t blockType = get32 (header);
+		if (blockType == PCAPNG_SHB) {
+			// Byte order may change on every section
+			uint8_t byteOrder[4];
+			if (fread (byteOrder, 1, 4, replayFile) != 4) {
+				return false;
+			}
+			swapped = byteOrder[0] == 0x1A;
+			numInterfaces = 0;
+			fseek (replayFile, -4, SEEK_CUR);
+		}
+		uint32_t blockLen = get32 (header + 4);
+		if (blockLen < 12 || blockLen % 4) {
+			DEBUG_WARN ("Wrong pcapng block length %u", blockLen);
+			return false;
+		}
+		uint32_t bodyLen = blockLen - 8; // Includes trailing block length
+		if (bodyLen > PCAP_HAL_MAX_BLOCK || (blockType != PCAPNG_IDB && blockType != PCAPNG_EPB && blockType != PCAPNG_SPB)) {
+			fseek (replayFile, bodyLen, SEEK_CUR);
+			continue;
+		}
+		if (fread (buffer, 1, bodyLen, replayFile) != bodyLen) {
+			return false;
+		}
+
+		if (blockType == PCAPNG_IDB) {
+			if (numInterfaces >= PCAP_HAL_MAX_INTERFACES) {
+				continue;
+			}
+			uint64_t units = 1000000;
+			size_t idx = 8;
+			while (idx + 4 <= bodyLen - 4) {
+				uint16_t code = get16 (buffer + idx);
+				uint16_t optLen = get16 (buffer + idx + 2);
+				if (code == 0) {
+					break;
+				}
+				if (code == 9 && optLen >= 1) { // if_tsresol
+					uint8_t resolution = buffer[idx + 4];
+					if (resolution & 0x80) {
+						units = 1ULL << (resolution & 0x7F);
+					} else {
+						units = 1;
+						for (int i = 0; i < resolution; i++) {
+							units *= 10;
+						}
+					}
+				}
+				idx += 4 + ((optLen + 3) & ~3);
+			}
+			ifLinkType[numInterfaces] = get16 (buffer);
+			ifTsUnits[numInterfaces] = units;
+			numInterfaces++;
+			continue;
+		}
+
+		if (blockType == PCAPNG_SPB) {
+			if (!numInterfaces || bodyLen < 8) {
+				continue;
+			}
+			uint32_t capLen = get32 (buffer);
+			if (capLen > bodyLen - 8) {
+				capLen = bodyLen - 8;
+			}
+			memmove (buffer, buffer + 4, capLen);
+			*len = capLen;
+			*timestamp = lastTimestamp; // Simple packets have no timestamp
+			*frameLinkType = ifLinkType[0];
+			return true;
+		}
+
+		// Enhanced packet block
+		if (bodyLen < 24) {
+			continue;
+		}
+		uint32_t ifId = get32 (buffer);
+		uint32_t capLen = get32 (buffer + 12);
+		if (ifId >= numInterfaces || capLen > bodyLen - 24) {
+			continue;
+		}
+		uint64_t ts = ((uint64_t)get32 (buffer + 4) << 32) | get32 (buffer + 8);
+		uint64_t units = ifTsUnits[ifId];
+		*timestamp = units >= 1000000 ? ts / (units / 1000000) : ts * (1000000 / units);
+		*frameLinkType = ifLinkType[ifId];
+		memmove (buffer, buffer + 20, capLen);
+		*len = capLen;
+		lastTimestamp = *timestamp;
+		return true;
+	}
+}
+
+bool Pcap_halClass::parseFrame (uint8_t* frame, size_t len, uint16_t frameLinkType, uint8_t** src, uint8_t** dst, uint8_t** payload, uint8_t* payloadLen, int* rssi) {
+	size_t offset = 0;
+	bool fcs = false;
+
+	*rssi = 0;
+	if (frameLinkType == LINKTYPE_IEEE802_11_RADIOTAP) {
+		// Radiotap header is always little endian. Only fields up to antenna signal are needed
+		static const uint8_t fieldAlign[] = { 8, 1, 1, 2, 2, 1 }; // TSFT, flags, rate, channel, FHSS, antenna signal
+		static const uint8_t fieldSize[] = { 8, 1, 1, 4, 2, 1 };
+
+		if (len < 8) {
+			return false;
+		}
+		size_t rtLen = frame[2] | (frame[3] << 8);
+		if (rtLen > len) {
+			return false;
+		}
+		uint32_t present = frame[4] | (frame[5] << 8) | (frame[6] << 16) | ((uint32_t)frame[7] << 24);
+		size_t pos = 8;
+		uint32_t extended = present;
+		while ((extended & 0x80000000) && pos + 4 <= rtLen) {
+			extended = frame[pos + 3] << 24;
+			pos += 4;
+		}
+		for (int bit = 0; bit < (int)sizeof (fieldSize); bit++) {
+			if (!(present & (1 << bit))) {
+				continue;
+			}
+			pos = (pos + fieldAlign[bit] - 1) & ~(size_t)(fieldAlign[bit] - 1);
+			if (pos + fieldSize[bit] > rtLen) {
+				return false;
+			}
+			if (bit == 1) {
+				fcs = frame[pos] & 0x10;
+			} else if (bit == 5) {
+				*rssi = (int8_t)frame[pos];
+			}
+			pos += fieldSize[bit];
+		}
+		offset = rtLen;
+	} else if (frameLinkType != LINKTYPE_IEEE802_11) {
+		return false;
+	}
+
+	uint8_t* wlan = frame + offset;
+	size_t wlanLen = len - offset - (fcs ? 4 : 0);
+	if (len < offset + (fcs ? 4 : 0) || wlanLen < WLAN_HEADER_LEN + ESPNOW_HEADER_LEN) {
+		return false;
+	}
+	if ((wlan[0] & 0xFC) != 0xD0) { // Management action frame
+		return false;
+	}
+	uint8_t* body = wlan + WLAN_HEADER_LEN;
+	if (body[0] != 0x7F || memcmp (body + 1, ESPRESSIF_OUI, sizeof (ESPRESSIF_OUI))) { // Vendor specific category
+		return false;
+	}
+	uint8_t* element = body + 8; // After random value
+	if (element[0] != 0xDD || memcmp (element + 2, ESPRESSIF_OUI, sizeof (ESPRESSIF_OUI)) || element[5] != ESPNOW_TYPE) {
+		return false;
+	}
+	uint8_t elementLen = element[1];
+	if (elementLen <= 5 || element + 2 + elementLen > wlan + wlanLen || elementLen - 5 > MAX_MESSAGE_LENGTH) {
+		return false;
+	}
+
+	*dst = wlan + 4;
+	*src = wlan + 10;
+	*payload = element + 7;
+	*payloadLen = elementLen - 5;
+	return true;
+}
+
+void Pcap_halClass::captureFrame (const uint8_t* da, const uint8_t* data, uint8_t len) {
+	static const uint8_t RADIOTAP_LEN = 8;
+	uint8_t frame[16 + RADIOTAP_LEN + WLAN_HEADER_LEN + ESPNOW_HEADER_LEN + MAX_MESSAGE_LENGTH];
+	uint8_t* record = frame;
+	uint8_t* radiotap = record + 16;
+	uint8_t* wlan = radiotap + RADIOTAP_LEN;
+	uint8_t* body = wlan + WLAN_HEADER_LEN;
+	size_t frameLen = RADIOTAP_LEN + WLAN_HEADER_LEN + ESPNOW_HEADER_LEN + len;
+
+	uint64_t now = std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::system_clock::now ().time_since_epoch ()).count ();
+	put32 (record, now / 1000000);
+	put32 (record + 4, now % 1000000);
+	put32 (record + 8, frameLen);
+	put32 (record + 12, frameLen);
+
+	memset (radiotap, 0, RADIOTAP_LEN); // Radiotap header with no fields
+	radiotap[2] = RADIOTAP_LEN;
+
+	wlan[0] = 0xD0; // Action frame
+	wlan[1] = 0;
+	put16 (wlan + 2, 0); // Duration
+	memcpy (wlan + 4, da, COMMS_HAL_ADDR_LEN);
+	memcpy (wlan + 10, ownAddress, COMMS_HAL_ADDR_LEN);
+	memcpy (wlan + 16, da, COMMS_HAL_ADDR_LEN);
+	put16 (wlan + 22, txSequence++ << 4);
+
+	body[0] = 0x7F; // Vendor specific category
+	memcpy (body + 1, ESPRESSIF_OUI, sizeof (ESPRESSIF_OUI));
+	put32 (body + 4, rand ());
+	body[8] = 0xDD;
+	body[9] = len + 5;
+	memcpy (body + 10, ESPRESSIF_OUI, sizeof (ESPRESSIF_OUI));
+	body[13] = ESPNOW_TYPE;
+	body[14] = ESPNOW_VERSION;
+	memcpy (body + ESPNOW_HEADER_LEN, data, len);
+
+	fwrite (frame, 1, 16 + frameLen, captureFile);
+	stats.captured++;
+}
+
+void Pcap_halClass::initComms (peerType_t peerType) {
+	(void)peerType; // Replay does not depend on role
+	running = true;
+	replayThread = std::thread (&Pcap_halClass::loop, this);
+}
+
+void Pcap_halClass::begin (uint8_t* gateway, uint8_t channel, peerType_t peerType) {
+	_ownPeerType = peerType;
+	this->channel = channel;
+	if (peerType == COMM_NODE && gateway) {
+		memcpy (this->gateway, gateway, COMMS_HAL_ADDR_LEN);
+	}
+	DEBUG_INFO ("Starting pcap replay as %s", peerType == COMM_GATEWAY ? "gateway" : "node");
+	initComms (peerType);
+}
+
+void Pcap_halClass::stop () {
+	DEBUG_INFO ("-------------> PCAP STOP");
+	running = false;
+	wakeUp.notify_one ();
+	if (replayThread.joinable ()) {
+		replayThread.join ();
+	}
+	std::lock_guard<std::mutex> lock (halMutex);
+	if (replayFile) {
+		fclose (replayFile);
+		replayFile = NULL;
+	}
+	if (captureFile) {
+		fclose (captureFile);
+		captureFile = NULL;
+	}
+}
+
+int32_t Pcap_halClass::send (uint8_t* da, uint8_t* data, int len) {
+	if (!da || !data || !len) {
+		DEBUG_WARN ("Parameters error");
+		return -1;
+	}
+
+	if (len > MAX_MESSAGE_LENGTH) {
+		DEBUG_WARN ("Length error");
+		return -1;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock (halMutex);
+		if (txResultCount >= PCAP_HAL_QUEUE_SIZE) {
+			txStats.dropped++;
+			DEBUG_WARN ("Queue full. Message to %s dropped", mac2str (da));
+			return -1;
+		}
+		if (captureFile) {
+			captureFrame (da, data, len);
+		}
+		if (!++txHandle) {
+			txHandle++; // 0 means no handle
+		}
+		memcpy (txResults[txResultCount].address, da, COMMS_HAL_ADDR_LEN);
+		txResults[txResultCount].handle = txHandle;
+		txResultCount++;
+		lastTxHandle = txHandle;
+		txStats.queued++;
+		txStats.attempts++;
+	}
+	wakeUp.notify_one ();
+	return 0;
+}
+
+void Pcap_halClass::notifySent () {
+	uint8_t count;
+	struct {
+		uint8_t address[COMMS_HAL_ADDR_LEN];
+		uint32_t handle;
+	} results[PCAP_HAL_QUEUE_SIZE];
+
+	if (!transmitEnabled) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock (halMutex);
+		count = txResultCount;
+		memcpy (results, txResults, count * sizeof (results[0]));
+		txResultCount = 0;
+		txStats.delivered += count;
+	}
+	for (int i = 0; i < count; i++) {
+		if (txReceipt) {
+			txReceipt (results[i].handle, results[i].address, COMMS_TX_DELIVERED, 1);
+		}
+		if (sentResult) {
+			sentResult (results[i].address, 0);
+		}
+	}
+}
+
+void Pcap_halClass::loop () {
+	uint8_t buffer[PCAP_HAL_MAX_BLOCK];
+	uint64_t firstTimestamp = 0;
+	bool first = true;
+	std::chrono::steady_clock::time_point start;
+
+	while (running) {
+		notifySent ();
+		if (!replayFile) {
+			std::unique_lock<std::mutex> lock (halMutex);
+			wakeUp.wait (lock, [this] { return !running || (transmitEnabled && txResultCount); });
+			continue;
+		}
+
+		size_t len;
+		uint64_t timestamp;
+		uint16_t frameLinkType;
+		if (!readFrame (buffer, &len, &timestamp, &frameLinkType)) {
+			if (loopReplay) {
+				fseek (replayFile, 0, SEEK_SET);
+				readFileHeader ();
+				first = true;
+			} else {
+				DEBUG_INFO ("Replay finished. %u messages delivered in %u ms", stats.delivered, stats.elapsed);
+				std::lock_guard<std::mutex> lock (halMutex);
+				fclose (replayFile);
+				replayFile = NULL;
+			}
+			continue;
+		}
+		stats.frames++;
+
+		uint8_t* src;
+		uint8_t* dst;
+		uint8_t* payload;
+		uint8_t payloadLen;
+		int rssi;
+		if (!parseFrame (buffer, len, frameLinkType, &src, &dst, &payload, &payloadLen, &rssi)
+			|| (addressSet && memcmp (dst, ownAddress, COMMS_HAL_ADDR_LEN) && memcmp (dst, BROADCAST_ADDRESS, COMMS_HAL_ADDR_LEN))
+			|| (addressSet && !memcmp (src, ownAddress, COMMS_HAL_ADDR_LEN))) {
+			stats.skipped++;
+			continue;
+		}
+
+		if (first) {
+			firstTimestamp = timestamp;
+			start = std::chrono::steady_clock::now ();
+			first = false;
+		}
+		if (speed > 0 && timestamp > firstTimestamp) {
+			auto due = start + std::chrono::microseconds ((int64_t)((timestamp - firstTimestamp) / speed));
+			if (std::chrono::steady_clock::now () > due + std::chrono::milliseconds (1)) {
+				stats.late++;
+			}
+			// Send results are notified while waiting for next frame
+			while (running && std::chrono::steady_clock::now () < due) {
+				{
+					std::unique_lock<std::mutex> lock (halMutex);
+					wakeUp.wait_until (lock, due, [this] { return !running || (transmitEnabled && txResultCount); });
+				}
+				notifySent ();
+			}
+		}
+		if (!running) {
+			break;
+		}
+
+		DEBUG_DBG ("Replaying message from %s. Len %u RSSI %d", mac2str (src), payloadLen, rssi);
+		if (dataRcvd) {
+			dataRcvd (src, payload, payloadLen, rssi);
+		}
+		stats.delivered++;
+		stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - start).count ();
+	}
+}
+
+#endif // __linux__
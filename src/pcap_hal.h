@@ -0,0 +1,284 @@
+/**
+  * @file pcap_hal.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief Capture and replay communication system abstraction layer. Feeds ESP-NOW frames from a pcap or pcapng
+  * file to upper layer and records sent messages to a pcap file
+  *
+  * Replay accepts 802.11 frames with or without radiotap header. Only ESP-NOW vendor specific action frames are
+  * passed to upper layer, with source address and RSSI taken from capture. Frames are delivered at recorded pace,
+  * scaled by a speed factor, or as fast as possible. Sent messages are written as ESP-NOW frames with radiotap header
+  * so they may be inspected with Wireshark or replayed again.
+  *
+  * It is only built on Linux hosts, using standard C file access and threads. Arduino API has to be provided by host build.
+  */
+
+#ifndef _PCAP_HAL_h
+#define _PCAP_HAL_h
+
+#ifdef __linux__
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "Comms_hal.h"
+#include "helperFunctions.h"
+
+/**
+  * @brief Replay and capture counters
+  */
+typedef struct {
+	uint32_t frames; ///< @brief Frames read from replay file
+	uint32_t delivered; ///< @brief ESP-NOW messages passed to upper layer
+	uint32_t skipped; ///< @brief Frames that are not ESP-NOW messages or are not addressed to this peer
+	uint32_t captured; ///< @brief Sent messages written to capture file
+	uint32_t late; ///< @brief Messages delivered after its scheduled time because upper layer was busy
+	uint32_t elapsed; ///< @brief Time from first to last delivered message (ms)
+} pcap_stats_t;
+
+/**
+  * @brief Definition for capture and replay abstraction layer
+  */
+class Pcap_halClass : public Comms_halClass {
+public:
+	static const size_t COMMS_HAL_MAX_MESSAGE_LENGTH = MAX_MESSAGE_LENGTH; ///< @brief Maximum message length. Same as ESP-NOW
+	static const uint8_t COMMS_HAL_ADDR_LEN = 6; ///< @brief Address length. Correspond to mac address
+	static const uint8_t PCAP_HAL_MAX_INTERFACES = 8; ///< @brief Maximum number of interfaces in a pcapng file
+	static const uint16_t PCAP_HAL_MAX_BLOCK = 4096; ///< @brief Bigger records are skipped
+	static const uint8_t PCAP_HAL_QUEUE_SIZE = 8; ///< @brief Number of send results waiting to be notified
+
+protected:
+	FILE* replayFile = NULL; ///< @brief File being replayed
+	FILE* captureFile = NULL; ///< @brief File where sent messages are recorded
+	bool pcapng = false; ///< @brief `true` if replay file is pcapng, `false` for classic pcap
+	bool swapped = false; ///< @brief `true` if replay file byte order is big endian
+	uint32_t tsDivisor = 1; ///< @brief Divisor to get microseconds from classic pcap fraction field
+	uint16_t linkType = 0; ///< @brief Link type of classic pcap file
+	uint8_t numInterfaces = 0; ///< @brief Number of interfaces defined in current pcapng section
+	uint16_t ifLinkType[PCAP_HAL_MAX_INTERFACES]; ///< @brief Link type of every pcapng interface
+	uint64_t ifTsUnits[PCAP_HAL_MAX_INTERFACES]; ///< @brief Timestamp units per second of every pcapng interface
+	uint64_t lastTimestamp = 0; ///< @brief Timestamp of last read frame, used for frames without timestamp (us)
+	float speed = 1; ///< @brief Replay speed factor. 0 means as fast as possible
+	bool loopReplay = false; ///< @brief Replay file again when it ends
+	uint8_t ownAddress[COMMS_HAL_ADDR_LEN]; ///< @brief Address used as source on capture and to filter replayed frames
+	bool addressSet = false; ///< @brief `true` if address was set by `setAddress`. All frames are replayed otherwise
+	pcap_stats_t stats = {}; ///< @brief Replay and capture counters
+	uint32_t txHandle = 0; ///< @brief Last assigned message handle
+	uint16_t txSequence = 0; ///< @brief 802.11 sequence number for captured frames
+
+	struct {
+		uint8_t address[COMMS_HAL_ADDR_LEN];
+		uint32_t handle;
+	} txResults[PCAP_HAL_QUEUE_SIZE]; ///< @brief Send results waiting to be notified
+	uint8_t txResultCount = 0; ///< @brief Number of send results waiting to be notified
+
+	std::thread replayThread; ///< @brief Thread that delivers replayed frames and send results
+	std::mutex halMutex; ///< @brief Protects capture file and send results
+	std::condition_variable wakeUp; ///< @brief Wakes replay thread when a message is sent or transmission is stopped
+	std::atomic<bool> running; ///< @brief `false` to make replay thread finish
+	std::atomic<bool> transmitEnabled; ///< @brief `false` while transmission is disabled by `enableTransmit`
+
+	/**
+	  * @brief Communication subsistem initialization
+	  * @param peerType Role that peer plays into the system, sensor node or gateway.
+	  */
+	void initComms (peerType_t peerType) override;
+
+	/**
+	  * @brief Reads replay file header and detects its format
+	  * @return `true` if it is a valid pcap or pcapng file
+	  */
+	bool readFileHeader ();
+
+	/**
+	  * @brief Reads next frame from replay file
+	  * @param buffer Buffer to store frame
+	  * @param len Gets frame length
+	  * @param timestamp Gets frame timestamp in microseconds
+	  * @param frameLinkType Gets frame link type
+	  * @return `false` on end of file or format error
+	  */
+	bool readFrame (uint8_t* buffer, size_t* len, uint64_t* timestamp, uint16_t* frameLinkType);
+
+	/**
+	  * @brief Extracts ESP-NOW message from a captured frame
+	  * @param frame Captured frame
+	  * @param len Frame length
+	  * @param frameLinkType Frame link type, 802.11 with or without radiotap header
+	  * @param src Gets pointer to source address
+	  * @param dst Gets pointer to destination address
+	  * @param payload Gets pointer to ESP-NOW payload
+	  * @param payloadLen Gets payload length
+	  * @param rssi Gets RSSI in dBm. 0 if it is not included on capture
+	  * @return `true` if frame is an ESP-NOW message
+	  */
+	static bool parseFrame (uint8_t* frame, size_t len, uint16_t frameLinkType, uint8_t** src, uint8_t** dst, uint8_t** payload, uint8_t* payloadLen, int* rssi);
+
+	/**
+	  * @brief Writes a sent message to capture file as an ESP-NOW frame
+	  * @param da Destination address
+	  * @param data Message
+	  * @param len Message length
+	  */
+	void captureFrame (const uint8_t* da, const uint8_t* data, uint8_t len);
+
+	/**
+	  * @brief Notifies pending send results to upper layer
+	  */
+	void notifySent ();
+
+	/**
+	  * @brief Thread that delivers replayed frames at their recorded time
+	  */
+	void loop ();
+
+	/**
+	  * @brief Gets 16 bit value from replay file data, considering its byte order
+	  */
+	uint16_t get16 (const uint8_t* data) {
+		return swapped ? (data[0] << 8) | data[1] : data[0] | (data[1] << 8);
+	}
+
+	/**
+	  * @brief Gets 32 bit value from replay file data, considering its byte order
+	  */
+	uint32_t get32 (const uint8_t* data) {
+		return swapped ? ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3]
+			: data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+	}
+
+public:
+	/**
+	 * @brief Class constructor
+	 */
+	Pcap_halClass () : running (false), transmitEnabled (true) {
+		memset (ownAddress, 0, sizeof (ownAddress));
+	}
+
+	/**
+	 * @brief Sets file to be replayed. It must be called before `begin`
+	 * @param fileName pcap or pcapng file name
+	 * @param speed Replay speed factor. 1 replays at recorded pace, 0 as fast as possible
+	 * @param loop `true` to start again when file ends
+	 * @return `true` if file is a valid capture
+	 */
+	bool openReplay (const char* fileName, float speed = 1, bool loop = false);
+
+	/**
+	 * @brief Sets file where sent messages are recorded. Any existing file is overwritten
+	 * @param fileName pcap file name
+	 * @return `true` if file could be created
+	 */
+	bool openCapture (const char* fileName);
+
+	/**
+	 * @brief Sets own address. Only replayed frames addressed to it or broadcast are delivered
+	 * @param address 6 byte address
+	 */
+	void setAddress (const uint8_t* address) {
+		memcpy (ownAddress, address, COMMS_HAL_ADDR_LEN);
+		addressSet = true;
+	}
+
+	/**
+	 * @brief Gets replay and capture counters
+	 * @return Pointer to counters
+	 */
+	const pcap_stats_t* getReplayStats () {
+		return &stats;
+	}
+
+	/**
+	 * @brief Checks if replay has finished
+	 * @return `true` if all frames have been delivered
+	 */
+	bool replayFinished () {
+		return !running || !replayFile;
+	}
+
+	/**
+	 * @brief Starts replay thread
+	 * @param gateway Address of gateway. Not used
+	 * @param channel Not used
+	 * @param peerType Role that peer plays into the system, sensor node or gateway.
+	 */
+	void begin (uint8_t* gateway, uint8_t channel = 0, peerType_t peerType = COMM_GATEWAY) override;
+
+	/**
+	 * @brief Stops replay and closes files
+	 */
+	void stop () override;
+
+	/**
+	  * @brief Records message to capture file. It is always reported as delivered
+	  * @param da Destination address to send the message to
+	  * @param data Data buffer that contain the message to be sent
+	  * @param len Data length in number of bytes
+	  * @return Returns queuing status. 0 for success, -1 to indicate an error
+	  */
+	int32_t send (uint8_t* da, uint8_t* data, int len) override;
+
+	/**
+	  * @brief Attach a callback function to be run on every replayed message
+	  * @param dataRcvd Pointer to the callback function
+	  */
+	void onDataRcvd (comms_hal_rcvd_data dataRcvd) override {
+		this->dataRcvd = dataRcvd;
+	}
+
+	/**
+	  * @brief Attach a callback function to be run after sending a message to receive its status
+	  * @param sentResult Pointer to the callback function
+	  */
+	void onDataSent (comms_hal_sent_data sentResult) override {
+		this->sentResult = sentResult;
+	}
+
+	/**
+	  * @brief Get address length
+	  * @return Always returns 6, as ESP-NOW
+	  */
+	uint8_t getAddressLength () override {
+		return COMMS_HAL_ADDR_LEN;
+	}
+
+	/**
+	  * @brief Get maximum message length
+	  * @return Always returns a value equal to `MAX_MESSAGE_LENGTH`
+	  */
+	size_t getMaxMessageLength () {
+		return COMMS_HAL_MAX_MESSAGE_LENGTH;
+	}
+
+	/**
+	  * @brief Enables or disables notification of sent messages
+	  * @param enable `true` to enable transmission, `false` to disable it
+	  */
+	void enableTransmit (bool enable) override {
+		transmitEnabled = enable;
+		wakeUp.notify_one ();
+	}
+
+	/**
+	  * @brief Notifies pending send results. Replay runs on its own thread
+	  */
+	void handle () override {
+		notifySent ();
+	}
+};
+
+extern Pcap_halClass Pcap_hal; ///< @brief Singleton instance of capture and replay class
+
+#endif // __linux__
+
+#endif // _PCAP_HAL_h
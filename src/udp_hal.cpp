@@ -0,0 +1,387 @@
+/**
+  * @file udp_hal.cpp
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief UDP multicast communication system abstraction layer. Lets gateway and nodes run as processes on the same host
+  */
+
+#ifdef __linux__
+
+#include "udp_hal.h"
+#include <chrono>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const uint8_t UDP_HEADER_LEN = 2 * Udp_halClass::COMMS_HAL_ADDR_LEN; ///< @brief Source and destination addresses
+static const int UDP_HAL_RCVBUF = 1 << 20; ///< @brief Socket receive buffer size. Kernel may limit it
+
+Udp_halClass Udp_hal;
+
+uint32_t Udp_halClass::now () {
+	return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+void Udp_halClass::begin (uint8_t* gateway, uint8_t channel, peerType_t peerType) {
+	_ownPeerType = peerType;
+	if (!addressSet) {
+		ownAddress[0] = 0x02; // Locally administered unicast address
+		for (int i = 1; i < COMMS_HAL_ADDR_LEN; i++) {
+			ownAddress[i] = rand () & 0xFF;
+		}
+	}
+	DEBUG_INFO ("Starting UDP as %s with address %s", peerType == COMM_GATEWAY ? "gateway" : "node", mac2str (ownAddress));
+	if (peerType == COMM_NODE && gateway) {
+		memcpy (this->gateway, gateway, COMMS_HAL_ADDR_LEN);
+	}
+	this->channel = channel;
+	port = UDP_HAL_BASE_PORT + channel;
+	initComms (peerType);
+}
+
+void Udp_halClass::initComms (peerType_t peerType) {
+	(void)peerType; // Every peer joins the same group whatever its role
+	struct sockaddr_in addr;
+	struct ip_mreq mreq;
+	struct in_addr loopback;
+	int enable = 1;
+	unsigned char ttl = 0;
+	unsigned char loop = 1;
+
+	sock = socket (AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		DEBUG_ERROR ("Cannot create socket");
+		return;
+	}
+	// Every process on the host binds the same port
+	setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof (enable));
+#ifdef SO_REUSEPORT
+	setsockopt (sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof (enable));
+#endif
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_ANY);
+	addr.sin_port = htons (port);
+	if (bind (sock, (struct sockaddr*)&addr, sizeof (addr)) < 0) {
+		DEBUG_ERROR ("Cannot bind port %u", port);
+		close (sock);
+		sock = -1;
+		return;
+	}
+
+	loopback.s_addr = htonl (INADDR_LOOPBACK);
+	mreq.imr_multiaddr.s_addr = inet_addr (group);
+	mreq.imr_interface = loopback;
+	if (setsockopt (sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)) < 0) {
+		DEBUG_ERROR ("Cannot join multicast group %s", group);
+		close (sock);
+		sock = -1;
+		return;
+	}
+	setsockopt (sock, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof (loopback));
+	setsockopt (sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof (loop));
+	setsockopt (sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl)); // Never leave this host
+	setsockopt (sock, SOL_SOCKET, SO_RCVBUF, &UDP_HAL_RCVBUF, sizeof (UDP_HAL_RCVBUF)); // Gateway gets bursts from many processes
+	fcntl (sock, F_SETFL, fcntl (sock, F_GETFL) | O_NONBLOCK);
+
+	if (pipe (wakePipe) == 0) {
+		fcntl (wakePipe[0], F_SETFL, fcntl (wakePipe[0], F_GETFL) | O_NONBLOCK);
+		fcntl (wakePipe[1], F_SETFL, fcntl (wakePipe[1], F_GETFL) | O_NONBLOCK);
+	}
+
+	running = true;
+	loopThread = std::thread (&Udp_halClass::loop, this);
+	DEBUG_DBG ("UDP listening on %s:%u", group, port);
+}
+
+void Udp_halClass::stop () {
+	DEBUG_INFO ("-------------> UDP STOP");
+	running = false;
+	wake ();
+	if (loopThread.joinable ()) {
+		loopThread.join ();
+	}
+	for (int i = 0; i < 2; i++) {
+		if (wakePipe[i] >= 0) {
+			close (wakePipe[i]);
+			wakePipe[i] = -1;
+		}
+	}
+	if (sock >= 0) {
+		close (sock);
+		sock = -1;
+	}
+}
+
+int32_t Udp_halClass::send (uint8_t* da, uint8_t* data, int len) {
+	udp_tx_item_t* slot = NULL;
+
+	if (!da || !data || !len) {
+		DEBUG_WARN ("Parameters error");
+		return -1;
+	}
+
+	if (len > MAX_MESSAGE_LENGTH) {
+		DEBUG_WARN ("Length error");
+		return -1;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock (txMutex);
+		for (int i = 0; i < UDP_HAL_QUEUE_SIZE; i++) {
+			if (!txQueue[i].used) {
+				slot = &txQueue[i];
+				break;
+			}
+		}
+		if (!slot) {
+			txStats.dropped++;
+			DEBUG_WARN ("Queue full. Message to %s dropped", mac2str (da));
+			return -1;
+		}
+		uint32_t delay = link.latency;
+		if (link.jitter) {
+			delay += rand () % (link.jitter + 1);
+		}
+		memcpy (slot->message.dstAddress, da, COMMS_HAL_ADDR_LEN);
+		memcpy (slot->message.payload, data, len);
+		slot->message.payload_len = len;
+		if (!++txHandle) {
+			txHandle++; // 0 means no handle
+		}
+		slot->handle = txHandle;
+		slot->queuedAt = now ();
+		slot->sendAt = slot->queuedAt + delay;
+		uint8_t loss = lossPercent (da);
+		slot->lost = loss && (uint8_t)(rand () % 100) < loss;
+		slot->used = true;
+		lastTxHandle = txHandle;
+		txStats.queued++;
+		txStats.depth++;
+		if (txStats.depth > txStats.maxDepth) {
+			txStats.maxDepth = txStats.depth;
+		}
+	}
+
+	wake ();
+	return 0;
+}
+
+uint8_t Udp_halClass::getQueueDepth (const uint8_t* da) {
+	std::lock_guard<std::mutex> lock (txMutex);
+	uint8_t count = 0;
+
+	for (int i = 0; i < UDP_HAL_QUEUE_SIZE; i++) {
+		if (txQueue[i].used && (!da || !memcmp (txQueue[i].message.dstAddress, da, COMMS_HAL_ADDR_LEN))) {
+			count++;
+		}
+	}
+	return count;
+}
+
+uint8_t Udp_halClass::lossPercent (const uint8_t* da) {
+	int loss = link.lossPercent;
+
+#if USE_LINK_ADAPTATION
+	if (link.rateLossStep && memcmp (da, BROADCAST_ADDRESS, COMMS_HAL_ADDR_LEN)) {
+		// Signal drops with power reduction. Every dB below rate sensitivity adds loss
+		LinkControllerClass* controller = links.get (da);
+		int rssi = link.rssi - (LINK_MAX_TX_POWER - controller->getTxPower ()) / 4;
+		int margin = rssi - LinkControllerClass::getRateSensitivity (controller->getRate ());
+		if (margin < 0) {
+			loss += -margin * link.rateLossStep;
+		}
+	}
+#endif
+	return loss > 100 ? 100 : loss;
+}
+
+bool Udp_halClass::getLinkState (const uint8_t* da, comms_link_state_t* state) {
+#if USE_LINK_ADAPTATION
+	std::lock_guard<std::mutex> lock (txMutex);
+	LinkControllerClass* controller = links.get (da, false);
+	if (controller) {
+		controller->getState (state);
+		return true;
+	}
+#endif
+	return false;
+}
+
+void Udp_halClass::linkRssiUpdate (const uint8_t* address, int rssi) {
+#if USE_LINK_ADAPTATION
+	std::lock_guard<std::mutex> lock (txMutex);
+	links.get (address)->rssiUpdate (rssi);
+#endif
+}
+
+bool Udp_halClass::sendDatagram (comms_queue_item_t* message) {
+	uint8_t buffer[UDP_HEADER_LEN + MAX_MESSAGE_LENGTH];
+	struct sockaddr_in addr;
+
+	if (sock < 0) {
+		return false;
+	}
+	memcpy (buffer, ownAddress, COMMS_HAL_ADDR_LEN);
+	memcpy (buffer + COMMS_HAL_ADDR_LEN, message->dstAddress, COMMS_HAL_ADDR_LEN);
+	memcpy (buffer + UDP_HEADER_LEN, message->payload, message->payload_len);
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr (group);
+	addr.sin_port = htons (port);
+	return sendto (sock, buffer, UDP_HEADER_LEN + message->payload_len, 0, (struct sockaddr*)&addr, sizeof (addr)) >= 0;
+}
+
+bool Udp_halClass::receiveDatagram () {
+	uint8_t buffer[UDP_HEADER_LEN + MAX_MESSAGE_LENGTH + 1];
+	ssize_t len;
+
+	len = recv (sock, buffer, sizeof (buffer), 0);
+	if (len < 0) {
+		return false;
+	}
+	if (len <= UDP_HEADER_LEN || len > UDP_HEADER_LEN + MAX_MESSAGE_LENGTH) {
+		return true; // Not an EnigmaIOT datagram
+	}
+
+	uint8_t* srcAddress = buffer;
+	uint8_t* dstAddress = buffer + COMMS_HAL_ADDR_LEN;
+	if (!memcmp (srcAddress, ownAddress, COMMS_HAL_ADDR_LEN)) {
+		return true; // Own message got back by multicast loop
+	}
+	if (memcmp (dstAddress, ownAddress, COMMS_HAL_ADDR_LEN) && memcmp (dstAddress, BROADCAST_ADDRESS, COMMS_HAL_ADDR_LEN)) {
+		return true; // Not for us
+	}
+
+	int rssi = link.rssi;
+	if (link.rssiVariation) {
+		rssi -= rand () % (link.rssiVariation + 1);
+	}
+	// Link controller is updated by upper layer once message is authenticated
+	if (dataRcvd) {
+		dataRcvd (srcAddress, buffer + UDP_HEADER_LEN, len - UDP_HEADER_LEN, rssi);
+	}
+	return true;
+}
+
+int Udp_halClass::nextEventDelay () {
+	std::lock_guard<std::mutex> lock (txMutex);
+	int delay = -1;
+	uint32_t time = now ();
+
+	if (!transmitEnabled) {
+		return -1;
+	}
+	for (int i = 0; i < UDP_HAL_QUEUE_SIZE; i++) {
+		if (txQueue[i].used) {
+			int32_t wait = txQueue[i].sendAt - time;
+			if (wait <= 0) {
+				return 0;
+			}
+			if (delay < 0 || wait < delay) {
+				delay = wait;
+			}
+		}
+	}
+	return delay;
+}
+
+void Udp_halClass::handle () {
+	if (!transmitEnabled) {
+		return;
+	}
+	for (;;) {
+		udp_tx_item_t item;
+		udp_tx_item_t* next = NULL;
+		uint32_t time = now ();
+
+		{
+			// Oldest expired message is sent first
+			std::lock_guard<std::mutex> lock (txMutex);
+			for (int i = 0; i < UDP_HAL_QUEUE_SIZE; i++) {
+				if (txQueue[i].used && (int32_t)(time - txQueue[i].sendAt) >= 0
+					&& (!next || (int32_t)(txQueue[i].sendAt - next->sendAt) < 0)) {
+					next = &txQueue[i];
+				}
+			}
+			if (!next) {
+				return;
+			}
+			memcpy (&item, next, sizeof (udp_tx_item_t));
+			next->used = false;
+			txStats.depth--;
+		}
+
+		txStats.attempts++;
+		// Broadcast is never acknowledged on ESP-NOW so it never fails
+		bool isBroadcast = !memcmp (item.message.dstAddress, BROADCAST_ADDRESS, COMMS_HAL_ADDR_LEN);
+		bool delivered = true;
+		if (!item.lost) {
+			delivered = sendDatagram (&item.message);
+		} else {
+			DEBUG_DBG ("Message #%u to %s lost by link emulation", item.handle, mac2str (item.message.dstAddress));
+			delivered = isBroadcast;
+		}
+
+#if USE_LINK_ADAPTATION
+		if (!isBroadcast) {
+			std::lock_guard<std::mutex> lock (txMutex);
+			links.get (item.message.dstAddress)->txResult (delivered);
+		}
+#endif
+		if (delivered) {
+			uint32_t latency = (now () - item.queuedAt) * 1000;
+			txStats.delivered++;
+			txStats.totalLatency += latency;
+			if (latency > txStats.maxLatency) {
+				txStats.maxLatency = latency;
+			}
+		} else {
+			txStats.failed++;
+		}
+		if (txReceipt) {
+			txReceipt (item.handle, item.message.dstAddress, delivered ? COMMS_TX_DELIVERED : COMMS_TX_FAILED, 1);
+		}
+		if (sentResult) {
+			sentResult (item.message.dstAddress, delivered ? 0 : 1);
+		}
+	}
+}
+
+void Udp_halClass::wake () {
+	if (wakePipe[1] >= 0) {
+		uint8_t dummy = 0;
+		(void)!write (wakePipe[1], &dummy, 1);
+	}
+}
+
+void Udp_halClass::loop () {
+	struct pollfd fds[2];
+
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = wakePipe[0];
+	fds[1].events = POLLIN;
+
+	while (running) {
+		handle ();
+		poll (fds, wakePipe[0] >= 0 ? 2 : 1, nextEventDelay ());
+		if (fds[1].revents & POLLIN) {
+			uint8_t dummy[16];
+			while (read (wakePipe[0], dummy, sizeof (dummy)) > 0);
+		}
+		if (fds[0].revents & POLLIN) {
+			while (receiveDatagram ()) {
+				handle (); // Answers queued by upper layer must not wait for a burst to be drained
+			}
+		}
+	}
+}
+
+#endif // __linux__
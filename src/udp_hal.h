@@ -0,0 +1,273 @@
+/**
+  * @file udp_hal.h
+  * @version 0.9.8
+  * @date 15/07/2021
+  * @author German Martin
+  * @brief UDP multicast communication system abstraction layer. Lets gateway and nodes run as processes on the same host
+  *
+  * Every process joins the same multicast group on loopback interface. Each datagram carries source and destination
+  * 6 byte addresses followed by EnigmaIOT message, so broadcast and unicast behave as in ESP-NOW. Loss, latency and
+  * jitter may be injected to emulate a radio link.
+  *
+  * It is only built on Linux hosts, using POSIX sockets and threads. Arduino API is provided by `extras/host/shim`, and
+  * `extras/host/launch_udp_peers.sh` runs one gateway and many node processes over it.
+  */
+
+#ifndef _UDP_HAL_h
+#define _UDP_HAL_h
+
+#ifdef __linux__
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "Comms_hal.h"
+#include "helperFunctions.h"
+#if USE_LINK_ADAPTATION
+#include "LinkController.h"
+#endif
+
+/**
+  * @brief Outgoing message waiting for its emulated latency
+  */
+typedef struct {
+	comms_queue_item_t message; ///< @brief Destination and payload
+	uint32_t handle; ///< @brief Handle returned to upper layer to identify delivery receipt
+	uint32_t sendAt; ///< @brief Time when message leaves the emulated link (ms)
+	uint32_t queuedAt; ///< @brief Time when message was queued (ms)
+	bool lost; ///< @brief Message is lost by the emulated link
+	bool used; ///< @brief `true` if this slot holds a message
+} udp_tx_item_t;
+
+/**
+  * @brief Emulated link quality
+  */
+typedef struct {
+	uint8_t lossPercent; ///< @brief Probability of a message being lost (%)
+	uint16_t latency; ///< @brief Fixed delay added to every message (ms)
+	uint16_t jitter; ///< @brief Maximum random delay added to latency (ms)
+	int8_t rssi; ///< @brief Reported RSSI of received messages (dBm)
+	uint8_t rssiVariation; ///< @brief Maximum random variation subtracted from RSSI (dB)
+	uint8_t rateLossStep; ///< @brief Loss added for every dB that link is below selected rate sensitivity (%). 0 to ignore rate
+} udp_link_model_t;
+
+/**
+  * @brief Definition for UDP multicast hardware abstraction layer
+  */
+class Udp_halClass : public Comms_halClass {
+public:
+	static const size_t COMMS_HAL_MAX_MESSAGE_LENGTH = MAX_MESSAGE_LENGTH; ///< @brief Maximum message length. Same as ESP-NOW
+	static const uint8_t COMMS_HAL_ADDR_LEN = 6; ///< @brief Address length. Emulates a MAC address
+	static const uint16_t UDP_HAL_BASE_PORT = 47400; ///< @brief UDP port for channel 0. Channel number is added so every channel is isolated
+	static const uint8_t UDP_HAL_QUEUE_SIZE = 16; ///< @brief Number of messages that may wait for its emulated latency
+
+protected:
+	udp_tx_item_t txQueue[UDP_HAL_QUEUE_SIZE]; ///< @brief Outgoing messages
+	std::mutex txMutex; ///< @brief Protects transmission queue
+	std::thread loopThread; ///< @brief Thread that sends delayed messages and receives datagrams
+	std::atomic<bool> running; ///< @brief `false` to make loop thread finish
+	std::atomic<bool> transmitEnabled; ///< @brief `false` while transmission is disabled by `enableTransmit`
+	int sock = -1; ///< @brief Multicast socket
+	int wakePipe[2] = { -1, -1 }; ///< @brief Pipe used to wake up loop thread when a message is queued
+	uint16_t port = UDP_HAL_BASE_PORT; ///< @brief Port used on current channel
+	char group[16] = "239.255.69.84"; ///< @brief Multicast group address
+	uint8_t ownAddress[COMMS_HAL_ADDR_LEN]; ///< @brief Address of this peer
+	bool addressSet = false; ///< @brief `true` if address was set by `setAddress`
+	udp_link_model_t link = { 0, 0, 0, -50, 5, 10 }; ///< @brief Emulated link quality
+#if USE_LINK_ADAPTATION
+	LinkTableClass links; ///< @brief Rate and power controller of every peer. Protected by `txMutex`
+#endif
+	uint32_t txHandle = 0; ///< @brief Last assigned message handle
+
+	/**
+	  * @brief Communication subsistem initialization
+	  * @param peerType Role that peer plays into the system, sensor node or gateway.
+	  */
+	void initComms (peerType_t peerType) override;
+
+	/**
+	  * @brief Sends a datagram to multicast group
+	  * @param message Destination and payload
+	  * @return `true` if datagram was sent
+	  */
+	bool sendDatagram (comms_queue_item_t* message);
+
+	/**
+	  * @brief Reads one datagram and passes it to upper layer if it is addressed to this peer
+	  * @return `true` if a datagram was read
+	  */
+	bool receiveDatagram ();
+
+	/**
+	  * @brief Calculates time until next queued message has to be sent
+	  * @return Time in milliseconds. -1 if queue is empty
+	  */
+	int nextEventDelay ();
+
+	/**
+	  * @brief Wakes up loop thread so that it recalculates its next event
+	  */
+	void wake ();
+
+	/**
+	  * @brief Thread that runs `handle` and waits for incoming datagrams
+	  */
+	void loop ();
+
+	/**
+	  * @brief Calculates loss probability of a message, using rate and power selected for its destination
+	  * @param da Destination address
+	  * @return Loss probability (%)
+	  */
+	uint8_t lossPercent (const uint8_t* da);
+
+	/**
+	  * @brief Gets monotonic time
+	  * @return Time in milliseconds
+	  */
+	static uint32_t now ();
+
+public:
+	/**
+	 * @brief Class constructor
+	 */
+	Udp_halClass () : running (false), transmitEnabled (true) {
+		memset (txQueue, 0, sizeof (txQueue));
+		memset (ownAddress, 0, sizeof (ownAddress));
+	}
+
+	/**
+	 * @brief Sets own address. It must be called before `begin`. A random locally administered address is used otherwise
+	 * @param address 6 byte address
+	 */
+	void setAddress (const uint8_t* address) {
+		memcpy (ownAddress, address, COMMS_HAL_ADDR_LEN);
+		addressSet = true;
+	}
+
+	/**
+	 * @brief Gets own address
+	 * @return Pointer to 6 byte address
+	 */
+	const uint8_t* getAddress () {
+		return ownAddress;
+	}
+
+	/**
+	 * @brief Sets multicast group. It must be called before `begin`
+	 * @param group Multicast group IPv4 address
+	 */
+	void setMulticastGroup (const char* group) {
+		strncpy (this->group, group, sizeof (this->group) - 1);
+	}
+
+	/**
+	 * @brief Sets emulated link quality. It may be changed at any time
+	 * @param model Link parameters
+	 */
+	void setLinkModel (const udp_link_model_t& model) {
+		link = model;
+	}
+
+	/**
+	 * @brief Setup communication environment and establish the connection from node to gateway
+	 * @param gateway Address of gateway. It may be `NULL` in case this is used in the own gateway
+	 * @param channel Channel is mapped to a different UDP port
+	 * @param peerType Role that peer plays into the system, sensor node or gateway.
+	 */
+	void begin (uint8_t* gateway, uint8_t channel = 0, peerType_t peerType = COMM_NODE) override;
+
+	/**
+	 * @brief Terminates communication and closes socket
+	 */
+	void stop () override;
+
+	/**
+	  * @brief Queues data to be sent to the other peer after emulated latency
+	  * @param da Destination address to send the message to
+	  * @param data Data buffer that contain the message to be sent
+	  * @param len Data length in number of bytes
+	  * @return Returns queuing status. 0 for success, -1 to indicate an error
+	  */
+	int32_t send (uint8_t* da, uint8_t* data, int len) override;
+
+	/**
+	  * @brief Gets number of messages queued for a destination
+	  * @param da Destination address
+	  * @return Number of queued messages
+	  */
+	uint8_t getQueueDepth (const uint8_t* da) override;
+
+	/**
+	  * @brief Gets rate and power selected for a peer and its link quality
+	  * @param da Peer address
+	  * @param state Gets link state
+	  * @return `true` if link to that peer is being tracked
+	  */
+	bool getLinkState (const uint8_t* da, comms_link_state_t* state) override;
+
+	/**
+	  * @brief Updates link controller of a peer with signal strength of an authenticated message
+	  * @param address Peer address
+	  * @param rssi RSSI in dBm
+	  */
+	void linkRssiUpdate (const uint8_t* address, int rssi) override;
+
+	/**
+	  * @brief Attach a callback function to be run on every received message
+	  * @param dataRcvd Pointer to the callback function
+	  */
+	void onDataRcvd (comms_hal_rcvd_data dataRcvd) override {
+		this->dataRcvd = dataRcvd;
+	}
+
+	/**
+	  * @brief Attach a callback function to be run after sending a message to receive its status
+	  * @param sentResult Pointer to the callback function
+	  */
+	void onDataSent (comms_hal_sent_data sentResult) override {
+		this->sentResult = sentResult;
+	}
+
+	/**
+	  * @brief Get address length
+	  * @return Always returns 6, as ESP-NOW
+	  */
+	uint8_t getAddressLength () override {
+		return COMMS_HAL_ADDR_LEN;
+	}
+
+	/**
+	  * @brief Get maximum message length
+	  * @return Always returns a value equal to `MAX_MESSAGE_LENGTH`
+	  */
+	size_t getMaxMessageLength () {
+		return COMMS_HAL_MAX_MESSAGE_LENGTH;
+	}
+
+	/**
+	  * @brief Enables or disables transmission of queued messages
+	  * @param enable `true` to enable transmission, `false` to disable it
+	  */
+	void enableTransmit (bool enable) override {
+		transmitEnabled = enable;
+		wake ();
+	}
+
+	/**
+	  * @brief Sends queued messages whose emulated latency has expired
+	  */
+	void handle () override;
+};
+
+extern Udp_halClass Udp_hal; ///< @brief Singleton instance of UDP class
+
+#endif // __linux__
+
+#endif // _UDP_HAL_h